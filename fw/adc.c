@@ -471,6 +471,7 @@ adc_show_sensors(void)
     print_reading(calc_v5cl_ma, "mA\n");
     printf("  V10FB=%04x %8u ", adc[6], adc[6] * scale);
     print_reading(calc_v10fb, "V\n");
+    adc_rail_show();
 }
 
 /*
@@ -589,3 +590,143 @@ adc_poll(int verbose, int force)
     v5_stable = true;
 #endif
 }
+
+/*
+ * Rail settling measurement. The ADC converts all channels continuously
+ * by DMA, so a new reading of every channel is available after each scan
+ * (about 25us). There is no faster conversion of a single rail. When the
+ * EEPROM VCC or VPP switch is turned on, the supply behind it droops
+ * while the EEPROM and its decoupling are charged. adc_rail_settle()
+ * waits until the latest reading of the supply is within tolerance
+ * rather than a fixed worst-case time, and records how long that took. Only STM32F107 boards sense the EEPROM 5V supply (V5CL);
+ * other boards use a fixed VCC delay.
+ */
+typedef struct {
+    uint8_t  index;        // adc_buffer[] channel
+    uint16_t expected_mv;  // Nominal rail voltage
+    uint16_t tolerance;    // Allowed deviation (0.1 percent)
+    bool     sensed;       // Rail is measured on this board
+} adc_rail_t;
+
+static const adc_rail_t adc_rails[] = {
+#ifdef STM32F107
+    { 5, V5_EXPECTED_MV,  50, true  },  // ADC_RAIL_VCC: V5CL
+#else
+    { 5, V5_EXPECTED_MV,  50, false },  // ADC_RAIL_VCC: not sensed
+#endif
+    { 2, V10_EXPECTED_MV, 50, true  },  // ADC_RAIL_VPP: V10
+};
+
+typedef struct {
+    uint count;     // Measurements
+    uint timeouts;  // Rail did not settle within the limit
+    uint last;      // Last settling time (usec)
+    uint min;       // Fastest settling time (usec)
+    uint max;       // Slowest settling time (usec)
+} adc_settle_t;
+
+static adc_settle_t adc_settle[ARRAY_SIZE(adc_rails)];
+
+/*
+ * adc_rail_mv() returns the present voltage of a rail, in millivolts.
+ */
+static uint
+adc_rail_mv(const adc_rail_t *rail)
+{
+    uint scale = adc_get_scale(adc_buffer[0]);
+    uint raw   = adc_buffer[rail->index];
+
+    if (rail->index == 2)
+        return (raw * scale * V10_DIVIDER_SCALE);
+    return (raw * scale * V5CL_DIVIDER_SCALE);
+}
+
+/*
+ * adc_rail_in_tolerance() reports whether a rail is within tolerance of
+ *                         its expected voltage.
+ */
+static bool
+adc_rail_in_tolerance(const adc_rail_t *rail)
+{
+    int diff = (int) rail->expected_mv - (int) adc_rail_mv(rail);
+
+    return (abs(diff) * 1000 / rail->expected_mv <= rail->tolerance);
+}
+
+/*
+ * adc_rail_settle() waits for a rail to settle after it was switched on.
+ *                   The wait is at least min_usec. After that, it ends as
+ *                   soon as the rail is within tolerance, or after
+ *                   max_usec if the rail does not settle. A rail which
+ *                   already reads within tolerance adds no wait beyond
+ *                   min_usec. When min_usec is shorter than an ADC scan,
+ *                   that reading may predate the switch, so only a droop
+ *                   already seen delays the return. If the rail is not
+ *                   sensed on this board, the wait is fixed_usec.
+ *
+ * @param [in]  rail       - ADC_RAIL_VCC or ADC_RAIL_VPP.
+ * @param [in]  min_usec   - Minimum wait (datasheet setup time).
+ * @param [in]  fixed_usec - Wait if the rail is not sensed.
+ * @param [in]  max_usec   - Maximum wait.
+ *
+ * @return      Time waited in microseconds.
+ */
+uint
+adc_rail_settle(uint rail, uint min_usec, uint fixed_usec, uint max_usec)
+{
+    const adc_rail_t *def = &adc_rails[rail];
+    adc_settle_t     *st  = &adc_settle[rail];
+    uint64_t          start = timer_tick_get();
+    uint64_t          min_end = timer_tick_plus_usec(min_usec);
+    uint64_t          max_end = timer_tick_plus_usec(max_usec);
+    bool              settled;
+    uint              usec;
+
+    if (!def->sensed) {
+        timer_delay_usec(fixed_usec);
+        return (fixed_usec);
+    }
+
+    while (1) {
+        if (timer_tick_has_elapsed(min_end) && adc_rail_in_tolerance(def)) {
+            settled = true;
+            break;
+        }
+        if (timer_tick_has_elapsed(max_end)) {
+            settled = false;
+            break;
+        }
+    }
+
+    usec = timer_tick_to_usec(timer_tick_get() - start);
+    st->last = usec;
+    if ((st->count == 0) || (st->min > usec))
+        st->min = usec;
+    if (st->max < usec)
+        st->max = usec;
+    st->count++;
+    if (!settled)
+        st->timeouts++;
+    return (usec);
+}
+
+/*
+ * adc_rail_show() reports rail settling time measurements.
+ */
+void
+adc_rail_show(void)
+{
+    static const char * const names[] = { "VCC", "VPP" };
+    uint rail;
+
+    for (rail = 0; rail < ARRAY_SIZE(adc_rails); rail++) {
+        const adc_settle_t *st = &adc_settle[rail];
+        if (!adc_rails[rail].sensed) {
+            printf("%s settle: not sensed (fixed delay)\n", names[rail]);
+            continue;
+        }
+        printf("%s settle: last %u us  min %u us  max %u us  "
+               "count %u  slow %u\n", names[rail], st->last,
+               st->min, st->max, st->count, st->timeouts);
+    }
+}
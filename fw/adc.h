@@ -16,6 +16,11 @@ void adc_init(void);
 void adc_show_sensors(void);
 void adc_poll(int verbose, int force);
 void dac_setvalue(uint32_t value);
+uint adc_rail_settle(uint rail, uint min_usec, uint fixed_usec, uint max_usec);
+void adc_rail_show(void);
+
+#define ADC_RAIL_VCC 0  // EEPROM VCC (5V)
+#define ADC_RAIL_VPP 1  // EEPROM VPP (10V)
 
 extern int v5_overcurrent; // true = V5 drawing too much current
 extern int v5_stable;      // true = V5 is within 5 percent of expected
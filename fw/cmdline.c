@@ -28,6 +28,8 @@
 #include "cmdline.h"
 #include "cmds.h"
 #include "led.h"
+#include "usb.h"
+#include "crashlog.h"
 #include "readline.h"
 #ifdef EMBEDDED_CMD
 #include "pcmds.h"
@@ -54,6 +56,8 @@ static const cmd_t cmd_list[] = {
                         "[bwlqoh] <addr1> <addr2> <len>", "compare memory" },
 #ifdef EMBEDDED_CMD
     { cmd_cpu,     "cpu",     2, cmd_cpu_help, " regs|usb", "CPU information" },
+    { cmd_crashlog, "crashlog", 5, cmd_crashlog_help, " [clear]",
+                        "show crash log from before last reset" },
 #endif
     { cmd_c,       "c",       1, cmd_c_help,
                         "[bwlqohS] <addr> <value...>", "change memory" },
@@ -892,6 +896,7 @@ cmdline(void)
     if (line != NULL) {
         HIST_ENTRY *hist_cur;
         char *sline = no_whitespace(line);
+        int   rc;
         if (sline[0] == '\0')
             return (0);
 
@@ -901,14 +906,22 @@ cmdline(void)
         }
 
         led_busy(1);
+        usb_serial_state(USB_SERIAL_STATE_READY | USB_SERIAL_STATE_BUSY);
         hist_cur = history_get(history_length + history_base - 1);
         if ((hist_cur == NULL) || (strcmp(sline, hist_cur->line) != 0)) {
             /* Not a duplicate of previous line; add to history. */
             add_history(sline);
         }
-        (void) cmd_exec_string(sline);
+        input_abort_clear();  // Discard stale abort (host DTR drop on close)
+        input_source_hold();  // Binary data stays on the command's path
+        crashlog_cmd(sline);
+        rc = cmd_exec_string(sline);
+        crashlog_cmd(NULL);
+        input_source_release();
         *line = '\0';
         led_busy(0);
+        usb_serial_state(USB_SERIAL_STATE_READY |
+                         ((rc == RC_SUCCESS) ? 0 : USB_SERIAL_STATE_ERROR));
     }
     return (0);
 }
@@ -133,6 +133,7 @@ const char cmd_time_help[] =
 "time now       - display the current time\n"
 #endif
 #ifdef EMBEDDED_CMD
+"time jitter [<count>] - delay and ISR latency histograms in ticks\n"
 "time test      - test timers\n"
 "time watch     - watch the timer to verify tick is working correctly\n"
 #endif
@@ -380,6 +381,214 @@ srand32(uint32_t seed)
     rand_seed = seed;
 }
 
+typedef enum {
+    PATT_ZERO,
+    PATT_ONE,
+    PATT_BLIP,
+    PATT_RAND,
+    PATT_STROBE,
+    PATT_WALK0,
+    PATT_WALK1,
+    PATT_VALUE,
+} patt_mode_t;
+
+/* Pattern generator state shared by mem_patt() and mem_test() */
+typedef struct {
+    patt_mode_t mode;      // Pattern to generate
+    uint        step;      // Element count (walk, strobe, blip)
+    uint        alt;       // Blip skew counter
+    bool_t      swap;      // Walk from the most significant byte
+    uint8_t     value[8];  // Current (or fixed) pattern value
+} patt_state_t;
+
+/*
+ * Width-specialized range kernels for SPACE_MEMORY
+ * ------------------------------------------------
+ * MEM_KERNELS() generates pattern, test, copy, and compare loops for one
+ * access width. These operate on an entire aligned range with native
+ * word access, instead of going through data_read() / data_write() for
+ * each element. Ranges of other spaces, widths, or alignment use the
+ * generic per-element path. Callers pass at most MEM_KERNEL_CHUNK
+ * elements at a time so that ^C is still checked regularly.
+ *
+ * patt_next_N() returns the next pattern value and advances the step.
+ * It follows the same sequence as the per-element code in cmd_patt().
+ */
+#define MEM_KERNEL_CHUNK 4096
+
+#define MEM_KERNELS(type, bits)                                               \
+static type                                                                   \
+patt_next_##bits(patt_state_t *ps)                                            \
+{                                                                             \
+    type value;                                                               \
+                                                                              \
+    switch (ps->mode) {                                                       \
+        case PATT_WALK0:                                                      \
+        case PATT_WALK1: {                                                    \
+            uint pos = (ps->step >> 3) & (sizeof (type) - 1);                 \
+            if (ps->swap)                                                     \
+                pos = sizeof (type) - 1 - pos;                                \
+            value = 0;                                                        \
+            ((uint8_t *) &value)[pos] = 1 << (ps->step & 7);                  \
+            if (ps->mode == PATT_WALK0)                                       \
+                value = ~value;                                               \
+            break;                                                            \
+        }                                                                     \
+        case PATT_RAND: {                                                     \
+            uint32_t rvalue[2];                                               \
+            rvalue[0] = rand32();                                             \
+            if (sizeof (type) > 4)                                            \
+                rvalue[1] = rand32();                                         \
+            memcpy(&value, rvalue, sizeof (type));                            \
+            break;                                                            \
+        }                                                                     \
+        case PATT_STROBE:                                                     \
+            value = (ps->step & 1) ? (type) ~0 : 0;                           \
+            break;                                                            \
+        case PATT_BLIP:                                                       \
+            memcpy(&value, ps->value, sizeof (type));                         \
+            if ((ps->step & 7) >= 5) {                                        \
+                int set_high = ((ps->step & 8) == 0) ^ (ps->step & 1);        \
+                value = set_high ? (type) ~0 : 0;                             \
+                memcpy(ps->value, &value, sizeof (type));                     \
+            }                                                                 \
+            if (ps->alt++ == 23) {                                            \
+                ps->alt = 0;                                                  \
+                ps->step++;                                                   \
+            }                                                                 \
+            break;                                                            \
+        default:                                                              \
+            memcpy(&value, ps->value, sizeof (type));                         \
+            break;                                                            \
+    }                                                                         \
+    ps->step++;                                                               \
+    return (value);                                                           \
+}                                                                             \
+                                                                              \
+static void                                                                   \
+mem_patt_##bits(uintptr_t addr, uint count, patt_state_t *ps)                 \
+{                                                                             \
+    volatile type *ptr = (volatile type *) addr;                              \
+                                                                              \
+    if ((ps->mode == PATT_ZERO) || (ps->mode == PATT_ONE) ||                  \
+        (ps->mode == PATT_VALUE)) {                                           \
+        type value;                                                           \
+        memcpy(&value, ps->value, sizeof (type));                             \
+        ps->step += count;                                                    \
+        while (count-- > 0)                                                   \
+            *(ptr++) = value;                                                 \
+        return;                                                               \
+    }                                                                         \
+    while (count-- > 0)                                                       \
+        *(ptr++) = patt_next_##bits(ps);                                      \
+}                                                                             \
+                                                                              \
+static void                                                                   \
+mem_test_##bits(uintptr_t addr, uint count, patt_state_t *ps, bool_t write)   \
+{                                                                             \
+    volatile type *ptr = (volatile type *) addr;                              \
+    type           rvalue;                                                    \
+                                                                              \
+    for (; count > 0; count--, ptr++) {                                       \
+        if (write)                                                            \
+            *ptr = patt_next_##bits(ps);                                      \
+        rvalue = *ptr;                                                        \
+        (void) rvalue;                                                        \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static void                                                                   \
+mem_copy_##bits(uintptr_t daddr, uintptr_t saddr, uint count)                 \
+{                                                                             \
+    volatile type *dptr = (volatile type *) daddr;                            \
+    volatile type *sptr = (volatile type *) saddr;                            \
+                                                                              \
+    while (count-- > 0)                                                       \
+        *(dptr++) = *(sptr++);                                                \
+}                                                                             \
+                                                                              \
+static uint                                                                   \
+mem_comp_##bits(uintptr_t addr1, uintptr_t addr2, uint count)                 \
+{                                                                             \
+    volatile type *ptr1 = (volatile type *) addr1;                            \
+    volatile type *ptr2 = (volatile type *) addr2;                            \
+    uint           pos;                                                       \
+                                                                              \
+    for (pos = 0; pos < count; pos++)                                         \
+        if (ptr1[pos] != ptr2[pos])                                           \
+            break;                                                            \
+    return (pos);                                                             \
+}
+
+MEM_KERNELS(uint8_t,  8)
+MEM_KERNELS(uint16_t, 16)
+MEM_KERNELS(uint32_t, 32)
+#ifndef AMIGA
+MEM_KERNELS(uint64_t, 64)
+#endif
+
+/*
+ * MEM_KERNEL_CALL() invokes the kernel of the specified width.
+ */
+#ifdef AMIGA
+#define MEM_KERNEL_CALL_64(func, ...)
+#else
+#define MEM_KERNEL_CALL_64(func, ...) \
+        case 8: func##_64(__VA_ARGS__); break;
+#endif
+#define MEM_KERNEL_CALL(width, func, ...)               \
+    switch (width) {                                    \
+        case 1: func##_8(__VA_ARGS__);  break;          \
+        case 2: func##_16(__VA_ARGS__); break;          \
+        case 4: func##_32(__VA_ARGS__); break;          \
+        MEM_KERNEL_CALL_64(func, __VA_ARGS__)           \
+    }
+
+/*
+ * mem_kernel_ok() returns TRUE if the range may be handled by the
+ *                 width-specialized kernels: CPU memory space, a kernel
+ *                 exists for the width, and the range is width aligned.
+ */
+static bool_t
+mem_kernel_ok(uint64_t space, uint64_t addr, uint len, uint width)
+{
+    if ((uint8_t) space != SPACE_MEMORY)
+        return (FALSE);
+    switch (width) {
+        case 1:
+        case 2:
+        case 4:
+#ifndef AMIGA
+        case 8:
+#endif
+            break;
+        default:
+            return (FALSE);
+    }
+    if ((addr | len) & (width - 1))
+        return (FALSE);
+    return (TRUE);
+}
+
+/*
+ * mem_kernel_begin() and mem_kernel_end() bracket a kernel call so that
+ *                    bus faults in peripheral space are counted rather
+ *                    than fatal, the same as mem_read() and mem_write().
+ */
+static void
+mem_kernel_begin(void)
+{
+    mem_fault_count = 0;
+    mem_fault_ok    = TRUE;
+}
+
+static rc_t
+mem_kernel_end(void)
+{
+    mem_fault_ok = FALSE;
+    return ((mem_fault_count != 0) ? RC_FAILURE : RC_SUCCESS);
+}
+
 static uint
 ascii_hex_to_digit(char ch)
 {
@@ -648,6 +857,42 @@ cmd_comp(int argc, char * const *argv)
         return (RC_USER_HELP);
 
     for (offset = 0; offset < len; offset += width) {
+        if (mem_kernel_ok(space1, addr1 + offset, len - offset, width) &&
+            mem_kernel_ok(space2, addr2 + offset, len - offset, width)) {
+            /* Skip ahead to the next mismatch (if any) in this chunk */
+            uint count = (len - offset) / width;
+            uint pos   = 0;
+            if (count > MEM_KERNEL_CHUNK)
+                count = MEM_KERNEL_CHUNK;
+            mem_kernel_begin();
+            switch (width) {
+                case 1:
+                    pos = mem_comp_8(addr1 + offset, addr2 + offset, count);
+                    break;
+                case 2:
+                    pos = mem_comp_16(addr1 + offset, addr2 + offset, count);
+                    break;
+                case 4:
+                    pos = mem_comp_32(addr1 + offset, addr2 + offset, count);
+                    break;
+#ifndef AMIGA
+                case 8:
+                    pos = mem_comp_64(addr1 + offset, addr2 + offset, count);
+                    break;
+#endif
+            }
+            if (mem_kernel_end() != RC_SUCCESS)
+                pos = 0;  // Per-element path below will report the fault
+            offset += pos * width;
+            if (pos == count) {
+                offset -= width;  // Loop increment moves to next chunk
+                if (input_break_pending()) {
+                    printf("^C\n");
+                    return (RC_USR_ABORT);
+                }
+                continue;
+            }
+        }
         rc = data_read(space1, addr1 + offset, width, buf1);
         if (rc != RC_SUCCESS) {
             if (printed)
@@ -733,6 +978,30 @@ cmd_copy(int argc, char * const *argv)
     if ((rc = parse_uint(argv[0], &len)) != RC_SUCCESS)
         return (RC_USER_HELP);
 
+    if (mem_kernel_ok(sspace, saddr, len, width) &&
+        mem_kernel_ok(dspace, daddr, len, width)) {
+        uint count;
+        for (offset = 0; offset < len; offset += count * width) {
+            count = (len - offset) / width;
+            if (count > MEM_KERNEL_CHUNK)
+                count = MEM_KERNEL_CHUNK;
+            mem_kernel_begin();
+            MEM_KERNEL_CALL(width, mem_copy, daddr + offset, saddr + offset,
+                            count);
+            if (mem_kernel_end() != RC_SUCCESS) {
+                printf("Error copying %d bytes at ", count * width);
+                print_addr(sspace, saddr + offset);
+                printf("\n");
+                return (RC_FAILURE);
+            }
+            if (input_break_pending()) {
+                printf("^C\n");
+                return (RC_USR_ABORT);
+            }
+        }
+        return (RC_SUCCESS);
+    }
+
     for (offset = 0; offset < len; offset += width) {
         rc = data_read(sspace, saddr + offset, width, buf);
         if (rc != RC_SUCCESS) {
@@ -1216,16 +1485,7 @@ cmd_patt(int argc, char * const *argv)
     uint8_t     buf[MAX_TRANSFER];
     const char *cmd;
     char       *ptr;
-    static enum {
-        PATT_ZERO,
-        PATT_ONE,
-        PATT_BLIP,
-        PATT_RAND,
-        PATT_STROBE,
-        PATT_WALK0,
-        PATT_WALK1,
-        PATT_VALUE,
-    } pattmode = PATT_ONE;
+    static patt_mode_t pattmode = PATT_ONE;
 
     if (argc < 4) {
         printf("Need address\n");
@@ -1302,6 +1562,35 @@ show_patterns:
         pattmode = PATT_VALUE;
     }
 
+    if (mem_kernel_ok(space, addr, len, width)) {
+        patt_state_t ps;
+        uint         count;
+
+        ps.mode = pattmode;
+        ps.step = 0;
+        ps.alt  = 0;
+        ps.swap = flag_S;
+        memcpy(ps.value, buf, width);
+        for (offset = 0; offset < len; offset += count * width) {
+            count = (len - offset) / width;
+            if (count > MEM_KERNEL_CHUNK)
+                count = MEM_KERNEL_CHUNK;
+            mem_kernel_begin();
+            MEM_KERNEL_CALL(width, mem_patt, addr + offset, count, &ps);
+            if (mem_kernel_end() != RC_SUCCESS) {
+                printf("Error writing %d bytes at ", count * width);
+                print_addr(space, addr + offset);
+                printf("\n");
+                return (RC_FAILURE);
+            }
+            if (input_break_pending()) {
+                printf("^C\n");
+                return (RC_USR_ABORT);
+            }
+        }
+        return (RC_SUCCESS);
+    }
+
     for (offset = 0; offset < len; offset += width) {
         switch (pattmode) {
             case PATT_WALK0: {
@@ -1394,6 +1683,7 @@ cmd_test(int argc, char * const *argv)
     uint8_t     buf[MAX_TRANSFER];
     uint8_t     rbuf[MAX_TRANSFER];
     uint32_t    srand_seed;
+    uint        step = 0;
     const char *cmd;
     static enum {
         TEST_ZERO,
@@ -1453,10 +1743,10 @@ show_patterns:
             srand32(srand_seed);
         } else if (strcmp(argv[0], "walk0") == 0) {
             testmode = TEST_WALK0;
-            memset(buf, 0x00, width);
+            memset(buf, 0xff, width);
         } else if (strcmp(argv[0], "walk1") == 0) {
             testmode = TEST_WALK1;
-            memset(buf, 0xff, width);
+            memset(buf, 0x00, width);
         } else if (strcmp(argv[0], "zero") == 0) {
             testmode = TEST_ZERO;
             memset(buf, 0x00, width);
@@ -1471,10 +1761,47 @@ show_patterns:
         rwmode = RWMODE_READ;
     }
 
+    if (mem_kernel_ok(space, addr, len, width)) {
+        static const patt_mode_t test_patt[] = {
+            [TEST_ZERO]  = PATT_ZERO,
+            [TEST_ONE]   = PATT_ONE,
+            [TEST_RAND]  = PATT_RAND,
+            [TEST_WALK0] = PATT_WALK0,
+            [TEST_WALK1] = PATT_WALK1,
+            [TEST_VALUE] = PATT_VALUE,
+        };
+        patt_state_t ps;
+        uint         tcount;
+
+        ps.mode = test_patt[testmode];
+        ps.step = 0;
+        ps.alt  = 0;
+        ps.swap = flag_S;
+        memcpy(ps.value, buf, width);
+        for (offset = 0; offset < len; offset += tcount * width) {
+            tcount = (len - offset) / width;
+            if (tcount > MEM_KERNEL_CHUNK)
+                tcount = MEM_KERNEL_CHUNK;
+            mem_kernel_begin();
+            MEM_KERNEL_CALL(width, mem_test, addr + offset, tcount, &ps,
+                            rwmode == RWMODE_WRITE);
+            if (mem_kernel_end() != RC_SUCCESS) {
+                printf("Error accessing %d bytes at ", tcount * width);
+                print_addr(space, addr + offset);
+                printf("\n");
+                return (RC_FAILURE);
+            }
+            if (input_break_pending()) {
+                printf("^C\n");
+                return (RC_USR_ABORT);
+            }
+        }
+        return (RC_SUCCESS);
+    }
+
     for (offset = 0; offset < len; offset += width) {
         count++;
         if (rwmode == RWMODE_WRITE) {
-            uint step = 0;
             switch (testmode) {
                 case TEST_RAND: {
                     uint swidth;
@@ -1510,6 +1837,7 @@ show_patterns:
                     break;
             }
             count++;
+            step++;
             rc = data_write(space, addr + offset, width, buf);
             if (rc != RC_SUCCESS) {
                 printf("Error writing %d bytes at ", width);
@@ -0,0 +1,203 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2020.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Crash and performance snapshot preserved across reset.
+ *
+ * The snapshot for the current run is kept up to date in SRAM which is
+ * not cleared by reset. It records the command executing, the EEPROM
+ * address in progress, and the most recent program and erase times. On
+ * a fault, the exception registers and uptime are added. If the board
+ * faults, or is reset while a command is executing, the snapshot is
+ * preserved at the next startup so that it can be retrieved with the
+ * "crashlog" command. After a fault, the snapshot is frozen so that
+ * commands entered at the fault prompt do not overwrite it.
+ */
+
+#include "printf.h"
+#include "board.h"
+#include "main.h"
+#include "utils.h"
+#include <stdbool.h>
+#include "timer.h"
+#include "crc32.h"
+#include "irq.h"
+#include "crashlog.h"
+#include <stddef.h>
+#include <string.h>
+
+#define CRASHLOG_MAGIC 0x474f4c43  // "CLOG"
+
+typedef struct {
+    uint32_t        magic;       // CRASHLOG_MAGIC
+    uint32_t        uptime_ms;   // Uptime at fault
+    uint32_t        prom_addr;   // EEPROM address in progress
+    uint32_t        prog_usec;   // Last page program time
+    uint32_t        erase_usec;  // Last erase time
+    uint32_t        faulted;     // Fault registers below are valid
+    crashlog_regs_t regs;        // Fault registers
+    char            cmd[64];     // Command executing
+    uint32_t        crc;         // CRC32 of preceding fields (saved log)
+} crashlog_t;
+
+SRAM_PERSIST static crashlog_t crashlog_cur;   // Current run
+SRAM_PERSIST static crashlog_t crashlog_prev;  // Preserved from prior run
+
+/*
+ * crashlog_init() preserves the snapshot of the previous run if that run
+ *                 faulted or was reset during a command, then starts a
+ *                 new snapshot for this run. It must be called early in
+ *                 startup, before any command executes.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+void
+crashlog_init(void)
+{
+    if ((crashlog_cur.magic == CRASHLOG_MAGIC) &&
+        (crashlog_cur.faulted || (crashlog_cur.cmd[0] != '\0'))) {
+        crashlog_cur.cmd[sizeof (crashlog_cur.cmd) - 1] = '\0';
+        memcpy(&crashlog_prev, &crashlog_cur, sizeof (crashlog_prev));
+        crashlog_prev.crc = crc32(0, &crashlog_prev,
+                                  offsetof(crashlog_t, crc));
+    }
+    memset(&crashlog_cur, 0, sizeof (crashlog_cur));
+    crashlog_cur.magic = CRASHLOG_MAGIC;
+}
+
+/*
+ * crashlog_cmd() records the command which is starting, or NULL when the
+ *                command has completed.
+ *
+ * @param [in]  cmd - The command line being executed.
+ *
+ * @return      None.
+ */
+void
+crashlog_cmd(const char *cmd)
+{
+    if (crashlog_cur.faulted)
+        return;
+    if (cmd == NULL) {
+        crashlog_cur.cmd[0] = '\0';
+        return;
+    }
+    strncpy(crashlog_cur.cmd, cmd, sizeof (crashlog_cur.cmd) - 1);
+    crashlog_cur.cmd[sizeof (crashlog_cur.cmd) - 1] = '\0';
+}
+
+/*
+ * crashlog_prom_addr() records the EEPROM address currently being accessed.
+ *
+ * @param [in]  addr - EEPROM byte address.
+ *
+ * @return      None.
+ */
+void
+crashlog_prom_addr(uint32_t addr)
+{
+    if (crashlog_cur.faulted == 0)
+        crashlog_cur.prom_addr = addr;
+}
+
+/*
+ * crashlog_timing() records the time taken by the most recent EEPROM
+ *                   program or erase operation.
+ *
+ * @param [in]  erase - Non-zero if the operation was an erase.
+ * @param [in]  usec  - Operation time in microseconds.
+ *
+ * @return      None.
+ */
+void
+crashlog_timing(uint erase, uint32_t usec)
+{
+    if (crashlog_cur.faulted)
+        return;
+    if (erase)
+        crashlog_cur.erase_usec = usec;
+    else
+        crashlog_cur.prog_usec = usec;
+}
+
+/*
+ * crashlog_fault() records fault registers and uptime. This is called from
+ *                  exception context, so it only stores values. Only the
+ *                  first fault is recorded.
+ *
+ * @param [in]  regs - Registers at the time of the fault.
+ *
+ * @return      None.
+ */
+void
+crashlog_fault(const crashlog_regs_t *regs)
+{
+    if (crashlog_cur.faulted)
+        return;
+    crashlog_cur.regs      = *regs;
+    crashlog_cur.uptime_ms = timer_tick_to_usec(timer_tick_get()) / 1000;
+    crashlog_cur.faulted   = 1;
+}
+
+/*
+ * crashlog_show() displays the snapshot preserved from the previous run.
+ *
+ * This function requires no arguments.
+ *
+ * @return      0 - A snapshot was displayed.
+ * @return      1 - No snapshot is available.
+ */
+int
+crashlog_show(void)
+{
+    const crashlog_t      *cl = &crashlog_prev;
+    const crashlog_regs_t *r  = &cl->regs;
+
+    if ((cl->magic != CRASHLOG_MAGIC) ||
+        (cl->crc != crc32(0, cl, offsetof(crashlog_t, crc)))) {
+        printf("No crash log\n");
+        return (1);
+    }
+    if (cl->faulted) {
+        printf("Fault: %s (vect 0x%lx) at uptime %lu.%03lu sec\n",
+               fault_vect_name(r->vect), r->vect,
+               cl->uptime_ms / 1000, cl->uptime_ms % 1000);
+    } else {
+        printf("Reset during command\n");
+    }
+    printf("Command: %s\n", (cl->cmd[0] != '\0') ? cl->cmd : "(none)");
+    printf("PROM addr: %lx\n", cl->prom_addr);
+    printf("Last program: %lu usec  Last erase: %lu.%03lu sec\n",
+           cl->prog_usec, cl->erase_usec / 1000000,
+           (cl->erase_usec % 1000000) / 1000);
+    if (cl->faulted) {
+        printf("R0=%08lx R3=%08lx R6=%08lx  R9=%08lx R12=%08lx PC=%08lx\n"
+               "R1=%08lx R4=%08lx R7=%08lx R10=%08lx PSR=%08lx SP=%08lx\n"
+               "R2=%08lx R5=%08lx R8=%08lx R11=%08lx              LR=%08lx\n",
+               r->r[0], r->r[3], r->r[6], r->r[9], r->r[12], r->pc,
+               r->r[1], r->r[4], r->r[7], r->r[10], r->psr, r->sp,
+               r->r[2], r->r[5], r->r[8], r->r[11], r->lr);
+        printf("HFSR=%08lx CFSR=%08lx BFAR=%08lx MMFAR=%08lx\n",
+               r->hfsr, r->cfsr, r->bfar, r->mmfar);
+    }
+    return (0);
+}
+
+/*
+ * crashlog_clear() discards the snapshot preserved from the previous run.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+void
+crashlog_clear(void)
+{
+    memset(&crashlog_prev, 0, sizeof (crashlog_prev));
+}
@@ -0,0 +1,37 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2020.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Crash and performance snapshot preserved across reset.
+ */
+
+#ifndef _CRASHLOG_H
+#define _CRASHLOG_H
+
+/* Fault registers, captured by the exception handler */
+typedef struct {
+    uint32_t vect;    // Exception number from SCB ICSR
+    uint32_t r[13];   // R0-R12
+    uint32_t sp;
+    uint32_t lr;
+    uint32_t pc;
+    uint32_t psr;
+    uint32_t hfsr;
+    uint32_t cfsr;
+    uint32_t bfar;
+    uint32_t mmfar;
+} crashlog_regs_t;
+
+void crashlog_init(void);
+void crashlog_cmd(const char *cmd);
+void crashlog_prom_addr(uint32_t addr);
+void crashlog_timing(uint erase, uint32_t usec);
+void crashlog_fault(const crashlog_regs_t *regs);
+int  crashlog_show(void);
+void crashlog_clear(void);
+
+#endif /* _CRASHLOG_H */
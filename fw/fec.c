@@ -0,0 +1,294 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2020.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Interleaved Reed-Solomon forward error correction for binary transfers.
+ *
+ * A block of up to 256 data bytes plus its 4-byte CRC is split into
+ * FEC_DEPTH codewords, where byte n of the block belongs to codeword
+ * (n % FEC_DEPTH). Each codeword is a shortened RS(255,251) code over
+ * GF(256), with FEC_NPAR parity bytes, which corrects up to 2 bad bytes.
+ * Interleaving allows a burst of up to 8 consecutive bad bytes in the
+ * block to be corrected. The CRC which follows the data is still used
+ * to detect any miscorrection.
+ *
+ * The parity of all codewords is sent together following the block, and
+ * continues the same interleave: parity byte n belongs to codeword
+ * ((len + n) % FEC_DEPTH), where len includes the CRC. A burst which
+ * reaches into the parity is therefore spread across codewords in the
+ * same way. The host (mxprog) implements the same code.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "main.h"
+#include "fec.h"
+
+#define GF_POLY 0x11d  // x^8 + x^4 + x^3 + x^2 + 1
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t rs_gen[FEC_NPAR + 1];  // Generator polynomial, rs_gen[0] = x^0
+static bool    fec_ready;
+
+/*
+ * gf_mul() multiplies two GF(256) elements.
+ */
+static uint8_t
+gf_mul(uint8_t a, uint8_t b)
+{
+    if ((a == 0) || (b == 0))
+        return (0);
+    return (gf_exp[gf_log[a] + gf_log[b]]);
+}
+
+/*
+ * gf_div() divides two GF(256) elements. The divisor must not be zero.
+ */
+static uint8_t
+gf_div(uint8_t a, uint8_t b)
+{
+    if (a == 0)
+        return (0);
+    return (gf_exp[gf_log[a] + 255 - gf_log[b]]);
+}
+
+/*
+ * fec_init() builds the GF(256) tables and the RS generator polynomial
+ *            (x - a^0)(x - a^1)...(x - a^(FEC_NPAR-1)).
+ */
+static void
+fec_init(void)
+{
+    uint x = 1;
+    uint i;
+    uint j;
+
+    for (i = 0; i < 255; i++) {
+        gf_exp[i] = x;
+        gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLY;
+    }
+    gf_exp[510] = gf_exp[0];
+    gf_exp[511] = gf_exp[1];
+
+    memset(rs_gen, 0, sizeof (rs_gen));
+    rs_gen[0] = 1;
+    for (i = 0; i < FEC_NPAR; i++) {
+        for (j = i + 1; j > 0; j--)
+            rs_gen[j] = rs_gen[j - 1] ^ gf_mul(rs_gen[j], gf_exp[i]);
+        rs_gen[0] = gf_mul(rs_gen[0], gf_exp[i]);
+    }
+    fec_ready = true;
+}
+
+/*
+ * rs_encode() computes the parity of one codeword, whose data bytes are
+ *             every <stride> bytes of buf. The parity bytes are stored
+ *             every <stride> bytes of parity.
+ */
+static void
+rs_encode(const uint8_t *buf, uint count, uint stride, uint8_t *parity)
+{
+    uint8_t par[FEC_NPAR];
+    uint    pos;
+    uint    j;
+    uint8_t fb;
+
+    memset(par, 0, sizeof (par));
+    for (pos = 0; pos < count; pos++, buf += stride) {
+        fb = *buf ^ par[0];
+        for (j = 0; j < FEC_NPAR - 1; j++)
+            par[j] = par[j + 1] ^ gf_mul(fb, rs_gen[FEC_NPAR - 1 - j]);
+        par[FEC_NPAR - 1] = gf_mul(fb, rs_gen[0]);
+    }
+    for (j = 0; j < FEC_NPAR; j++)
+        parity[j * stride] = par[j];
+}
+
+/*
+ * rs_symbol() returns a pointer to symbol <pos> of a codeword. Data
+ *             symbols come first, followed by the parity symbols.
+ */
+static uint8_t *
+rs_symbol(uint8_t *buf, uint count, uint stride, uint8_t *parity, uint pos)
+{
+    if (pos < count)
+        return (buf + pos * stride);
+    return (parity + (pos - count) * stride);
+}
+
+/*
+ * rs_syndromes() computes the codeword syndromes.
+ *
+ * @return      true if any syndrome is non-zero (codeword has errors).
+ */
+static bool
+rs_syndromes(uint8_t *buf, uint count, uint stride, uint8_t *parity,
+             uint8_t *synd)
+{
+    uint    n = count + FEC_NPAR;
+    uint    pos;
+    uint    j;
+    uint8_t bad = 0;
+
+    for (j = 0; j < FEC_NPAR; j++) {
+        uint8_t s = 0;
+        for (pos = 0; pos < n; pos++)
+            s = gf_mul(s, gf_exp[j]) ^
+                *rs_symbol(buf, count, stride, parity, pos);
+        synd[j] = s;
+        bad |= s;
+    }
+    return (bad != 0);
+}
+
+/*
+ * rs_decode() corrects one codeword in place. The Berlekamp-Massey
+ *             algorithm finds the error locator, a Chien search finds the
+ *             error positions, and the Forney algorithm the error values.
+ *
+ * @return      Number of bytes corrected, or -1 if uncorrectable.
+ */
+static int
+rs_decode(uint8_t *buf, uint count, uint stride, uint8_t *parity)
+{
+    uint8_t synd[FEC_NPAR];
+    uint8_t lambda[FEC_NPAR + 1];  // Error locator
+    uint8_t prev[FEC_NPAR + 1];    // Previous locator
+    uint8_t temp[FEC_NPAR + 1];
+    uint8_t omega[FEC_NPAR];       // Error evaluator
+    uint8_t b = 1;
+    uint    n = count + FEC_NPAR;
+    uint    len = 0;               // Number of errors located
+    uint    shift = 1;
+    uint    found = 0;
+    uint    pos;
+    uint    i;
+    uint    j;
+
+    if (rs_syndromes(buf, count, stride, parity, synd) == false)
+        return (0);
+
+    memset(lambda, 0, sizeof (lambda));
+    memset(prev, 0, sizeof (prev));
+    lambda[0] = 1;
+    prev[0] = 1;
+    for (i = 0; i < FEC_NPAR; i++) {
+        uint8_t d = synd[i];
+        uint8_t coef;
+        for (j = 1; j <= len; j++)
+            d ^= gf_mul(lambda[j], synd[i - j]);
+        if (d == 0) {
+            shift++;
+            continue;
+        }
+        coef = gf_div(d, b);
+        memcpy(temp, lambda, sizeof (temp));
+        for (j = 0; j + shift <= FEC_NPAR; j++)
+            lambda[j + shift] ^= gf_mul(coef, prev[j]);
+        if (2 * len <= i) {
+            len = i + 1 - len;
+            memcpy(prev, temp, sizeof (prev));
+            b = d;
+            shift = 1;
+        } else {
+            shift++;
+        }
+    }
+    if (len > FEC_NPAR / 2)
+        return (-1);
+
+    for (i = 0; i < FEC_NPAR; i++) {
+        omega[i] = 0;
+        for (j = 0; j <= i; j++)
+            omega[i] ^= gf_mul(synd[j], lambda[i - j]);
+    }
+
+    for (pos = 0; pos < n; pos++) {
+        uint    power = n - 1 - pos;        // Symbol is coefficient of x^power
+        uint    xinv  = (255 - power) % 255;  // log of X^-1
+        uint8_t lval  = 0;
+        uint8_t dval  = 0;
+        uint8_t oval  = 0;
+
+        for (j = 0; j <= len; j++)
+            lval ^= gf_mul(lambda[j], gf_exp[(xinv * j) % 255]);
+        if (lval != 0)
+            continue;
+
+        /* Forney: e = X * omega(X^-1) / lambda'(X^-1) */
+        for (j = 1; j <= len; j += 2)
+            dval ^= gf_mul(lambda[j], gf_exp[(xinv * (j - 1)) % 255]);
+        for (j = 0; j < FEC_NPAR; j++)
+            oval ^= gf_mul(omega[j], gf_exp[(xinv * j) % 255]);
+        if (dval == 0)
+            return (-1);
+        *rs_symbol(buf, count, stride, parity, pos) ^=
+            gf_mul(gf_exp[power], gf_div(oval, dval));
+        found++;
+    }
+    if ((found != len) ||
+        rs_syndromes(buf, count, stride, parity, synd))
+        return (-1);
+    return (found);
+}
+
+/*
+ * fec_encode() computes the interleaved parity of a block.
+ *
+ * @param [in]  buf    - Block data (up to 255 * FEC_DEPTH - FEC_NPAR bytes).
+ * @param [in]  len    - Length of block data.
+ * @param [out] parity - FEC_PARITY_LEN bytes of parity.
+ *
+ * @return      None.
+ */
+void
+fec_encode(const uint8_t *buf, uint len, uint8_t *parity)
+{
+    uint cw;
+
+    if (fec_ready == false)
+        fec_init();
+    for (cw = 0; cw < FEC_DEPTH; cw++) {
+        uint count = (len > cw) ? (len - cw + FEC_DEPTH - 1) / FEC_DEPTH : 0;
+        rs_encode(buf + cw, count, FEC_DEPTH,
+                  parity + FEC_PARITY_POS(len, cw));
+    }
+}
+
+/*
+ * fec_decode() corrects a received block and its parity in place.
+ *
+ * @param [io]  buf    - Block data.
+ * @param [in]  len    - Length of block data.
+ * @param [io]  parity - FEC_PARITY_LEN bytes of parity.
+ *
+ * @return      Number of bytes corrected, or -1 if uncorrectable.
+ */
+int
+fec_decode(uint8_t *buf, uint len, uint8_t *parity)
+{
+    uint cw;
+    int  fixed = 0;
+
+    if (fec_ready == false)
+        fec_init();
+    for (cw = 0; cw < FEC_DEPTH; cw++) {
+        uint count = (len > cw) ? (len - cw + FEC_DEPTH - 1) / FEC_DEPTH : 0;
+        int  rc = rs_decode(buf + cw, count, FEC_DEPTH,
+                            parity + FEC_PARITY_POS(len, cw));
+        if (rc < 0)
+            return (-1);
+        fixed += rc;
+    }
+    return (fixed);
+}
@@ -0,0 +1,26 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2020.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Interleaved Reed-Solomon forward error correction for binary transfers.
+ */
+
+#ifndef _FEC_H
+#define _FEC_H
+
+#define FEC_DEPTH      4   // Interleaved codewords per block
+#define FEC_NPAR       4   // Parity bytes per codeword (corrects 2 bytes)
+#define FEC_PARITY_LEN (FEC_DEPTH * FEC_NPAR)
+
+/* Offset of the first parity byte of codeword <cw> after <len> data bytes */
+#define FEC_PARITY_POS(len, cw) \
+    (((cw) + FEC_DEPTH - (len) % FEC_DEPTH) % FEC_DEPTH)
+
+void fec_encode(const uint8_t *buf, uint len, uint8_t *parity);
+int  fec_decode(uint8_t *buf, uint len, uint8_t *parity);
+
+#endif /* _FEC_H */
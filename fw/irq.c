@@ -18,6 +18,7 @@
 #include "irq.h"
 #include "cmdline.h"
 #include "mem_access.h"
+#include "crashlog.h"
 #include "main.h"
 #include <string.h>
 
@@ -157,6 +158,76 @@ stm32_instruction_width(uint32_t addr)
     }
 }
 
+/**
+ * fault_vect_name() returns the name of the specified Cortex-M exception.
+ *
+ * @param [in]  vect - Exception number (SCB ICSR VECTACTIVE).
+ * @return      Exception name.
+ */
+const char *
+fault_vect_name(uint vect)
+{
+    static const char * const exception_vects[] = {
+        "Thread mode",        // 0
+        "Reserved",           // 1
+        "NMI",                // 2
+        "Hard fault",         // 3
+        "Memory mgmt fault",  // 4
+        "Bus fault",          // 5
+        "Usage fault",        // 6
+        "Reserved",           // 7
+        "Reserved",           // 8
+        "Reserved",           // 9
+        "Reserved",           // 10
+        "SVCall",             // 11
+        "Debug",              // 12
+        "Reserved",           // 13
+        "PendSV",             // 14
+        "SysTick",            // 15
+    };
+    if (vect < ARRAY_SIZE(exception_vects))
+        return (exception_vects[vect]);
+    return ("Interrupt");
+}
+
+/**
+ * fault_record() saves fault registers in the crash log, which is
+ *                preserved across reset for later retrieval.
+ *
+ * @param [in]  sp - Register frame end address.
+ * @return      None.
+ */
+static void
+fault_record(const void *sp)
+{
+    const reg_frame_t *sf = (const reg_frame_t *) sp - 1;
+    crashlog_regs_t    regs;
+
+    regs.vect  = (uint8_t) SCB_ICSR;
+    regs.r[0]  = sf->r0;
+    regs.r[1]  = sf->r1;
+    regs.r[2]  = sf->r2;
+    regs.r[3]  = sf->r3;
+    regs.r[4]  = sf->r4;
+    regs.r[5]  = sf->r5;
+    regs.r[6]  = sf->r6;
+    regs.r[7]  = sf->r7;
+    regs.r[8]  = sf->r8;
+    regs.r[9]  = sf->r9;
+    regs.r[10] = sf->r10;
+    regs.r[11] = sf->r11;
+    regs.r[12] = sf->r12;
+    regs.sp    = sf->sp;
+    regs.lr    = sf->lr;
+    regs.pc    = sf->pc;
+    regs.psr   = sf->psr;
+    regs.hfsr  = SCB_HFSR;
+    regs.cfsr  = SCB_CFSR;
+    regs.bfar  = SCB_BFAR;
+    regs.mmfar = SCB_MMFAR;
+    crashlog_fault(&regs);
+}
+
 /**
  * fault_show_regs() displays additional fault status registers which are
  *                   present in the Cortex-M3 core.
@@ -186,27 +257,9 @@ fault_show_regs(const void *sp)
             sf->r2, sf->r5, sf->r8, sf->r11, sf->lr_e, sf->lr);
     if (SCB_ICSR != 0) {
         uint8_t vect = (uint8_t) SCB_ICSR;
-        static const char * const exception_vects[] = {
-            "Thread mode",        // 0
-            "Reserved",           // 1
-            "NMI",                // 2
-            "Hard fault",         // 3
-            "Memory mgmt fault",  // 4
-            "Bus fault",          // 5
-            "Usage fault",        // 6
-            "Reserved",           // 7
-            "Reserved",           // 8
-            "Reserved",           // 9
-            "Reserved",           // 10
-            "SVCall",             // 11
-            "Debug",              // 12
-            "Reserved",           // 13
-            "PendSV",             // 14
-            "SysTick",            // 15
-        };
         printf("SCB ICSR: %08lx  vect=0x%x", SCB_ICSR, vect);
         if (vect < 0x10)
-            printf(":%s\n", exception_vects[vect]);
+            printf(":%s\n", fault_vect_name(vect));
         printf("\n");
     }
     if (SCB_HFSR != 0)
@@ -262,6 +315,7 @@ hard_fault_handler_impl(void *sp)
         }
     }
     puts("Hard fault");
+    fault_record(sp);
     fault_show_regs(sp);
     led_alert(1);
     while (1)
@@ -289,6 +343,7 @@ static void __attribute__((noinline))
 nmi_handler_impl(const void *sp)
 {
     puts("NMI");
+    fault_record(sp);
     fault_show_regs(sp);
     led_alert(1);
     while (1)
@@ -310,6 +365,7 @@ static void __attribute__((noinline))
 bus_fault_handler_impl(const void *sp)
 {
     puts("bus fault");
+    fault_record(sp);
     fault_show_regs(sp);
     led_alert(1);
     while (1)
@@ -331,6 +387,7 @@ static void __attribute__((noinline))
 mem_manage_handler_impl(const void *sp)
 {
     puts("Memory management exception");
+    fault_record(sp);
     fault_show_regs(sp);
     led_alert(1);
     while (1)
@@ -352,6 +409,7 @@ static void __attribute__((noinline))
 usage_fault_handler_impl(const void *sp)
 {
     puts("usage fault");
+    fault_record(sp);
     fault_show_regs(sp);
     led_alert(1);
     while (1)
@@ -373,6 +431,7 @@ static void __attribute__((noinline))
 unknown_handler_impl(const void *sp)
 {
     puts("Unknown fault");
+    fault_record(sp);
     fault_show_regs(sp);
     led_alert(1);
     while (1)
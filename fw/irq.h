@@ -58,5 +58,6 @@ static inline void __enable_irq(bool enable)
 #endif /* libopencm3 */
 
 void fault_show_regs(const void *sp);
+const char *fault_vect_name(uint vect);
 
 #endif /* _IRQ_H */
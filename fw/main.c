@@ -28,6 +28,8 @@
 #include "timer.h"
 #include "utils.h"
 #include "version.h"
+#include "crashlog.h"
+#include "stage.h"
 
 #ifdef USE_HAL_DRIVER
 /* ST-Micro HAL Library compatibility definitions */
@@ -55,6 +57,7 @@ reset_everything(void)
 int main(void)
 {
     reset_check();
+    crashlog_init();
     reset_everything();
     clock_init();
     timer_init();
@@ -82,6 +85,7 @@ int main(void)
         usb_poll();
         mx_poll();
         adc_poll(true, false);
+        stage_poll();
         cmdline();
     }
 
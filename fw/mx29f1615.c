@@ -22,10 +22,10 @@
 #include "timer.h"
 #include "gpio.h"
 #include "usb.h"
+#include "crashlog.h"
 
 #undef DEBUG_SIGNALS
 
-#define MX_DEVICE_SIZE          (1 << 20)   // 1M words (16-bit words)
 #define MX_ERASE_SECTOR_SIZE    (64 << 10)  // 64K-word sectors
 #define MX_PAGE_SIZE            64          // Page program words
 
@@ -53,6 +53,112 @@ static uint32_t ticks_per_120_nsec;
 static uint64_t mx_last_access = 0;
 static bool     mx_enabled = false;
 
+/*
+ * Bus capture buffer. When capture is active, pin state is sampled after
+ * every bus signal change and continuously during bus timing delays.
+ * A sample is only recorded when it differs from the previous sample,
+ * so the buffer holds a list of transitions.
+ */
+#ifdef STM32F4
+#define MX_CAPTURE_MAX 1024
+#else
+#define MX_CAPTURE_MAX 512
+#endif
+static mx_capture_t mx_capture_buf[MX_CAPTURE_MAX];
+static uint         mx_capture_count;
+static bool         mx_capture_active = false;
+static bool         mx_capture_overflow;
+static bool         mx_data_driven = false;
+
+/*
+ * Page read-back retry statistics since the last status clear. Only words
+ * which did not read back correctly after a page program are reprogrammed.
+ */
+static uint         mx_retry_pages;    // Pages which required reprogram
+static uint         mx_retry_words;    // Words which were reprogrammed
+static uint16_t     mx_retry_bits;     // Bits which were still 1
+static mx_line_stats_t mx_lines;       // Read-back mismatches per line
+
+static uint32_t address_input(void);
+static uint16_t data_input(void);
+
+/*
+ * mx_capture_sample() records the current state of the EEPROM bus pins
+ *                     if it differs from the last recorded state. Each
+ *                     call takes several hundred ns, which stretches the
+ *                     bus cycle being captured; captures therefore cannot
+ *                     resolve the 35-120 ns EEPROM cycle timing.
+ */
+static void
+mx_capture_sample(void)
+{
+    mx_capture_t *cap;
+    uint32_t      addr = address_input();
+    uint16_t      data = data_input();
+    uint16_t      ctrl = 0;
+
+    if (gpio_get(CE_GPIO_Port, CE_Pin))
+        ctrl |= MX_CAPTURE_CE;
+    if (gpio_get(OE_GPIO_Port, OE_Pin))
+        ctrl |= MX_CAPTURE_OE;
+    if (gpio_get(EE_EN_VPP_GPIO_Port, EE_EN_VPP_Pin))
+        ctrl |= MX_CAPTURE_VPP;
+    if (mx_data_driven)
+        ctrl |= MX_CAPTURE_DOE;
+
+    if (mx_capture_count > 0) {
+        cap = &mx_capture_buf[mx_capture_count - 1];
+        if ((cap->addr == addr) && (cap->data == data) && (cap->ctrl == ctrl))
+            return;  // No change
+    }
+    if (mx_capture_count >= ARRAY_SIZE(mx_capture_buf)) {
+        mx_capture_overflow = true;
+        return;
+    }
+    cap = &mx_capture_buf[mx_capture_count++];
+    cap->tick = (uint32_t) timer_tick_get();
+    cap->addr = addr;
+    cap->data = data;
+    cap->ctrl = ctrl;
+}
+
+#define MX_CAPTURE() do {                 \
+        if (mx_capture_active)            \
+            mx_capture_sample();          \
+    } while (0)
+
+/*
+ * mx_delay_ticks() delays the specified number of timer ticks. If bus
+ *                  capture is active, the pins are sampled for the
+ *                  duration of the delay.
+ */
+static void
+mx_delay_ticks(uint32_t ticks)
+{
+    if (mx_capture_active) {
+        uint64_t end = timer_tick_get() + ticks;
+        do {
+            mx_capture_sample();
+        } while (timer_tick_has_elapsed(end) == false);
+    } else {
+        timer_delay_ticks(ticks);
+    }
+}
+
+/*
+ * mx_delay_usec() delays the specified number of microseconds. If bus
+ *                 capture is active, the pins are sampled for the
+ *                 duration of the delay.
+ */
+static void
+mx_delay_usec(uint usec)
+{
+    if (mx_capture_active)
+        mx_delay_ticks(timer_usec_to_tick(usec));
+    else
+        timer_delay_usec(usec);
+}
+
 
 static void
 address_output(uint32_t addr)
@@ -76,6 +182,7 @@ address_output(uint32_t addr)
     GPIO_BSRR(A16_GPIO_Port) = 0x03c00000 |             // Clear A19..A16
                                ((addr >> 10) & 0x03c0); // Set A19..A16
 #endif
+    MX_CAPTURE();
 }
 
 static uint32_t
@@ -155,6 +262,7 @@ static void
 data_output(uint16_t data)
 {
     GPIO_ODR(D0_GPIO_Port) = data;
+    MX_CAPTURE();
 }
 
 static uint16_t
@@ -172,6 +280,8 @@ data_output_enable(void)
     GPIO_CRL(D0_GPIO_Port) = 0x11111111;   // Output Push-Pull
     GPIO_CRH(D0_GPIO_Port) = 0x11111111;
 #endif
+    mx_data_driven = true;
+    MX_CAPTURE();
 }
 
 static void
@@ -184,6 +294,8 @@ data_output_disable(void)
     GPIO_CRH(D0_GPIO_Port) = 0x88888888;
     GPIO_ODR(D0_GPIO_Port) = 0x00000000;   // Pull down D0-D15
 #endif
+    mx_data_driven = false;
+    MX_CAPTURE();
 }
 
 static void
@@ -193,6 +305,7 @@ ce_output(uint value)
     printf(" CE=%d", value);
 #endif
     gpio_setv(CE_GPIO_Port, CE_Pin, value);
+    MX_CAPTURE();
 }
 
 static void
@@ -202,6 +315,7 @@ oe_output(uint value)
     printf(" OE=%d", value);
 #endif
     gpio_setv(OE_GPIO_Port, OE_Pin, value);
+    MX_CAPTURE();
 }
 
 static void
@@ -270,6 +384,17 @@ vpp_enable(void)
 #endif
     /* Drive EN_VPP high to turn on VPP */
     gpio_setv(EE_EN_VPP_GPIO_Port, EE_EN_VPP_Pin, 1);
+    MX_CAPTURE();
+}
+
+/*
+ * vpp_settle() waits after VPP is raised to VHH: tVPS (2us), or longer
+ *              while the 10V supply reads out of tolerance.
+ */
+static void
+vpp_settle(void)
+{
+    (void) adc_rail_settle(ADC_RAIL_VPP, 2, 2, 100);
 }
 
 static void
@@ -280,6 +405,7 @@ vpp_disable(void)
 #endif
     /* Drive EE_EN_VPP low to turn off VPP */
     gpio_setv(EE_EN_VPP_GPIO_Port, EE_EN_VPP_Pin, 0);
+    MX_CAPTURE();
 }
 
 /*
@@ -309,7 +435,8 @@ mx_enable(void)
     ce_output_enable();
     oe_output_enable();
     data_output_disable();
-    timer_delay_usec(52);  // tVCS=50us tVPS=2us
+    /* tVCS=50us, then until VCC is measured within tolerance */
+    (void) adc_rail_settle(ADC_RAIL_VCC, 50, 52, 1000);
     mx_enabled = true;
     mx_read_mode();
 #ifdef DEBUG_SIGNALS
@@ -364,11 +491,11 @@ mx_read_word(uint32_t addr, uint16_t *data)
     address_output(addr);
     ce_output(0);
     oe_output(0);
-    timer_delay_ticks(ticks_per_120_nsec);  // Wait for tACC / tCE / tOE
+    mx_delay_ticks(ticks_per_120_nsec);  // Wait for tACC / tCE / tOE
     *data = data_input();
     ce_output(1);
     oe_output(1);
-    timer_delay_ticks(ticks_per_35_nsec);   // Wait for tDF
+    mx_delay_ticks(ticks_per_35_nsec);   // Wait for tDF
 
 #if 0
     /* If it's an EPROM, it may need more delay than MX29F1615... */
@@ -385,6 +512,7 @@ mx_read(uint32_t addr, uint16_t *data, uint count)
     if ((addr + count) > MX_DEVICE_SIZE)
         return (1);
 
+    crashlog_prom_addr(addr << 1);
     usb_mask_interrupts();
     while (count-- > 0)
         mx_read_word(addr++, data++);
@@ -432,7 +560,7 @@ mx_write_word(uint32_t addr, uint16_t data)
     data_output(data);
     data_output_enable();
 
-    timer_delay_ticks(ticks_per_60_nsec);  // tAH=60ns tDS=60ns
+    mx_delay_ticks(ticks_per_60_nsec);  // tAH=60ns tDS=60ns
     ce_output(1);
     data_output_disable(); // tDH=0ns
 }
@@ -446,7 +574,7 @@ void
 mx_cmd(uint32_t addr, uint16_t cmd, int vpp_delay)
 {
     vpp_enable();
-    timer_delay_usec(2);  // Wait 2us after enabling VPP=VHH (10V)
+    vpp_settle();
     usb_mask_interrupts();
     mx_last_access = timer_tick_get();
 
@@ -454,13 +582,13 @@ mx_cmd(uint32_t addr, uint16_t cmd, int vpp_delay)
     mx_write_word(0x02aaa, 0x0055);
     mx_write_word(addr, cmd);
 
-    timer_delay_usec(2);   // Wait 2us before disabling VPP=VHH (10V)
+    mx_delay_usec(2);      // Wait 2us before disabling VPP=VHH (10V)
     vpp_disable();
     usb_unmask_interrupts();
-    timer_delay_usec(2);   // Wait for command to complete
+    mx_delay_usec(2);      // Wait for command to complete
 
     if (vpp_delay)
-        timer_delay_usec(100); // Wait for command to complete
+        mx_delay_usec(100);    // Wait for command to complete
 }
 
 /*
@@ -471,6 +599,103 @@ mx_status_clear(void)
 {
     mx_cmd(0x05555, 0x0050, 0);
     mx_read_mode();
+    mx_retry_pages = 0;
+    mx_retry_words = 0;
+    mx_retry_bits  = 0;
+    memset(&mx_lines, 0, sizeof (mx_lines));
+}
+
+/*
+ * mx_retry_stats() returns page read-back retry statistics accumulated by
+ *                  mx_write() since the last mx_status_clear().
+ *
+ * @param [out] words - Number of words which were reprogrammed.
+ * @param [out] bits  - Data bits which were found still 1 on read-back.
+ *
+ * @return      Number of pages which required reprogramming.
+ */
+uint
+mx_retry_stats(uint *words, uint16_t *bits)
+{
+    *words = mx_retry_words;
+    *bits  = mx_retry_bits;
+    return (mx_retry_pages);
+}
+
+/*
+ * mx_line_stats() returns per data and address line read-back mismatch
+ *                 statistics accumulated by mx_write() since the last
+ *                 mx_status_clear().
+ */
+const mx_line_stats_t *
+mx_line_stats(void)
+{
+    return (&mx_lines);
+}
+
+/*
+ * bits_set_below() returns the count of values in [0, limit) which have
+ *                  the specified bit set.
+ */
+static uint32_t
+bits_set_below(uint32_t limit, uint bit)
+{
+    uint32_t period = BIT(bit + 1);
+    uint32_t rem    = limit & (period - 1);
+
+    return ((limit >> (bit + 1)) << bit) +
+           ((rem > BIT(bit)) ? rem - BIT(bit) : 0);
+}
+
+/*
+ * mx_line_stats_add() accumulates read-back compare statistics per data
+ *                     and address line for a range of words. It is used
+ *                     by mx_write() and by prom_pattern() checks.
+ *
+ * @param [in]  addr     - EEPROM word address of the first word.
+ * @param [in]  expected - Data which was programmed.
+ * @param [in]  actual   - Data which was read back, or NULL if all words
+ *                         are already known to match.
+ * @param [in]  count    - Number of words compared.
+ *
+ * @return      None.
+ */
+void
+mx_line_stats_add(uint32_t addr, const uint16_t *expected,
+                  const uint16_t *actual, uint count)
+{
+    uint pos;
+    uint bit;
+
+    mx_lines.words += count;
+    for (bit = 0; bit < MX_ADDR_LINES; bit++) {
+        mx_lines.a_one[bit] += bits_set_below(addr + count, bit) -
+                               bits_set_below(addr, bit);
+    }
+
+    if (actual == NULL)
+        return;
+
+    for (pos = 0; pos < count; pos++) {
+        uint16_t stuck0 = expected[pos] & ~actual[pos];
+        uint16_t stuck1 = actual[pos] & ~expected[pos];
+
+        if ((stuck0 | stuck1) == 0)
+            continue;
+        mx_lines.bad++;
+        for (bit = 0; bit < MX_DQ_LINES; bit++) {
+            if (stuck0 & BIT(bit))
+                mx_lines.dq_stuck0[bit]++;
+            if (stuck1 & BIT(bit))
+                mx_lines.dq_stuck1[bit]++;
+        }
+        for (bit = 0; bit < MX_ADDR_LINES; bit++) {
+            if ((addr + pos) & BIT(bit))
+                mx_lines.a_stuck0[bit]++;
+            else
+                mx_lines.a_stuck1[bit]++;
+        }
+    }
 }
 
 /*
@@ -519,6 +744,7 @@ mx_wait_for_done_status(uint32_t timeout_usec, int verbose, int mode)
             break;  // done
         }
     }
+    crashlog_timing(mode == MX_MODE_ERASE, usecs);
     if (status & (MX_STATUS_FAIL_PROGRAM | MX_STATUS_FAIL_ERASE)) {
         printf("    %s failed %02x\n",
                (mode == MX_MODE_ERASE) ? "Erase" : "Program", status);
@@ -554,14 +780,19 @@ mx_wait_for_done_status(uint32_t timeout_usec, int verbose, int mode)
  * Words may be loaded in any order, but this code always
  * loads them sequentially. Words not loaded will not be
  * written to EEPROM (will remain with 0xffff value).
+ *
+ * If current is not NULL, it holds the present content of the words
+ * being programmed, and only those words which differ are loaded. This
+ * is used to reprogram just the words which failed read-back verify.
  */
 static int
-mx_program_page(uint32_t addr, uint16_t *data, uint count, uint *words)
+mx_program_page(uint32_t addr, uint16_t *data, uint count, uint *words,
+                const uint16_t *current)
 {
     *words = 0;
 
     vpp_enable();
-    timer_delay_usec(2);  // Wait 2us after enabling VPP=VHH (10V)
+    vpp_settle();
     usb_mask_interrupts();
 
     mx_write_word(0x05555, 0x00aa);
@@ -569,7 +800,8 @@ mx_program_page(uint32_t addr, uint16_t *data, uint count, uint *words)
     mx_write_word(0x05555, 0x00a0);
 
     while (count > 0) {
-        mx_write_word(addr, *data);
+        if ((current == NULL) || (current[*words] != *data))
+            mx_write_word(addr, *data);
 
         data++;
         addr++;
@@ -578,10 +810,10 @@ mx_program_page(uint32_t addr, uint16_t *data, uint count, uint *words)
         if ((addr & (MX_PAGE_SIZE - 1)) == 0)
             break; // End of page
     }
-    timer_delay_usec(2);    // tVPH - Hold Time before disabling VPP=VHH (10V)
+    mx_delay_usec(2);       // tVPH - Hold Time before disabling VPP=VHH (10V)
     vpp_disable();
     usb_unmask_interrupts();
-    timer_delay_usec(100);  // tBAL - Word Access Load Time
+    mx_delay_usec(100);     // tBAL - Word Access Load Time
 
     return (mx_wait_for_done_status(2000000, 0, MX_MODE_PROGRAM));  // 2 sec
 }
@@ -604,12 +836,14 @@ mx_write(uint32_t addr, uint16_t *data, uint count)
 
     while (count > 0) {
         int try_count = 0;
-        if (is_abort_button_pressed()) {
+        /* Page boundary: VPP is off, so this is a safe point to stop */
+        if (is_abort_button_pressed() || input_abort_pending()) {
             printf("Aborted\n");
             return (3);
         }
+        crashlog_prom_addr(addr << 1);
+        rc = mx_program_page(addr, data, count, &words, NULL);
 try_again:
-        rc = mx_program_page(addr, data, count, &words);
         if (rc != 0) {
             printf("  Program failed at %lx\n", addr << 1);
             return (rc);  // Page program failed
@@ -624,13 +858,39 @@ try_again:
             return (2);
         }
         if (memcmp(data, wordbuf, words * 2) != 0) {
-            if (try_count++ < 2) {
-//              printf("Read verify failed -- trying again at %lx\n", addr);
+            uint16_t still_set = 0;  // Bits which should have been cleared
+            uint16_t cleared   = 0;  // Bits which should not have been cleared
+            uint     bad       = 0;
+            uint     pos;
+
+            for (pos = 0; pos < words; pos++) {
+                if (wordbuf[pos] != data[pos]) {
+                    still_set |= wordbuf[pos] & ~data[pos];
+                    cleared   |= data[pos] & ~wordbuf[pos];
+                    bad++;
+                }
+            }
+            if (try_count == 0)
+                mx_retry_pages++;
+
+            /* Programming can't set bits back to 1; only erase can */
+            if ((cleared == 0) && (try_count++ < 2)) {
+                mx_retry_words += bad;
+                mx_retry_bits  |= still_set;
+                rc = mx_program_page(addr, data, words, &words, wordbuf);
                 goto try_again;
             }
-            printf("  Read verify failed at %lx\n", addr << 1);
+            mx_line_stats_add(addr, data, wordbuf, words);  // Final read-back
+            printf("  Read verify failed at %lx: %u word%s", addr << 1,
+                   bad, (bad == 1) ? "" : "s");
+            if (still_set != 0)
+                printf(", bits %04x still 1", still_set);
+            if (cleared != 0)
+                printf(", bits %04x should not be 0", cleared);
+            printf("\n");
             return (3);
         }
+        mx_line_stats_add(addr, data, NULL, words);
         count -= words;
         addr  += words;
         data  += words;
@@ -752,9 +1012,10 @@ mx_erase(uint mode, uint32_t addr, uint32_t len, int verbose)
             rc = 1;
             break;
         }
+        crashlog_prom_addr(addr << 1);
 
         vpp_enable();
-        timer_delay_usec(2);  // Wait 2us after enabling VPP=VHH (10V)
+        vpp_settle();
         usb_mask_interrupts();
 
         mx_write_word(0x05555, 0x00aa);
@@ -861,6 +1122,40 @@ mx_poll(void)
     }
 }
 
+/*
+ * mx_capture_start() begins capture of EEPROM bus signal transitions.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+void
+mx_capture_start(void)
+{
+    mx_capture_count    = 0;
+    mx_capture_overflow = false;
+    mx_capture_active   = true;
+    mx_capture_sample();  // Initial state
+}
+
+/*
+ * mx_capture_stop() ends capture of EEPROM bus signal transitions.
+ *
+ * @param [out] count    - Number of samples captured.
+ * @param [out] overflow - Set non-zero if capture buffer filled before stop.
+ *
+ * @return      Pointer to captured samples.
+ */
+const mx_capture_t *
+mx_capture_stop(uint *count, uint *overflow)
+{
+    mx_capture_sample();  // Final state
+    mx_capture_active = false;
+    *count    = mx_capture_count;
+    *overflow = mx_capture_overflow;
+    return (mx_capture_buf);
+}
+
 static void
 mx_print_bits(uint32_t value, int high_bit, char *prefix)
 {
@@ -12,6 +12,39 @@
 #ifndef __MX29F1615_H
 #define __MX29F1615_H
 
+/* Bus capture sample (recorded on each pin transition) */
+typedef struct {
+    uint32_t tick;  // Timer tick (low 32 bits)
+    uint32_t addr;  // A19..A0
+    uint16_t data;  // D15..D0
+    uint16_t ctrl;  // MX_CAPTURE_* control signal state
+} mx_capture_t;
+
+#define MX_DEVICE_SIZE (1 << 20)  // 1M words (16-bit words)
+
+/*
+ * Read-back mismatch statistics per data and address line. A line which
+ * is stuck (or marginal) shows as one line which fails in one direction
+ * across most mismatched words. See mx_line_stats().
+ */
+#define MX_DQ_LINES    16
+#define MX_ADDR_LINES  20
+
+typedef struct {
+    uint32_t words;                     // Words compared
+    uint32_t bad;                       // Words which mismatched
+    uint32_t dq_stuck0[MX_DQ_LINES];    // Read DQn=0 where 1 expected
+    uint32_t dq_stuck1[MX_DQ_LINES];    // Read DQn=1 where 0 expected
+    uint32_t a_one[MX_ADDR_LINES];      // Words compared with An=1
+    uint32_t a_stuck0[MX_ADDR_LINES];   // Mismatched words with An=1
+    uint32_t a_stuck1[MX_ADDR_LINES];   // Mismatched words with An=0
+} mx_line_stats_t;
+
+#define MX_CAPTURE_CE  0x0001  // CE# pin level
+#define MX_CAPTURE_OE  0x0002  // OE# pin level
+#define MX_CAPTURE_VPP 0x0004  // VPP=VHH enable
+#define MX_CAPTURE_DOE 0x0008  // Data lines driven by programmer
+
 void     mx_enable(void);
 void     mx_disable(void);
 int      mx_read(uint32_t addr, uint16_t *data, uint count);
@@ -21,11 +54,17 @@ void     mx_read_mode(void);
 int      mx_erase(uint mode, uint32_t addr, uint32_t len, int verbose);
 uint16_t mx_status_read(char *status, uint status_len);
 void     mx_status_clear(void);
+uint     mx_retry_stats(uint *words, uint16_t *bits);
+const mx_line_stats_t *mx_line_stats(void);
+void     mx_line_stats_add(uint32_t addr, const uint16_t *expected,
+                           const uint16_t *actual, uint count);
 void     mx_cmd(uint32_t addr, uint16_t cmd, int vpp_delay);
 int      mx_vcc_is_on(void);
 int      mx_vpp_is_on(void);
 void     mx_poll(void);
 int      mx_verify(int verbose);
+void     mx_capture_start(void);
+const mx_capture_t *mx_capture_stop(uint *count, uint *overflow);
 
 #define MX_ERASE_MODE_CHIP   0
 #define MX_ERASE_MODE_SECTOR 1
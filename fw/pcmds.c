@@ -27,6 +27,8 @@
 #include "utils.h"
 #include "usb.h"
 #include "irq.h"
+#include "crashlog.h"
+#include "stage.h"
 
 #ifdef USE_HAL_DRIVER
 /* ST-Micro HAL Library compatibility definitions */
@@ -60,15 +62,31 @@
 const char cmd_cpu_help[] =
 "cpu regs - show CPU registers";
 
+const char cmd_crashlog_help[] =
+"crashlog       - show fault or command in progress before last reset\n"
+"crashlog clear - discard the saved crash log";
+
 const char cmd_gpio_help[] =
 "gpio [name=value/mode/?] - display or set GPIOs";
 
 const char cmd_prom_help[] =
+"prom capture <op> [<addr>] - binary bus capture of read|unlock|id|page\n"
 "prom cmd <cmd> [<addr>] - send a 16-bit command to the EEPROM chip\n"
+"prom crc <addr> <len>   - report CRC32 of EEPROM range\n"
+"prom crc list <count>   - binary CRC32 of each range in uploaded list\n"
 "prom id                 - report EEPROM chip vendor and id\n"
+"prom patt <type> <addr> <len> - program and check test pattern (erase first)\n"
+"prom patt check <type> <addr> <len> - check test pattern\n"
+"                          type: walk1 walk0 addr checker ichecker zero\n"
 "prom disable            - disable and power off EEPROM\n"
 "prom erase chip|<addr>  - erase EEPROM chip or 128K sector; <len> optional\n"
+"prom fec <op> ...       - capture, read, write, or stage write with FEC\n"
+"prom program staged     - erase, program, and verify from staged image\n"
 "prom read <addr> <len>  - read binary data from EEPROM (to terminal)\n"
+"prom read list <count>  - read binary data of ranges in uploaded list\n"
+"prom stage [status]     - show image staged in MCU flash\n"
+"prom stage erase <len>  - erase MCU flash staging area for image\n"
+"prom stage write <len>  - write binary staged image (from terminal)\n"
 "prom status [clear]     - display or clear EEPROM status\n"
 "prom verify             - verify PROM is connected\n"
 "prom vpp [<value>]      - show or set voltages (V10FBADC 0-fff around 0.54V)\n"
@@ -193,6 +211,197 @@ timer_test(void)
     return (RC_SUCCESS);
 }
 
+#define JITTER_MAX_SAMPLES 2000
+#define JITTER_BUCKETS     8
+#define JITTER_BAR_WIDTH   40
+
+typedef enum {
+    JITTER_TICK_GET,
+    JITTER_TICKS_0,
+    JITTER_TICKS_100,
+    JITTER_USEC_1,
+    JITTER_USEC_10,
+    JITTER_MSEC_1,
+    JITTER_TIMER_ISR,
+    JITTER_USB_ISR,
+} jitter_op_t;
+
+static const char * const jitter_names[] = {
+    "timer_tick_get()",
+    "timer_delay_ticks(0)",
+    "timer_delay_ticks(100)",
+    "timer_delay_usec(1)",
+    "timer_delay_usec(10)",
+    "timer_delay_msec(1)",
+    "timer ISR entry",
+    "USB ISR entry",
+};
+
+static uint32_t jitter_samples[JITTER_MAX_SAMPLES];
+
+/*
+ * jitter_sort() sorts samples in ascending order (Shell sort).
+ */
+static void
+jitter_sort(uint32_t *samples, uint count)
+{
+    uint gap;
+    uint cur;
+    uint pos;
+
+    for (gap = count / 2; gap > 0; gap /= 2) {
+        for (cur = gap; cur < count; cur++) {
+            uint32_t value = samples[cur];
+            for (pos = cur; (pos >= gap) && (samples[pos - gap] > value);
+                 pos -= gap)
+                samples[pos] = samples[pos - gap];
+            samples[pos] = value;
+        }
+    }
+}
+
+/*
+ * jitter_sample() performs a single timed run of the specified operation.
+ *
+ * @param [in]  op    - Operation to time.
+ * @param [out] ticks - Elapsed timer ticks.
+ *
+ * @return      RC_SUCCESS - Sample was taken.
+ * @return      RC_TIMEOUT - ISR did not run.
+ */
+static rc_t
+jitter_sample(jitter_op_t op, uint32_t *ticks)
+{
+    uint64_t start;
+    uint64_t end;
+    uint     spin;
+
+    start = timer_tick_get();
+    switch (op) {
+        case JITTER_TICK_GET:
+            break;
+        case JITTER_TICKS_0:
+            timer_delay_ticks(0);
+            break;
+        case JITTER_TICKS_100:
+            timer_delay_ticks(100);
+            break;
+        case JITTER_USEC_1:
+            timer_delay_usec(1);
+            break;
+        case JITTER_USEC_10:
+            timer_delay_usec(10);
+            break;
+        case JITTER_MSEC_1:
+            timer_delay_msec(1);
+            break;
+        case JITTER_TIMER_ISR:
+        case JITTER_USB_ISR:
+            isr_latency_armed = true;
+            start = timer_tick_get();
+            if (op == JITTER_TIMER_ISR)
+                timer_irq_pend();
+            else
+                (void) usb_irq_pend();
+            for (spin = 0; isr_latency_armed; spin++)
+                if (spin > 100000) {
+                    isr_latency_armed = false;
+                    return (RC_TIMEOUT);
+                }
+            *ticks = isr_latency_tick - start;
+            return (RC_SUCCESS);
+    }
+    end = timer_tick_get();
+    *ticks = end - start;
+    return (RC_SUCCESS);
+}
+
+/*
+ * jitter_report() displays min, median, 99th percentile, and max of the
+ *                 sorted samples, followed by a histogram of the range.
+ */
+static void
+jitter_report(const char *name, uint32_t *samples, uint count)
+{
+    uint32_t min = samples[0];
+    uint32_t max = samples[count - 1];
+    uint32_t width = (max - min) / JITTER_BUCKETS + 1;
+    uint     buckets[JITTER_BUCKETS];
+    uint     peak = 0;
+    uint     cur;
+
+    printf("%-24s n=%u min=%lu med=%lu p99=%lu max=%lu\n", name, count,
+           min, samples[count / 2], samples[count * 99 / 100], max);
+
+    memset(buckets, 0, sizeof (buckets));
+    for (cur = 0; cur < count; cur++)
+        buckets[(samples[cur] - min) / width]++;
+    for (cur = 0; cur < JITTER_BUCKETS; cur++)
+        if (peak < buckets[cur])
+            peak = buckets[cur];
+    for (cur = 0; cur < JITTER_BUCKETS; cur++) {
+        uint bar;
+        uint len;
+        if (buckets[cur] == 0)
+            continue;
+        len = (buckets[cur] * JITTER_BAR_WIDTH + peak - 1) / peak;
+        printf("    %8lu-%-8lu ", min + cur * width,
+               min + (cur + 1) * width - 1);
+        for (bar = 0; bar < len; bar++)
+            putchar('#');
+        printf(" %u\n", buckets[cur]);
+    }
+}
+
+/*
+ * timer_jitter() runs each delay primitive many times, and measures timer
+ *                and USB interrupt entry latency, reporting the
+ *                distribution of each in timer ticks. Running this while
+ *                the host streams USB data shows tail latency under load.
+ *
+ * @param [in]  count - Number of iterations (0 = default).
+ *
+ * @return      RC_SUCCESS - Measurement completed.
+ * @return      RC_USR_ABORT - User pressed ^C.
+ */
+static rc_t
+timer_jitter(uint count)
+{
+    jitter_op_t op;
+
+    if ((count == 0) || (count > JITTER_MAX_SAMPLES))
+        count = JITTER_MAX_SAMPLES;
+
+    printf("%lu ticks per usec\n", (uint32_t) timer_usec_to_tick(1));
+    for (op = JITTER_TICK_GET; op <= JITTER_USB_ISR; op++) {
+        uint cur;
+        uint n = count;
+
+        if ((op == JITTER_USB_ISR) && !usb_irq_pend()) {
+            printf("%-24s not measured (USB not interrupt driven)\n",
+                   jitter_names[op]);
+            continue;
+        }
+        if ((op == JITTER_MSEC_1) && (n > 500))
+            n = 500;  // Limit run time
+        for (cur = 0; cur < n; cur++) {
+            if (jitter_sample(op, &jitter_samples[cur]) != RC_SUCCESS) {
+                printf("%-24s ISR did not run\n", jitter_names[op]);
+                break;
+            }
+            if (input_break_pending()) {
+                printf("^C\n");
+                return (RC_USR_ABORT);
+            }
+        }
+        if (cur < n)
+            continue;
+        jitter_sort(jitter_samples, n);
+        jitter_report(jitter_names[op], jitter_samples, n);
+    }
+    return (RC_SUCCESS);
+}
+
 static rc_t
 timer_watch(void)
 {
@@ -240,6 +449,11 @@ cmd_time(int argc, char * const *argv)
         printf("%lld us\n", timer_tick_to_usec(time_diff));
         if (rc == RC_USER_HELP)
             rc = RC_FAILURE;
+    } else if (strncmp(argv[1], "jitter", 1) == 0) {
+        int count = 0;
+        if ((argc > 2) && ((rc = scan_int(argv[2], &count)) != RC_SUCCESS))
+            return (rc);
+        rc = timer_jitter((count < 0) ? 0 : count);
     } else if (strncmp(argv[1], "now", 1) == 0) {
         uint64_t now = timer_tick_get();
         printf("tick=0x%llx uptime=%lld usec\n", now, timer_tick_to_usec(now));
@@ -276,12 +490,88 @@ cmd_prom_vpp(int argc, char * const *argv)
     return (RC_SUCCESS);
 }
 
+static rc_t
+cmd_prom_patt(int argc, char * const *argv)
+{
+    static const char * const patt_types[] = {
+        "walk1", "walk0", "addr", "checker", "ichecker", "zero"
+    };
+    uint     flags = PROM_PATT_FLAG_PROGRAM | PROM_PATT_FLAG_CHECK;
+    uint     type;
+    uint32_t addr;
+    uint32_t len;
+    rc_t     rc;
+
+    if ((argc > 0) && (strcmp(argv[0], "check") == 0)) {
+        flags = PROM_PATT_FLAG_CHECK;
+        argc--;
+        argv++;
+    }
+    if (argc != 3) {
+        printf("error: prom patt [check] <type> <addr> <len>\n");
+        return (RC_USER_HELP);
+    }
+    for (type = 0; type < ARRAY_SIZE(patt_types); type++)
+        if (strcmp(argv[0], patt_types[type]) == 0)
+            break;
+    if (type >= ARRAY_SIZE(patt_types)) {
+        printf("error: unknown pattern %s\n", argv[0]);
+        return (RC_USER_HELP);
+    }
+    if (((rc = parse_value(argv[1], (uint8_t *) &addr, 4)) != RC_SUCCESS) ||
+        ((rc = parse_value(argv[2], (uint8_t *) &len, 4)) != RC_SUCCESS))
+        return (rc);
+
+    rc = prom_pattern(type, addr, len, flags);
+    if (rc != RC_SUCCESS)
+        printf("FAILURE %d\n", rc);
+    return (rc);
+}
+
+static rc_t
+cmd_prom_stage(int argc, char * const *argv, bool fec)
+{
+    rc_t     rc;
+    uint32_t len = 0;
+
+    if ((argc < 1) || (strcmp(argv[0], "status") == 0))
+        return (stage_show());
+
+    if (argc > 1) {
+        rc = parse_value(argv[1], (uint8_t *) &len, 4);
+        if (rc != RC_SUCCESS)
+            return (rc);
+    }
+    if ((*argv[0] == 'e') && (strstr("erase", argv[0]) != NULL)) {
+        if (argc > 2) {
+            printf("error: prom stage erase allows optional <len>\n");
+            return (RC_USER_HELP);
+        }
+        rc = stage_erase(len);
+    } else if ((*argv[0] == 'w') && (strstr("write", argv[0]) != NULL)) {
+        if (argc != 2) {
+            printf("error: prom stage write requires <len>\n");
+            return (RC_USER_HELP);
+        }
+        rc = prom_stage_write_binary(len, fec);
+    } else {
+        printf("error: unknown prom stage operation %s\n", argv[0]);
+        return (RC_USER_HELP);
+    }
+    if (rc != RC_SUCCESS)
+        printf("FAILURE %d\n", rc);
+    return (rc);
+}
+
 rc_t
 cmd_prom(int argc, char * const *argv)
 {
     enum {
         OP_NONE,
         OP_READ,
+        OP_READ_LIST,
+        OP_CRC,
+        OP_CRC_LIST,
         OP_WRITE,
         OP_ERASE_CHIP,
         OP_ERASE_SECTOR,
@@ -291,6 +581,7 @@ cmd_prom(int argc, char * const *argv)
     const char *cmd_prom = "prom";
     uint32_t    addr = 0;
     uint32_t    len = 0;
+    bool        fec = false;
 
     while (*arg != '\0') {
         if (*arg != *cmd_prom)
@@ -307,6 +598,18 @@ cmd_prom(int argc, char * const *argv)
         }
         arg = argv[0];
     }
+    if (strcmp(arg, "fec") == 0) {
+        /* Binary transfer which follows includes FEC parity */
+        fec = true;
+        argv++;
+        argc--;
+        if (argc < 1) {
+            printf("error: prom fec requires capture, read, write, or "
+                   "stage\n");
+            return (RC_USER_HELP);
+        }
+        arg = argv[0];
+    }
     if ((strncmp(arg, "erase", 2) == 0) && (strstr(arg, "erase") != NULL)) {
         if (argc < 2) {
             printf("error: prom erase requires either chip or "
@@ -320,6 +623,29 @@ cmd_prom(int argc, char * const *argv)
         } else {
             op_mode = OP_ERASE_SECTOR;
         }
+    } else if ((strncmp(arg, "capture", 2) == 0) &&
+               (strstr("capture", arg) != NULL)) {
+        static const char * const capture_ops[] = {
+            "read", "unlock", "id", "page"
+        };
+        uint op;
+        if ((argc < 2) || (argc > 3)) {
+            printf("error: prom capture <op> [<addr>]\n");
+            return (RC_USER_HELP);
+        }
+        for (op = 0; op < ARRAY_SIZE(capture_ops); op++)
+            if (strcmp(argv[1], capture_ops[op]) == 0)
+                break;
+        if (op >= ARRAY_SIZE(capture_ops)) {
+            printf("error: unknown capture operation %s\n", argv[1]);
+            return (RC_USER_HELP);
+        }
+        if (argc == 3) {
+            rc = parse_value(argv[2], (uint8_t *) &addr, 4);
+            if (rc != RC_SUCCESS)
+                return (rc);
+        }
+        return (prom_capture(op, addr, fec));
     } else if ((*arg == 'c') && (strstr("cmd", arg) != NULL)) {
         uint16_t cmd;
         if ((argc < 2) || (argc > 3)) {
@@ -340,6 +666,13 @@ cmd_prom(int argc, char * const *argv)
 
         prom_cmd(addr, cmd);
         return (RC_SUCCESS);
+    } else if ((*arg == 'c') && (strstr("crc", arg) != NULL)) {
+        op_mode = OP_CRC;
+        if ((argc > 1) && (strcmp(argv[1], "list") == 0)) {
+            op_mode = OP_CRC_LIST;
+            argc--;
+            argv++;
+        }
     } else if ((*arg == 'd') && (strstr("disable", arg) != NULL)) {
         prom_disable();
         return (RC_SUCCESS);
@@ -348,6 +681,24 @@ cmd_prom(int argc, char * const *argv)
         return (RC_SUCCESS);
     } else if ((*arg == 'r') && (strstr("read", arg) != NULL)) {
         op_mode = OP_READ;
+        if ((argc > 1) && (strcmp(argv[1], "list") == 0)) {
+            op_mode = OP_READ_LIST;
+            argc--;
+            argv++;
+        }
+    } else if (strcmp(arg, "patt") == 0) {
+        return (cmd_prom_patt(argc - 1, argv + 1));
+    } else if ((*arg == 'p') && (strstr("program", arg) != NULL)) {
+        if ((argc != 2) || (strcmp(argv[1], "staged") != 0)) {
+            printf("error: prom program requires staged\n");
+            return (RC_USER_HELP);
+        }
+        rc = stage_program();
+        if (rc != RC_SUCCESS)
+            printf("FAILURE %d\n", rc);
+        return (rc);
+    } else if (strcmp(arg, "stage") == 0) {
+        return (cmd_prom_stage(argc - 1, argv + 1, fec));
     } else if ((*arg == 's') && (strstr("status", arg) != NULL)) {
         if ((argc > 1) &&
             (*argv[1] == 'c') && (strstr("clear", argv[1]) != NULL))
@@ -387,14 +738,39 @@ cmd_prom(int argc, char * const *argv)
                 printf("error: prom %s requires <addr> and <len>\n", arg);
                 return (RC_USER_HELP);
             }
-            rc = prom_read_binary(addr, len);
+            rc = prom_read_binary(addr, len, fec);
+            break;
+        case OP_READ_LIST:
+            if (argc != 2) {
+                printf("error: prom %s list requires <count>\n", arg);
+                return (RC_USER_HELP);
+            }
+            rc = prom_read_binary_list(addr, fec);
+            break;
+        case OP_CRC: {
+            uint32_t crc;
+            if (argc != 3) {
+                printf("error: prom %s requires <addr> and <len>\n", arg);
+                return (RC_USER_HELP);
+            }
+            rc = prom_crc(addr, len, &crc);
+            if (rc == RC_SUCCESS)
+                printf("%08lx\n", crc);
+            break;
+        }
+        case OP_CRC_LIST:
+            if (argc != 2) {
+                printf("error: prom %s list requires <count>\n", arg);
+                return (RC_USER_HELP);
+            }
+            rc = prom_crc_binary_list(addr);
             break;
         case OP_WRITE:
             if (argc != 3) {
                 printf("error: prom %s requires <addr> and <len>\n", arg);
                 return (RC_USER_HELP);
             }
-            rc = prom_write_binary(addr, len);
+            rc = prom_write_binary(addr, len, fec);
             break;
         case OP_ERASE_CHIP:
             printf("Chip erase\n");
@@ -444,9 +820,26 @@ cmd_map(int argc, char * const *argv)
     return (RC_SUCCESS);
 }
 
+rc_t
+cmd_crashlog(int argc, char * const *argv)
+{
+    if (argc < 2) {
+        if (crashlog_show())
+            return (RC_NO_DATA);
+        return (RC_SUCCESS);
+    } else if (strcmp(argv[1], "clear") == 0) {
+        crashlog_clear();
+        return (RC_SUCCESS);
+    } else {
+        printf("Unknown argument %s\n", argv[1]);
+        return (RC_USER_HELP);
+    }
+}
+
 rc_t
 cmd_reset(int argc, char * const *argv)
 {
+    crashlog_cmd(NULL);  // Requested reset is not a crash
     if (argc < 2) {
         printf("Resetting...\n");
         uart_flush();
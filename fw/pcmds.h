@@ -15,6 +15,7 @@
 #define HAVE_SPACE_PROM
 
 rc_t cmd_cpu(int argc, char * const *argv);
+rc_t cmd_crashlog(int argc, char * const *argv);
 rc_t cmd_gpio(int argc, char * const *argv);
 rc_t cmd_map(int argc, char * const *argv);
 rc_t cmd_prom(int argc, char * const *argv);
@@ -22,6 +23,7 @@ rc_t cmd_reset(int argc, char * const *argv);
 rc_t cmd_usb(int argc, char * const *argv);
 
 extern const char cmd_cpu_help[];
+extern const char cmd_crashlog_help[];
 extern const char cmd_gpio_help[];
 extern const char cmd_prom_help[];
 extern const char cmd_reset_help[];
@@ -11,15 +11,22 @@
 
 #include "main.h"
 #include "cmdline.h"
+#include <stdbool.h>
 #include "prom_access.h"
 #include "mx29f1615.h"
 #include "printf.h"
 #include "uart.h"
-#include <stdbool.h>
 #include "timer.h"
 #include "crc32.h"
+#include "fec.h"
+#include "stage.h"
+#include <string.h>
 
 #define DATA_CRC_INTERVAL 256
+#define LINE_SUSPECT_MIN  4    // Mismatched words before blaming a line
+#define PATT_PAGE_WORDS   64   // EEPROM page program size (words)
+
+static uint prom_fec_fixed;  // Bytes corrected by FEC in the last write
 
 rc_t
 prom_read(uint32_t addr, uint width, void *bufp)
@@ -113,12 +120,112 @@ prom_id(void)
     printf("%08lx\n", mx_id());
 }
 
+/*
+ * line_suspect() determines whether a line's mismatches indicate it is
+ *                stuck: nearly all mismatched words fail on that line in
+ *                the same direction.
+ *
+ * @param [in]  n0  - Mismatched words which read 0 (or had An=1).
+ * @param [in]  n1  - Mismatched words which read 1 (or had An=0).
+ * @param [in]  bad - Total mismatched words.
+ *
+ * @return      0 - Line appears stuck at 0.
+ * @return      1 - Line appears stuck at 1.
+ * @return      -1 - Line does not appear stuck.
+ */
+static int
+line_suspect(uint32_t n0, uint32_t n1, uint32_t bad)
+{
+    if (bad < LINE_SUSPECT_MIN)
+        return (-1);
+    if ((n0 * 10 >= bad * 9) && (n1 * 10 <= n0))
+        return (0);
+    if ((n1 * 10 >= bad * 9) && (n0 * 10 <= n1))
+        return (1);
+    return (-1);
+}
+
+/*
+ * prom_line_stats_show() reports read-back mismatches per data line, and
+ *                        data or address lines which appear stuck.
+ *
+ * An address line stuck at 0 causes mismatches only in words with An=1
+ * (which read their An=0 alias), and most of those words will mismatch.
+ * A range of bad words shares its high address bits, so an address line
+ * is only suspect if a large fraction of the words compared on that side
+ * failed.
+ */
+static void
+prom_line_stats_show(void)
+{
+    const mx_line_stats_t *ls = mx_line_stats();
+    uint  bit;
+    uint  suspects = 0;
+
+    if (ls->bad == 0)
+        return;
+    printf("Line errors in %lu of %lu words (stuck-0/stuck-1):",
+           ls->bad, ls->words);
+    for (bit = 0; bit < MX_DQ_LINES; bit++)
+        if ((ls->dq_stuck0[bit] != 0) || (ls->dq_stuck1[bit] != 0))
+            printf(" DQ%u %lu/%lu", bit, ls->dq_stuck0[bit],
+                   ls->dq_stuck1[bit]);
+    printf("\n");
+
+    for (bit = 0; bit < MX_DQ_LINES; bit++) {
+        int stuck = line_suspect(ls->dq_stuck0[bit], ls->dq_stuck1[bit],
+                                 ls->bad);
+        if (stuck >= 0)
+            printf("%s DQ%u stuck-%d", suspects++ ? "," : "Suspect", bit,
+                   stuck);
+    }
+    for (bit = 0; bit < MX_ADDR_LINES; bit++) {
+        uint32_t one  = ls->a_one[bit];
+        uint32_t zero = ls->words - one;
+        uint32_t n0   = ls->a_stuck0[bit];
+        uint32_t n1   = ls->a_stuck1[bit];
+        int      stuck = line_suspect(n0, n1, ls->bad);
+
+        /*
+         * The failing side must have mostly failed, and the other side
+         * must have been compared and failed at a far lower rate.
+         */
+        if ((stuck == 0) && ((zero == 0) || (n0 * 4 < one) ||
+                             ((uint64_t) n1 * one * 10 > (uint64_t) n0 * zero)))
+            stuck = -1;
+        if ((stuck == 1) && ((one == 0) || (n1 * 4 < zero) ||
+                             ((uint64_t) n0 * zero * 10 > (uint64_t) n1 * one)))
+            stuck = -1;
+        if (stuck >= 0)
+            printf("%s A%u stuck-%d", suspects++ ? "," : "Suspect", bit,
+                   stuck);
+    }
+    if (suspects != 0)
+        printf("\n");
+}
+
 void
 prom_status(void)
 {
-    char status[64];
+    char     status[64];
+    uint     pages;
+    uint     words;
+    uint16_t bits;
+
     mx_enable();
     printf("%04x %s\n", mx_status_read(status, sizeof (status)), status);
+
+    pages = mx_retry_stats(&words, &bits);
+    if (pages != 0) {
+        printf("Reprogrammed %u word%s in %u page%s (bits %04x still 1)\n",
+               words, (words == 1) ? "" : "s",
+               pages, (pages == 1) ? "" : "s", bits);
+    }
+    prom_line_stats_show();
+    if (prom_fec_fixed != 0) {
+        printf("FEC corrected %u byte%s received from host\n",
+               prom_fec_fixed, (prom_fec_fixed == 1) ? "" : "s");
+    }
 }
 
 void
@@ -126,6 +233,7 @@ prom_status_clear(void)
 {
     mx_enable();
     mx_status_clear();
+    prom_fec_fixed = 0;
 }
 
 static int
@@ -135,12 +243,37 @@ getchar_wait(uint pos)
     uint64_t timeout = timer_tick_plus_msec(200);
 
     while ((ch = getchar()) == -1)
-        if (timer_tick_has_elapsed(timeout))
+        if (timer_tick_has_elapsed(timeout) || input_abort_pending())
             break;
 
     return (ch);
 }
 
+/*
+ * prom_resync() discards host input following a failed or aborted binary
+ *               transfer, and then sends PROM_SYNC_TOKEN so the host knows
+ *               that no stale data remains in flight. Input is discarded
+ *               until it has been idle for PROM_RESYNC_IDLE msec. A host
+ *               which never stops sending is given at most 2 seconds.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+static void
+prom_resync(void)
+{
+    uint64_t limit = timer_tick_plus_msec(2000);
+    uint64_t idle  = timer_tick_plus_msec(PROM_RESYNC_IDLE);
+
+    while (!timer_tick_has_elapsed(idle) && !timer_tick_has_elapsed(limit))
+        if (getchar() != -1)
+            idle = timer_tick_plus_msec(PROM_RESYNC_IDLE);  // Discard input
+
+    input_abort_clear();
+    (void) puts_binary(PROM_SYNC_TOKEN, sizeof (PROM_SYNC_TOKEN) - 1);
+}
+
 static int
 check_crc(uint32_t crc, uint spos, uint epos, bool send_rc)
 {
@@ -180,107 +313,405 @@ check_rc(uint pos)
     return (RC_SUCCESS);
 }
 
+/* Extent list uploaded by the host for scatter-gather operations */
+static prom_extent_t prom_extent[PROM_EXTENT_MAX];
+
+typedef rc_t (*binary_read_t)(uint32_t addr, uint len, void *buf);
+typedef rc_t (*binary_write_t)(uint32_t addr, uint len, void *buf);
+
 /*
- * prom_read_binary() reads data from an EEPROM and writes it to the host.
- *                    Every 256 bytes, a rolling CRC value is expected back
- *                    from the host.
+ * sram_read() is a binary_read_t function which copies from CPU memory.
  */
-rc_t
-prom_read_binary(uint32_t addr, uint32_t len)
+static rc_t
+sram_read(uint32_t addr, uint len, void *buf)
 {
-    rc_t     rc;
-    uint8_t  buf[256];
+    memcpy(buf, (void *) (uintptr_t) addr, len);
+    return (RC_SUCCESS);
+}
+
+/*
+ * binary_send_extents() reads data from one or more ranges and writes it
+ *                       to the host as a single framed stream. Ranges are
+ *                       sent back to back, so a 256-byte CRC block may
+ *                       span multiple ranges. Every 256 bytes, a rolling
+ *                       CRC value is expected back from the host.
+ *                       With FEC, each CRC is followed by FEC_PARITY_LEN
+ *                       bytes of parity covering the block and its CRC.
+ *
+ * @param [in]  ext   - Array of ranges to read.
+ * @param [in]  count - Number of ranges in the array.
+ * @param [in]  read  - Function which reads a range (EEPROM or SRAM).
+ * @param [in]  fec   - Send forward error correction parity.
+ *
+ * @return      RC_SUCCESS - All ranges were successfully sent.
+ * @return      RC_TIMEOUT - Timeout sending data.
+ * @return      RC_FAILURE - Host reported CRC mismatch.
+ * @return      RC_USR_ABORT - Host requested abort.
+ */
+static rc_t
+binary_send_extents(const prom_extent_t *ext, uint count, binary_read_t read,
+                    bool fec)
+{
+    rc_t     rc = RC_SUCCESS;
+    uint8_t  buf[DATA_CRC_INTERVAL + sizeof (uint32_t)];  // Data and CRC
+    uint8_t  parity[FEC_PARITY_LEN];
     uint32_t crc = 0;
-    uint     crc_next = DATA_CRC_INTERVAL;
     uint32_t cap_pos[4];
     uint     cap_count = 0;
     uint     cap_prod  = 0;  // producer
     uint     cap_cons  = 0;  // consumer
     uint     pos = 0;
+    uint32_t addr;
+    uint32_t len;
+    const prom_extent_t *ext_end = ext + count;
+
+    if (count == 0)
+        return (RC_SUCCESS);
+
+    addr = ext->addr;
+    len  = ext->len;
 
     mx_enable();
-    while (len > 0) {
-        uint32_t tlen = sizeof (buf);
-        if (tlen > len)
-            tlen = len;
-        if (tlen > crc_next)
-            tlen = crc_next;
-        rc = prom_read(addr, tlen, buf);
+    while (1) {
+        uint32_t tlen = 0;
+
+        /* Gather the next CRC block, which may span multiple ranges */
+        while (tlen < DATA_CRC_INTERVAL) {
+            uint32_t clen;
+            if (len == 0) {
+                if (++ext >= ext_end)
+                    break;
+                addr = ext->addr;
+                len  = ext->len;
+                continue;
+            }
+            clen = DATA_CRC_INTERVAL - tlen;
+            if (clen > len)
+                clen = len;
+            if (rc == RC_SUCCESS)
+                rc = read(addr, clen, buf + tlen);
+            addr += clen;
+            len  -= clen;
+            tlen += clen;
+        }
+        if (tlen == 0)
+            break;  // All ranges sent
+
+        if (input_abort_pending())
+            rc = RC_USR_ABORT;
         if (puts_binary(&rc, 1)) {
-            printf("Status send timeout at %lx\n", addr + pos);
-            return (RC_TIMEOUT);
+            printf("Status send timeout at %x\n", pos);
+            rc = RC_TIMEOUT;
+            goto fail;
         }
         if (rc != RC_SUCCESS)
-            return (rc);
+            goto fail;
         if (puts_binary(buf, tlen)) {
-            printf("Data send timeout at %lx\n", addr + pos);
-            return (RC_TIMEOUT);
+            printf("Data send timeout at %x\n", pos);
+            rc = RC_TIMEOUT;
+            goto fail;
         }
 
-        crc = crc32(crc, buf, tlen);
-        crc_next -= tlen;
-        addr     += tlen;
-        len      -= tlen;
-        pos      += tlen;
+        crc  = crc32(crc, buf, tlen);
+        pos += tlen;
 
         if (cap_count >= ARRAY_SIZE(cap_pos)) {
             /* Verify received RC */
             cap_count--;
-            if (check_rc(cap_pos[cap_cons]))
-                return (RC_FAILURE);
+            if (check_rc(cap_pos[cap_cons])) {
+                rc = RC_FAILURE;
+                goto fail;
+            }
             if (++cap_cons >= ARRAY_SIZE(cap_pos))
                 cap_cons = 0;
         }
 
-        if (crc_next == 0) {
-            /* Send and record the current CRC value */
-            if (puts_binary(&crc, sizeof (crc))) {
-                printf("Data send CRC timeout at %lx\n", addr + pos);
-                return (RC_TIMEOUT);
+        /* Send and record the current CRC value */
+        if (puts_binary(&crc, sizeof (crc))) {
+            printf("Data send CRC timeout at %x\n", pos);
+            rc = RC_TIMEOUT;
+            goto fail;
+        }
+        if (fec) {
+            memcpy(buf + tlen, &crc, sizeof (crc));
+            fec_encode(buf, tlen + sizeof (crc), parity);
+            if (puts_binary(parity, sizeof (parity))) {
+                printf("Data send FEC timeout at %x\n", pos);
+                rc = RC_TIMEOUT;
+                goto fail;
             }
-            cap_pos[cap_prod] = pos;
-            if (++cap_prod >= ARRAY_SIZE(cap_pos))
-                cap_prod = 0;
-            cap_count++;
-            crc_next = DATA_CRC_INTERVAL;
         }
-    }
-    if (crc_next != DATA_CRC_INTERVAL) {
-        /* Send CRC for last partial segment */
-        if (puts_binary(&crc, sizeof (crc)))
-            return (RC_TIMEOUT);
+        cap_pos[cap_prod] = pos;
+        if (++cap_prod >= ARRAY_SIZE(cap_pos))
+            cap_prod = 0;
+        cap_count++;
     }
 
     /* Verify trailing CRC packets */
-    cap_prod += ARRAY_SIZE(cap_pos) - cap_count;
-    if (cap_prod >= ARRAY_SIZE(cap_pos))
-        cap_prod -= ARRAY_SIZE(cap_pos);
-
     while (cap_count-- > 0) {
-        if (check_rc(cap_pos[cap_cons]))
-            return (1);
+        if (check_rc(cap_pos[cap_cons])) {
+            rc = RC_FAILURE;
+            goto fail;
+        }
         if (++cap_cons >= ARRAY_SIZE(cap_pos))
             cap_cons = 0;
     }
+    return (RC_SUCCESS);
 
-    if (crc_next != DATA_CRC_INTERVAL) {
-        /* Verify CRC for last partial segment */
-        if (check_rc(pos))
+fail:
+    prom_resync();
+    return (rc);
+}
+
+/*
+ * prom_read_binary() reads data from an EEPROM and writes it to the host.
+ *                    Every 256 bytes, a rolling CRC value is expected back
+ *                    from the host. If fec is set, FEC parity is also sent.
+ */
+rc_t
+prom_read_binary(uint32_t addr, uint32_t len, bool fec)
+{
+    prom_extent_t ext;
+
+    ext.addr = addr;
+    ext.len  = len;
+    return (binary_send_extents(&ext, 1, prom_read, fec));
+}
+
+/*
+ * sram_send_binary() sends a CPU memory buffer to the host using the same
+ *                    framed CRC protocol as prom_read_binary().
+ */
+static rc_t
+sram_send_binary(const void *buf, uint32_t len, bool fec)
+{
+    prom_extent_t ext;
+
+    ext.addr = (uintptr_t) buf;
+    ext.len  = len;
+    return (binary_send_extents(&ext, 1, sram_read, fec));
+}
+
+/*
+ * prom_extent_receive() receives a binary extent list from the host.
+ *                       The list is <count> pairs of 32-bit little endian
+ *                       <addr> <len> values, followed by a 32-bit CRC of
+ *                       the list. A status byte is sent back to the host
+ *                       to indicate whether the list was accepted.
+ *
+ * @param [in]  count - Number of extents to receive.
+ *
+ * @return      RC_SUCCESS   - List received and stored in prom_extent[].
+ * @return      RC_BAD_PARAM - Invalid count, or a range is outside EEPROM.
+ * @return      RC_TIMEOUT   - Timeout receiving list.
+ * @return      RC_FAILURE   - CRC mismatch.
+ */
+static rc_t
+prom_extent_receive(uint count)
+{
+    uint8_t *ptr = (uint8_t *) prom_extent;
+    uint     len = count * sizeof (prom_extent[0]);
+    uint     pos;
+    int      ch;
+    rc_t     rc = RC_SUCCESS;
+
+    if ((count == 0) || (count > ARRAY_SIZE(prom_extent))) {
+        printf("Extent count %u must be 1 to %d\n",
+               count, ARRAY_SIZE(prom_extent));
+        return (RC_BAD_PARAM);
+    }
+
+    for (pos = 0; pos < len; pos++) {
+        ch = getchar_wait(200);
+        if (ch == -1) {
+            rc = RC_TIMEOUT;
+            break;
+        }
+        ptr[pos] = ch;
+    }
+    if ((rc == RC_SUCCESS) &&
+        check_crc(crc32(0, prom_extent, len), 0, len, false))
+        rc = RC_FAILURE;
+
+    for (pos = 0; (rc == RC_SUCCESS) && (pos < count); pos++) {
+        const prom_extent_t *ext = &prom_extent[pos];
+
+        if ((ext->addr > MX_DEVICE_SIZE * 2) ||
+            (ext->len > MX_DEVICE_SIZE * 2 - ext->addr)) {
+            printf("Extent %lx+%lx is outside EEPROM\n", ext->addr, ext->len);
+            rc = RC_BAD_PARAM;
+        }
+    }
+
+    (void) puts_binary(&rc, 1);
+    if (rc != RC_SUCCESS)
+        prom_resync();
+    return (rc);
+}
+
+/*
+ * prom_read_binary_list() receives an extent list from the host and then
+ *                         sends the contents of all listed EEPROM ranges
+ *                         in a single framed transfer.
+ *
+ * @param [in]  count - Number of extents the host will provide.
+ * @param [in]  fec   - Send forward error correction parity.
+ */
+rc_t
+prom_read_binary_list(uint count, bool fec)
+{
+    rc_t rc = prom_extent_receive(count);
+    if (rc != RC_SUCCESS)
+        return (rc);
+    return (binary_send_extents(prom_extent, count, prom_read, fec));
+}
+
+/*
+ * prom_crc() computes the CRC32 of the specified EEPROM range.
+ *
+ * @param [in]  addr - EEPROM starting byte address.
+ * @param [in]  len  - Length in bytes.
+ * @param [out] crc  - Computed CRC value.
+ *
+ * @return      RC_SUCCESS - CRC computed.
+ * @return      RC_FAILURE - EEPROM read failure.
+ */
+rc_t
+prom_crc(uint32_t addr, uint32_t len, uint32_t *crc)
+{
+    uint8_t buf[DATA_CRC_INTERVAL];
+
+    *crc = 0;
+    while (len > 0) {
+        uint32_t tlen = sizeof (buf);
+        if (tlen > len)
+            tlen = len;
+        if (prom_read(addr, tlen, buf) != RC_SUCCESS)
             return (RC_FAILURE);
+        *crc  = crc32(*crc, buf, tlen);
+        addr += tlen;
+        len  -= tlen;
     }
     return (RC_SUCCESS);
 }
 
 /*
- * prom_write_binary() takes binary input from an application via the serial
- *                     console and writes that to the EEPROM. Every 256 bytes,
- *                     a rolling 8-bit CRC value is sent back to the host.
- *                     This is so the host knows that the data was received
- *                     correctly. Incorrectly received data will still be
- *                     written to the EEPROM.
+ * prom_crc_binary_list() receives an extent list from the host and then
+ *                        sends <status> <CRC> for each listed EEPROM range.
+ *                        This allows the host to verify many ranges with a
+ *                        single command and only 5 bytes per range.
+ *
+ * @param [in]  count - Number of extents the host will provide.
  */
 rc_t
-prom_write_binary(uint32_t addr, uint32_t len)
+prom_crc_binary_list(uint count)
+{
+    uint     cur;
+    uint32_t crc;
+    rc_t     rc = prom_extent_receive(count);
+
+    if (rc != RC_SUCCESS)
+        return (rc);
+
+    for (cur = 0; cur < count; cur++) {
+        rc = prom_crc(prom_extent[cur].addr, prom_extent[cur].len, &crc);
+        if (puts_binary(&rc, 1) || puts_binary(&crc, sizeof (crc)))
+            return (RC_TIMEOUT);
+        if (rc != RC_SUCCESS)
+            return (rc);
+    }
+    return (RC_SUCCESS);
+}
+
+/*
+ * binary_receive_fec() is binary_receive() with forward error correction.
+ *                      Each block of up to 256 bytes is followed by the
+ *                      rolling CRC and FEC_PARITY_LEN bytes of parity.
+ *                      The entire block is received and corrected before
+ *                      it is written, so that corrupted data is never
+ *                      written to the EEPROM.
+ */
+static rc_t
+binary_receive_fec(uint32_t addr, uint32_t len, binary_write_t write)
+{
+    uint8_t  buf[DATA_CRC_INTERVAL + sizeof (uint32_t) + FEC_PARITY_LEN];
+    int      ch;
+    int      fixed;
+    rc_t     rc;
+    uint32_t crc = 0;
+    uint32_t compcrc;
+
+    while (len > 0) {
+        uint32_t tlen    = len;
+        uint32_t flen;
+        uint64_t timeout = timer_tick_plus_msec(1000);
+        uint32_t pos;
+
+        if (tlen > DATA_CRC_INTERVAL)
+            tlen = DATA_CRC_INTERVAL;
+        flen = tlen + sizeof (crc) + FEC_PARITY_LEN;
+
+        for (pos = 0; pos < flen; pos++) {
+            while ((ch = getchar()) == -1) {
+                if (input_abort_pending()) {
+                    printf("Aborted at %lx\n", addr);
+                    rc = RC_USR_ABORT;
+                    goto fail;
+                }
+                if (timer_tick_has_elapsed(timeout)) {
+                    printf("Data receive timeout at %lx\n", addr);
+                    rc = RC_TIMEOUT;
+                    goto fail;
+                }
+            }
+            timeout = timer_tick_plus_msec(1000);
+            buf[pos] = ch;
+        }
+        fixed = fec_decode(buf, tlen + sizeof (crc),
+                           buf + tlen + sizeof (crc));
+        crc = crc32(crc, buf, tlen);
+        memcpy(&compcrc, buf + tlen, sizeof (compcrc));
+        if ((fixed < 0) || (crc != compcrc)) {
+            printf("Uncorrectable data at %lx-%lx\n", addr, addr + tlen);
+            rc = RC_FAILURE;
+            goto fail;
+        }
+        prom_fec_fixed += fixed;
+        rc = RC_SUCCESS;
+        if (puts_binary(&rc, 1)) {
+            rc = RC_TIMEOUT;
+            goto fail;
+        }
+        rc = write(addr, tlen, buf);
+        if (rc != RC_SUCCESS) {
+fail:
+            (void) puts_binary(&rc, 1);  // Inform remote side
+            prom_resync();
+            return (rc);
+        }
+        addr += tlen;
+        len  -= tlen;
+    }
+    return (RC_SUCCESS);
+}
+
+/*
+ * binary_receive() takes binary input from an application via the serial
+ *                  console and writes that to the EEPROM (or the image
+ *                  staging area). Every 256 bytes, a rolling 8-bit CRC
+ *                  value is sent back to the host. This is so the host
+ *                  knows that the data was received correctly. Incorrectly
+ *                  received data will still be written. On failure or host
+ *                  abort, the stream is resynchronized with prom_resync().
+ *                  If fec is set, see binary_receive_fec().
+ *
+ * @param [in]  addr  - Destination starting address.
+ * @param [in]  len   - Number of bytes to receive.
+ * @param [in]  fec   - Host sends forward error correction parity.
+ * @param [in]  write - Function which writes a received block.
+ */
+static rc_t
+binary_receive(uint32_t addr, uint32_t len, bool fec, binary_write_t write)
 {
     uint8_t  buf[128];
     int      ch;
@@ -289,7 +720,11 @@ prom_write_binary(uint32_t addr, uint32_t len)
     uint32_t saddr = addr;
     uint     crc_next = DATA_CRC_INTERVAL;
 
-    mx_enable();
+    if (fec) {
+        prom_fec_fixed = 0;
+        return (binary_receive_fec(addr, len, write));
+    }
+
     while (len > 0) {
         uint32_t tlen    = len;
         uint32_t rem     = addr & (sizeof (buf) - 1);
@@ -301,12 +736,18 @@ prom_write_binary(uint32_t addr, uint32_t len)
             tlen = sizeof (buf) - rem;
 
         for (pos = 0; pos < tlen; pos++) {
-            while ((ch = getchar()) == -1)
+            while ((ch = getchar()) == -1) {
+                if (input_abort_pending()) {
+                    printf("Aborted at %lx\n", addr + pos);
+                    rc = RC_USR_ABORT;
+                    goto fail;
+                }
                 if (timer_tick_has_elapsed(timeout)) {
                     printf("Data receive timeout at %lx\n", addr + pos);
                     rc = RC_TIMEOUT;
                     goto fail;
                 }
+            }
             timeout = timer_tick_plus_msec(1000);
             *(ptr++) = ch;
             crc = crc32(crc, ptr - 1, 1);
@@ -324,13 +765,11 @@ prom_write_binary(uint32_t addr, uint32_t len)
                 saddr = addr + pos + 1;
             }
         }
-        rc = prom_write(addr, tlen, buf);
+        rc = write(addr, tlen, buf);
         if (rc != RC_SUCCESS) {
 fail:
             (void) puts_binary(&rc, 1);  // Inform remote side
-            timeout = timer_tick_plus_msec(2000);
-            while (!timer_tick_has_elapsed(timeout))
-                (void) getchar();  // Discard input
+            prom_resync();
             return (rc);
         }
         addr += tlen;
@@ -350,6 +789,224 @@ fail:
     return (RC_SUCCESS);
 }
 
+/*
+ * prom_write_binary() receives binary data from the host and writes it to
+ *                     the EEPROM. See binary_receive().
+ */
+rc_t
+prom_write_binary(uint32_t addr, uint32_t len, bool fec)
+{
+    mx_enable();
+    return (binary_receive(addr, len, fec, prom_write));
+}
+
+/*
+ * prom_stage_write_binary() receives an image from the host and writes it
+ *                           to the staging area in MCU flash, starting at
+ *                           the beginning. See binary_receive().
+ */
+rc_t
+prom_stage_write_binary(uint32_t len, bool fec)
+{
+    return (binary_receive(0, len, fec, stage_write));
+}
+
+/*
+ * prom_capture() runs a short EEPROM bus sequence with bus capture active,
+ *                and then sends the captured pin transitions to the host.
+ *                Two framed transfers are sent: a prom_capture_hdr_t and
+ *                then <count> mx_capture_t samples.
+ *
+ * @param [in]  op   - PROM_CAPTURE_* sequence to capture.
+ * @param [in]  addr - EEPROM byte address used by the sequence.
+ * @param [in]  fec  - Send forward error correction parity.
+ *
+ * @return      RC_SUCCESS - Capture was sent to the host.
+ * @return      RC_FAILURE - Sequence or send failed.
+ */
+rc_t
+prom_capture(uint op, uint32_t addr, bool fec)
+{
+    prom_capture_hdr_t  hdr;
+    const mx_capture_t *cap;
+    uint16_t            page[64];
+    uint                count;
+    uint                overflow;
+    rc_t                rc = RC_SUCCESS;
+
+    mx_enable();
+    addr >>= 1;  // Word address
+    if (op == PROM_CAPTURE_PAGE) {
+        /* Re-program the page with its current contents (no change) */
+        addr &= ~(ARRAY_SIZE(page) - 1);
+        if (mx_read(addr, page, ARRAY_SIZE(page)))
+            return (RC_FAILURE);
+    }
+
+    mx_capture_start();
+    switch (op) {
+        case PROM_CAPTURE_READ:
+            if (mx_read(addr, page, 8))
+                rc = RC_FAILURE;
+            break;
+        case PROM_CAPTURE_UNLOCK:
+            mx_read_mode();
+            break;
+        case PROM_CAPTURE_ID:
+            (void) mx_id();
+            break;
+        case PROM_CAPTURE_PAGE:
+            if (mx_write(addr, page, ARRAY_SIZE(page)))
+                rc = RC_FAILURE;
+            break;
+    }
+    cap = mx_capture_stop(&count, &overflow);
+
+    hdr.magic   = PROM_CAPTURE_MAGIC;
+    hdr.count   = count;
+    hdr.tick_hz = timer_usec_to_tick(1000000);
+    hdr.flags   = (overflow ? PROM_CAPTURE_FLAG_OVERFLOW : 0) |
+                  ((rc != RC_SUCCESS) ? PROM_CAPTURE_FLAG_FAILED : 0);
+
+    rc = sram_send_binary(&hdr, sizeof (hdr), fec);
+    if ((rc == RC_SUCCESS) && (count > 0))
+        rc = sram_send_binary(cap, count * sizeof (*cap), fec);
+    return (rc);
+}
+
+/*
+ * prom_pattern_word() generates one word of a test pattern.
+ *
+ * @param [in]  type - PROM_PATT_* pattern.
+ * @param [in]  addr - EEPROM word address.
+ *
+ * @return      Pattern data for the word.
+ */
+static uint16_t
+prom_pattern_word(uint type, uint32_t addr)
+{
+    switch (type) {
+        default:
+        case PROM_PATT_WALK1:
+            return (1 << (addr & 15));
+        case PROM_PATT_WALK0:
+            return ((uint16_t) ~(1 << (addr & 15)));
+        case PROM_PATT_ADDR:
+            return ((uint16_t) (addr ^ (addr >> 16)));
+        case PROM_PATT_CHECKER:
+            return ((addr & 1) ? 0xaaaa : 0x5555);
+        case PROM_PATT_ICHECKER:
+            return ((addr & 1) ? 0x5555 : 0xaaaa);
+        case PROM_PATT_ZERO:
+            return (0x0000);
+    }
+}
+
+/*
+ * prom_pattern() programs and/or checks a test pattern which is generated
+ *                by the programmer, so that burn-in and socket tests run
+ *                at the EEPROM's programming speed with no host data
+ *                transfer. The range must already be erased to program.
+ *                In check-only mode, the check pass is added to the line
+ *                statistics shown by "prom status". When programming,
+ *                mx_write() has already counted the read-back.
+ *
+ * @param [in]  type  - PROM_PATT_* pattern.
+ * @param [in]  addr  - EEPROM byte address (even).
+ * @param [in]  len   - Length in bytes (even).
+ * @param [in]  flags - PROM_PATT_FLAG_PROGRAM and/or PROM_PATT_FLAG_CHECK.
+ *
+ * @return      RC_SUCCESS - Pattern programmed and/or matched.
+ * @return      RC_FAILURE - Program failed or pattern did not match.
+ * @return      RC_USR_ABORT - User aborted.
+ */
+rc_t
+prom_pattern(uint type, uint32_t addr, uint32_t len, uint flags)
+{
+    uint16_t buf[PATT_PAGE_WORDS];
+    uint32_t waddr = addr >> 1;
+    uint32_t wend  = (addr + len) >> 1;
+    uint32_t bad   = 0;
+    uint32_t cur;
+    uint64_t start;
+    uint     count;
+    uint     pos;
+
+    if ((addr | len) & 1) {
+        printf("Pattern address and length must be even\n");
+        return (RC_BAD_PARAM);
+    }
+    if ((len > MX_DEVICE_SIZE * 2) || (addr > MX_DEVICE_SIZE * 2 - len)) {
+        printf("Pattern range %lx+%lx exceeds device size %x\n",
+               addr, len, MX_DEVICE_SIZE * 2);
+        return (RC_BAD_PARAM);
+    }
+    mx_enable();
+
+    if (flags & PROM_PATT_FLAG_PROGRAM) {
+        start = timer_tick_get();
+        for (cur = waddr; cur < wend; cur += count) {
+            /* Generate up to the next page boundary */
+            count = PATT_PAGE_WORDS - (cur & (PATT_PAGE_WORDS - 1));
+            if (count > wend - cur)
+                count = wend - cur;
+            for (pos = 0; pos < count; pos++)
+                buf[pos] = prom_pattern_word(type, cur + pos);
+            if (mx_write(cur, buf, count) != 0) {
+                printf("Program failed at %lx\n", cur << 1);
+                return (RC_FAILURE);
+            }
+            if (input_break_pending()) {
+                printf("^C\n");
+                return (RC_USR_ABORT);
+            }
+        }
+        printf("Programmed %lx bytes in %lu ms\n", len,
+               (uint32_t) (timer_tick_to_usec(timer_tick_get() - start) /
+                           1000));
+    }
+
+    if (flags & PROM_PATT_FLAG_CHECK) {
+        uint16_t expected[PATT_PAGE_WORDS];
+
+        start = timer_tick_get();
+        for (cur = waddr; cur < wend; cur += count) {
+            count = PATT_PAGE_WORDS;
+            if (count > wend - cur)
+                count = wend - cur;
+            if (mx_read(cur, buf, count) != 0) {
+                printf("Read failed at %lx\n", cur << 1);
+                return (RC_FAILURE);
+            }
+            for (pos = 0; pos < count; pos++)
+                expected[pos] = prom_pattern_word(type, cur + pos);
+            if ((flags & PROM_PATT_FLAG_PROGRAM) == 0)
+                mx_line_stats_add(cur, expected, buf, count);
+            for (pos = 0; pos < count; pos++) {
+                if (buf[pos] == expected[pos])
+                    continue;
+                if (bad++ < 8) {
+                    printf("mismatch %lx: %04x expected %04x\n",
+                           (cur + pos) << 1, buf[pos], expected[pos]);
+                }
+            }
+            if (input_break_pending()) {
+                printf("^C\n");
+                return (RC_USR_ABORT);
+            }
+        }
+        printf("Checked %lx bytes in %lu ms: ", len,
+               (uint32_t) (timer_tick_to_usec(timer_tick_get() - start) /
+                           1000));
+        if (bad != 0) {
+            printf("%lu mismatched words\n", bad);
+            return (RC_FAILURE);
+        }
+        printf("pass\n");
+    }
+    return (RC_SUCCESS);
+}
+
 void
 prom_disable(void)
 {
@@ -12,11 +12,63 @@
 #ifndef _PROM_ACCESS_H
 #define _PROM_ACCESS_H
 
+#include <stdbool.h>
+
+/* Scatter-gather EEPROM range, as uploaded by the host */
+typedef struct {
+    uint32_t addr;  // EEPROM byte address
+    uint32_t len;   // Length in bytes
+} prom_extent_t;
+
+#define PROM_EXTENT_MAX 64  // Maximum ranges in one list
+
+/* Header sent before bus capture samples */
+typedef struct {
+    uint32_t magic;    // PROM_CAPTURE_MAGIC
+    uint32_t count;    // Number of mx_capture_t samples which follow
+    uint32_t tick_hz;  // Sample timer tick rate
+    uint32_t flags;    // PROM_CAPTURE_FLAG_*
+} prom_capture_hdr_t;
+
+#define PROM_CAPTURE_MAGIC         0x5043584d  // "MXCP"
+#define PROM_CAPTURE_FLAG_OVERFLOW 0x0001      // Capture buffer filled
+#define PROM_CAPTURE_FLAG_FAILED   0x0002      // Bus sequence failed
+
+#define PROM_CAPTURE_READ   0  // Read burst of 8 words
+#define PROM_CAPTURE_UNLOCK 1  // Unlock sequence and read mode command
+#define PROM_CAPTURE_ID     2  // Chip ID query
+#define PROM_CAPTURE_PAGE   3  // Page load and program
+
+/* Test patterns generated by prom_pattern(), as named in pcmds.c */
+#define PROM_PATT_WALK1     0  // One bit set, walking by word address
+#define PROM_PATT_WALK0     1  // One bit clear, walking by word address
+#define PROM_PATT_ADDR      2  // Word address (A15-A0 ^ A19-A16) in data
+#define PROM_PATT_CHECKER   3  // 5555 aaaa ...
+#define PROM_PATT_ICHECKER  4  // aaaa 5555 ...
+#define PROM_PATT_ZERO      5  // All bits programmed
+
+#define PROM_PATT_FLAG_PROGRAM 0x0001  // Program the pattern
+#define PROM_PATT_FLAG_CHECK   0x0002  // Read back and check the pattern
+
+/*
+ * Sent to the host after a failed or aborted binary transfer, once host
+ * input has been idle for PROM_RESYNC_IDLE msec. Everything the host
+ * receives after this token is command console output.
+ */
+#define PROM_SYNC_TOKEN     "\026SYNC\n"  // ASCII SYN
+#define PROM_RESYNC_IDLE    20            // msec
+
 rc_t prom_read(uint32_t addr, uint width, void *bufp);
 rc_t prom_write(uint32_t addr, uint width, void *bufp);
 rc_t prom_erase(uint mode, uint32_t addr, uint32_t len);
-rc_t prom_read_binary(uint32_t addr, uint32_t len);
-rc_t prom_write_binary(uint32_t addr, uint32_t len);
+rc_t prom_read_binary(uint32_t addr, uint32_t len, bool fec);
+rc_t prom_read_binary_list(uint count, bool fec);
+rc_t prom_crc(uint32_t addr, uint32_t len, uint32_t *crc);
+rc_t prom_crc_binary_list(uint count);
+rc_t prom_capture(uint op, uint32_t addr, bool fec);
+rc_t prom_write_binary(uint32_t addr, uint32_t len, bool fec);
+rc_t prom_stage_write_binary(uint32_t len, bool fec);
+rc_t prom_pattern(uint type, uint32_t addr, uint32_t len, uint flags);
 void prom_cmd(uint32_t addr, uint16_t cmd);
 void prom_id(void);
 void prom_disable(void);
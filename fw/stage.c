@@ -0,0 +1,412 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2020.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * EEPROM image staged in MCU flash for standalone programming.
+ *
+ * The host stages an image once with "prom stage erase" and
+ * "prom stage write". After that, "prom program staged" or a press of
+ * the abort button while idle erases, programs, and verifies the socketed
+ * EEPROM with no host involvement. The Busy LED is lit while programming,
+ * and the Alert LED is lit if programming or verify failed.
+ *
+ * Only the STM32F407 has flash to spare: the firmware is linked within
+ * the first 256K (sectors 0-5), so the 128K sectors 6-11 (768K) are used
+ * for staging. Images are run-length compressed by the host (see
+ * stage_hdr_t), so an EEPROM image larger than 768K may still fit if it
+ * has erased or padded areas. While a flash sector is being erased, the
+ * CPU stalls on instruction fetch; each sector takes one to two seconds.
+ */
+
+#include "printf.h"
+#include "board.h"
+#include "main.h"
+#include "cmdline.h"
+#include <stdbool.h>
+#include "prom_access.h"
+#include "button.h"
+#include "crashlog.h"
+#include "crc32.h"
+#include "led.h"
+#include "timer.h"
+#include "usb.h"
+#include "stage.h"
+#include <stddef.h>
+#include <string.h>
+
+#ifdef STM32F4
+#ifndef USE_HAL_DRIVER
+/* libopencm3 */
+#include <libopencm3/stm32/flash.h>
+#endif
+
+#define STAGE_BASE         0x08040000U  // Flash sector 6
+#define STAGE_SECTOR_FIRST 6
+#define STAGE_SECTOR_SIZE  (128 << 10)
+#define STAGE_SECTORS      6            // Sectors 6 through 11
+#define STAGE_SIZE         (STAGE_SECTORS * STAGE_SECTOR_SIZE)
+#else
+#define STAGE_BASE         0
+#define STAGE_SIZE         0            // No flash to spare
+#endif
+
+#define STAGE_CHUNK        128          // EEPROM program granule (bytes)
+
+/*
+ * stage_size() returns the size of the staging area in MCU flash.
+ *
+ * This function requires no arguments.
+ *
+ * @return      Size in bytes; 0 if this board does not support staging.
+ */
+uint32_t
+stage_size(void)
+{
+    return (STAGE_SIZE);
+}
+
+/*
+ * stage_unsupported() reports that staging is not available.
+ */
+static rc_t
+stage_unsupported(void)
+{
+    printf("Image staging requires STM32F407 (not enough MCU flash)\n");
+    return (RC_FAILURE);
+}
+
+/*
+ * stage_erase() erases enough of the staging area to hold an image of
+ *               the specified size. The entire area is erased if the
+ *               size is 0.
+ *
+ * @param [in]  len - Size of staged image in bytes (0 = entire area).
+ *
+ * @return      RC_SUCCESS   - Staging area erased.
+ * @return      RC_BAD_PARAM - Image does not fit.
+ * @return      RC_FAILURE   - Erase failed.
+ */
+rc_t
+stage_erase(uint32_t len)
+{
+#ifdef STM32F4
+    uint sector;
+    uint count;
+    const uint32_t *ptr;
+    const uint32_t *end;
+
+    if (len > STAGE_SIZE) {
+        printf("Image length %lx exceeds staging area %x\n", len, STAGE_SIZE);
+        return (RC_BAD_PARAM);
+    }
+    if (len == 0)
+        len = STAGE_SIZE;
+    count = (len + STAGE_SECTOR_SIZE - 1) / STAGE_SECTOR_SIZE;
+
+#ifdef USE_HAL_DRIVER
+    HAL_FLASH_Unlock();
+#else
+    flash_unlock();
+#endif
+    for (sector = STAGE_SECTOR_FIRST; sector < STAGE_SECTOR_FIRST + count;
+         sector++) {
+        usb_poll();
+#ifdef USE_HAL_DRIVER
+        FLASH_EraseInitTypeDef erase;
+        uint32_t               bad_sector;
+        erase.TypeErase    = FLASH_TYPEERASE_SECTORS;
+        erase.Sector       = sector;
+        erase.NbSectors    = 1;
+        erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+        (void) HAL_FLASHEx_Erase(&erase, &bad_sector);
+#else
+        flash_erase_sector(sector, FLASH_CR_PROGRAM_X32);
+#endif
+    }
+#ifdef USE_HAL_DRIVER
+    HAL_FLASH_Lock();
+#else
+    flash_lock();
+#endif
+
+    /* Blank check */
+    end = (const uint32_t *) (STAGE_BASE + count * STAGE_SECTOR_SIZE);
+    for (ptr = (const uint32_t *) STAGE_BASE; ptr < end; ptr++) {
+        if (*ptr != 0xffffffff) {
+            printf("Staging flash erase failed at %lx\n", (uint32_t) ptr);
+            return (RC_FAILURE);
+        }
+    }
+    return (RC_SUCCESS);
+#else
+    (void) len;
+    return (stage_unsupported());
+#endif
+}
+
+/*
+ * stage_write() is a binary receive function which programs data into the
+ *               (previously erased) staging area.
+ *
+ * @param [in]  offset - Offset in staging area.
+ * @param [in]  len    - Number of bytes to write.
+ * @param [in]  buf    - Data to write.
+ *
+ * @return      RC_SUCCESS   - Data written and verified.
+ * @return      RC_BAD_PARAM - Data does not fit in staging area.
+ * @return      RC_FAILURE   - Flash program failed.
+ */
+rc_t
+stage_write(uint32_t offset, uint len, void *buf)
+{
+#ifdef STM32F4
+    uint32_t addr = STAGE_BASE + offset;
+    uint8_t *ptr  = buf;
+    uint     pos  = 0;
+
+    if ((offset > STAGE_SIZE) || (len > STAGE_SIZE - offset))
+        return (RC_BAD_PARAM);
+
+#ifdef USE_HAL_DRIVER
+    HAL_FLASH_Unlock();
+#else
+    flash_unlock();
+#endif
+    for (pos = 0; pos < len; ) {
+        if ((((addr + pos) & 3) == 0) && (len - pos >= 4)) {
+            uint32_t word;
+            memcpy(&word, ptr + pos, sizeof (word));
+#ifdef USE_HAL_DRIVER
+            (void) HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + pos, word);
+#else
+            flash_program_word(addr + pos, word);
+#endif
+            pos += 4;
+        } else {
+#ifdef USE_HAL_DRIVER
+            (void) HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, addr + pos,
+                                     ptr[pos]);
+#else
+            flash_program_byte(addr + pos, ptr[pos]);
+#endif
+            pos++;
+        }
+    }
+#ifdef USE_HAL_DRIVER
+    HAL_FLASH_Lock();
+#else
+    flash_lock();
+#endif
+
+    if (memcmp((void *) addr, buf, len) != 0) {
+        printf("Staging flash program failed at %lx\n", addr);
+        return (RC_FAILURE);
+    }
+    return (RC_SUCCESS);
+#else
+    (void) offset;
+    (void) len;
+    (void) buf;
+    return (stage_unsupported());
+#endif
+}
+
+/*
+ * stage_header() returns the header of the staged image, after checking
+ *                that the header and records are intact.
+ *
+ * @param [in]  verbose - Report why there is no valid staged image.
+ *
+ * @return      Pointer to header; NULL if there is no valid staged image.
+ */
+static const stage_hdr_t *
+stage_header(bool verbose)
+{
+    const stage_hdr_t *hdr = (const stage_hdr_t *) STAGE_BASE;
+
+    if (STAGE_SIZE == 0) {
+        if (verbose)
+            (void) stage_unsupported();
+        return (NULL);
+    }
+    if (hdr->magic != STAGE_MAGIC) {
+        if (verbose)
+            printf("No staged image\n");
+        return (NULL);
+    }
+    if ((hdr->version != STAGE_VERSION) ||
+        (hdr->hdr_crc != crc32(0, hdr, offsetof(stage_hdr_t, hdr_crc))) ||
+        (hdr->rec_len > STAGE_SIZE - sizeof (*hdr)) ||
+        (hdr->rec_crc != crc32(0, hdr + 1, hdr->rec_len))) {
+        if (verbose)
+            printf("Staged image is corrupt\n");
+        return (NULL);
+    }
+    return (hdr);
+}
+
+/*
+ * stage_show() reports the staged image.
+ *
+ * This function requires no arguments.
+ *
+ * @return      RC_SUCCESS - A valid image is staged.
+ * @return      RC_NO_DATA - There is no valid staged image.
+ */
+rc_t
+stage_show(void)
+{
+    const stage_hdr_t *hdr = stage_header(true);
+
+    if (hdr == NULL)
+        return (RC_NO_DATA);
+    printf("Staged image: EEPROM %lx-%lx  CRC %08lx  "
+           "%lu of %u bytes used\n",
+           hdr->addr, hdr->addr + hdr->len - 1, hdr->image_crc,
+           (uint32_t) (sizeof (*hdr) + hdr->rec_len), STAGE_SIZE);
+    return (RC_SUCCESS);
+}
+
+/*
+ * stage_program_range() programs one record of the staged image.
+ *
+ * @param [in]  addr - EEPROM byte address.
+ * @param [in]  rec  - Record to program.
+ *
+ * @return      RC_SUCCESS - Range programmed.
+ * @return      RC_FAILURE - EEPROM program failed.
+ */
+static rc_t
+stage_program_range(uint32_t addr, const stage_rec_t *rec)
+{
+    uint8_t        buf[STAGE_CHUNK];
+    const uint8_t *data = (const uint8_t *) (rec + 1);
+    uint32_t       len  = rec->len;
+    uint           pos;
+
+    if (rec->flags & STAGE_REC_FILL) {
+        if (rec->fill == 0xffff)
+            return (RC_SUCCESS);  // Already erased
+        for (pos = 0; pos < sizeof (buf); pos += 2)
+            memcpy(buf + pos, &rec->fill, sizeof (rec->fill));
+    }
+    while (len > 0) {
+        uint32_t tlen = STAGE_CHUNK - (addr & (STAGE_CHUNK - 1));
+        if (tlen > len)
+            tlen = len;
+        if ((rec->flags & STAGE_REC_FILL) == 0) {
+            memcpy(buf, data, tlen);
+            data += tlen;
+        }
+        crashlog_prom_addr(addr);
+        if (prom_write(addr, tlen, buf) != RC_SUCCESS)
+            return (RC_FAILURE);
+        addr += tlen;
+        len  -= tlen;
+    }
+    return (RC_SUCCESS);
+}
+
+/*
+ * stage_program() erases, programs, and verifies the socketed EEPROM from
+ *                 the staged image. Progress is reported on the console,
+ *                 and the result is shown on the Alert LED.
+ *
+ * This function requires no arguments.
+ *
+ * @return      RC_SUCCESS - EEPROM was programmed and verified.
+ * @return      RC_NO_DATA - There is no valid staged image.
+ * @return      RC_FAILURE - Erase, program, or verify failed.
+ */
+rc_t
+stage_program(void)
+{
+    const stage_hdr_t *hdr = stage_header(true);
+    const uint8_t     *ptr;
+    const uint8_t     *end;
+    uint32_t           addr;
+    uint32_t           crc;
+    uint64_t           start;
+    rc_t               rc;
+
+    if (hdr == NULL)
+        return (RC_NO_DATA);
+
+    led_alert(0);
+    start = timer_tick_get();
+    printf("Erase %lx-%lx\n", hdr->addr, hdr->addr + hdr->len - 1);
+    rc = prom_erase(ERASE_MODE_SECTOR, hdr->addr, hdr->len);
+    if (rc != RC_SUCCESS) {
+        printf("Erase failed\n");
+        goto fail;
+    }
+
+    printf("Program\n");
+    addr = hdr->addr;
+    ptr  = (const uint8_t *) (hdr + 1);
+    end  = ptr + hdr->rec_len;
+    while (ptr < end) {
+        stage_rec_t rec;
+        memcpy(&rec, ptr, sizeof (rec));
+        rc = stage_program_range(addr, (const stage_rec_t *) ptr);
+        if (rc != RC_SUCCESS) {
+            printf("Program failed at %lx\n", addr);
+            goto fail;
+        }
+        addr += rec.len;
+        ptr  += sizeof (rec);
+        if ((rec.flags & STAGE_REC_FILL) == 0)
+            ptr += rec.len;
+    }
+
+    printf("Verify\n");
+    rc = prom_crc(hdr->addr, hdr->len, &crc);
+    if ((rc == RC_SUCCESS) && (crc != hdr->image_crc)) {
+        printf("Verify failed: CRC %08lx should be %08lx\n",
+               crc, hdr->image_crc);
+        rc = RC_FAILURE;
+    }
+    if (rc != RC_SUCCESS)
+        goto fail;
+
+    printf("Programmed and verified in %lu ms\n",
+           (uint32_t) (timer_tick_to_usec(timer_tick_get() - start) / 1000));
+    prom_disable();
+    return (RC_SUCCESS);
+
+fail:
+    prom_disable();
+    led_alert(1);
+    return (rc);
+}
+
+/*
+ * stage_poll() starts programming from the staged image when the abort
+ *              button is pressed while the programmer is idle.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+void
+stage_poll(void)
+{
+    if ((STAGE_SIZE == 0) || !is_abort_button_pressed())
+        return;
+    if (stage_header(false) == NULL)
+        return;  // Button has no standalone function without an image
+
+    printf("Button: prom program staged\n");
+    led_busy(1);
+    usb_serial_state(USB_SERIAL_STATE_READY | USB_SERIAL_STATE_BUSY);
+    crashlog_cmd("prom program staged");
+    if (stage_program() != RC_SUCCESS)
+        printf("FAILURE\n");
+    crashlog_cmd(NULL);
+    led_busy(0);
+    usb_serial_state(USB_SERIAL_STATE_READY);
+}
@@ -0,0 +1,51 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2020.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * EEPROM image staged in MCU flash for standalone programming.
+ */
+
+#ifndef _STAGE_H
+#define _STAGE_H
+
+/*
+ * A staged image is a stage_hdr_t followed by records which describe
+ * consecutive EEPROM ranges starting at the header address. A data record
+ * is followed by <len> bytes of image data. A fill record has no data;
+ * its range is filled with a repeated 16-bit word. Fill records of the
+ * erased value (0xffff) are not programmed.
+ */
+typedef struct {
+    uint32_t magic;      // STAGE_MAGIC
+    uint32_t version;    // STAGE_VERSION
+    uint32_t addr;       // EEPROM starting byte address
+    uint32_t len;        // EEPROM image length in bytes
+    uint32_t rec_len;    // Bytes of records which follow the header
+    uint32_t image_crc;  // CRC32 of the expanded EEPROM image
+    uint32_t rec_crc;    // CRC32 of the records
+    uint32_t hdr_crc;    // CRC32 of the preceding header fields
+} stage_hdr_t;
+
+typedef struct {
+    uint32_t len;    // EEPROM bytes covered by this record
+    uint16_t fill;   // Fill word (STAGE_REC_FILL)
+    uint16_t flags;  // STAGE_REC_*
+} stage_rec_t;
+
+#define STAGE_MAGIC    0x4753584d  // "MXSG"
+#define STAGE_VERSION  1
+#define STAGE_REC_DATA 0x0000      // Image data follows record
+#define STAGE_REC_FILL 0x0001      // Range is filled with fill word
+
+uint32_t stage_size(void);
+rc_t     stage_erase(uint32_t len);
+rc_t     stage_write(uint32_t offset, uint len, void *buf);
+rc_t     stage_show(void);
+rc_t     stage_program(void);
+void     stage_poll(void);
+
+#endif /* _STAGE_H */
@@ -22,6 +22,7 @@
 #include "timer.h"
 #include "utils.h"
 #include "version.h"
+#include "crashlog.h"
 
 #ifdef STM32F1XX
 #include "stm32f1xx_hal_flash_ex.h"
@@ -92,6 +93,7 @@ mx_main(void)
 {
     /* Power LED on */
     HAL_GPIO_WritePin(LED_POWER_GPIO_Port, LED_POWER_Pin, 1);
+    crashlog_init();
 
     uart_init();
 
@@ -31,6 +31,7 @@
 #define nvic_set_priority(irq, pri) \
                              HAL_NVIC_SetPriority(irq, (pri) >> 4, (pri) & 0xf)
 #define nvic_enable_irq(irq) HAL_NVIC_EnableIRQ(irq)
+#define nvic_set_pending_irq(irq) HAL_NVIC_SetPendingIRQ(irq)
 #define tim2_isr TIM2_IRQHandler
 #define NVIC_TIM2_IRQ TIM2_IRQn
 #define TIM_CR1_CKD_CK_INT_MASK TIM_CR1_CKD_Msk
@@ -64,6 +65,9 @@
 
 static volatile uint32_t timer_high = 0;
 
+volatile bool     isr_latency_armed = false;  // Mark next instrumented ISR
+volatile uint64_t isr_latency_tick;           // Tick at marked ISR entry
+
 /**
  * __dmb() implements a Data Memory Barrier.
  *
@@ -82,6 +86,7 @@ tim2_isr(void)
 {
     uint32_t flags = TIM_SR(TIM2) & TIM_DIER(TIM2);
 
+    isr_latency_mark();
     TIM_SR(TIM2) = ~flags;  // Clear observed flags
 
     if (flags & TIM_SR_UIF)
@@ -248,6 +253,21 @@ timer_delay_ticks(uint32_t ticks)
 }
 #endif
 
+/*
+ * timer_irq_pend() software-triggers the timer interrupt. The ISR finds no
+ *                  timer flags set, so this only serves to measure ISR
+ *                  entry latency.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+void
+timer_irq_pend(void)
+{
+    nvic_set_pending_irq(NVIC_TIM2_IRQ);
+}
+
 /**
  * timer_usec_to_tick() converts the specified number of microseconds to an
  *                      equivalent number of timer ticks.
@@ -23,5 +23,23 @@ uint64_t timer_tick_plus_usec(uint usec);
 uint64_t timer_tick_to_usec(uint64_t value);
 uint64_t timer_usec_to_tick(uint usec);
 uint32_t timer_nsec_to_tick(uint nsec);
+void     timer_irq_pend(void);
+
+/* ISR entry latency measurement (see "time jitter") */
+extern volatile bool     isr_latency_armed;
+extern volatile uint64_t isr_latency_tick;
+
+/*
+ * isr_latency_mark() records the entry time of an instrumented ISR, if a
+ *                    latency measurement is armed.
+ */
+static inline void
+isr_latency_mark(void)
+{
+    if (isr_latency_armed) {
+        isr_latency_tick  = timer_tick_get();
+        isr_latency_armed = false;
+    }
+}
 
 #endif /* _TIMER_H */
@@ -17,6 +17,7 @@
 #include "timer.h"
 #include "irq.h"
 #include "usb.h"
+#include <string.h>
 
 #ifdef USE_HAL_DRIVER
 /* ST-Micro HAL Library compatibility definitions */
@@ -63,9 +64,15 @@ typedef uint32_t USART_TypeDef_P;
 static volatile uint cons_in_rb_producer; // Console input current writer pos
 static uint          cons_in_rb_consumer; // Console input current reader pos
 static uint8_t       cons_in_rb[1024];    // Console input ring buffer (FIFO)
+static volatile uint bulk_in_rb_producer; // Bulk data input writer pos
+static uint          bulk_in_rb_consumer; // Bulk data input reader pos
+static uint8_t       bulk_in_rb[1024];    // Bulk data input ring buffer
+static uint8_t       cons_in_source;      // Sender of console input
+static bool          input_source_held = false; // Command is executing
 static uint8_t       usb_out_buf[256];    // USB output buffer
 static uint16_t      usb_out_bufpos = 0;  // USB output buffer position
 static bool          uart_console_active = false;
+static volatile bool input_abort = false; // Host requested transfer abort
 
 uint8_t last_input_source = 0;
 
@@ -155,7 +162,6 @@ cons_rb_get(void)
     return (ch);
 }
 
-#if 0
 /*
  * cons_rb_space() returns a count of the number of characters remaining
  *                 in the UART input ring buffer before the buffer is
@@ -172,7 +178,6 @@ cons_rb_space(void)
     uint diff = cons_in_rb_consumer - cons_in_rb_producer;
     return (diff + sizeof (cons_in_rb) - 1) % sizeof (cons_in_rb);
 }
-#endif
 
 /*
  * input_break_pending() returns true if a ^C is pending in the input buffer.
@@ -199,18 +204,185 @@ input_break_pending(void)
     return (0);
 }
 
+/*
+ * input_abort_set() records an out-of-band abort request from the host.
+ *                   This is called from USB interrupt context when the
+ *                   host drops DTR or sends a break.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+void
+input_abort_set(void)
+{
+    input_abort = true;
+}
+
+/*
+ * input_abort_pending() returns true if the host has requested that the
+ *                       current transfer be aborted.
+ *
+ * This function requires no arguments.
+ *
+ * @return      1 - abort is pending.
+ * @return      0 - no abort is pending.
+ */
+int
+input_abort_pending(void)
+{
+    return (input_abort);
+}
+
+/*
+ * input_abort_clear() acknowledges a pending host abort request.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+void
+input_abort_clear(void)
+{
+    input_abort = false;
+}
+
 void
 usb_rb_put(uint ch)
 {
     cons_rb_put(ch);
-    last_input_source = SOURCE_USB;
+    cons_in_source = SOURCE_USB;
+}
+
+/*
+ * rb_put_buf() copies received data into an input ring buffer, in at most
+ *              two contiguous pieces rather than one character at a time.
+ *
+ * @param [io]  rb       - The ring buffer.
+ * @param [in]  rb_size  - The size of the ring buffer.
+ * @param [io]  producer - The ring buffer writer position.
+ * @param [in]  consumer - The ring buffer reader position.
+ * @param [in]  buf      - The received data.
+ * @param [in]  len      - The number of bytes received.
+ *
+ * @return      The number of bytes stored. Fewer than len means overflow.
+ */
+static uint
+rb_put_buf(uint8_t *rb, uint rb_size, volatile uint *producer, uint consumer,
+           const uint8_t *buf, uint len)
+{
+    uint prod;
+    uint space;
+    uint count;
+
+    disable_irq();
+    prod = *producer;
+    space = (consumer - prod + rb_size - 1) % rb_size;
+    if (len > space) {
+        uart_putchar('%');
+        len = space;  // Would cause ring buffer overflow
+    }
+    for (count = 0; count < len; ) {
+        uint tlen = rb_size - prod;
+        if (tlen > len - count)
+            tlen = len - count;
+        memcpy(&rb[prod], buf + count, tlen);
+        count += tlen;
+        prod = (prod + tlen) % rb_size;
+    }
+    *producer = prod;
+    enable_irq();
+    return (len);
+}
+
+/*
+ * usb_rb_put_buf() stores a packet received on the USB virtual serial port
+ *                  in the console input ring buffer.
+ *
+ * @param [in]  buf - The received data.
+ * @param [in]  len - The number of bytes received.
+ *
+ * @return      The number of bytes stored. Fewer than len means overflow.
+ */
+uint
+usb_rb_put_buf(const uint8_t *buf, uint len)
+{
+    len = rb_put_buf(cons_in_rb, sizeof (cons_in_rb), &cons_in_rb_producer,
+                     cons_in_rb_consumer, buf, len);
+    cons_in_source = SOURCE_USB;
+    return (len);
+}
+
+/*
+ * usb_bulk_rb_put_buf() stores a packet received on the USB bulk data
+ *                       interface in its own input ring buffer, so that
+ *                       console input can never be mixed into a binary
+ *                       transfer.
+ *
+ * @param [in]  buf - The received data.
+ * @param [in]  len - The number of bytes received.
+ *
+ * @return      The number of bytes stored. Fewer than len means overflow.
+ */
+uint
+usb_bulk_rb_put_buf(const uint8_t *buf, uint len)
+{
+    return (rb_put_buf(bulk_in_rb, sizeof (bulk_in_rb), &bulk_in_rb_producer,
+                       bulk_in_rb_consumer, buf, len));
+}
+
+/*
+ * usb_bulk_rb_space() returns the space remaining in the bulk data input
+ *                     ring buffer, so that the bulk receive path can hold
+ *                     off the host rather than overflow it.
+ *
+ * This function requires no arguments.
+ *
+ * @return      The number of characters of available space.
+ */
+uint
+usb_bulk_rb_space(void)
+{
+    uint diff = bulk_in_rb_consumer - bulk_in_rb_producer;
+    return (diff + sizeof (bulk_in_rb) - 1) % sizeof (bulk_in_rb);
+}
+
+/*
+ * bulk_rb_get() returns the next character in the bulk data input ring
+ *               buffer, or -1 if it is empty.
+ */
+static int
+bulk_rb_get(void)
+{
+    uint ch;
+    if (bulk_in_rb_consumer == bulk_in_rb_producer)
+        return (-1);  // Ring buffer empty
+
+    ch = bulk_in_rb[bulk_in_rb_consumer];
+    bulk_in_rb_consumer = (bulk_in_rb_consumer + 1) % sizeof (bulk_in_rb);
+    return (ch);
+}
+
+/*
+ * usb_rb_space() returns the space remaining in the console input ring
+ *                buffer, so that the USB receive path can hold off the
+ *                host rather than overflow it.
+ *
+ * This function requires no arguments.
+ *
+ * @return      The number of characters of available space.
+ */
+uint
+usb_rb_space(void)
+{
+    return (cons_rb_space());
 }
 
 static void
 uart_rb_put(uint ch)
 {
     cons_rb_put(ch);
-    last_input_source = SOURCE_UART;
+    cons_in_source = SOURCE_UART;
 }
 
 static void
@@ -220,8 +392,16 @@ usb_putchar_flush(void)
         return;
     if (usb_out_bufpos == 0)
         return;
+#ifdef USE_HAL_DRIVER
+    uint sent = usb_tx_queue(usb_out_buf, usb_out_bufpos);
+    if (sent != 0) {
+        usb_out_bufpos -= sent;
+        memmove(usb_out_buf, usb_out_buf + sent, usb_out_bufpos);
+    }
+#else
     if (CDC_Transmit_FS(usb_out_buf, usb_out_bufpos) == USBD_OK)
         usb_out_bufpos = 0;
+#endif
 }
 
 static void
@@ -267,14 +447,28 @@ usb_puts_wait(uint8_t *buf, uint32_t len)
             usb_putchar_flush();
         }
     }
-    // XXX: Simplify below loop if both STM32 HAL and opencm3 libraries
-    //      support transmitting more than 64 bytes at a time.
+#ifdef USE_HAL_DRIVER
+    /*
+     * Data is copied to the transmit queue, which is drained one
+     * multi-packet transfer at a time from the transmit complete callback.
+     */
+    uint64_t timeout = timer_tick_plus_msec(50);
+    while (len > 0) {
+        uint sent = usb_tx_queue(buf, len);
+        if (sent == 0) {
+            if (timer_tick_has_elapsed(timeout)) {
+                printf("Host Timeout on USB send\n");
+                return (1);
+            }
+            continue;
+        }
+        len -= sent;
+        buf += sent;
+        timeout = timer_tick_plus_msec(50);
+    }
+#else
     while (len > 0) {
         uint32_t tlen = len;
-#ifdef USE_HAL_DRIVER
-        if (tlen > 64)
-            tlen = 64;
-#endif
         if (CDC_Transmit_FS(buf, tlen) != USBD_OK) {
             uint64_t timeout = timer_tick_plus_msec(50);
             while (CDC_Transmit_FS(buf, tlen) != USBD_OK) {
@@ -287,9 +481,23 @@ usb_puts_wait(uint8_t *buf, uint32_t len)
         len -= tlen;
         buf += tlen;
     }
+#endif
     return (0);
 }
 
+/*
+ * puts_binary() sends binary transfer data to the host, using the same
+ *               path on which the command arrived. A command received on
+ *               the USB bulk data interface is answered there, keeping
+ *               binary data out of the console stream. The path is held
+ *               for the whole command by input_source_hold().
+ *
+ * @param [in]  buf - The data to send.
+ * @param [in]  len - The number of bytes to send.
+ *
+ * @return      0 = Success.
+ * @return      1 = Failure (host timeout).
+ */
 int
 puts_binary(void *buf, uint32_t len)
 {
@@ -298,6 +506,8 @@ puts_binary(void *buf, uint32_t len)
         while (len-- > 0)
             uart_putchar(*(ptr++));
         return (0);
+    } else if (last_input_source == SOURCE_BULK) {
+        return (usb_bulk_transmit(ptr, len));
     } else {
         return (usb_puts_wait(ptr, len));
     }
@@ -326,13 +536,62 @@ puts(const char *str)
     return (putchar('\n'));
 }
 
+/*
+ * input_source_hold() holds the input path on which the current command
+ *                     arrived, until input_source_release(). While held,
+ *                     getchar() reads only from that path, and puts_binary()
+ *                     replies only on it, regardless of other input.
+ *
+ * This function requires no arguments.
+ *
+ * @return      None.
+ */
+void
+input_source_hold(void)
+{
+    input_source_held = true;
+}
+
+void
+input_source_release(void)
+{
+    input_source_held = false;
+}
+
+/*
+ * getchar() returns the next input character, or -1 if there is none.
+ *           Between commands, console input (USB CDC or UART) is read
+ *           first, and the bulk data ring only when the console has
+ *           nothing pending. This is how a command line sent on the bulk
+ *           data interface is read. While a command executes
+ *           (input_source_hold()), only the ring on which the command
+ *           arrived is read. A bulk transfer therefore never consumes
+ *           console keystrokes, and console input never feeds a bulk
+ *           transfer.
+ *
+ * This function requires no arguments.
+ *
+ * @return      Character read, or -1 if no input is available.
+ */
 int
 getchar(void)
 {
+    int ch;
+
     usb_putchar_flush();  // Ensure USB output is flushed
     usb_poll();
 
-    return (cons_rb_get());
+    if (input_source_held)
+        return ((last_input_source == SOURCE_BULK) ? bulk_rb_get() :
+                cons_rb_get());
+
+    /* The source of the most recently read character is the reply path */
+    if ((ch = cons_rb_get()) != -1) {
+        last_input_source = cons_in_source;
+    } else if ((ch = bulk_rb_get()) != -1) {
+        last_input_source = SOURCE_BULK;
+    }
+    return (ch);
 }
 
 void
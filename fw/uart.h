@@ -54,6 +54,21 @@ int getchar(void);
 void uart_init(void);
 
 void usb_rb_put(uint ch);
+uint usb_rb_put_buf(const uint8_t *buf, uint len);
+uint usb_rb_space(void);
+uint usb_bulk_rb_put_buf(const uint8_t *buf, uint len);
+uint usb_bulk_rb_space(void);
+
+/*
+ * input_source_hold() holds the input path of the current command (console
+ *                     or USB bulk data interface) until released, so that
+ *                     binary data is read from and sent on that path only,
+ *                     even if other input arrives meanwhile. Between
+ *                     commands, the bulk data ring is read only when the
+ *                     console has no input pending (see getchar()).
+ */
+void input_source_hold(void);
+void input_source_release(void);
 
 /*
  * input_break_pending() returns true if a ^C is pending in the input buffer.
@@ -65,12 +80,24 @@ void usb_rb_put(uint ch);
  */
 int input_break_pending(void);
 
+/*
+ * input_abort_set() records an out-of-band abort request from the host
+ *                   (DTR drop or break on the USB virtual serial port).
+ *                   Binary transfers check input_abort_pending() at safe
+ *                   points and resynchronize with the host when it is set.
+ *                   input_abort_clear() is called as each command starts.
+ */
+void input_abort_set(void);
+int  input_abort_pending(void);
+void input_abort_clear(void);
+
 int uart_putchar(int ch);
 void uart_flush(void);
 int puts_binary(void *buf, uint32_t len);
 
-#define SOURCE_UART 0  // Last input source was serial UART
-#define SOURCE_USB  1  // Last input source was USB virtual serial port
+#define SOURCE_UART 0  // Last input read was from serial UART
+#define SOURCE_USB  1  // Last input read was from USB virtual serial port
+#define SOURCE_BULK 2  // Last input read was from USB bulk data interface
 
 extern uint8_t last_input_source;
 
@@ -28,6 +28,9 @@
 #include <usbd_desc.h>
 #include <usbd_conf.h>
 #include <usb_device.h>
+#include <usbd_cdc.h>
+#include <usbd_cdc_if.h>
+#include <string.h>
 #ifdef STM32F1
 #include <stm32f1xx_ll_usb.h>
 #else
@@ -46,6 +49,8 @@
 #define nvic_enable_irq(x)  HAL_NVIC_EnableIRQ(x)
 #define nvic_disable_irq(x) HAL_NVIC_DisableIRQ(x)
 
+extern USBD_HandleTypeDef hUsbDeviceFS;  // Defined in generated usb_device.c
+
 #else
 /* libopencm3 */
 #include <libopencm3/stm32/gpio.h>
@@ -414,28 +419,284 @@ static const char *usb_strings[] = {
 };
 #endif
 
+#ifdef USE_HAL_DRIVER
+/*
+ * STM32 HAL transmit queue. Output is copied into this ring buffer and sent
+ * as multi-packet transfers, so the CPU does not wait between packets. The
+ * completion of a transfer is found from the CDC class TxState, as not all
+ * HAL CDC class versions provide a TransmitCplt callback. Transfer sizes
+ * which are a multiple of the packet size are terminated with a zero
+ * length packet by the HAL CDC class.
+ */
+static uint8_t           usb_tx_rb[2048];      // Transmit queue (FIFO)
+static volatile uint     usb_tx_rb_producer;   // Transmit queue writer pos
+static volatile uint     usb_tx_rb_consumer;   // Transmit queue reader pos
+static volatile uint     usb_tx_inflight = 0;  // Bytes in current transfer
+static volatile bool     usb_rx_held = false;  // Receive not yet re-armed
+static uint8_t          *usb_rx_buf;           // Held-off receive buffer
+
+/*
+ * usb_tx_start() starts a transfer of the contiguous data at the head of
+ *                the transmit queue, if a transfer is not already in
+ *                progress. Must be called with USB interrupts masked, or
+ *                from USB interrupt context.
+ */
+static void
+usb_tx_start(void)
+{
+    uint cons = usb_tx_rb_consumer;
+    uint prod = usb_tx_rb_producer;
+    uint len;
+
+    if ((usb_tx_inflight != 0) || (cons == prod))
+        return;
+
+    len = ((prod > cons) ? prod : sizeof (usb_tx_rb)) - cons;
+    USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &usb_tx_rb[cons], len);
+    if (USBD_CDC_TransmitPacket(&hUsbDeviceFS) == USBD_OK)
+        usb_tx_inflight = len;
+}
+
+/*
+ * usb_tx_reap() retires the transfer in progress once the CDC class reports
+ *               that the host has collected it, and starts the next one.
+ *               Must be called with USB interrupts masked.
+ */
+static void
+usb_tx_reap(void)
+{
+    USBD_CDC_HandleTypeDef *hcdc = hUsbDeviceFS.pClassData;
+
+    if ((usb_tx_inflight == 0) || (hcdc == NULL) || (hcdc->TxState != 0))
+        return;
+
+    usb_tx_rb_consumer = (usb_tx_rb_consumer + usb_tx_inflight) %
+                         sizeof (usb_tx_rb);
+    usb_tx_inflight = 0;
+    usb_tx_start();
+}
+
+/*
+ * usb_tx_queue() copies data into the USB transmit queue and starts a
+ *                transfer if the endpoint is idle.
+ *
+ * @param [in]  buf - Data to send.
+ * @param [in]  len - Length of data to send.
+ *
+ * @return      The number of bytes queued, which may be less than len
+ *              (or 0) if the queue is full.
+ */
+uint
+usb_tx_queue(const uint8_t *buf, uint len)
+{
+    uint prod = usb_tx_rb_producer;
+    uint space;
+    uint count;
+
+    if (usb_console_active == false)
+        return (0);
+
+    space = (usb_tx_rb_consumer - prod + sizeof (usb_tx_rb) - 1) %
+            sizeof (usb_tx_rb);
+    if (len > space)
+        len = space;
+    for (count = 0; count < len; ) {
+        uint tlen = sizeof (usb_tx_rb) - prod;
+        if (tlen > len - count)
+            tlen = len - count;
+        memcpy(&usb_tx_rb[prod], buf + count, tlen);
+        count += tlen;
+        prod = (prod + tlen) % sizeof (usb_tx_rb);
+    }
+
+    usb_mask_interrupts();
+    usb_tx_rb_producer = prod;
+    usb_tx_reap();
+    usb_tx_start();
+    usb_unmask_interrupts();
+    return (len);
+}
+
+/*
+ * usb_hal_receive() is the CDC class Receive callback, in place of the
+ *                   generated CDC_Receive_FS(). Each packet received from
+ *                   the host is copied to the console input ring buffer in
+ *                   bulk. The endpoint is re-armed only while there is
+ *                   space for another full packet; otherwise the host is
+ *                   held off (NAKed) until usb_poll() finds the space has
+ *                   drained.
+ *
+ * @param [in]  buf - Receive buffer provided by the CDC class.
+ * @param [in]  len - Number of bytes received.
+ *
+ * @return      USBD_OK.
+ */
+static int8_t
+usb_hal_receive(uint8_t *buf, uint32_t *len)
+{
+    usb_console_active = true;
+    (void) usb_rb_put_buf(buf, *len);
+
+    usb_rx_buf = buf;
+    if (usb_rb_space() < CDC_DATA_FS_MAX_PACKET_SIZE) {
+        usb_rx_held = true;
+        return (USBD_OK);
+    }
+    USBD_CDC_SetRxBuffer(&hUsbDeviceFS, buf);
+    USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+    return (USBD_OK);
+}
+
+/*
+ * usb_rx_resume() re-arms the receive endpoint if it was held off because
+ *                 the console input ring buffer was nearly full.
+ */
+static void
+usb_rx_resume(void)
+{
+    if ((usb_rx_held == false) ||
+        (usb_rb_space() < CDC_DATA_FS_MAX_PACKET_SIZE))
+        return;
+
+    usb_mask_interrupts();
+    usb_rx_held = false;
+    USBD_CDC_SetRxBuffer(&hUsbDeviceFS, usb_rx_buf);
+    USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+    usb_unmask_interrupts();
+}
+
+/*
+ * STM32 HAL CDC interface callbacks. A copy of the CubeMX generated
+ * USBD_Interface_fops_FS is registered with the CDC class at startup, with
+ * Control and Receive substituted, so that no generated code need be
+ * edited.
+ */
+static USBD_CDC_ItfTypeDef usb_hal_fops;
+
+/*
+ * usb_hal_control() handles CDC class requests from the host. A drop of
+ *                   DTR, or a SEND_BREAK, is an out-of-band transfer abort
+ *                   request, as in the libopencm3 cdcacm_control_request().
+ *                   All requests are then passed to the generated
+ *                   CDC_Control_FS().
+ *
+ * @param [in]  cmd    - CDC class request code.
+ * @param [in]  pbuf   - Request data, or the setup packet if none.
+ * @param [in]  length - Length of request data.
+ *
+ * @return      The status from CDC_Control_FS().
+ */
+static int8_t
+usb_hal_control(uint8_t cmd, uint8_t *pbuf, uint16_t length)
+{
+    static uint16_t            last_state = 0;
+    const USBD_SetupReqTypedef *req = (const USBD_SetupReqTypedef *) pbuf;
+
+    switch (cmd) {
+        case CDC_SET_CONTROL_LINE_STATE:
+            if ((last_state & BIT(0)) && ((req->wValue & BIT(0)) == 0))
+                input_abort_set();  // DTR dropped
+            last_state = req->wValue;
+            break;
+        case CDC_SEND_BREAK:
+            if (req->wValue != 0)
+                input_abort_set();
+            break;
+    }
+    return (USBD_Interface_fops_FS.Control(cmd, pbuf, length));
+}
+
+/*
+ * usb_hal_callbacks() registers the CDC interface callbacks with the HAL
+ *                     CDC class.
+ */
+static void
+usb_hal_callbacks(void)
+{
+    usb_hal_fops = USBD_Interface_fops_FS;
+    usb_hal_fops.Control = usb_hal_control;
+    usb_hal_fops.Receive = usb_hal_receive;
+    USBD_CDC_RegisterInterface(&hUsbDeviceFS, &usb_hal_fops);
+}
+#endif /* USE_HAL_DRIVER */
+
 void
 usb_shutdown(void)
 {
 #ifdef USE_HAL_DRIVER
-//  extern PCD_HandleTypeDef hUsbDeviceFS;
-    extern USBD_HandleTypeDef hUsbDeviceFS;
-
     USBD_Stop(&hUsbDeviceFS);
     USBD_DeInit(&hUsbDeviceFS);
     HAL_Delay(10);
     usb_console_active = false;
+    usb_tx_rb_consumer = usb_tx_rb_producer;
+    usb_tx_inflight = 0;
+    usb_rx_held = false;
+#endif
+}
+
+/*
+ * usb_irq_pend() software-triggers the USB interrupt, for measurement of
+ *                ISR entry latency. With no USB event flags set, the ISR
+ *                has nothing to process.
+ *
+ * This function requires no arguments.
+ *
+ * @return      true  - The interrupt was triggered.
+ * @return      false - USB is not interrupt driven, or the ISR is not
+ *                      instrumented (STM32 HAL generated ISR).
+ */
+bool
+usb_irq_pend(void)
+{
+#if defined(USE_HAL_DRIVER) || !defined(USING_USB_INTERRUPT)
+    return (false);
+#else
+    if (!using_usb_interrupt)
+        return (false);
+    nvic_set_pending_irq(USB_INTERRUPT);
+    return (true);
 #endif
 }
 
+#ifndef USE_HAL_DRIVER
+static volatile bool bulk_tx_busy = false;    // Bulk IN packet in flight
+static volatile bool bulk_rx_held = false;    // Bulk OUT NAKed (ring full)
+static bool          bulk_configured = false; // Host set configuration
+
+/*
+ * usb_bulk_rx_resume() re-enables the bulk data OUT endpoint if it was
+ *                      held off because the bulk data input ring buffer
+ *                      was nearly full.
+ */
+static void
+usb_bulk_rx_resume(void)
+{
+    if ((bulk_rx_held == false) || (usb_bulk_rb_space() < 64))
+        return;
+
+    usb_mask_interrupts();
+    bulk_rx_held = false;
+    usbd_ep_nak_set(usbd_gdev, 0x02, 0);
+    usb_unmask_interrupts();
+}
+#endif
+
 void usb_poll(void)
 {
 #ifdef USE_HAL_DRIVER
-    /* Nothing to do for STM32 HAL driver, as this library is interrupt-based */
+    /*
+     * STM32 HAL library is interrupt-based; only retire a completed
+     * transmit and resume held-off receive.
+     */
+    usb_mask_interrupts();
+    usb_tx_reap();
+    usb_unmask_interrupts();
+    usb_rx_resume();
 #else
 #ifndef DEBUG_NO_USB
     if (!using_usb_interrupt)
         usbd_poll(usbd_gdev);
+    usb_bulk_rx_resume();
 #endif
 #endif
 }
@@ -555,13 +816,65 @@ CDC_Transmit_FS(uint8_t *buf, uint16_t len)
     }
     return (USBD_OK);
 }
+
+/*
+ * usb_bulk_transmit() sends binary transfer data to the host on the bulk
+ *                     data interface IN endpoint (0x81). Each packet waits
+ *                     for the previous one to be collected by the host.
+ *                     A transfer which is a multiple of the packet size is
+ *                     terminated by a zero length packet, so that the host
+ *                     may post reads larger than one packet.
+ *
+ * @param [in]  buf - The data to send.
+ * @param [in]  len - The number of bytes to send.
+ *
+ * @return      0 = Success.
+ * @return      1 = Failure (host timeout).
+ */
+int
+usb_bulk_transmit(uint8_t *buf, uint32_t len)
+{
+    bool zlp = (len != 0) && ((len % 64) == 0);
+
+    if (bulk_configured == false)
+        return (1);
+
+    while ((len > 0) || zlp) {
+        uint16_t tlen = (len > 64) ? 64 : len;
+        uint64_t timeout = timer_tick_plus_msec(50);
+        while (bulk_tx_busy) {
+            usb_poll();
+            if (timer_tick_has_elapsed(timeout)) {
+                printf("Host Timeout on USB bulk send\n");
+                return (1);
+            }
+        }
+        usb_mask_interrupts();
+        bulk_tx_busy = true;
+        (void) usbd_ep_write_packet(usbd_gdev, 0x81, buf, tlen);
+        usb_unmask_interrupts();
+        if (tlen == 0)
+            break;  // Zero length packet sent
+        len -= tlen;
+        buf += tlen;
+    }
+    return (0);
+}
+#else
+int
+usb_bulk_transmit(uint8_t *buf, uint32_t len)
+{
+    /* Generated HAL descriptors do not include the bulk data interface */
+    return (1);
+}
 #endif
 
 #ifndef USE_HAL_DRIVER
 /*
- * This notification endpoint isn't implemented. According to CDC spec its
- * optional, but its absence causes a NULL pointer dereference in Linux
- * cdc_acm driver.
+ * This notification endpoint is used only for SERIAL_STATE notifications
+ * which report command state (see usb_serial_state()). According to CDC
+ * spec its optional, but its absence causes a NULL pointer dereference in
+ * Linux cdc_acm driver.
  */
 static const struct usb_endpoint_descriptor comm_endp[] = {
     {
@@ -570,7 +883,7 @@ static const struct usb_endpoint_descriptor comm_endp[] = {
         .bEndpointAddress = 0x83,
         .bmAttributes     = USB_ENDPOINT_ATTR_INTERRUPT,
         .wMaxPacketSize   = 16,
-        .bInterval        = 255,
+        .bInterval        = 10,
     }
 };
 
@@ -592,6 +905,31 @@ static const struct usb_endpoint_descriptor data_endp[] = {
     }
 };
 
+/*
+ * The bulk data interface carries binary PROM transfers, so that they are
+ * not mixed with console text on the CDC interface. It is a vendor class
+ * interface, which is not claimed by a host driver, so mxprog may open it
+ * directly. STM32F107 / STM32F407 OTG FS has only four IN endpoints, which
+ * leaves room for a single bulk pair but not a second CDC ACM function.
+ */
+static const struct usb_endpoint_descriptor bulk_endp[] = {
+    {
+        .bLength          = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType  = USB_DT_ENDPOINT,
+        .bEndpointAddress = 0x02,
+        .bmAttributes     = USB_ENDPOINT_ATTR_BULK,
+        .wMaxPacketSize   = 64,
+        .bInterval        = 1,
+    }, {
+        .bLength          = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType  = USB_DT_ENDPOINT,
+        .bEndpointAddress = 0x81,
+        .bmAttributes     = USB_ENDPOINT_ATTR_BULK,
+        .wMaxPacketSize   = 64,
+        .bInterval        = 1,
+    }
+};
+
 static const struct {
         struct usb_cdc_header_descriptor header;
         struct usb_cdc_call_management_descriptor call_mgmt;
@@ -661,13 +999,45 @@ static const struct usb_interface_descriptor data_iface[] = {
     }
 };
 
+static const struct usb_interface_descriptor bulk_iface[] = {
+    {
+        .bLength = USB_DT_INTERFACE_SIZE,
+        .bDescriptorType    = USB_DT_INTERFACE,
+        .bInterfaceNumber   = 2,
+        .bAlternateSetting  = 0,
+        .bNumEndpoints      = 2,
+        .bInterfaceClass    = USB_CLASS_VENDOR,
+        .bInterfaceSubClass = 0,
+        .bInterfaceProtocol = 0,
+        .iInterface         = 0,
+
+        .endpoint           = bulk_endp,
+    }
+};
+
+/* Groups the CDC interfaces as one function of the composite device */
+static const struct usb_iface_assoc_descriptor cdcacm_assoc = {
+    .bLength            = USB_DT_INTERFACE_ASSOCIATION_SIZE,
+    .bDescriptorType    = USB_DT_INTERFACE_ASSOCIATION,
+    .bFirstInterface    = 0,
+    .bInterfaceCount    = 2,
+    .bFunctionClass     = USB_CLASS_CDC,
+    .bFunctionSubClass  = USB_CDC_SUBCLASS_ACM,
+    .bFunctionProtocol  = USB_CDC_PROTOCOL_AT,
+    .iFunction          = 0,
+};
+
 static const struct usb_interface ifaces[] = {
     {
         .num_altsetting     = 1,
+        .iface_assoc        = &cdcacm_assoc,
         .altsetting         = comm_iface,
     }, {
         .num_altsetting     = 1,
         .altsetting         = data_iface,
+    }, {
+        .num_altsetting     = 1,
+        .altsetting         = bulk_iface,
     }
 };
 
@@ -675,7 +1045,7 @@ static const struct usb_config_descriptor config = {
     .bLength = USB_DT_CONFIGURATION_SIZE,
     .bDescriptorType = USB_DT_CONFIGURATION,
     .wTotalLength        = 0,
-    .bNumInterfaces      = 2,
+    .bNumInterfaces      = 3,
     .bConfigurationValue = 1,
     .iConfiguration      = 0,
     .bmAttributes        = 0x80,
@@ -688,6 +1058,63 @@ static const struct usb_config_descriptor config = {
 static uint8_t usbd_control_buffer[128];
 
 #define USB_CDC_REQ_GET_LINE_CODING 0x21  // Not defined in libopencm3
+#define USB_CDC_REQ_SEND_BREAK      0x23  // Not defined in libopencm3
+#define USB_CDC_CONTROL_LINE_DTR    0x01  // SET_CONTROL_LINE_STATE DTR bit
+
+static volatile uint16_t serial_state = 0;   // Current SERIAL_STATE bits
+static volatile bool     serial_state_pending = false;  // Not yet sent
+static volatile bool     serial_state_busy_owed = false;  // BUSY not yet sent
+static volatile bool     cdcacm_configured = false;
+
+/*
+ * cdcacm_send_serial_state() sends a CDC SERIAL_STATE notification with the
+ *                            current state bits on the interrupt endpoint
+ *                            (0x83). The Linux cdc_acm driver presents
+ *                            these bits to the host as modem status lines.
+ *                            If a command started and finished before its
+ *                            BUSY state could be sent, BUSY is sent first,
+ *                            so that the host still sees the command.
+ *
+ * @param [in]  usbd_dev - USB device handle.
+ * @return      true  - A notification is still to be sent.
+ * @return      false - The host has been sent the current state.
+ */
+static bool
+cdcacm_send_serial_state(usbd_device *usbd_dev)
+{
+    uint8_t  buf[10] __attribute__ ((aligned(4)));
+    struct usb_cdc_notification *notif = (void *)buf;
+    uint16_t state = serial_state;
+
+    if (cdcacm_configured == false)
+        return (true);
+    if (serial_state_busy_owed)
+        state |= USB_SERIAL_STATE_BUSY;
+
+    notif->bmRequestType = 0xA1;
+    notif->bNotification = USB_CDC_NOTIFY_SERIAL_STATE;
+    notif->wValue = 0;
+    notif->wIndex = 0;  // Communication interface
+    notif->wLength = 2;
+    buf[8] = state & 0xff;
+    buf[9] = state >> 8;
+    if (usbd_ep_write_packet(usbd_dev, 0x83, buf, sizeof (buf)) == 0)
+        return (true);  // Endpoint still busy; sent on completion
+    serial_state_busy_owed = false;
+    return (state != serial_state);
+}
+
+/*
+ * cdcacm_notify_cb() gets called when the host has collected the previous
+ *                    notification from the interrupt endpoint (0x83). If
+ *                    state changed while that notification was in flight,
+ *                    the latest state is sent now.
+ */
+static void cdcacm_notify_cb(usbd_device *usbd_dev, uint8_t ep)
+{
+    if (serial_state_pending)
+        serial_state_pending = cdcacm_send_serial_state(usbd_dev);
+}
 
 static enum usbd_request_return_codes
 cdcacm_control_request(usbd_device *usbd_dev, struct usb_setup_data *req,
@@ -708,20 +1135,27 @@ cdcacm_control_request(usbd_device *usbd_dev, struct usb_setup_data *req,
              * even though it's optional in the CDC spec, and we don't
              * advertise it in the ACM functional descriptor.
              */
-            char local_buf[10];
-            struct usb_cdc_notification *notif = (void *)local_buf;
-
-            /* We echo signals back to host as notification. */
-            notif->bmRequestType = 0xA1;
-            notif->bNotification = USB_CDC_NOTIFY_SERIAL_STATE;
-            notif->wValue = 0;
-            notif->wIndex = 0;
-            notif->wLength = 2;
-            local_buf[8] = req->wValue & 3;
-            local_buf[9] = 0;
-            // usbd_ep_write_packet(usbd_gdev, 0x83, buf, 10);
+            static uint16_t last_state = 0;
+
+            /* Host dropping DTR is an out-of-band transfer abort request */
+            if ((last_state & USB_CDC_CONTROL_LINE_DTR) &&
+                ((req->wValue & USB_CDC_CONTROL_LINE_DTR) == 0))
+                input_abort_set();
+            last_state = req->wValue;
+
+            /*
+             * Host opened (or re-opened) the port; report current state
+             * so it need not wait for the next command transition.
+             */
+            if (req->wValue & USB_CDC_CONTROL_LINE_DTR)
+                serial_state_pending = cdcacm_send_serial_state(usbd_dev);
             return (USBD_REQ_HANDLED);
         }
+        case USB_CDC_REQ_SEND_BREAK:
+            /* Break from a terminal program also aborts a transfer */
+            if (req->wValue != 0)
+                input_abort_set();
+            return (USBD_REQ_HANDLED);
         case USB_CDC_REQ_SET_LINE_CODING:
             /* Windows 10 VCP driver requires this */
             if (*len < sizeof (struct usb_cdc_line_coding))
@@ -746,10 +1180,8 @@ static void cdcacm_rx_cb(usbd_device *usbd_dev, uint8_t ep)
     int len = usbd_ep_read_packet(usbd_dev, 0x01, buf, sizeof (buf));
 
     if (len > 0) {
-        int pos;
         usb_console_active = true;
-        for (pos = 0; pos < len; pos++)
-            usb_rb_put(buf[pos]);
+        (void) usb_rb_put_buf((uint8_t *)buf, len);
     }
 }
 
@@ -793,11 +1225,46 @@ uart_putchar("0123456789abcdef"[gpos & 0xf]);
 #endif
 }
 
+/*
+ * bulk_rx_cb() gets called when the USB hardware has received data from
+ *              the host on the bulk data OUT endpoint (0x02). Data goes to
+ *              the bulk data input ring buffer. The endpoint is NAKed while
+ *              there is not space for another full packet.
+ */
+static void bulk_rx_cb(usbd_device *usbd_dev, uint8_t ep)
+{
+    char buf[64];
+    int len = usbd_ep_read_packet(usbd_dev, 0x02, buf, sizeof (buf));
+
+    if (len > 0)
+        (void) usb_bulk_rb_put_buf((uint8_t *)buf, len);
+    if (usb_bulk_rb_space() < sizeof (buf)) {
+        bulk_rx_held = true;
+        usbd_ep_nak_set(usbd_dev, 0x02, 1);
+    }
+}
+
+/*
+ * bulk_tx_cb() gets called when the host has collected the previous packet
+ *              from the bulk data IN endpoint (0x81).
+ */
+static void bulk_tx_cb(usbd_device *usbd_dev, uint8_t ep)
+{
+    bulk_tx_busy = false;
+}
+
 static void cdcacm_set_config(usbd_device *usbd_dev, uint16_t wValue)
 {
     usbd_ep_setup(usbd_dev, 0x01, USB_ENDPOINT_ATTR_BULK, 64, cdcacm_rx_cb);
     usbd_ep_setup(usbd_dev, 0x82, USB_ENDPOINT_ATTR_BULK, 64, cdcacm_tx_cb);
-    usbd_ep_setup(usbd_dev, 0x83, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
+    usbd_ep_setup(usbd_dev, 0x83, USB_ENDPOINT_ATTR_INTERRUPT, 16,
+                  cdcacm_notify_cb);
+    usbd_ep_setup(usbd_dev, 0x02, USB_ENDPOINT_ATTR_BULK, 64, bulk_rx_cb);
+    usbd_ep_setup(usbd_dev, 0x81, USB_ENDPOINT_ATTR_BULK, 64, bulk_tx_cb);
+    cdcacm_configured = true;
+    bulk_configured = true;
+    bulk_tx_busy = false;
+    bulk_rx_held = false;
 
     usbd_register_control_callback(usbd_dev,
                                    USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
@@ -814,6 +1281,7 @@ usb_lp_can_rx0_isr(void)
     static uint16_t preg2 = 0;
     uint16_t        reg;
 
+    isr_latency_mark();
     usbd_poll(usbd_gdev);
 
     /* Detect and clear unhandled interrupt */
@@ -836,6 +1304,7 @@ usb_lp_can_rx0_isr(void)
 void
 otg_fs_isr(void)
 {
+    isr_latency_mark();
     usbd_poll(usbd_gdev);
 }
 #endif
@@ -868,11 +1337,46 @@ usbd_device   *usbd_gdev = NULL;
 
 #endif /* !USE_HAL_DRIVER */
 
+/*
+ * usb_serial_state() updates the command state reported to the host through
+ *                    CDC SERIAL_STATE notifications. This lets the host
+ *                    wait for a long-running command (such as erase) to
+ *                    complete using TIOCMIWAIT, without parsing the data
+ *                    stream. A notification is only sent when state changes.
+ *                    If the endpoint is still busy with the previous
+ *                    notification, the new state is sent on its completion.
+ *                    A BUSY state is never coalesced away, even when the
+ *                    command finishes before it could be sent.
+ *
+ * @param [in]  state - USB_SERIAL_STATE_* bits.
+ * @return      None.
+ */
+void
+usb_serial_state(uint16_t state)
+{
+#ifdef USE_HAL_DRIVER
+    /* Generated HAL CDC class does not expose the notification endpoint */
+    (void) state;
+#else
+    if (state == serial_state)
+        return;
+
+    usb_mask_interrupts();
+    if ((state & ~serial_state) & USB_SERIAL_STATE_BUSY)
+        serial_state_busy_owed = true;
+    serial_state = state;
+    if (serial_state_pending == false)
+        serial_state_pending = cdcacm_send_serial_state(usbd_gdev);
+    usb_unmask_interrupts();
+#endif
+}
+
 
 void usb_startup(void)
 {
 #ifdef USE_HAL_DRIVER
     MX_USB_DEVICE_Init();
+    usb_hal_callbacks();
     using_usb_interrupt = true;  // STM32 HAL driver always uses interrupts
 
 #else /* !USE_HAL_DRIVER */
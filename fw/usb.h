@@ -23,11 +23,28 @@ void usb_shutdown(void);
 void usb_startup(void);
 void usb_signal_reset_to_host(int restart);
 void usb_poll(void);
+bool usb_irq_pend(void);
 void usb_mask_interrupts(void);
 void usb_unmask_interrupts(void);
 void usb_show_regs(void);
 
 uint8_t CDC_Transmit_FS(uint8_t *buf, uint16_t len);
+int usb_bulk_transmit(uint8_t *buf, uint32_t len);
+void usb_serial_state(uint16_t state);
+
+#ifdef USE_HAL_DRIVER
+/* STM32 HAL transmit queue */
+uint usb_tx_queue(const uint8_t *buf, uint len);
+#endif
+
+/*
+ * CDC SERIAL_STATE bits used to report command state. The Linux cdc_acm
+ * driver presents these as modem status lines (TIOCM_CD, TIOCM_DSR, and
+ * TIOCM_RI), which the host may wait on with TIOCMIWAIT.
+ */
+#define USB_SERIAL_STATE_READY 0x0001  // DCD: firmware sends notifications
+#define USB_SERIAL_STATE_BUSY  0x0002  // DSR: a command is executing
+#define USB_SERIAL_STATE_ERROR 0x0008  // RI:  the last command failed
 
 extern uint8_t usb_console_active;
 
@@ -74,9 +74,6 @@ static void SystemInit_post(void) { }
 #define COMPILE_CPU "unknown"
 #endif
 
-/* Force a variable into the custom "persist" section */
-#define SRAM_PERSIST __attribute__((section(".persist,\"aw\",%nobits@")))
-
 /*
  * The System memory base appears at different addresses on different
  * STM32 processors.
@@ -22,6 +22,9 @@
 
 #define BIT(x)      (1 << (x))
 
+/* Force a variable into the custom "persist" section (not cleared by reset) */
+#define SRAM_PERSIST __attribute__((section(".persist,\"aw\",%nobits@")))
+
 #define ARRAY_SIZE(x) (int)((sizeof (x) / sizeof ((x)[0])))
 
 void reset_dfu(void);
@@ -11,6 +11,9 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <termios.h>
@@ -28,11 +31,16 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <time.h>
 #ifdef LINUX
 #include <usb.h>
 #include <dirent.h>
+#include <linux/serial.h>
+#include <linux/usbdevice_fs.h>
 #endif
 
 
@@ -40,18 +48,37 @@
 static const struct option long_opts[] = {
     { "all",      no_argument,       NULL, 'A' },
     { "addr",     required_argument, NULL, 'a' },
+    { "archive",  required_argument, NULL, 'R' },
+    { "archive-get", required_argument, NULL, 'G' },
     { "bank",     required_argument, NULL, 'b' },
+    { "bench",    no_argument,       NULL, 'B' },
+    { "capture",  required_argument, NULL, 'c' },
+    { "capture-op", required_argument, NULL, 'C' },
+    { "crashlog", no_argument,       NULL, 'k' },
     { "delay",    required_argument, NULL, 'D' },
     { "device",   required_argument, NULL, 'd' },
     { "erase",    no_argument,       NULL, 'e' },
+    { "estimate", no_argument,       NULL, 'E' },
+    { "fec",      no_argument,       NULL, 'F' },
     { "fill",     no_argument,       NULL, 'f' },
     { "identify", no_argument,       NULL, 'i' },
     { "help",     no_argument,       NULL, 'h' },
     { "len",      required_argument, NULL, 'l' },
+    { "pack",     required_argument, NULL, 'P' },
+    { "pair",     required_argument, NULL, 'p' },
     { "read",     no_argument,       NULL, 'r' },
+    { "split-banks", required_argument, NULL, 's' },
+    { "spot-check", required_argument, NULL, 'V' },
+    { "stage",    no_argument,       NULL, 'S' },
+    { "link-dups", no_argument,      NULL, 'L' },
+    { "no-bulk",  no_argument,       NULL, 'N' },
     { "term",     no_argument,       NULL, 't' },
+    { "timeline", required_argument, NULL, 'j' },
+    { "timing",   no_argument,       NULL, 'T' },
+    { "usbfs",    no_argument,       NULL, 'U' },
     { "verify",   no_argument,       NULL, 'v' },
     { "write",    no_argument,       NULL, 'w' },
+    { "extents",  required_argument, NULL, 'x' },
     { "yes",      no_argument,       NULL, 'y' },
     { NULL,       no_argument,       NULL,  0  }
 };
@@ -61,17 +88,36 @@ static char short_opts[] = {
     'A',         // --all
     'a', ':',    // --addr <addr>
     'b', ':',    // --bank <num>
+    'B',         // --bench
+    'c', ':',    // --capture <filename>
+    'C', ':',    // --capture-op <op>
     'D', ':',    // --delay <num>
     'd', ':',    // --device <filename>
     'e',         // --erase
+    'E',         // --estimate
     'f',         // --fill
+    'F',         // --fec
+    'G', ':',    // --archive-get <name>
     'h',         // --help
     'i',         // --identify
+    'j', ':',    // --timeline <filename>
+    'k',         // --crashlog
     'l', ':',    // --len <num>
+    'L',         // --link-dups
+    'N',         // --no-bulk
+    'p', ':',    // --pair <dev_hi> <dev_lo>
+    'P', ':',    // --pack <container>
     'r',         // --read <filename>
+    'R', ':',    // --archive <dir>
+    's', ':',    // --split-banks <size>
+    'S',         // --stage <filename>
     't',         // --term
+    'T',         // --timing
+    'U',         // --usbfs
     'v',         // --verify <filename>
+    'V', ':',    // --spot-check <confidence>[:<seed>]
     'w',         // --write <filename>
+    'x', ':',    // --extents <list>
     'y',         // --yes
     '\0'
 };
@@ -82,17 +128,36 @@ static const char usage_text[] =
 "    -A --all               show all verify miscompares\n"
 "    -a --addr <addr>       starting EEPROM address\n"
 "    -b --bank <num>        starting EEPROM address as multiple of file size\n"
+"    -B --bench             measure programmer round trip time and read rate\n"
+"    -c --capture <file>    capture bus signals to VCD file (use -a <addr>)\n"
+"    -C --capture-op <op>   bus sequence to capture: read unlock id page\n"
 "    -D --delay             pacing delay between sent characters (ms)\n"
 "    -d --device <filename> serial device to use (e.g. /dev/ttyACM0)\n"
 "    -e --erase             erase EEPROM (use -a <addr> for sector erase)\n"
+"    -E --estimate          predict duration of -e -r -v -w without running\n"
 "    -f --fill              fill EEPROM with duplicates of the same image\n"
+"    -F --fec               error-correct transfers (noisy serial links)\n"
+"    -G --archive-get <name> rebuild dump <name> from archive into file\n"
 "    -h --help              display usage\n"
 "    -i --identify          identify installed EEPROM\n"
+"    -j --timeline <file>   record a trace of the job in Chrome JSON format\n"
+"    -k --crashlog          show programmer crash log from before last reset\n"
 "    -l --len <num>         length in bytes\n"
+"    -L --link-dups         hard link banks identical to an earlier bank (-s)\n"
+"    -N --no-bulk           send binary data on the console, not the bulk iface\n"
+"    -p --pair <hi> <lo>    write 32-bit image to HI and LO programmers\n"
+"    -P --pack <container>  pack file (with -a -b -l) into image container\n"
 "    -r --read <filename>   read EEPROM and write to file\n"
+"    -R --archive <dir>     with -r, store dump in archive <dir> (see -G)\n"
+"    -s --split-banks <size> with -r, write each <size> bank to its own file\n"
+"    -S --stage <filename>  stage file in programmer for standalone writes\n"
 "    -v --verify <filename> verify file matches EEPROM contents\n"
+"    -V --spot-check <pct>[:<seed>] verify random blocks to <pct>% confidence\n"
 "    -w --write <filename>  read file and write to EEPROM\n"
 "    -t --term              just act in terminal mode (CLI)\n"
+"    -T --timing            capture bus timing (coarse; see examples)\n"
+"    -U --usbfs             use usbdevfs URBs instead of the tty (Linux)\n"
+"    -x --extents <list>    read or verify only <addr>:<len>[,...] or @file\n"
 "    -y --yes               answer all prompts with 'yes'\n"
 "\n"
 "Example (including specific TTY to open):\n"
@@ -101,6 +166,12 @@ static const char usage_text[] =
 #else
 "    mxprog -d /dev/ttyACM0 -i\n"
 #endif
+"Example (program a 32-bit ROM pair on two programmers at once):\n"
+#ifdef OSX
+"    mxprog -p /dev/cu.usbmodem1 /dev/cu.usbmodem2 kick.rom\n"
+#else
+"    mxprog -p /dev/ttyACM0 /dev/ttyACM1 kick.rom\n"
+#endif
 "";
 
 /* Command line modes which may be specified by the user */
@@ -111,6 +182,13 @@ static const char usage_text[] =
 #define MODE_TERM    0x08
 #define MODE_VERIFY  0x10
 #define MODE_WRITE   0x20
+#define MODE_CAPTURE 0x40
+#define MODE_PACK    0x80
+#define MODE_CRASHLOG 0x100
+#define MODE_STAGE   0x200
+#define MODE_TIMING  0x400
+#define MODE_ARCHIVE_GET 0x800
+#define MODE_BENCH   0x1000
 
 /* XXX: Need to register USB device ID at http://pid.codes */
 #define MX_VENDOR 0x1209
@@ -122,6 +200,50 @@ static const char usage_text[] =
 #define ADDR_NOT_SPECIFIED        0xffffffff
 
 #define DATA_CRC_INTERVAL         256  // How often CRC is sent (bytes)
+#define FEC_DEPTH                 4    // Interleaved codewords per block
+#define FEC_NPAR                  4    // Parity bytes per codeword
+#define FEC_PARITY_LEN            (FEC_DEPTH * FEC_NPAR)
+#define FEC_PARITY_POS(len, cw)   (((cw) + FEC_DEPTH - (len) % FEC_DEPTH) % \
+                                   FEC_DEPTH)  // First parity byte of cw
+#define EXTENT_MAX                64   // Programmer PROM_EXTENT_MAX
+#define IMAGE_MAGIC               0x494d584d  // "MXMI"
+#define IMAGE_VERSION             2
+#define IMAGE_SECTOR_SIZE         0x20000     // EEPROM erase sector
+#define IMAGE_BLOCK_SIZE          0x1000      // Verify readback granule
+#define IMAGE_EXTENT_GRAIN        DATA_CRC_INTERVAL
+#define IMAGE_EXTENT_GAP          0x1000      // Merge closer extents
+#define IMAGE_FLAGS_KNOWN         0x0000      // No transforms defined yet
+#define STAGE_MAGIC               0x4753584d  // "MXSG"
+#define STAGE_VERSION             1
+#define STAGE_REC_DATA            0x0000      // Image data follows record
+#define STAGE_REC_FILL            0x0001      // Range is filled with word
+#define STAGE_FILL_MIN            64          // Shortest fill run (bytes)
+#define EEPROM_PAGE_SIZE          128         // Page program size (bytes)
+#define MODEL_WEIGHT              4           // New sample weighs 1/4
+#define LINE_SUSPECT_MIN          4           // Bad words to blame a line
+#define SPOT_BLOCK_SIZE           DATA_CRC_INTERVAL  // Spot-check granule
+#define SPOT_DEFECT_PCT           1           // Spot-check detects 1% bad
+#define LINUX_BY_ID_DIR           "/dev/serial/by-id"
+#define SYNC_TOKEN                "\026SYNC"  // Programmer PROM_SYNC_TOKEN
+#define BULK_IFACE                2           // Programmer bulk data iface
+#define BULK_EP_OUT               0x02        // Bulk data OUT endpoint
+#define BULK_EP_IN                0x81        // Bulk data IN endpoint
+#define BULK_TIMEOUT              1000        // Bulk transfer timeout (ms)
+#define BULK_RX_URBS              4           // Bulk reads kept in flight
+#define BULK_RX_SIZE              4096        // Bytes per bulk read URB
+#define USBFS_DEV_DIR             "/dev/bus/usb"
+#define USBFS_SYSFS_DIR           "/sys/bus/usb/devices"
+#define USBFS_COMM_IFACE          0           // CDC ACM control interface
+#define USBFS_DATA_IFACE          1           // CDC ACM data interface
+#define USBFS_IN_URBS             16          // Reads kept in flight (-U)
+#define USBFS_OUT_URBS            4           // Writes kept in flight (-U)
+#define USBFS_URB_SIZE            4096        // Largest write URB (bytes)
+#define USBFS_EP_DIR_IN           0x80        // Endpoint address IN bit
+#define CDC_REQ_SET_CONTROL_LINE  0x22        // SET_CONTROL_LINE_STATE
+#define CDC_CONTROL_LINE_DTR      0x01
+#define CDC_CONTROL_LINE_RTS      0x02
+#define BENCH_ROUNDS              100         // Round trips timed by -B
+#define BENCH_LEN_DEFAULT         0x40000     // Bytes read by -B
 
 /* Enable for gdb debug */
 #undef DEBUG_CTRL_C_KILL
@@ -146,6 +268,139 @@ typedef enum {
     FALSE = 0,
 } bool_t;
 
+/* Per-board timing model parameters, learned from prior jobs */
+typedef enum {
+    TM_LINK,    // Read transfer rate (bytes/sec)
+    TM_PAGE,    // Page write time, including transfer (usec)
+    TM_SECTOR,  // Sector erase time (usec)
+    TM_CHIP,    // Chip erase time (usec)
+    TM_CRC,     // Programmer CRC rate, no data transferred (bytes/sec)
+    TM_COUNT
+} tm_param_t;
+
+/* Bus capture header and sample, as sent by the programmer */
+typedef struct {
+    uint32_t magic;    // CAPTURE_MAGIC
+    uint32_t count;    // Number of capture_t samples which follow
+    uint32_t tick_hz;  // Sample timer tick rate
+    uint32_t flags;    // CAPTURE_FLAG_*
+} capture_hdr_t;
+
+typedef struct {
+    uint32_t tick;  // Timer tick (low 32 bits)
+    uint32_t addr;  // A19..A0
+    uint16_t data;  // D15..D0
+    uint16_t ctrl;  // CAPTURE_* control signal state
+} capture_t;
+
+#define CAPTURE_MAGIC         0x5043584d  // "MXCP"
+#define CAPTURE_FLAG_OVERFLOW 0x0001      // Capture buffer filled
+#define CAPTURE_FLAG_FAILED   0x0002      // Bus sequence failed
+#define CAPTURE_CE            0x0001      // CE# pin level
+#define CAPTURE_OE            0x0002      // OE# pin level
+#define CAPTURE_VPP           0x0004      // VPP=VHH enable
+#define CAPTURE_DOE           0x0008      // Data lines driven by programmer
+
+/* Scatter-gather EEPROM range, sent to the programmer in binary form */
+typedef struct {
+    uint32_t addr;  // EEPROM byte address
+    uint32_t len;   // Length in bytes
+} extent_t;
+
+/* Consumer of data blocks received by receive_ll_crc_sink() */
+typedef int (*rx_sink_t)(void *arg, const uint8_t *data, uint pos, uint len);
+
+/* State for writing a read to one file per bank (-s) */
+typedef struct {
+    const char *filename;  // Base output filename
+    uint        size;      // Bank size
+    uint        banks;     // Number of banks (last may be partial)
+    uint        cur;       // Current bank being written
+    uint        cur_len;   // Bytes written to the current bank
+    FILE       *fp;        // Current bank file
+    uint32_t   *crc;       // CRC of each completed bank
+    uint       *len;       // Length of each completed bank
+} split_t;
+
+/*
+ * Image container (mxprog --pack). All values are little endian, and
+ * all offsets are from the start of the file. Extent addresses are
+ * offsets within the payload, so a container may be retargeted with -a.
+ * Sector and block CRC maps cover consecutive payload chunks of
+ * sector_size and block_size bytes (the last chunk may be short).
+ */
+typedef struct {
+    uint32_t magic;         // IMAGE_MAGIC
+    uint16_t version;       // IMAGE_VERSION
+    uint16_t hdr_len;       // sizeof (image_hdr_t)
+    uint32_t flags;         // IMAGE_FLAG_* transforms applied to payload
+    uint32_t addr;          // Target EEPROM address
+    uint32_t bank;          // Target bank (BANK_NOT_SPECIFIED if none)
+    uint32_t len;           // Payload length
+    uint32_t extent_count;  // Non-erased (not all 0xff) payload ranges
+    uint32_t extent_off;    // Offset of extent_t table
+    uint32_t sector_size;   // Bytes covered by each sector CRC
+    uint32_t sector_off;    // Offset of sector CRC map
+    uint32_t block_size;    // Bytes covered by each block CRC
+    uint32_t block_off;     // Offset of block CRC map
+    uint32_t payload_off;   // Offset of payload
+    uint32_t payload_crc;   // CRC32 of payload
+    uint32_t table_crc;     // CRC32 of extent table, sector and block maps
+    uint32_t hdr_crc;       // CRC32 of header with hdr_crc = 0
+} image_hdr_t;
+
+/* Image container mapped into memory by image_open() */
+typedef struct {
+    const image_hdr_t *hdr;
+    const extent_t    *ext;
+    const uint32_t    *sector_crc;
+    const uint32_t    *block_crc;
+    uint8_t           *payload;
+    void              *map;
+    size_t             map_len;
+} image_t;
+
+/*
+ * Image staged in programmer MCU flash (mxprog --stage). Must match the
+ * programmer's stage_hdr_t and stage_rec_t. Records describe consecutive
+ * EEPROM ranges from addr; a data record is followed by its image data,
+ * and a fill record covers a range of one repeated 16-bit word.
+ */
+typedef struct {
+    uint32_t magic;      // STAGE_MAGIC
+    uint32_t version;    // STAGE_VERSION
+    uint32_t addr;       // EEPROM starting byte address
+    uint32_t len;        // EEPROM image length in bytes
+    uint32_t rec_len;    // Bytes of records which follow the header
+    uint32_t image_crc;  // CRC32 of the expanded EEPROM image
+    uint32_t rec_crc;    // CRC32 of the records
+    uint32_t hdr_crc;    // CRC32 of the preceding header fields
+} stage_hdr_t;
+
+typedef struct {
+    uint32_t len;    // EEPROM bytes covered by this record
+    uint16_t fill;   // Fill word (STAGE_REC_FILL)
+    uint16_t flags;  // STAGE_REC_*
+} stage_rec_t;
+
+/*
+ * Verify mismatch statistics per EEPROM data and address line. Must match
+ * the programmer's mx_line_stats_t, so that a report from either side
+ * reads the same.
+ */
+#define DQ_LINES   16
+#define ADDR_LINES 20
+
+typedef struct {
+    uint32_t words;                  // Words compared
+    uint32_t bad;                    // Words which mismatched
+    uint32_t dq_stuck0[DQ_LINES];    // Read DQn=0 where 1 expected
+    uint32_t dq_stuck1[DQ_LINES];    // Read DQn=1 where 0 expected
+    uint32_t a_one[ADDR_LINES];      // Words compared with An=1
+    uint32_t a_stuck0[ADDR_LINES];   // Mismatched words with An=1
+    uint32_t a_stuck1[ADDR_LINES];   // Mismatched words with An=0
+} line_stats_t;
+
 /*
  * ARRAY_SIZE() provides a count of the number of elements in an array.
  *              This macro works the same as the Linux kernel header
@@ -162,7 +417,15 @@ static volatile uint    rx_rb_consumer    = 0;
 static volatile uint8_t  tx_rb[TX_RING_SIZE];
 static volatile uint    tx_rb_producer = 0;
 static volatile uint    tx_rb_consumer = 0;
+static volatile uint8_t brx_rb[RX_RING_SIZE];       // Bulk data receive
+static volatile uint    brx_rb_producer   = 0;
+static volatile uint    brx_rb_consumer   = 0;
 static int              dev_fd            = -1;
+static volatile int     bulk_fd           = -1;     // Bulk data interface
+static volatile bool    bulk_failed       = FALSE;  // Bulk reader error
+static bool             usbfs_mode        = FALSE;  // -U usbdevfs transport
+static bool             bulk_disabled     = FALSE;  // -N binary on console
+static volatile int     usbfs_fd          = -1;     // usbdevfs transport
 static int              got_terminfo      = 0;
 static int              running           = 1;
 static uint             ic_delay          = 0;  // Pacing delay (ms)
@@ -170,6 +433,36 @@ static char             device_name[PATH_MAX];
 static struct termios   saved_term;  // good terminal settings
 static bool             terminal_mode     = FALSE;
 static bool             force_yes         = FALSE;
+static bool             show_progress     = TRUE;
+static extent_t         extent_list[EXTENT_MAX];
+static uint             extent_count      = 0;
+static uint             split_size        = 0;      // Bank size for -s
+static bool             link_dups         = FALSE;  // Hard link dup banks
+static volatile bool    xfer_active       = FALSE;  // Binary transfer busy
+static bool             fec_mode          = FALSE;  // FEC on transfers
+static uint             fec_fixed         = 0;      // Bytes FEC corrected
+static double           tm_value[TM_COUNT];         // Timing model
+static uint             tm_samples[TM_COUNT];       // Samples in model
+static bool             tm_dirty          = FALSE;  // Model needs save
+static char             tm_path[PATH_MAX];          // Model file
+static line_stats_t     line_stats;                 // Verify line errors
+static double           spot_confidence   = 0;      // Spot-check (-V) %
+static uint64_t         spot_seed         = 0;      // Spot-check seed
+static const char      *archive_dir       = NULL;   // Dump archive (-R)
+
+static const char * const tm_name[TM_COUNT] = {
+    "link_bytes_per_sec", "page_usec", "sector_erase_usec", "chip_erase_usec",
+    "crc_bytes_per_sec"
+};
+
+/* Used until a board has been measured (datasheet and bench values) */
+static const double tm_default[TM_COUNT] = {
+    500000,    // Link
+    2000,      // Page program and read-back
+    2500000,   // Sector erase (measured about 2.5 sec)
+    40000000,  // Chip erase (datasheet 32-256 sec)
+    2000000    // CRC of EEPROM on the programmer (unmeasured guess)
+};
 
 
 /*
@@ -275,6 +568,433 @@ crc32(uint32_t crc, const void *buf, size_t len)
     return (crc);
 }
 
+/*
+ * SHA-256 (FIPS 180-4), used to name the sectors of the dump archive (-R).
+ */
+typedef struct {
+    uint32_t state[8];
+    uint64_t count;     // Bytes hashed
+    uint8_t  buf[64];   // Partial block
+} sha256_t;
+
+#define SHA256_LEN 32   // Digest bytes
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * sha256_block() applies the SHA-256 compression function to one 64-byte
+ *                block.
+ *
+ * @param  [io]  ctx   - Hash state.
+ * @param  [in]  block - The block to hash.
+ * @return       None.
+ */
+static void
+sha256_block(sha256_t *ctx, const uint8_t *block)
+{
+    uint32_t w[64];
+    uint32_t v[8];
+    uint32_t t1;
+    uint32_t t2;
+    uint     cur;
+
+    for (cur = 0; cur < 16; cur++) {
+        w[cur] = ((uint32_t) block[cur * 4] << 24) |
+                 ((uint32_t) block[cur * 4 + 1] << 16) |
+                 ((uint32_t) block[cur * 4 + 2] << 8) |
+                 block[cur * 4 + 3];
+    }
+    for (; cur < 64; cur++) {
+        w[cur] = w[cur - 16] + w[cur - 7] +
+                 (ROR32(w[cur - 15], 7) ^ ROR32(w[cur - 15], 18) ^
+                  (w[cur - 15] >> 3)) +
+                 (ROR32(w[cur - 2], 17) ^ ROR32(w[cur - 2], 19) ^
+                  (w[cur - 2] >> 10));
+    }
+    memcpy(v, ctx->state, sizeof (v));
+    for (cur = 0; cur < 64; cur++) {
+        t1 = v[7] + (ROR32(v[4], 6) ^ ROR32(v[4], 11) ^ ROR32(v[4], 25)) +
+             ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256_k[cur] + w[cur];
+        t2 = (ROR32(v[0], 2) ^ ROR32(v[0], 13) ^ ROR32(v[0], 22)) +
+             ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, sizeof (v[0]) * 7);
+        v[4] += t1;
+        v[0]  = t1 + t2;
+    }
+    for (cur = 0; cur < 8; cur++)
+        ctx->state[cur] += v[cur];
+}
+
+/*
+ * sha256_init() starts a new SHA-256 calculation.
+ *
+ * @param  [out] ctx - Hash state.
+ * @return       None.
+ */
+static void
+sha256_init(sha256_t *ctx)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, iv, sizeof (iv));
+    ctx->count = 0;
+}
+
+/*
+ * sha256_update() adds data to a SHA-256 calculation.
+ *
+ * @param  [io]  ctx - Hash state.
+ * @param  [in]  buf - Data to hash.
+ * @param  [in]  len - Length of data.
+ * @return       None.
+ */
+static void
+sha256_update(sha256_t *ctx, const void *buf, size_t len)
+{
+    const uint8_t *ptr  = buf;
+    uint           have = ctx->count % 64;
+
+    ctx->count += len;
+    if (have != 0) {
+        uint take = 64 - have;
+        if (take > len)
+            take = len;
+        memcpy(ctx->buf + have, ptr, take);
+        ptr += take;
+        len -= take;
+        if (have + take < 64)
+            return;
+        sha256_block(ctx, ctx->buf);
+    }
+    for (; len >= 64; ptr += 64, len -= 64)
+        sha256_block(ctx, ptr);
+    memcpy(ctx->buf, ptr, len);
+}
+
+/*
+ * sha256_final() pads the message and returns the digest.
+ *
+ * @param  [io]  ctx    - Hash state.
+ * @param  [out] digest - SHA256_LEN byte digest.
+ * @return       None.
+ */
+static void
+sha256_final(sha256_t *ctx, uint8_t *digest)
+{
+    uint64_t bits = ctx->count * 8;
+    uint8_t  pad[72];
+    uint     padlen = 64 - ((ctx->count + 8) % 64);
+    uint     cur;
+
+    memset(pad, 0, sizeof (pad));
+    pad[0] = 0x80;
+    for (cur = 0; cur < 8; cur++)
+        pad[padlen + cur] = bits >> (56 - cur * 8);
+    sha256_update(ctx, pad, padlen + 8);
+    for (cur = 0; cur < 8; cur++) {
+        digest[cur * 4]     = ctx->state[cur] >> 24;
+        digest[cur * 4 + 1] = ctx->state[cur] >> 16;
+        digest[cur * 4 + 2] = ctx->state[cur] >> 8;
+        digest[cur * 4 + 3] = ctx->state[cur];
+    }
+}
+
+/*
+ * Interleaved Reed-Solomon forward error correction (-F), which must match
+ * the programmer firmware (fec.c). A block of up to 256 data bytes plus
+ * its 4-byte CRC is split into FEC_DEPTH codewords, where byte n of the
+ * block belongs to codeword (n % FEC_DEPTH). Each codeword is a shortened
+ * RS(255,251) code over GF(256) which corrects up to 2 bad bytes, so a
+ * burst of up to 8 bad bytes in a block can be corrected. The parity
+ * follows the block CRC and continues the same interleave: parity byte
+ * n belongs to codeword ((len + n) % FEC_DEPTH), so a burst which reaches
+ * into the parity is spread across codewords in the same way.
+ */
+#define GF_POLY 0x11d  // x^8 + x^4 + x^3 + x^2 + 1
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t rs_gen[FEC_NPAR + 1];  // Generator polynomial, rs_gen[0] = x^0
+static bool    fec_ready;
+
+/*
+ * gf_mul() multiplies two GF(256) elements.
+ */
+static uint8_t
+gf_mul(uint8_t a, uint8_t b)
+{
+    if ((a == 0) || (b == 0))
+        return (0);
+    return (gf_exp[gf_log[a] + gf_log[b]]);
+}
+
+/*
+ * gf_div() divides two GF(256) elements. The divisor must not be zero.
+ */
+static uint8_t
+gf_div(uint8_t a, uint8_t b)
+{
+    if (a == 0)
+        return (0);
+    return (gf_exp[gf_log[a] + 255 - gf_log[b]]);
+}
+
+/*
+ * fec_init() builds the GF(256) tables and the RS generator polynomial
+ *            (x - a^0)(x - a^1)...(x - a^(FEC_NPAR-1)).
+ */
+static void
+fec_init(void)
+{
+    uint x = 1;
+    uint i;
+    uint j;
+
+    for (i = 0; i < 255; i++) {
+        gf_exp[i] = x;
+        gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLY;
+    }
+    gf_exp[510] = gf_exp[0];
+    gf_exp[511] = gf_exp[1];
+
+    memset(rs_gen, 0, sizeof (rs_gen));
+    rs_gen[0] = 1;
+    for (i = 0; i < FEC_NPAR; i++) {
+        for (j = i + 1; j > 0; j--)
+            rs_gen[j] = rs_gen[j - 1] ^ gf_mul(rs_gen[j], gf_exp[i]);
+        rs_gen[0] = gf_mul(rs_gen[0], gf_exp[i]);
+    }
+    fec_ready = true;
+}
+
+/*
+ * rs_encode() computes the parity of one codeword, whose data bytes are
+ *             every <stride> bytes of buf. The parity bytes are stored
+ *             every <stride> bytes of parity.
+ */
+static void
+rs_encode(const uint8_t *buf, uint count, uint stride, uint8_t *parity)
+{
+    uint8_t par[FEC_NPAR];
+    uint    pos;
+    uint    j;
+    uint8_t fb;
+
+    memset(par, 0, sizeof (par));
+    for (pos = 0; pos < count; pos++, buf += stride) {
+        fb = *buf ^ par[0];
+        for (j = 0; j < FEC_NPAR - 1; j++)
+            par[j] = par[j + 1] ^ gf_mul(fb, rs_gen[FEC_NPAR - 1 - j]);
+        par[FEC_NPAR - 1] = gf_mul(fb, rs_gen[0]);
+    }
+    for (j = 0; j < FEC_NPAR; j++)
+        parity[j * stride] = par[j];
+}
+
+/*
+ * rs_symbol() returns a pointer to symbol <pos> of a codeword. Data
+ *             symbols come first, followed by the parity symbols.
+ */
+static uint8_t *
+rs_symbol(uint8_t *buf, uint count, uint stride, uint8_t *parity, uint pos)
+{
+    if (pos < count)
+        return (buf + pos * stride);
+    return (parity + (pos - count) * stride);
+}
+
+/*
+ * rs_syndromes() computes the codeword syndromes.
+ *
+ * @return      true if any syndrome is non-zero (codeword has errors).
+ */
+static bool
+rs_syndromes(uint8_t *buf, uint count, uint stride, uint8_t *parity,
+             uint8_t *synd)
+{
+    uint    n = count + FEC_NPAR;
+    uint    pos;
+    uint    j;
+    uint8_t bad = 0;
+
+    for (j = 0; j < FEC_NPAR; j++) {
+        uint8_t s = 0;
+        for (pos = 0; pos < n; pos++)
+            s = gf_mul(s, gf_exp[j]) ^
+                *rs_symbol(buf, count, stride, parity, pos);
+        synd[j] = s;
+        bad |= s;
+    }
+    return (bad != 0);
+}
+
+/*
+ * rs_decode() corrects one codeword in place. The Berlekamp-Massey
+ *             algorithm finds the error locator, a Chien search finds the
+ *             error positions, and the Forney algorithm the error values.
+ *
+ * @return      Number of bytes corrected, or -1 if uncorrectable.
+ */
+static int
+rs_decode(uint8_t *buf, uint count, uint stride, uint8_t *parity)
+{
+    uint8_t synd[FEC_NPAR];
+    uint8_t lambda[FEC_NPAR + 1];  // Error locator
+    uint8_t prev[FEC_NPAR + 1];    // Previous locator
+    uint8_t temp[FEC_NPAR + 1];
+    uint8_t omega[FEC_NPAR];       // Error evaluator
+    uint8_t b = 1;
+    uint    n = count + FEC_NPAR;
+    uint    len = 0;               // Number of errors located
+    uint    shift = 1;
+    uint    found = 0;
+    uint    pos;
+    uint    i;
+    uint    j;
+
+    if (rs_syndromes(buf, count, stride, parity, synd) == false)
+        return (0);
+
+    memset(lambda, 0, sizeof (lambda));
+    memset(prev, 0, sizeof (prev));
+    lambda[0] = 1;
+    prev[0] = 1;
+    for (i = 0; i < FEC_NPAR; i++) {
+        uint8_t d = synd[i];
+        uint8_t coef;
+        for (j = 1; j <= len; j++)
+            d ^= gf_mul(lambda[j], synd[i - j]);
+        if (d == 0) {
+            shift++;
+            continue;
+        }
+        coef = gf_div(d, b);
+        memcpy(temp, lambda, sizeof (temp));
+        for (j = 0; j + shift <= FEC_NPAR; j++)
+            lambda[j + shift] ^= gf_mul(coef, prev[j]);
+        if (2 * len <= i) {
+            len = i + 1 - len;
+            memcpy(prev, temp, sizeof (prev));
+            b = d;
+            shift = 1;
+        } else {
+            shift++;
+        }
+    }
+    if (len > FEC_NPAR / 2)
+        return (-1);
+
+    for (i = 0; i < FEC_NPAR; i++) {
+        omega[i] = 0;
+        for (j = 0; j <= i; j++)
+            omega[i] ^= gf_mul(synd[j], lambda[i - j]);
+    }
+
+    for (pos = 0; pos < n; pos++) {
+        uint    power = n - 1 - pos;        // Symbol is coefficient of x^power
+        uint    xinv  = (255 - power) % 255;  // log of X^-1
+        uint8_t lval  = 0;
+        uint8_t dval  = 0;
+        uint8_t oval  = 0;
+
+        for (j = 0; j <= len; j++)
+            lval ^= gf_mul(lambda[j], gf_exp[(xinv * j) % 255]);
+        if (lval != 0)
+            continue;
+
+        /* Forney: e = X * omega(X^-1) / lambda'(X^-1) */
+        for (j = 1; j <= len; j += 2)
+            dval ^= gf_mul(lambda[j], gf_exp[(xinv * (j - 1)) % 255]);
+        for (j = 0; j < FEC_NPAR; j++)
+            oval ^= gf_mul(omega[j], gf_exp[(xinv * j) % 255]);
+        if (dval == 0)
+            return (-1);
+        *rs_symbol(buf, count, stride, parity, pos) ^=
+            gf_mul(gf_exp[power], gf_div(oval, dval));
+        found++;
+    }
+    if ((found != len) ||
+        rs_syndromes(buf, count, stride, parity, synd))
+        return (-1);
+    return (found);
+}
+
+/*
+ * fec_encode() computes the interleaved parity of a block.
+ *
+ * @param [in]  buf    - Block data (up to 255 * FEC_DEPTH - FEC_NPAR bytes).
+ * @param [in]  len    - Length of block data.
+ * @param [out] parity - FEC_PARITY_LEN bytes of parity.
+ *
+ * @return      None.
+ */
+static void
+fec_encode(const uint8_t *buf, uint len, uint8_t *parity)
+{
+    uint cw;
+
+    if (fec_ready == false)
+        fec_init();
+    for (cw = 0; cw < FEC_DEPTH; cw++) {
+        uint count = (len > cw) ? (len - cw + FEC_DEPTH - 1) / FEC_DEPTH : 0;
+        rs_encode(buf + cw, count, FEC_DEPTH,
+                  parity + FEC_PARITY_POS(len, cw));
+    }
+}
+
+/*
+ * fec_decode() corrects a received block and its parity in place.
+ *
+ * @param [io]  buf    - Block data.
+ * @param [in]  len    - Length of block data.
+ * @param [io]  parity - FEC_PARITY_LEN bytes of parity.
+ *
+ * @return      Number of bytes corrected, or -1 if uncorrectable.
+ */
+static int
+fec_decode(uint8_t *buf, uint len, uint8_t *parity)
+{
+    uint cw;
+    int  fixed = 0;
+
+    if (fec_ready == false)
+        fec_init();
+    for (cw = 0; cw < FEC_DEPTH; cw++) {
+        uint count = (len > cw) ? (len - cw + FEC_DEPTH - 1) / FEC_DEPTH : 0;
+        int  rc = rs_decode(buf + cw, count, FEC_DEPTH,
+                            parity + FEC_PARITY_POS(len, cw));
+        if (rc < 0)
+            return (-1);
+        fixed += rc;
+    }
+    return (fixed);
+}
+
 /*
  * atou() converts a numeric string into an integer.
  */
@@ -418,6 +1138,65 @@ tx_rb_flushed(void)
         return (FALSE);  // Ring buffer has output pending
 }
 
+/*
+ * brx_rb_put() stores a character received on the bulk data interface.
+ *
+ * @param [in]  ch - The character to store in the bulk receive ring buffer.
+ *
+ * @return      0 = Success.
+ * @return      1 = Failure (ring buffer is full).
+ */
+static int
+brx_rb_put(int ch)
+{
+    uint new_prod = (brx_rb_producer + 1) % sizeof (brx_rb);
+
+    if (new_prod == brx_rb_consumer)
+        return (1);  // Discard input because ring buffer is full
+
+    brx_rb[brx_rb_producer] = (uint8_t) ch;
+    brx_rb_producer = new_prod;
+    return (0);
+}
+
+/*
+ * brx_rb_get() returns the next character received on the bulk data
+ *              interface, or -1 if there is none pending.
+ *
+ * @param  [in]  None.
+ * @return       The next input character.
+ * @return       -1 = No characters are pending.
+ */
+static int
+brx_rb_get(void)
+{
+    int ch;
+
+    if (brx_rb_consumer == brx_rb_producer)
+        return (-1);  // Ring buffer empty
+
+    ch = brx_rb[brx_rb_consumer];
+    brx_rb_consumer = (brx_rb_consumer + 1) % sizeof (brx_rb);
+    return (ch);
+}
+
+/*
+ * bin_rb_get() returns the next character of binary transfer data. This
+ *              comes from the bulk data interface when it is open, and
+ *              otherwise from the serial console.
+ *
+ * @param  [in]  None.
+ * @return       The next input character.
+ * @return       -1 = No characters are pending.
+ */
+static int
+bin_rb_get(void)
+{
+    if (bulk_fd != -1)
+        return (brx_rb_get());
+    return (rx_rb_get());
+}
+
 
 /*
  * time_delay_msec() will delay for a specified number of milliseconds.
@@ -434,69 +1213,610 @@ time_delay_msec(int msec)
 }
 
 /*
- * send_ll_bin() sends a binary block of data to the remote programmer.
+ * time_usec() returns a monotonic timestamp in microseconds.
  *
- * @param  [in] data  - Data to send to the programmer.
- * @param  [in] len   - Number of bytes to send.
+ * @param [in]  None.
+ *
+ * @return      Current time in microseconds.
  */
-static int
-send_ll_bin(uint8_t *data, size_t len)
+static uint64_t
+time_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*
+ * Timeline trace (--timeline <file>). Begin/end spans and instant events
+ * from all threads are appended to the file in Chrome trace event format
+ * as they occur, so the file may be opened in chrome://tracing or the
+ * Perfetto UI. Each event is a single write() to a file opened O_APPEND,
+ * so events from the reader, writer, and main threads (and from both
+ * processes of a -p pair job) do not interleave. No lock is taken, so
+ * events may also be recorded from a signal handler (sig_exit() aborts
+ * a transfer) which interrupted tl_write().
+ */
+#define TL_TID_MAIN   1
+#define TL_TID_READER 2
+#define TL_TID_WRITER 3
+#define TL_TID_BULK   4
+
+static int             tl_fd    = -1;   // Timeline trace file
+static pid_t           tl_owner = 0;    // Process which closes the trace
+static uint64_t        tl_start = 0;    // Time of first event
+static _Thread_local int tl_tid = TL_TID_MAIN;
+
+/*
+ * tl_quote() copies a string into a JSON string body, escaping characters
+ *            which are special to JSON.
+ */
+static void
+tl_quote(char *buf, size_t buflen, const char *str)
 {
-    int timeout_count = 0;
     size_t pos = 0;
 
-    while (pos < len) {
-        if (tx_rb_put(*data)) {
-            time_delay_msec(1);
-            if (timeout_count++ >= 500) {
-                printf("Send timeout at 0x%zx\n", pos);
-                return (1);  // Timeout
-            }
-            printf("-\n"); fflush(stdout);  // XXX: shouldn't happen
-            continue;        // Try again
+    for (; (*str != '\0') && (pos + 7 < buflen); str++) {
+        if ((*str == '"') || (*str == '\\')) {
+            buf[pos++] = '\\';
+            buf[pos++] = *str;
+        } else if ((uint8_t) *str < ' ') {
+            pos += sprintf(buf + pos, "\\u%04x", (uint8_t) *str);
+        } else {
+            buf[pos++] = *str;
         }
-        timeout_count = 0;
-        data++;
-        pos++;
     }
-    return (0);
+    buf[pos] = '\0';
 }
 
 /*
- * config_dev() will configure the serial device used for communicating
- *              with the programmer.
- *
- * @param  [in]  fd - Opened file descriptor for serial device.
- * @return       RC_FAILURE - Failed to configure device.
+ * tl_write() appends one formatted event to the timeline trace file.
  */
-static rc_t
-config_dev(int fd)
+static void
+tl_write(const char *name, char ph, const char *args)
 {
-    struct termios tty;
-
-    if (flock(fd, LOCK_EX | LOCK_NB) < 0)
-        warnx("Failed to get exclusive lock on %s", device_name);
-
-#ifdef OSX
-    /* Disable non-blocking */
-    if (fcntl(fd, F_SETFL, 0) < 0)
-        warnx("Failed to enable blocking on %s", device_name);
-#endif
+    char     line[512];
+    char     qargs[256];
+    int      len;
+    int      fd  = tl_fd;
+    uint64_t now = time_usec() - tl_start;
+
+    qargs[0] = '\0';
+    if (args != NULL)
+        tl_quote(qargs, sizeof (qargs), args);
+    len = snprintf(line, sizeof (line),
+                   ",\n{\"name\":\"%s\",\"cat\":\"mxprog\",\"ph\":\"%c\","
+                   "\"ts\":%ju,\"pid\":%d,\"tid\":%d%s%s%s%s}",
+                   name, ph, (uintmax_t) now, (int) getpid(), tl_tid,
+                   (ph == 'i') ? ",\"s\":\"t\"" : "",
+                   (args != NULL) ?
+                   ((ph == 'M') ? ",\"args\":{\"name\":\"" :
+                                  ",\"args\":{\"detail\":\"") : "",
+                   qargs, (args != NULL) ? "\"}" : "");
+    if (len >= (int) sizeof (line))
+        len = sizeof (line) - 1;
+
+    /* On failure, stop tracing; another thread may still be using fd */
+    if ((fd != -1) && (write(fd, line, len) != len)) {
+        tl_fd = -1;
+        warn("Timeline write failed");
+    }
+}
 
-    (void) memset(&tty, 0, sizeof (tty));
+/*
+ * tl_event() records a timeline event with optional printf-style detail.
+ *
+ * @param [in]  ph   - Chrome trace phase: 'B' begin, 'E' end, 'i' instant,
+ *                     or 'M' metadata (fmt is then the process or thread
+ *                     name).
+ * @param [in]  name - Event name (a JSON-safe literal).
+ * @param [in]  fmt  - Detail format string, or NULL for no detail.
+ *
+ * @return      None.
+ */
+static void __attribute__((format(printf, 3, 4)))
+tl_event(char ph, const char *name, const char *fmt, ...)
+{
+    char    detail[200];
+    va_list ap;
 
-    if (tcgetattr(fd, &tty) != 0) {
-        /* Failed to get terminal information */
-        warn("Failed to get tty info for %s", device_name);
-        close(fd);
-        return (RC_FAILURE);
+    if (tl_fd == -1)
+        return;
+    if (fmt == NULL) {
+        tl_write(name, ph, NULL);
+        return;
     }
+    va_start(ap, fmt);
+    vsnprintf(detail, sizeof (detail), fmt, ap);
+    va_end(ap);
+    tl_write(name, ph, detail);
+}
 
-#undef DEBUG_TTY
-#ifdef DEBUG_TTY
-    printf("tty: pre  c=%x i=%x o=%x l=%x\n",
-           tty.c_cflag, tty.c_iflag, tty.c_oflag, tty.c_lflag);
-#endif
+#define tl_begin(name, ...)   tl_event('B', name, __VA_ARGS__)
+#define tl_end(name)          tl_event('E', name, NULL)
+#define tl_instant(name, ...) tl_event('i', name, __VA_ARGS__)
+
+/*
+ * tl_thread() names the calling thread in the timeline.
+ *
+ * @param [in]  tid  - Timeline thread id (TL_TID_*).
+ * @param [in]  name - Thread name.
+ *
+ * @return      None.
+ */
+static void
+tl_thread(int tid, const char *name)
+{
+    tl_tid = tid;
+    tl_event('M', "thread_name", "%s", name);
+}
+
+/*
+ * tl_close() terminates the timeline trace file at program exit.
+ */
+static void
+tl_close(void)
+{
+    static const char tail[] = "\n]}\n";
+    int               fd = tl_fd;
+
+    if ((fd != -1) && (getpid() == tl_owner)) {
+        tl_fd = -1;
+        if (write(fd, tail, sizeof (tail) - 1) != sizeof (tail) - 1)
+            warn("Timeline write failed");
+        close(fd);
+    }
+}
+
+/*
+ * tl_open() starts a timeline trace, which is written to the specified
+ *           file until the program exits.
+ *
+ * @param [in]  filename - Trace file to create.
+ *
+ * @return      None.
+ * @exit        EXIT_FAILURE - The file could not be created.
+ */
+static void
+tl_open(const char *filename)
+{
+    char head[160];
+    int  len;
+
+    /* The first event has no leading separator; tl_write() adds one */
+    len = snprintf(head, sizeof (head),
+                   "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                   "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                   "\"args\":{\"name\":\"mxprog\"}}", (int) getpid());
+    tl_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (tl_fd == -1)
+        err(EXIT_FAILURE, "Failed to create %s", filename);
+    if (write(tl_fd, head, len) != len)
+        err(EXIT_FAILURE, "Failed to write %s", filename);
+    tl_owner = getpid();
+    tl_start = time_usec();
+    atexit(tl_close);
+    tl_thread(TL_TID_MAIN, "main");
+}
+
+/*
+ * bulk_close() stops use of the bulk data interface. Binary transfers
+ *              revert to the serial console.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+bulk_close(void)
+{
+    int fd = bulk_fd;
+
+    bulk_fd = -1;
+    if (fd != -1)
+        close(fd);
+}
+
+/*
+ * bulk_check() closes the bulk data interface if the bulk reader thread
+ *              found that it failed. This is called only between transfers,
+ *              so that a transfer never changes path part way through.
+ *              Binary transfers then revert to the serial console.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+bulk_check(void)
+{
+    if (bulk_failed == FALSE)
+        return;
+    bulk_failed = FALSE;
+    bulk_close();
+    while (brx_rb_get() != -1)
+        ;  // Discard partial binary data
+}
+
+/*
+ * bulk_send() sends a binary block of data to the programmer on the bulk
+ *             data interface.
+ *
+ * @param  [in] data  - Data to send to the programmer.
+ * @param  [in] len   - Number of bytes to send.
+ *
+ * @return      0 - Data was sent.
+ * @return      1 - A timeout or error occurred.
+ */
+static int
+bulk_send(uint8_t *data, size_t len)
+{
+#ifdef LINUX
+    struct usbdevfs_bulktransfer bt;
+
+    bt.ep      = BULK_EP_OUT;
+    bt.len     = len;
+    bt.timeout = BULK_TIMEOUT;
+    bt.data    = data;
+    tl_begin("bulk_send", "%zu bytes", len);
+    if (ioctl(bulk_fd, USBDEVFS_BULK, &bt) != (int) len) {
+        tl_end("bulk_send");
+        warn("Bulk send of %zu bytes failed", len);
+        return (1);
+    }
+    tl_end("bulk_send");
+    return (0);
+#else
+    return (1);
+#endif
+}
+
+/*
+ * sysfs_read() reads the first line of a sysfs attribute file.
+ *
+ * @param  [in]  dir    - sysfs directory.
+ * @param  [in]  attr   - Attribute within directory.
+ * @param  [out] buf    - Buffer to hold value.
+ * @param  [in]  buflen - Size of buffer.
+ * @return       0 - Success.
+ * @return       1 - Attribute could not be read.
+ */
+static int
+sysfs_read(const char *dir, const char *attr, char *buf, size_t buflen)
+{
+    char  path[PATH_MAX];
+    FILE *fp;
+
+    snprintf(path, sizeof (path), "%s/%s", dir, attr);
+    if ((fp = fopen(path, "r")) == NULL)
+        return (1);
+    if (fgets(buf, buflen, fp) == NULL) {
+        fclose(fp);
+        return (1);
+    }
+    fclose(fp);
+    buf[strcspn(buf, "\n")] = '\0';
+    return (0);
+}
+
+/*
+ * usb_sysfs_find() locates the sysfs directory of the programmer's USB
+ *                  device, starting from the console tty, or from a
+ *                  usbdevfs node (/dev/bus/usb/<bus>/<dev>) given with -d.
+ *                  The result is remembered, because the console tty goes
+ *                  away while the usbdevfs transport (-U) has the device.
+ *
+ * @param  [in]  None.
+ * @return       sysfs directory of the USB device.
+ * @return       NULL - The device is not an MX programmer on USB.
+ */
+static const char *
+usb_sysfs_find(void)
+{
+#ifdef LINUX
+    static char usbdev[PATH_MAX];
+    char        tty[PATH_MAX];
+    char        path[PATH_MAX];
+    char        value[32];
+    char       *name;
+    uint        busnum;
+    uint        devnum;
+
+    if (usbdev[0] != '\0')
+        return (usbdev);
+
+    if (sscanf(device_name, USBFS_DEV_DIR "/%u/%u", &busnum, &devnum) == 2) {
+        DIR           *dirp;
+        struct dirent *dent;
+        uint           bus;
+        uint           dev;
+
+        if ((dirp = opendir(USBFS_SYSFS_DIR)) == NULL)
+            return (NULL);
+        while ((dent = readdir(dirp)) != NULL) {
+            /* Interfaces are named <dev>:<config>.<iface> */
+            if ((dent->d_name[0] == '.') || (strchr(dent->d_name, ':')))
+                continue;
+            snprintf(path, sizeof (path), "%s/%s",
+                     USBFS_SYSFS_DIR, dent->d_name);
+            if ((sysfs_read(path, "busnum", value, sizeof (value)) == 0) &&
+                (sscanf(value, "%u", &bus) == 1) && (bus == busnum) &&
+                (sysfs_read(path, "devnum", value, sizeof (value)) == 0) &&
+                (sscanf(value, "%u", &dev) == 1) && (dev == devnum)) {
+                strcpy(usbdev, path);
+                break;
+            }
+        }
+        closedir(dirp);
+    } else {
+        if (realpath(device_name, tty) == NULL)
+            return (NULL);
+        name = strrchr(tty, '/');
+        name = (name == NULL) ? tty : name + 1;
+
+        /* /sys/class/tty/ttyACM0/device is the CDC interface of the device */
+        if ((snprintf(path, sizeof (path), "/sys/class/tty/%s/device",
+                      name) >= (int) sizeof (path)) ||
+            (realpath(path, usbdev) == NULL) ||
+            ((name = strrchr(usbdev, '/')) == NULL)) {
+            usbdev[0] = '\0';
+            return (NULL);  // Not a USB tty
+        }
+        *name = '\0';  // Parent is the USB device
+    }
+
+    if ((usbdev[0] == '\0') ||
+        (sysfs_read(usbdev, "idVendor", value, sizeof (value)) != 0) ||
+        (strtoul(value, NULL, 16) != MX_VENDOR) ||
+        (sysfs_read(usbdev, "idProduct", value, sizeof (value)) != 0) ||
+        (strtoul(value, NULL, 16) != MX_DEVICE)) {
+        usbdev[0] = '\0';
+        return (NULL);
+    }
+    return (usbdev);
+#else
+    return (NULL);
+#endif
+}
+
+/*
+ * usb_dev_node() generates the usbdevfs node name of a USB device. The
+ *                device number changes each time the device enumerates,
+ *                so it is read from sysfs again each time.
+ *
+ * @param  [in]  usbdev - sysfs directory of the USB device.
+ * @param  [out] buf    - Buffer to hold the node name.
+ * @param  [in]  buflen - Size of the buffer.
+ * @return       0 - Success.
+ * @return       1 - The device is not present.
+ */
+static int
+usb_dev_node(const char *usbdev, char *buf, size_t buflen)
+{
+    char value[32];
+    uint busnum;
+    uint devnum;
+
+    if ((sysfs_read(usbdev, "busnum", value, sizeof (value)) != 0) ||
+        (sscanf(value, "%u", &busnum) != 1) ||
+        (sysfs_read(usbdev, "devnum", value, sizeof (value)) != 0) ||
+        (sscanf(value, "%u", &devnum) != 1))
+        return (1);
+    snprintf(buf, buflen, "%s/%03u/%03u", USBFS_DEV_DIR, busnum, devnum);
+    return (0);
+}
+
+/*
+ * bulk_open() locates and claims the programmer's bulk data interface,
+ *             which shares a USB device with the serial console. Binary
+ *             transfers then travel on the bulk endpoints, separate from
+ *             console text. If the interface is not present (older
+ *             firmware, or not Linux), binary transfers use the console.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+bulk_open(void)
+{
+#ifdef LINUX
+    const char *usbdev = usb_sysfs_find();
+    const char *name;
+    char        path[PATH_MAX + 16];
+    char        value[32];
+    uint        iface = BULK_IFACE;
+    int         fd;
+
+    if (usbdev == NULL)
+        return;
+    name = strrchr(usbdev, '/');
+    if ((snprintf(path, sizeof (path), "%s/%s:1.%u",
+                  usbdev, name + 1, BULK_IFACE) >= (int) sizeof (path)) ||
+        (sysfs_read(path, "bInterfaceClass", value, sizeof (value)) != 0) ||
+        (strtoul(value, NULL, 16) != 0xff))
+        return;  // Firmware does not provide the bulk data interface
+    if (usb_dev_node(usbdev, path, sizeof (path)) != 0)
+        return;
+
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        warn("Bulk data interface unavailable; using console: %s", path);
+        return;
+    }
+    if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, &iface) < 0) {
+        warn("Failed to claim bulk data interface of %s", path);
+        close(fd);
+        return;
+    }
+    brx_rb_consumer = brx_rb_producer;
+    bulk_fd = fd;
+#endif
+}
+
+/*
+ * bulk_submit_in() submits a read URB on the bulk data IN endpoint.
+ *
+ * @param  [in]  fd  - Bulk data interface file descriptor.
+ * @param  [in]  urb - URB to submit.
+ * @param  [in]  buf - BULK_RX_SIZE byte buffer for received data.
+ * @return       0 - Success.
+ * @return       1 - The URB could not be submitted.
+ */
+#ifdef LINUX
+static int
+bulk_submit_in(int fd, struct usbdevfs_urb *urb, uint8_t *buf)
+{
+    memset(urb, 0, sizeof (*urb));
+    urb->type          = USBDEVFS_URB_TYPE_BULK;
+    urb->endpoint      = BULK_EP_IN;
+    urb->buffer        = buf;
+    urb->buffer_length = BULK_RX_SIZE;
+    return (ioctl(fd, USBDEVFS_SUBMITURB, urb) < 0);
+}
+#endif
+
+/*
+ * th_bulk_reader() is a thread to read from the bulk data interface and
+ *                  store data in the bulk receive ring buffer. Several
+ *                  read URBs are kept in flight, with no timeout, so that
+ *                  no received data is lost to a cancelled transfer. The
+ *                  programmer ends each transfer with a short or zero
+ *                  length packet, so reads larger than one packet complete
+ *                  as soon as the programmer has finished sending.
+ *
+ * @param [in]  arg - Unused argument.
+ *
+ * @return      NULL pointer (unused)
+ */
+static void *
+th_bulk_reader(void *arg)
+{
+#ifdef LINUX
+    static uint8_t       buf[BULK_RX_URBS][BULK_RX_SIZE];
+    struct usbdevfs_urb *urb[BULK_RX_URBS];
+    int                  error  = 0;     // errno of failure
+    int                  fd     = bulk_fd;
+    uint                 cur;
+
+    tl_thread(TL_TID_BULK, "bulk reader");
+    for (cur = 0; cur < BULK_RX_URBS; cur++) {
+        /* Not freed: the kernel may still own them when this thread ends */
+        urb[cur] = calloc(1, sizeof (*urb[cur]));
+        if (urb[cur] == NULL)
+            errx(EXIT_FAILURE, "Could not allocate URB");
+        if ((error == 0) && (bulk_submit_in(fd, urb[cur], buf[cur]) != 0))
+            error = errno;
+    }
+    while (running && (error == 0) && (bulk_fd == fd)) {
+        struct usbdevfs_urb *done;
+        struct pollfd        pfd;
+
+        /* usbdevfs reports completed URBs as writable */
+        pfd.fd      = fd;
+        pfd.events  = POLLOUT;
+        pfd.revents = 0;
+        (void) poll(&pfd, 1, 100);
+        while (error == 0) {
+            uint8_t *data;
+            int      pos;
+
+            if (ioctl(fd, USBDEVFS_REAPURBNDELAY, &done) != 0) {
+                if (errno != EAGAIN)
+                    error = errno;
+                break;  // Nothing more to reap
+            }
+            if (done->status != 0) {
+                error = -done->status;
+                break;
+            }
+            data = done->buffer;
+            tl_instant("bulk_rx", "%d bytes", done->actual_length);
+            for (pos = 0; pos < done->actual_length; pos++) {
+                while (brx_rb_put(data[pos]) == 1) {
+                    time_delay_msec(1);
+                    if (running == 0)
+                        break;
+                }
+            }
+            if (bulk_submit_in(fd, done, data) != 0)
+                error = errno;
+        }
+    }
+    if ((error != 0) && running && (bulk_fd == fd)) {
+        warnx("Bulk data interface read failed; using console: %s",
+              strerror(error));
+        bulk_failed = TRUE;  // Main thread closes it between transfers
+    }
+#endif
+    return (NULL);
+}
+
+/*
+ * send_ll_bin() sends a binary block of data to the remote programmer.
+ *
+ * @param  [in] data  - Data to send to the programmer.
+ * @param  [in] len   - Number of bytes to send.
+ */
+static int
+send_ll_bin(uint8_t *data, size_t len)
+{
+    int timeout_count = 0;
+    size_t pos = 0;
+
+    if (bulk_fd != -1)
+        return (bulk_send(data, len));
+
+    while (pos < len) {
+        if (tx_rb_put(*data)) {
+            time_delay_msec(1);
+            if (timeout_count++ >= 500) {
+                printf("Send timeout at 0x%zx\n", pos);
+                return (1);  // Timeout
+            }
+            printf("-\n"); fflush(stdout);  // XXX: shouldn't happen
+            continue;        // Try again
+        }
+        timeout_count = 0;
+        data++;
+        pos++;
+    }
+    return (0);
+}
+
+/*
+ * config_dev() will configure the serial device used for communicating
+ *              with the programmer.
+ *
+ * @param  [in]  fd - Opened file descriptor for serial device.
+ * @return       RC_FAILURE - Failed to configure device.
+ */
+static rc_t
+config_dev(int fd)
+{
+    struct termios tty;
+
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0)
+        warnx("Failed to get exclusive lock on %s", device_name);
+
+#ifdef OSX
+    /* Disable non-blocking */
+    if (fcntl(fd, F_SETFL, 0) < 0)
+        warnx("Failed to enable blocking on %s", device_name);
+#endif
+
+    (void) memset(&tty, 0, sizeof (tty));
+
+    if (tcgetattr(fd, &tty) != 0) {
+        /* Failed to get terminal information */
+        warn("Failed to get tty info for %s", device_name);
+        close(fd);
+        return (RC_FAILURE);
+    }
+
+#undef DEBUG_TTY
+#ifdef DEBUG_TTY
+    printf("tty: pre  c=%x i=%x o=%x l=%x\n",
+           tty.c_cflag, tty.c_iflag, tty.c_oflag, tty.c_lflag);
+#endif
 
     if (cfsetispeed(&tty, B115200) ||
         cfsetospeed(&tty, B115200)) {
@@ -555,28 +1875,443 @@ config_dev(int fd)
 }
 
 /*
- * reopen_dev() will wait for the serial device to reappear after it has
- *              disappeared.
+ * usbdevfs transport (-U). The cdc_acm driver is detached from the
+ * programmer's CDC interfaces, and mxprog issues bulk URBs on the CDC data
+ * endpoints itself, so that console I/O does not pass through the tty line
+ * discipline and termios. Several URBs are kept in flight in each direction.
+ * Each read URB is one packet, because the programmer does not end console
+ * output with a zero length packet; a larger read would wait for more data.
+ * The reader thread reaps all URBs: it passes received data to the receive
+ * ring buffer and resubmits, and frees write URBs for the writer thread.
+ * The device is released to cdc_acm again at exit.
+ */
+#ifdef LINUX
+typedef struct {
+    struct usbdevfs_urb *urb;                  // Allocated by usbfs_open()
+    volatile bool        busy;                 // Submitted, not yet reaped
+    uint8_t              buf[USBFS_URB_SIZE];
+} usbfs_urb_t;
+
+static usbfs_urb_t usbfs_in[USBFS_IN_URBS];
+static usbfs_urb_t usbfs_out[USBFS_OUT_URBS];
+static uint        usbfs_ep_in;                // CDC data IN endpoint
+static uint        usbfs_ep_out;               // CDC data OUT endpoint
+static uint        usbfs_in_len;               // IN endpoint packet size
+static pthread_t   usbfs_reader_thread;        // Reader thread
+#endif
+static volatile bool usbfs_stop;               // Reader thread must exit
+static volatile bool usbfs_reader_active;      // Reader thread is running
+
+/*
+ * usbfs_endpoints() finds the bulk endpoints of the CDC data interface
+ *                   in sysfs, so that a gadget stand-in which numbers its
+ *                   endpoints differently may also be used.
  *
- * @param  [in]  None.
- * @return       None.
+ * @param  [in]  usbdev - sysfs directory of the USB device.
+ * @return       0 - Both endpoints were found.
+ * @return       1 - The CDC data interface or an endpoint is missing.
  */
-static void
-reopen_dev(void)
+static int
+usbfs_endpoints(const char *usbdev)
 {
-    int           temp      = dev_fd;
-    static time_t last_time = 0;
-    time_t        now       = time(NULL);
-    bool_t        printed   = FALSE;
-    int           oflags    = O_NOCTTY;
+#ifdef LINUX
+    const char    *name = strrchr(usbdev, '/');
+    char           ifdir[PATH_MAX + 16];
+    char           epdir[PATH_MAX + NAME_MAX + 32];
+    char           type[16];
+    char           dir[16];
+    char           value[16];
+    DIR           *dirp;
+    struct dirent *dent;
 
-#ifdef OSX
-    oflags |= O_NONBLOCK;
+    usbfs_ep_in  = 0;
+    usbfs_ep_out = 0;
+    snprintf(ifdir, sizeof (ifdir), "%s/%s:1.%u",
+             usbdev, name + 1, USBFS_DATA_IFACE);
+    if ((dirp = opendir(ifdir)) == NULL)
+        return (1);
+    while ((dent = readdir(dirp)) != NULL) {
+        uint addr;
+        if (strncmp(dent->d_name, "ep_", 3) != 0)
+            continue;
+        snprintf(epdir, sizeof (epdir), "%s/%s", ifdir, dent->d_name);
+        if ((sysfs_read(epdir, "type", type, sizeof (type)) != 0) ||
+            (strcmp(type, "Bulk") != 0) ||
+            (sysfs_read(epdir, "direction", dir, sizeof (dir)) != 0) ||
+            (sysfs_read(epdir, "bEndpointAddress", value,
+                        sizeof (value)) != 0))
+            continue;
+        addr = strtoul(value, NULL, 16);
+        if (strcmp(dir, "out") == 0) {
+            usbfs_ep_out = addr;
+        } else if (strcmp(dir, "in") == 0) {
+            usbfs_ep_in  = addr;
+            usbfs_in_len = 64;
+            if (sysfs_read(epdir, "wMaxPacketSize", value,
+                           sizeof (value)) == 0)
+                usbfs_in_len = strtoul(value, NULL, 16) & 0x7ff;
+            if ((usbfs_in_len == 0) || (usbfs_in_len > USBFS_URB_SIZE))
+                usbfs_in_len = 64;
+        }
+    }
+    closedir(dirp);
+    return ((usbfs_ep_in == 0) || (usbfs_ep_out == 0));
+#else
+    return (1);
 #endif
+}
 
-    dev_fd = -1;
-    if (temp != -1) {
-        if (flock(temp, LOCK_UN | LOCK_NB) < 0)
+/*
+ * usbfs_control_line() sends a CDC SET_CONTROL_LINE_STATE request, which
+ *                      is how the tty layer raises and drops DTR.
+ *
+ * @param  [in]  fd    - usbdevfs file descriptor.
+ * @param  [in]  state - CDC_CONTROL_LINE_* bits.
+ * @return       0 - Success.
+ * @return       1 - The request failed.
+ */
+static int
+usbfs_control_line(int fd, uint state)
+{
+#ifdef LINUX
+    struct usbdevfs_ctrltransfer ctrl;
+
+    ctrl.bRequestType = 0x21;  // Host to device, class, interface
+    ctrl.bRequest     = CDC_REQ_SET_CONTROL_LINE;
+    ctrl.wValue       = state;
+    ctrl.wIndex       = USBFS_COMM_IFACE;
+    ctrl.wLength      = 0;
+    ctrl.timeout      = BULK_TIMEOUT;
+    ctrl.data         = NULL;
+    return (ioctl(fd, USBDEVFS_CONTROL, &ctrl) < 0);
+#else
+    return (1);
+#endif
+}
+
+/*
+ * usbfs_urb_alloc() allocates the URB of a transfer slot on first use.
+ *                   struct usbdevfs_urb ends in a flexible array, so it
+ *                   can not be embedded in the slot.
+ *
+ * @param  [io]  slot - Transfer slot.
+ * @return       None.
+ * @exit         EXIT_FAILURE - Out of memory.
+ */
+#ifdef LINUX
+static void
+usbfs_urb_alloc(usbfs_urb_t *slot)
+{
+    if (slot->urb != NULL)
+        return;
+    slot->urb = calloc(1, sizeof (*slot->urb));
+    if (slot->urb == NULL)
+        errx(EXIT_FAILURE, "Could not allocate URB");
+}
+#endif
+
+/*
+ * usbfs_submit_in() submits a read URB on the CDC data IN endpoint.
+ *
+ * @param  [in]  fd   - usbdevfs file descriptor.
+ * @param  [in]  slot - Read URB to submit.
+ * @return       0 - Success.
+ * @return       1 - The URB could not be submitted.
+ */
+#ifdef LINUX
+static int
+usbfs_submit_in(int fd, usbfs_urb_t *slot)
+{
+    memset(slot->urb, 0, sizeof (*slot->urb));
+    slot->urb->type          = USBDEVFS_URB_TYPE_BULK;
+    slot->urb->endpoint      = usbfs_ep_in;
+    slot->urb->buffer        = slot->buf;
+    slot->urb->buffer_length = usbfs_in_len;
+    slot->urb->usercontext   = slot;
+    slot->busy = TRUE;
+    if (ioctl(fd, USBDEVFS_SUBMITURB, slot->urb) < 0) {
+        slot->busy = FALSE;
+        return (1);
+    }
+    return (0);
+}
+#endif
+
+/*
+ * usbfs_release() releases the CDC interfaces up to the specified one,
+ *                 reattaches the cdc_acm driver to them, and closes the
+ *                 usbdevfs file descriptor.
+ *
+ * @param  [in]  fd         - usbdevfs file descriptor.
+ * @param  [in]  last_iface - Last interface which was detached.
+ * @return       None.
+ */
+#ifdef LINUX
+static void
+usbfs_release(int fd, uint last_iface)
+{
+    uint iface;
+
+    for (iface = USBFS_COMM_IFACE; iface <= last_iface; iface++) {
+        struct usbdevfs_ioctl cmd;
+
+        (void) ioctl(fd, USBDEVFS_RELEASEINTERFACE, &iface);
+        cmd.ifno       = iface;
+        cmd.ioctl_code = USBDEVFS_CONNECT;
+        cmd.data       = NULL;
+        (void) ioctl(fd, USBDEVFS_IOCTL, &cmd);
+    }
+    close(fd);
+}
+#endif
+
+/*
+ * usbfs_close() releases the programmer to the cdc_acm driver, so that
+ *               the console tty returns. As when a tty is closed, writes
+ *               in flight are first allowed to drain, and DTR is dropped.
+ *               The reader thread is stopped before the device is
+ *               released, so that it does not take the release for a
+ *               disconnect and reopen the device.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+usbfs_close(void)
+{
+#ifdef LINUX
+    int  fd = usbfs_fd;
+    uint cur;
+    uint count;
+
+    if (fd == -1)
+        return;
+    for (count = 0; count < BULK_TIMEOUT; count++) {
+        for (cur = 0; cur < USBFS_OUT_URBS; cur++)
+            if (usbfs_out[cur].busy)
+                break;
+        if (cur == USBFS_OUT_URBS)
+            break;  // All writes have completed
+        time_delay_msec(1);
+    }
+    usbfs_stop = TRUE;
+    if (!pthread_equal(pthread_self(), usbfs_reader_thread)) {
+        /* Reader exits after poll() (100 ms) or usbfs_reopen() (400 ms) */
+        while (usbfs_reader_active)
+            time_delay_msec(1);
+    }
+    fd = usbfs_fd;
+    if (fd == -1)
+        return;
+    usbfs_fd = -1;
+    (void) usbfs_control_line(fd, 0);
+    usbfs_release(fd, USBFS_DATA_IFACE);
+#endif
+}
+
+/*
+ * usbfs_open() detaches the cdc_acm driver from the programmer, claims
+ *              the CDC interfaces, raises DTR, and starts the read URBs.
+ *
+ * @param  [in]  verbose - Report the reason for failure.
+ * @return       RC_SUCCESS - The usbdevfs transport is ready.
+ * @return       RC_FAILURE - The device could not be opened.
+ */
+static rc_t
+usbfs_open(bool_t verbose)
+{
+#ifdef LINUX
+    static bool  registered = FALSE;
+    const char  *usbdev     = usb_sysfs_find();
+    char         path[PATH_MAX];
+    uint         iface;
+    uint         cur;
+    int          fd;
+
+    if (usbdev == NULL) {
+        if (verbose)
+            warnx("%s is not an MX programmer USB device", device_name);
+        return (RC_FAILURE);
+    }
+    if (usbfs_endpoints(usbdev) != 0) {
+        if (verbose)
+            warnx("CDC data endpoints of %s not found", usbdev);
+        return (RC_FAILURE);
+    }
+    if (usb_dev_node(usbdev, path, sizeof (path)) != 0)
+        return (RC_FAILURE);
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        if (verbose)
+            warn("Failed to open %s", path);
+        return (RC_FAILURE);
+    }
+    for (iface = USBFS_COMM_IFACE; iface <= USBFS_DATA_IFACE; iface++) {
+        struct usbdevfs_ioctl cmd;
+
+        cmd.ifno       = iface;
+        cmd.ioctl_code = USBDEVFS_DISCONNECT;
+        cmd.data       = NULL;
+        (void) ioctl(fd, USBDEVFS_IOCTL, &cmd);  // No driver bound is fine
+        if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, &iface) < 0) {
+            if (verbose)
+                warn("Failed to claim interface %u of %s", iface, path);
+            usbfs_release(fd, iface);
+            return (RC_FAILURE);
+        }
+    }
+    if (usbfs_control_line(fd, CDC_CONTROL_LINE_DTR | CDC_CONTROL_LINE_RTS)) {
+        if (verbose)
+            warn("Failed to raise DTR on %s", path);
+        usbfs_release(fd, USBFS_DATA_IFACE);
+        return (RC_FAILURE);
+    }
+    for (cur = 0; cur < USBFS_OUT_URBS; cur++) {
+        usbfs_urb_alloc(&usbfs_out[cur]);
+        usbfs_out[cur].busy = FALSE;
+    }
+    for (cur = 0; cur < USBFS_IN_URBS; cur++) {
+        usbfs_urb_alloc(&usbfs_in[cur]);
+        if (usbfs_submit_in(fd, &usbfs_in[cur]) != 0) {
+            if (verbose)
+                warn("Failed to submit read URB on %s", path);
+            usbfs_release(fd, USBFS_DATA_IFACE);  // Cancels the URBs
+            return (RC_FAILURE);
+        }
+    }
+    usbfs_fd = fd;
+    if (registered == FALSE) {
+        registered = TRUE;
+        atexit(usbfs_close);
+    }
+    return (RC_SUCCESS);
+#else
+    warnx("The usbdevfs transport (-U) requires Linux");
+    return (RC_FAILURE);
+#endif
+}
+
+/*
+ * usbfs_reopen() waits for the programmer to reappear after it has
+ *                disconnected, and reopens the usbdevfs transport.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+usbfs_reopen(void)
+{
+    int fd = usbfs_fd;
+
+    usbfs_fd = -1;
+    if (fd != -1)
+        close(fd);  // URBs in flight are cancelled by the close
+    printf("\n<< Closed %s >>", device_name);
+    fflush(stdout);
+    do {
+        if ((running == 0) || usbfs_stop)
+            return;
+        time_delay_msec(400);
+    } while (usbfs_open(FALSE) != RC_SUCCESS);
+    printf("\r<< Reopened %s >>\n", device_name);
+}
+
+/*
+ * usbfs_write() sends data to the programmer in a write URB. When all
+ *               write URBs are in flight, this waits for one to complete.
+ *
+ * @param  [in]  buf - Data to send.
+ * @param  [in]  len - Number of bytes to send (up to USBFS_URB_SIZE).
+ * @return       Number of bytes sent.
+ * @return       -1 - The device is not open or the URB was not accepted.
+ */
+static ssize_t
+usbfs_write(const void *buf, size_t len)
+{
+#ifdef LINUX
+    usbfs_urb_t *slot = NULL;
+    uint         cur;
+    int          fd;
+
+    while (slot == NULL) {
+        if ((running == 0) || ((fd = usbfs_fd) == -1))
+            return (-1);
+        for (cur = 0; cur < USBFS_OUT_URBS; cur++) {
+            if (usbfs_out[cur].busy == FALSE) {
+                slot = &usbfs_out[cur];
+                break;
+            }
+        }
+        if (slot == NULL)
+            time_delay_msec(1);
+    }
+    memcpy(slot->buf, buf, len);
+    memset(slot->urb, 0, sizeof (*slot->urb));
+    slot->urb->type          = USBDEVFS_URB_TYPE_BULK;
+    slot->urb->endpoint      = usbfs_ep_out;
+    slot->urb->buffer        = slot->buf;
+    slot->urb->buffer_length = len;
+    slot->urb->usercontext   = slot;
+    slot->busy = TRUE;
+    if (ioctl(fd, USBDEVFS_SUBMITURB, slot->urb) < 0) {
+        slot->busy = FALSE;
+        return (-1);
+    }
+    return (len);
+#else
+    return (-1);
+#endif
+}
+
+/*
+ * usbfs_abort() is the usbdevfs equivalent of flushing tty output and
+ *               toggling DTR: write URBs in flight are cancelled, and DTR
+ *               is dropped, which the programmer treats as a transfer
+ *               abort request.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+usbfs_abort(void)
+{
+#ifdef LINUX
+    int  fd = usbfs_fd;
+    uint cur;
+
+    if (fd == -1)
+        return;
+    for (cur = 0; cur < USBFS_OUT_URBS; cur++)
+        if (usbfs_out[cur].busy)
+            (void) ioctl(fd, USBDEVFS_DISCARDURB, usbfs_out[cur].urb);
+    (void) usbfs_control_line(fd, 0);
+    (void) usbfs_control_line(fd, CDC_CONTROL_LINE_DTR | CDC_CONTROL_LINE_RTS);
+#endif
+}
+
+/*
+ * reopen_dev() will wait for the serial device to reappear after it has
+ *              disappeared.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+reopen_dev(void)
+{
+    int             temp      = dev_fd;
+    static uint64_t last_time = 0;
+    uint64_t        now       = time_usec() / 1000000;
+    bool_t          printed   = FALSE;
+    int             oflags    = O_NOCTTY;
+
+#ifdef OSX
+    oflags |= O_NONBLOCK;
+#endif
+
+    dev_fd = -1;
+    if (temp != -1) {
+        if (flock(temp, LOCK_UN | LOCK_NB) < 0)
             warnx("Failed to release exclusive lock on %s", device_name);
         close(temp);
     }
@@ -598,7 +2333,7 @@ top:
     /* Hand off the new I/O fd */
     dev_fd = temp;
 
-    now = time(NULL);
+    now = time_usec() / 1000000;
     if (now - last_time > 5) {
         if (printed == FALSE)
             printf("\n");
@@ -608,23 +2343,17 @@ top:
 }
 
 /*
- * th_serial_reader() is a thread to read from serial port and store it in
- *                    a circular buffer.  The buffer's contents are retrieved
- *                    asynchronously by another thread.
- *
- * @param [in]  arg - Unused argument.
+ * serial_log_open() opens the receive log file named by the TERM_DEBUG
+ *                   environment variable, if set.
  *
- * @return      NULL pointer (unused)
- *
- * @see         serial_in_snapshot(), serial_in_count(), serial_in_advance(),
- *              serial_in_flush()
+ * @param  [in]  None.
+ * @return       Log file, or NULL if not logging.
  */
-static void *
-th_serial_reader(void *arg)
+static FILE *
+serial_log_open(void)
 {
     const char *log_file;
     FILE       *log_fp = NULL;
-    uint8_t     buf[64];
 
     if ((log_file = getenv("TERM_DEBUG")) != NULL) {
         /*
@@ -636,7 +2365,66 @@ th_serial_reader(void *arg)
         if (log_fp == NULL)
             warn("Unable to open %s for log", log_file);
     }
+    return (log_fp);
+}
+
+/*
+ * serial_deliver() passes input received from the programmer to the
+ *                  terminal (in terminal mode) or to the receive ring
+ *                  buffer, and to the receive log.
+ *
+ * @param [in]  buf    - Received data.
+ * @param [in]  len    - Number of bytes received.
+ * @param [in]  log_fp - Receive log, or NULL.
+ *
+ * @return      None.
+ */
+static void
+serial_deliver(const uint8_t *buf, size_t len, FILE *log_fp)
+{
+    tl_instant("rx", "%zu bytes", len);
+    if (terminal_mode) {
+        fwrite(buf, len, 1, stdout);
+        fflush(stdout);
+    } else {
+        uint pos;
+        for (pos = 0; pos < len; pos++) {
+            while (rx_rb_put(buf[pos]) == 1) {
+                tl_instant("rx_ring_full", NULL);
+                time_delay_msec(1);
+                printf("RX ring buffer overflow\n");
+                if ((running == 0) || usbfs_stop)
+                    break;
+            }
+            if ((running == 0) || usbfs_stop)
+                break;
+        }
+    }
+    if (log_fp != NULL) {
+        fwrite(buf, len, 1, log_fp);
+        fflush(log_fp);
+    }
+}
+
+/*
+ * th_serial_reader() is a thread to read from serial port and store it in
+ *                    a circular buffer.  The buffer's contents are retrieved
+ *                    asynchronously by another thread.
+ *
+ * @param [in]  arg - Unused argument.
+ *
+ * @return      NULL pointer (unused)
+ *
+ * @see         serial_in_snapshot(), serial_in_count(), serial_in_advance(),
+ *              serial_in_flush()
+ */
+static void *
+th_serial_reader(void *arg)
+{
+    FILE       *log_fp = serial_log_open();
+    uint8_t     buf[64];
 
+    tl_thread(TL_TID_READER, "reader");
     while (running) {
         ssize_t len;
         while ((len = read(dev_fd, buf, sizeof (buf))) >= 0) {
@@ -653,30 +2441,13 @@ th_serial_reader(void *arg)
             if (running == 0)
                 break;
 
-            if (terminal_mode) {
-                fwrite(buf, len, 1, stdout);
-                fflush(stdout);
-            } else {
-                uint pos;
-                for (pos = 0; pos < len; pos++) {
-                    while (rx_rb_put(buf[pos]) == 1) {
-                        time_delay_msec(1);
-                        printf("RX ring buffer overflow\n");
-                        if (running == 0)
-                            break;
-                    }
-                    if (running == 0)
-                        break;
-                }
-            }
-            if (log_fp != NULL) {
-                fwrite(buf, len, 1, log_fp);
-                fflush(log_fp);
-            }
+            serial_deliver(buf, len, log_fp);
         }
         if (running == 0)
             break;
+        tl_begin("reopen", "%s", device_name);
         reopen_dev();
+        tl_end("reopen");
     }
     printf("not running\n");
 
@@ -685,6 +2456,91 @@ th_serial_reader(void *arg)
     return (NULL);
 }
 
+/*
+ * th_usbfs_reader() is the reader thread of the usbdevfs transport (-U).
+ *                   It reaps completed URBs: received data is passed on
+ *                   and the read URB resubmitted, and completed write URBs
+ *                   are freed for the writer thread after their status
+ *                   is checked. If the programmer disconnects, the
+ *                   transport is reopened when it returns. The thread
+ *                   exits when usbfs_close() sets usbfs_stop.
+ *
+ * @param [in]  arg - Unused argument.
+ *
+ * @return      NULL pointer (unused)
+ */
+static void *
+th_usbfs_reader(void *arg)
+{
+#ifdef LINUX
+    FILE *log_fp = serial_log_open();
+
+    tl_thread(TL_TID_READER, "reader");
+    usbfs_reader_thread = pthread_self();
+    while (running && !usbfs_stop) {
+        struct usbdevfs_urb *urb;
+        struct pollfd        pfd;
+        int                  fd = usbfs_fd;
+        bool_t               lost = FALSE;
+
+        if (fd != -1) {
+            /* usbdevfs reports completed URBs as writable */
+            pfd.fd      = fd;
+            pfd.events  = POLLOUT;
+            pfd.revents = 0;
+            (void) poll(&pfd, 1, 100);
+            while (1) {
+                usbfs_urb_t *slot;
+
+                if (ioctl(fd, USBDEVFS_REAPURBNDELAY, &urb) != 0) {
+                    lost = (errno != EAGAIN);
+                    break;
+                }
+                slot = urb->usercontext;
+                slot->busy = FALSE;
+                if ((urb->endpoint & USBFS_EP_DIR_IN) == 0) {
+                    /* Write completed; cancelled by usbfs_abort() is fine */
+                    if ((urb->status == -ENODEV) ||
+                        (urb->status == -ESHUTDOWN)) {
+                        lost = TRUE;  // Programmer disconnected
+                        break;
+                    }
+                    if ((urb->status != 0) && (urb->status != -ENOENT) &&
+                        (urb->status != -ECONNRESET)) {
+                        warnx("USB write of %d bytes failed: %s",
+                              urb->buffer_length, strerror(-urb->status));
+                    } else if ((urb->status == 0) &&
+                               (urb->actual_length != urb->buffer_length)) {
+                        warnx("USB write sent %d of %d bytes",
+                              urb->actual_length, urb->buffer_length);
+                    }
+                    continue;
+                }
+                if ((urb->status == 0) && (urb->actual_length > 0) &&
+                    running)
+                    serial_deliver(slot->buf, urb->actual_length, log_fp);
+                if ((urb->status == -ENODEV) || (urb->status == -ESHUTDOWN) ||
+                    (usbfs_submit_in(fd, slot) != 0)) {
+                    lost = TRUE;  // Programmer disconnected
+                    break;
+                }
+            }
+            if (!lost || (usbfs_fd != fd))
+                continue;  // Nothing more to reap, or closed at exit
+        }
+        if ((running == 0) || usbfs_stop)
+            break;
+        tl_begin("reopen", "%s", device_name);
+        usbfs_reopen();
+        tl_end("reopen");
+    }
+    if (log_fp != NULL)
+        fclose(log_fp);
+    usbfs_reader_active = FALSE;
+#endif
+    return (NULL);
+}
+
 /*
  * th_serial_writer() is a thread to read from the tty input ring buffer and
  *                    write data to the serial port.  The separation of tty
@@ -704,29 +2560,47 @@ th_serial_writer(void *arg)
 {
     int ch;
     uint pos = 0;
-    char lbuf[64];
+    char lbuf[USBFS_URB_SIZE];
+    uint lmax = usbfs_mode ? sizeof (lbuf) : 64;  // Largest single write
 
+    tl_thread(TL_TID_WRITER, "writer");
     while (1) {
         ch = tx_rb_get();
         if (ch >= 0)
             lbuf[pos++] = ch;
         if (((ch < 0) && (pos > 0)) ||
-             (pos >= sizeof (lbuf)) || (ic_delay != 0)) {
+             (pos >= lmax) || (ic_delay != 0)) {
             ssize_t count;
-            if (dev_fd == -1) {
+            if ((usbfs_mode ? usbfs_fd : dev_fd) == -1) {
+                tl_begin("sleep", "no device");
                 time_delay_msec(500);
-                if (pos >= sizeof (lbuf))
+                tl_end("sleep");
+                if (pos >= lmax)
                     pos--;
                 continue;
-            } else if ((count = write(dev_fd, lbuf, pos)) < 0) {
+            }
+            if (usbfs_mode) {
+                tl_begin("usb_write", "%u bytes", pos);
+                count = usbfs_write(lbuf, pos);
+                tl_end("usb_write");
+            } else {
+                tl_begin("tty_write", "%u bytes", pos);
+                count = write(dev_fd, lbuf, pos);
+                tl_end("tty_write");
+            }
+            if (count < 0) {
                 /* Wait for reader thread to close / reopen */
+                tl_begin("sleep", "write failed");
                 time_delay_msec(500);
-                if (pos >= sizeof (lbuf))
+                tl_end("sleep");
+                if (pos >= lmax)
                     pos--;
                 continue;
             } else if (ic_delay) {
                 /* Inter-character pacing delay was specified */
+                tl_begin("sleep", "pacing");
                 time_delay_msec(ic_delay);
+                tl_end("sleep");
             }
 #ifdef DEBUG_TRANSFER
             printf(">%02x\n", lbuf[0]);
@@ -736,7 +2610,9 @@ th_serial_writer(void *arg)
             }
             pos = 0;
         } else if (ch < 0) {
+            tl_begin("sleep", "idle");
             time_delay_msec(10);
+            tl_end("sleep");
             if (!running)
                 break;
         }
@@ -759,6 +2635,9 @@ serial_open(bool_t verbose)
     oflags |= O_NONBLOCK;
 #endif
 
+    if (usbfs_mode)
+        return (usbfs_open(verbose));
+
     /* First verify the file exists */
     dev_fd = open(device_name, oflags | O_RDONLY);
     if (dev_fd == -1) {
@@ -795,25 +2674,383 @@ at_exit_func(void)
 }
 
 /*
- * do_exit() exits gracefully.
+ * wait_for_ring() waits for a specific sequence of characters (string) from
+ *                 the programmer. This is typically a command prompt or
+ *                 expected status message.
  *
- * @param [in]  rc - The exit code with which to terminate the program.
+ * @param  [in] rb_get  - Receive ring buffer (console or binary data).
+ * @param  [in] str     - Specific text string expected from the programmer.
+ * @param  [in] timeout - Number of milliseconds since last character before
+ *                        giving up.
  *
- * @return      This function does not return.
+ * @return      0 - The text was received from the programmer.
+ * @return      1 - A timeout waiting for the text occurred.
  */
-static void __attribute__((noreturn))
-do_exit(int rc)
+static int
+wait_for_ring(int (*rb_get)(void), const char *str, int timeout)
 {
-    putchar('\n');
-    exit(rc);
-}
-
-/*
+    int         ch;
+    int         timeout_count = 0;
+    const char *ptr = str;
+
+#ifdef DEBUG_WAITFOR
+    printf("waitfor %02x %02x %02x %02x %s\n",
+           str[0], str[1], str[2], str[3], str);
+#endif
+    while (*ptr != '\0') {
+        ch = rb_get();
+        if (ch == -1) {
+            time_delay_msec(1);
+            if (++timeout_count >= timeout) {
+                return (1);
+            }
+            continue;
+        }
+        timeout_count = 0;
+        if (*ptr == ch) {
+            ptr++;
+        } else {
+            ptr = str;
+        }
+    }
+    return (0);
+}
+
+/*
+ * wait_for_text() waits for specific text on the serial console.
+ *                 See wait_for_ring().
+ */
+static int
+wait_for_text(const char *str, int timeout)
+{
+    return (wait_for_ring(rx_rb_get, str, timeout));
+}
+
+/*
+ * report_remote_text() reports console text which the programmer sent
+ *                      while a binary transfer was being abandoned. This
+ *                      is normally the reason for the failure. The command
+ *                      prompt is not reported.
+ *
+ * @param  [in]  text - Text received, which is modified.
+ * @param  [in]  len  - Length of text.
+ * @return       None.
+ */
+static void
+report_remote_text(char *text, uint len)
+{
+    char *line;
+    char *next;
+
+    text[len] = '\0';
+    for (line = text; line != NULL; line = next) {
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        line += strspn(line, " \r");
+        line[strcspn(line, "\r")] = '\0';
+        if ((*line != '\0') && (strncmp(line, "CMD>", 4) != 0))
+            printf("Status from programmer: %s\n", line);
+    }
+}
+
+/*
+ * abort_transfer() stops a binary transfer in progress with the programmer.
+ *                  Pending output is discarded and DTR is dropped, which
+ *                  the programmer treats as an out-of-band abort. It then
+ *                  stops at a safe point (page boundary with VPP off),
+ *                  discards stale input, and replies with a sync token.
+ *                  Everything received after the token is console output.
+ *                  The token arrives on the same path as binary data.
+ *                  Console text the programmer sent before the token is
+ *                  reported, as it normally explains the failure. If the
+ *                  programmer had not entered binary mode, nothing is done.
+ *
+ * @param  [in]  None.
+ * @return       0 - The programmer resynchronized.
+ * @return       1 - A timeout waiting for the sync token occurred.
+ */
+static int
+abort_transfer(void)
+{
+    int         dtr = TIOCM_DTR;
+    const char *ptr = SYNC_TOKEN;
+    char        text[160];
+    uint        tlen = 0;
+    int         timeout_count = 0;
+    int         ch;
+
+    while (tx_rb_get() != -1)
+        ;  // Discard data not yet sent
+    if (xfer_active == FALSE)
+        return (0);
+
+    xfer_active = FALSE;
+    tl_instant("abort", NULL);
+    if (dev_fd != -1) {
+        (void) tcflush(dev_fd, TCOFLUSH);
+        (void) ioctl(dev_fd, TIOCMBIC, &dtr);
+        (void) ioctl(dev_fd, TIOCMBIS, &dtr);
+    }
+    usbfs_abort();
+    tl_begin("resync", NULL);
+    while (*ptr != '\0') {
+        ch = bin_rb_get();
+        if (ch == -1) {
+            time_delay_msec(1);
+            if (++timeout_count >= 500) {
+                tl_end("resync");
+                report_remote_text(text, tlen);
+                warnx("Programmer did not resynchronize after abort");
+                return (1);
+            }
+            continue;
+        }
+        timeout_count = 0;
+        if (*ptr == ch) {
+            ptr++;
+            continue;
+        }
+        ptr = SYNC_TOKEN;
+        if (isprint(ch) || (ch == '\r') || (ch == '\n')) {
+            /* Possible console text; keep the most recent */
+            if (tlen >= sizeof (text) - 1) {
+                tlen = sizeof (text) / 2;
+                memmove(text, text + sizeof (text) - 1 - tlen, tlen);
+            }
+            text[tlen++] = ch;
+        } else {
+            tlen = 0;  // Binary data
+        }
+    }
+    tl_end("resync");
+
+    /* With the bulk interface, console text arrives separately */
+    if (bulk_fd != -1) {
+        tlen = 0;
+        while ((tlen < sizeof (text) - 1) && ((ch = rx_rb_get()) != -1))
+            text[tlen++] = ch;
+    }
+    report_remote_text(text, tlen);
+    return (0);
+}
+
+/*
+ * cmd_notify_start() samples the programmer's command state notification
+ *                    count before a command is sent. Firmware reports
+ *                    command state as CDC SERIAL_STATE notifications,
+ *                    which the host driver presents as modem status lines:
+ *                    DCD means notifications are sent, DSR means a command
+ *                    is busy, and RI means the last command failed.
+ *
+ * @param  [in]  None.
+ * @return       DSR transition count, to be passed to cmd_notify_wait().
+ * @return       -1 - Notifications are not available.
+ */
+static int
+cmd_notify_start(void)
+{
+#if defined(TIOCMIWAIT) && defined(TIOCGICOUNT)
+    struct serial_icounter_struct icount;
+    int status;
+
+    if ((dev_fd == -1) ||
+        (ioctl(dev_fd, TIOCMGET, &status) != 0) ||
+        ((status & TIOCM_CD) == 0) ||
+        (ioctl(dev_fd, TIOCGICOUNT, &icount) != 0))
+        return (-1);
+    return (icount.dsr);
+#else
+    return (-1);
+#endif
+}
+
+#if defined(TIOCMIWAIT) && defined(TIOCGICOUNT)
+/* Bounds a TIOCMIWAIT wait; see th_notify_watchdog() */
+typedef struct {
+    pthread_t       waiter;   // Thread blocked in TIOCMIWAIT
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    struct timespec deadline; // CLOCK_MONOTONIC
+    volatile bool   done;     // Waiter has finished
+    volatile bool   expired;  // Timeout reached
+} notify_watch_t;
+
+/*
+ * notify_alarm() handles SIGALRM. It exists only so that the signal
+ *                interrupts TIOCMIWAIT with EINTR.
+ */
+static void
+notify_alarm(int sig)
+{
+    (void) sig;
+}
+
+/*
+ * th_notify_watchdog() bounds the TIOCMIWAIT wait of cmd_notify_wait().
+ *                      It sleeps until the wait finishes, and signals the
+ *                      waiting thread once per second so that the waiter
+ *                      rechecks the counts. A transition just before the
+ *                      waiter entered TIOCMIWAIT is then seen at the next
+ *                      wakeup. At the deadline it marks the wait as
+ *                      expired, and keeps signalling until the waiter is
+ *                      done.
+ *
+ * @param [in]  arg - notify_watch_t of the wait.
+ *
+ * @return      NULL pointer (unused)
+ */
+static void *
+th_notify_watchdog(void *arg)
+{
+    notify_watch_t *watch = arg;
+    struct timespec now;
+    struct timespec next;
+
+    pthread_mutex_lock(&watch->lock);
+    while (!watch->done) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        next = now;
+        if (watch->expired) {
+            next.tv_nsec += 10000000;  // Waiter may not be in the ioctl yet
+            if (next.tv_nsec >= 1000000000) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000;
+            }
+        } else {
+            next.tv_sec++;
+            if ((next.tv_sec > watch->deadline.tv_sec) ||
+                ((next.tv_sec == watch->deadline.tv_sec) &&
+                 (next.tv_nsec > watch->deadline.tv_nsec)))
+                next = watch->deadline;
+        }
+        if ((pthread_cond_timedwait(&watch->cond, &watch->lock, &next) !=
+             ETIMEDOUT) || watch->done)
+            continue;
+        if ((next.tv_sec == watch->deadline.tv_sec) &&
+            (next.tv_nsec == watch->deadline.tv_nsec))
+            watch->expired = TRUE;
+        pthread_kill(watch->waiter, SIGALRM);
+    }
+    pthread_mutex_unlock(&watch->lock);
+    return (NULL);
+}
+#endif
+
+/*
+ * cmd_notify_wait() waits until the programmer reports that the command
+ *                   sent after cmd_notify_start() has completed. No data
+ *                   is read from the programmer, so command output remains
+ *                   available to the caller. The thread blocks in
+ *                   TIOCMIWAIT. TIOCMIWAIT has no timeout of its own, so
+ *                   th_notify_watchdog() interrupts it with SIGALRM.
+ *                   Completion is taken from the DSR transition count, so
+ *                   a command which has already finished by the time this
+ *                   is called returns at once.
+ *
+ * @param  [in]  dsr_start - DSR transition count from cmd_notify_start().
+ * @param  [in]  timeout   - Maximum time to wait in milliseconds.
+ * @return       0 - The command completed successfully.
+ * @return       1 - The command completed with an error.
+ * @return       -1 - Notifications are not available, or timeout.
+ */
+static int
+cmd_notify_wait(int dsr_start, uint timeout)
+{
+#if defined(TIOCMIWAIT) && defined(TIOCGICOUNT)
+    static bool                   handler_set = FALSE;
+    struct serial_icounter_struct icount;
+    notify_watch_t                watch;
+    pthread_condattr_t            cattr;
+    pthread_t                     thread_id;
+    int                           status;
+    int                           rc = -1;
+
+    if (dsr_start < 0)
+        return (-1);
+
+    if (handler_set == FALSE) {
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof (sa));
+        sa.sa_handler = notify_alarm;  // No SA_RESTART: interrupt the wait
+        (void) sigaction(SIGALRM, &sa, NULL);
+        handler_set = TRUE;
+    }
+    memset(&watch, 0, sizeof (watch));
+    watch.waiter = pthread_self();
+    pthread_mutex_init(&watch.lock, NULL);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&watch.cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    clock_gettime(CLOCK_MONOTONIC, &watch.deadline);
+    watch.deadline.tv_sec  += timeout / 1000;
+    watch.deadline.tv_nsec += (timeout % 1000) * 1000000;
+    if (watch.deadline.tv_nsec >= 1000000000) {
+        watch.deadline.tv_sec++;
+        watch.deadline.tv_nsec -= 1000000000;
+    }
+    if (pthread_create(&thread_id, NULL, th_notify_watchdog, &watch)) {
+        warn("failed to create notification watchdog thread");
+        return (-1);
+    }
+
+    for (;;) {
+        if ((ioctl(dev_fd, TIOCGICOUNT, &icount) != 0) ||
+            (ioctl(dev_fd, TIOCMGET, &status) != 0) ||
+            ((status & TIOCM_CD) == 0))
+            break;  // Programmer restarted or went away
+
+        /* Done once DSR has been asserted and then deasserted */
+        if ((icount.dsr - dsr_start >= 2) && ((status & TIOCM_DSR) == 0)) {
+            rc = (status & TIOCM_RI) ? 1 : 0;
+            break;
+        }
+        if (watch.expired) {
+            tl_instant("notify_timeout", NULL);
+            break;  // Caller falls back to watching for the prompt
+        }
+        if ((ioctl(dev_fd, TIOCMIWAIT, TIOCM_DSR | TIOCM_CD) != 0) &&
+            (errno != EINTR))
+            break;
+    }
+
+    pthread_mutex_lock(&watch.lock);
+    watch.done = TRUE;
+    pthread_cond_signal(&watch.cond);
+    pthread_mutex_unlock(&watch.lock);
+    pthread_join(thread_id, NULL);
+    pthread_cond_destroy(&watch.cond);
+    pthread_mutex_destroy(&watch.lock);
+    return (rc);
+#else
+    return (-1);
+#endif
+}
+
+/*
+ * do_exit() exits gracefully.
+ *
+ * @param [in]  rc - The exit code with which to terminate the program.
+ *
+ * @return      This function does not return.
+ */
+static void __attribute__((noreturn))
+do_exit(int rc)
+{
+    putchar('\n');
+    exit(rc);
+}
+
+/*
  * sig_exit() will exit on a fatal signal (SIGTERM, etc).
  */
 static void
 sig_exit(int sig)
 {
+    if (xfer_active)
+        (void) abort_transfer();  // Leave programmer at command prompt
     do_exit(EXIT_FAILURE);
 }
 
@@ -829,18 +3066,28 @@ create_threads(void)
     /* Create thread */
     pthread_attr_init(&thread_attr);
     pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
-    if (pthread_create(&thread_id, &thread_attr, th_serial_reader, NULL))
+    usbfs_reader_active = usbfs_mode;  // Until the reader thread exits
+    if (pthread_create(&thread_id, &thread_attr,
+                       usbfs_mode ? th_usbfs_reader : th_serial_reader, NULL))
         err(EXIT_FAILURE, "failed to create %s reader thread", device_name);
     if (pthread_create(&thread_id, &thread_attr, th_serial_writer, NULL))
         err(EXIT_FAILURE, "failed to create %s writer thread", device_name);
+
+    if ((terminal_mode == FALSE) && (bulk_disabled == FALSE))
+        bulk_open();
+    if ((bulk_fd != -1) &&
+        pthread_create(&thread_id, &thread_attr, th_bulk_reader, NULL))
+        err(EXIT_FAILURE, "failed to create %s bulk reader thread",
+            device_name);
 }
 
 /*
- * receive_ll() receives bytes from the remote side until a timeout occurs
+ * receive_ring() receives bytes from the remote side until a timeout occurs
  *              or the specified length has been reached. If exact_bytes is
  *              specified, then a timeout warning will be issued if less
  *              than the specified number of bytes is received.
  *
+ * @param  [in]  rb_get  - Receive ring buffer (console or binary data).
  * @param  [out] buf     - Buffer into which output from the programmer is
  *                         to be captured.
  * @param  [in]  buflen  - Maximum number of bytes to receive.
@@ -848,14 +3095,15 @@ create_threads(void)
  *                         giving up.
  */
 static int
-receive_ll(void *buf, size_t buflen, int timeout, bool exact_bytes)
+receive_ring(int (*rb_get)(void), void *buf, size_t buflen, int timeout,
+             bool exact_bytes)
 {
     int received = 0;
     int timeout_count = 0;
     uint8_t *data = (uint8_t *)buf;
 
     while (received < buflen) {
-        int ch = rx_rb_get();
+        int ch = rb_get();
         if (ch == -1) {
             if (timeout_count++ >= timeout) {
                 if (exact_bytes && ((timeout > 50) || (received == 0))) {
@@ -874,6 +3122,26 @@ receive_ll(void *buf, size_t buflen, int timeout, bool exact_bytes)
     return (received);
 }
 
+/*
+ * receive_ll() receives console output from the programmer.
+ *              See receive_ring().
+ */
+static int
+receive_ll(void *buf, size_t buflen, int timeout, bool exact_bytes)
+{
+    return (receive_ring(rx_rb_get, buf, buflen, timeout, exact_bytes));
+}
+
+/*
+ * receive_bin() receives binary transfer data from the programmer, from
+ *               the bulk data interface if open. See receive_ring().
+ */
+static int
+receive_bin(void *buf, size_t buflen, int timeout, bool exact_bytes)
+{
+    return (receive_ring(bin_rb_get, buf, buflen, timeout, exact_bytes));
+}
+
 /*
  * report_remote_failure_message() will report status on the console which
  *                                 was provided by the programmer.
@@ -896,21 +3164,52 @@ report_remote_failure_message(void)
 }
 
 /*
- * check_crc() verifies the CRC data value received matches the previously
- *             received data.
+ * transfer_refused() checks whether the programmer refused a binary transfer
+ *                    command with a console message, rather than entering
+ *                    binary mode. Any such message is reported, and no
+ *                    resync is then attempted by abort_transfer().
+ *
+ * @param  [in]  first - First status character received, or -1 if none.
+ * @return       TRUE  - The programmer refused the transfer.
+ * @return       FALSE - The programmer is in binary mode (or unknown).
  */
-static int
-check_crc(uint32_t crc, uint spos, uint epos, bool send_status)
+static bool
+transfer_refused(int first)
 {
-    uint32_t compcrc;
-    uint8_t  rc;
-
-    if (receive_ll(&compcrc, 4, 2000, false) == 0) {
-        printf("CRC receive timeout at 0x%x-0x%x\n", spos, epos);
-        return (1);
+    char text[160];
+    uint tlen = 0;
+    int  len;
+
+    if (first != -1) {
+        if (first < ' ')
+            return (FALSE);  // Binary status code
+        text[tlen++] = first;
+    } else if (bulk_fd == -1) {
+        return (FALSE);  // Nothing at all was received
     }
+    len = receive_ll(text + tlen, sizeof (text) - 1 - tlen, 100, false);
+    if (len > 0)
+        tlen += len;
+    if (tlen == 0)
+        return (FALSE);
+    xfer_active = FALSE;
+    report_remote_text(text, tlen);
+    return (TRUE);
+}
+
+/*
+ * compare_crc() verifies the CRC data value received matches the previously
+ *               received data, and optionally sends status to the
+ *               programmer.
+ */
+static int
+compare_crc(uint32_t crc, uint32_t compcrc, uint spos, uint epos,
+            bool send_status)
+{
+    uint8_t rc;
 
     if (compcrc != crc) {
+        tl_instant("crc_error", "0x%x-0x%x", spos, epos);
         if ((compcrc == 0x20202020) && report_remote_failure_message())
             return (1);  // Failure message from programmer
         warnx("Bad CRC %08x received from programmer (should be %08x) "
@@ -929,11 +3228,38 @@ check_crc(uint32_t crc, uint spos, uint epos, bool send_status)
     return (rc);
 }
 
+/*
+ * check_crc() receives a CRC value from the programmer and verifies that
+ *             it matches the previously received data.
+ */
+static int
+check_crc(uint32_t crc, uint spos, uint epos, bool send_status)
+{
+    uint32_t compcrc;
+    uint     received;
+
+    tl_begin("crc_wait", "0x%x", spos);
+    received = receive_bin(&compcrc, 4, 2000, false);
+    tl_end("crc_wait");
+    if (received == 0) {
+        if ((bulk_fd != -1) && report_remote_failure_message())
+            return (1);  // Failure message from programmer on console
+        printf("CRC receive timeout at 0x%x-0x%x\n", spos, epos);
+        return (1);
+    }
+    return (compare_crc(crc, compcrc, spos, epos, send_status));
+}
+
 static int
 check_rc(uint pos)
 {
     uint8_t rc;
-    if (receive_ll(&rc, 1, 200, false) == 0) {
+    uint    received;
+
+    tl_begin("status_wait", "0x%x", pos);
+    received = receive_bin(&rc, 1, 200, false);
+    tl_end("status_wait");
+    if (received == 0) {
         printf("RC receive timeout at 0x%x\n", pos);
         return (1);
     }
@@ -945,7 +3271,7 @@ check_rc(uint pos)
 }
 
 /*
- * receive_ll_crc() receives data from the remote side with status and
+ * receive_ll_crc_sink() receives data from the remote side with status and
  *                  CRC data embedded. This function checks status and CRC
  *                  and sends status back to the remote side.
  *
@@ -958,20 +3284,26 @@ check_rc(uint pos)
  *     If the sender is mxprog, then it could also be user abort.
  *     <data> is 256 bytes (or less if the remaining transfer length is
  *     less than that amount. <CRC> is a 32-bit CRC over the previous
- *     (up to) 256 bytes of data.
+ *     (up to) 256 bytes of data. With FEC (-F), <CRC> is followed by
+ *     FEC_PARITY_LEN bytes of parity, which are used to correct the
+ *     data and CRC before the CRC is checked.
  * RECEIVER
  *     The <status> byte is whether the received data matched the CRC.
  *     If the receiver is the programmer, then the <status> byte also
  *     indicates whether the data write was successful.
  *
- * @param  [out] buf     - Data received from the programmer.
+ * Each block of data is handed to the sink function as it arrives, so
+ * that the entire transfer need not be held in memory.
+ *
  * @param  [in]  buflen  - Number of bytes to receive from programmer.
+ * @param  [in]  sink    - Function which consumes each received block.
+ * @param  [in]  arg     - Argument passed to the sink function.
  *
  * @return       -1 a send timeout occurred.
  * @return       The number of bytes received.
  */
 static int
-receive_ll_crc(void *buf, size_t buflen)
+receive_ll_crc_sink(size_t buflen, rx_sink_t sink, void *arg)
 {
     int      timeout = 200; // 200 ms
     uint     pos = 0;
@@ -980,50 +3312,133 @@ receive_ll_crc(void *buf, size_t buflen)
     size_t   lpercent = -1;
     size_t   percent;
     uint32_t crc = 0;
-    uint8_t *data = (uint8_t *)buf;
+    uint32_t compcrc = 0;
+    uint8_t  data[DATA_CRC_INTERVAL + sizeof (crc) + FEC_PARITY_LEN];
     uint8_t  rc;
+    int      fixed;
 
+    xfer_active = TRUE;
     while (pos < buflen) {
         tlen = buflen - pos;
         if (tlen > DATA_CRC_INTERVAL)
             tlen = DATA_CRC_INTERVAL;
 
-        received = receive_ll(&rc, 1, timeout, true);
+        tl_begin("rx_block", "0x%x", pos);
+        received = receive_bin(&rc, 1, timeout, true);
+        tl_end("rx_block");
         if (received == 0) {
+            if (pos == 0)
+                (void) transfer_refused(-1);
             printf("Status receive timeout at 0x%x\n", pos);
+            (void) abort_transfer();
             return (-1);  // Timeout
         }
         if (rc != 0) {
+            if ((pos == 0) && transfer_refused(rc))
+                return (-1);
             printf("Read error %d at 0x%x\n", rc, pos);
+            (void) abort_transfer();
             return (-1);
         }
 
-        received = receive_ll(data, tlen, timeout, true);
+        if (fec_mode) {
+            uint flen = tlen + sizeof (crc) + FEC_PARITY_LEN;
+            tl_begin("rx_data", "0x%x", pos);
+            received = receive_bin(data, flen, timeout, true);
+            tl_end("rx_data");
+            if (received < flen) {
+                (void) abort_transfer();
+                return (pos);  // Timeout
+            }
+            fixed = fec_decode(data, tlen + sizeof (crc),
+                               data + tlen + sizeof (crc));
+            if (fixed > 0)
+                tl_instant("fec_fixed", "0x%x %d bytes", pos, fixed);
+            if (fixed < 0) {
+                tl_instant("fec_uncorrectable", "0x%x", pos);
+                warnx("Uncorrectable data from programmer at 0x%x-0x%x",
+                      pos, pos + tlen);
+                rc = 1;
+                (void) send_ll_bin(&rc, sizeof (rc));
+                (void) abort_transfer();
+                return (pos);
+            }
+            fec_fixed += fixed;
+            memcpy(&compcrc, data + tlen, sizeof (compcrc));
+            received = tlen;
+        } else {
+            tl_begin("rx_data", "0x%x", pos);
+            received = receive_bin(data, tlen, timeout, true);
+            tl_end("rx_data");
+        }
         crc = crc32(crc, data, received);
 #ifdef DEBUG_TRANSFER
         printf("c:%02x\n", crc); fflush(stdout);
 #endif
-        if (check_crc(crc, pos, pos + received, true))
+        if (sink(arg, data, pos, received)) {
+            (void) abort_transfer();
+            return (pos);
+        }
+        if (fec_mode ?
+            compare_crc(crc, compcrc, pos, pos + received, true) :
+            check_crc(crc, pos, pos + received, true)) {
+            (void) abort_transfer();
             return (pos + received);
+        }
 
-        data   += received;
         pos    += received;
 
         percent = (pos * 100) / buflen;
-        if (lpercent != percent) {
+        if (show_progress && (lpercent != percent)) {
             lpercent = percent;
             printf("\r%zu%%", percent);
             fflush(stdout);
         }
 
-        if (received < tlen)
+        if (received < tlen) {
+            (void) abort_transfer();
             return (pos);  // Timeout
+        }
+    }
+    xfer_active = FALSE;
+    if (show_progress)
+        printf("\r100%%\n");
+    if (fec_fixed != 0) {
+        printf("FEC corrected %u byte%s\n", fec_fixed,
+               (fec_fixed == 1) ? "" : "s");
+        fec_fixed = 0;
     }
-    printf("\r100%%\n");
     time_delay_msec(20); // Allow remaining CRC bytes to be sent
     return (pos);
 }
 
+/*
+ * rx_sink_buf() is a receive_ll_crc_sink() function which stores received
+ *               data in a memory buffer.
+ */
+static int
+rx_sink_buf(void *arg, const uint8_t *data, uint pos, uint len)
+{
+    memcpy((uint8_t *) arg + pos, data, len);
+    return (0);
+}
+
+/*
+ * receive_ll_crc() receives a CRC-protected transfer from the programmer
+ *                  into a memory buffer. See receive_ll_crc_sink().
+ *
+ * @param  [out] buf     - Data received from the programmer.
+ * @param  [in]  buflen  - Number of bytes to receive from programmer.
+ *
+ * @return       -1 a send timeout occurred.
+ * @return       The number of bytes received.
+ */
+static int
+receive_ll_crc(void *buf, size_t buflen)
+{
+    return (receive_ll_crc_sink(buflen, rx_sink_buf, buf));
+}
+
 /*
  * send_ll_str() sends a string to the programmer, typically a command.
  *
@@ -1058,6 +3473,8 @@ static void
 discard_input(int timeout)
 {
     int timeout_count = 0;
+
+    tl_begin("discard_input", "%d ms", timeout);
     while (timeout_count <= timeout) {
         int ch = rx_rb_get();
         if (ch == -1) {
@@ -1067,6 +3484,7 @@ discard_input(int timeout)
         }
         timeout_count = 0;
     }
+    tl_end("discard_input");
 }
 
 /*
@@ -1088,7 +3506,8 @@ discard_input(int timeout)
  *     If the sender is mxprog, then it could also be user abort.
  *     <data> is 256 bytes (or less if the remaining transfer length is
  *     less than that amount. <CRC> is a 32-bit CRC over the previous
- *     (up to) 256 bytes of data.
+ *     (up to) 256 bytes of data. With FEC (-F), <CRC> is followed by
+ *     FEC_PARITY_LEN bytes of parity covering the data and CRC.
  * RECEIVER
  *     The <status> byte is whether the received data matched the CRC.
  *     If the receiver is the programmer, then the <status> byte also
@@ -1114,21 +3533,29 @@ send_ll_crc(uint8_t *data, size_t len)
     size_t   lpercent = -1;
 
     discard_input(250);
+    xfer_active = TRUE;
 
     while (pos < len) {
         uint tlen = DATA_CRC_INTERVAL;
         if (tlen > len - pos)
             tlen = len - pos;
-        if (send_ll_bin(data, tlen))
+        tl_begin("tx_block", "0x%x", pos);
+        if (send_ll_bin(data, tlen)) {
+            tl_end("tx_block");
+            (void) abort_transfer();
             return (1);
+        }
+        tl_end("tx_block");
         crc = crc32(crc, data, tlen);
         data += tlen;
         pos  += tlen;
 
         if (cap_count >= ARRAY_SIZE(cap_pos)) {
             cap_count--;
-            if (check_rc(cap_pos[cap_cons]))
+            if (check_rc(cap_pos[cap_cons])) {
+                (void) abort_transfer();
                 return (RC_FAILURE);
+            }
             if (++cap_cons >= ARRAY_SIZE(cap_pos))
                 cap_cons = 0;
         }
@@ -1136,8 +3563,22 @@ send_ll_crc(uint8_t *data, size_t len)
         /* Send and record the current CRC position */
         if (send_ll_bin((uint8_t *)&crc, sizeof (crc))) {
             printf("Data send CRC timeout at 0x%x\n", pos);
+            (void) abort_transfer();
             return (RC_TIMEOUT);
         }
+        if (fec_mode) {
+            uint8_t block[DATA_CRC_INTERVAL + sizeof (crc)];
+            uint8_t parity[FEC_PARITY_LEN];
+
+            memcpy(block, data - tlen, tlen);
+            memcpy(block + tlen, &crc, sizeof (crc));
+            fec_encode(block, tlen + sizeof (crc), parity);
+            if (send_ll_bin(parity, sizeof (parity))) {
+                printf("Data send FEC timeout at 0x%x\n", pos);
+                (void) abort_transfer();
+                return (RC_TIMEOUT);
+            }
+        }
         crc_cap_pos = pos;
         cap_pos[cap_prod] = pos;
         if (++cap_prod >= ARRAY_SIZE(cap_pos))
@@ -1145,7 +3586,7 @@ send_ll_crc(uint8_t *data, size_t len)
         cap_count++;
 
         percent = (crc_cap_pos * 100) / len;
-        if (lpercent != percent) {
+        if (show_progress && (lpercent != percent)) {
             lpercent = percent;
             printf("\r%zu%%", percent);
             fflush(stdout);
@@ -1153,85 +3594,79 @@ send_ll_crc(uint8_t *data, size_t len)
     }
 
     while (cap_count-- > 0) {
-        if (check_rc(cap_pos[cap_cons]))
+        if (check_rc(cap_pos[cap_cons])) {
+            (void) abort_transfer();
             return (1);
+        }
         if (++cap_cons >= ARRAY_SIZE(cap_pos))
             cap_cons = 0;
     }
 
-    printf("\r100%%\n");
+    xfer_active = FALSE;
+    if (show_progress)
+        printf("\r100%%\n");
     return (0);
 }
 
 
 /*
- * wait_for_text() waits for a specific sequence of characters (string) from
- *                 the programmer. This is typically a command prompt or
- *                 expected status message.
+ * prom_xfer() returns the programmer command prefix for a CRC-framed
+ *             binary transfer, which requests FEC parity if enabled (-F).
+ */
+static const char *
+prom_xfer(void)
+{
+    return (fec_mode ? "prom fec" : "prom");
+}
+
+/*
+ * send_cmd() sends a command string to the programmer, verifying that the
+ *            command prompt is present before issuing the command.
  *
- * @param  [in] str     - Specific text string expected from the programmer.
- * @param  [in] timeout - Number of milliseconds since last character before
- *                        giving up.
+ * @param  [in] cmd - Command string to send to the programmer.
  *
- * @return      0 - The text was received from the programmer.
- * @return      1 - A timeout waiting for the text occurred.
+ * @return      0 - Command was issued to the programmer.
+ * @return      1 - A timeout waiting for the command prompt occurred.
  */
 static int
-wait_for_text(const char *str, int timeout)
+send_cmd(const char *cmd)
 {
-    int         ch;
-    int         timeout_count = 0;
-    const char *ptr = str;
+    int rc = 0;
 
-#ifdef DEBUG_WAITFOR
-    printf("waitfor %02x %02x %02x %02x %s\n",
-           str[0], str[1], str[2], str[3], str);
-#endif
-    while (*ptr != '\0') {
-        ch = rx_rb_get();
-        if (ch == -1) {
-            time_delay_msec(1);
-            if (++timeout_count >= timeout) {
-                return (1);
-            }
-            continue;
-        }
-        timeout_count = 0;
-        if (*ptr == ch) {
-            ptr++;
-        } else {
-            ptr = str;
-        }
-    }
-    return (0);
-}
-
-/*
- * send_cmd() sends a command string to the programmer, verifying that the
- *            command prompt is present before issuing the command.
- *
- * @param  [in] cmd - Command string to send to the programmer.
- *
- * @return      0 - Command was issued to the programmer.
- * @return      1 - A timeout waiting for the command prompt occurred.
- */
-static int
-send_cmd(const char *cmd)
-{
+    tl_begin("send_cmd", "%s", cmd);
+    bulk_check();
     send_ll_str("\025");       // ^U  (delete any command text)
     discard_input(50);         // Wait for buffered output to arrive
     send_ll_str("\n");         // ^M  (request new command prompt)
 
-    if (wait_for_text("CMD>", 500)) {
+    tl_begin("wait_prompt", NULL);
+    rc = wait_for_text("CMD>", 500);
+    tl_end("wait_prompt");
+    if (rc) {
+        tl_end("send_cmd");
         warnx("CMD: timeout");
         return (1);
     }
 
-    send_ll_str(cmd);
-    send_ll_str("\n");         // ^M (execute command)
-    wait_for_text("\n", 200);  // Discard echo of command and newline
+    if (bulk_fd != -1) {
+        /*
+         * Commands sent on the bulk data interface are answered there
+         * with binary data. Text output remains on the console.
+         */
+        char line[256];
+        snprintf(line, sizeof (line), "%s\n", cmd);
+        while (brx_rb_get() != -1)
+            ;  // Discard stale binary data
+        rc = bulk_send((uint8_t *) line, strlen(line));
+    } else {
+        send_ll_str(cmd);
+        send_ll_str("\n");     // ^M (execute command)
+    }
+    if (rc == 0)
+        wait_for_text("\n", 200);  // Discard echo of command and newline
+    tl_end("send_cmd");
 
-    return (0);
+    return (rc);
 }
 
 /*
@@ -1258,6 +3693,223 @@ recv_output(char *buf, size_t buflen, int *rxcount, int timeout)
     return (0);
 }
 
+/*
+ * model_key_set() stores a model key, truncated to fit the buffer.
+ *
+ * @param  [out] buf    - Buffer to hold the key.
+ * @param  [in]  buflen - Size of the buffer.
+ * @param  [in]  name   - Key to store.
+ * @return       None.
+ */
+static void
+model_key_set(char *buf, size_t buflen, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len >= buflen)
+        len = buflen - 1;
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+}
+
+/*
+ * model_key() generates the name under which the timing model of the
+ *             current programmer is stored. The /dev/serial/by-id name
+ *             includes the USB serial number, so it is used when the
+ *             device can be found there. Otherwise the device name is
+ *             used as-is.
+ *
+ * @param  [out] buf    - Buffer to hold the generated key.
+ * @param  [in]  buflen - Size of the buffer.
+ * @return       None.
+ */
+static void
+model_key(char *buf, size_t buflen)
+{
+    const char *name = strrchr(device_name, '/');
+    char       *ptr;
+
+    name = (name == NULL) ? device_name : name + 1;
+    if (*name == '\0')
+        name = "default";
+    model_key_set(buf, buflen, name);
+#ifdef LINUX
+    if (strncmp(device_name, LINUX_BY_ID_DIR, strlen(LINUX_BY_ID_DIR)) != 0) {
+        char           path[PATH_MAX];
+        char           dev_real[PATH_MAX];
+        char           id_real[PATH_MAX];
+        DIR           *dirp;
+        struct dirent *dent;
+
+        if ((realpath(device_name, dev_real) != NULL) &&
+            ((dirp = opendir(LINUX_BY_ID_DIR)) != NULL)) {
+            while ((dent = readdir(dirp)) != NULL) {
+                snprintf(path, sizeof (path), "%s/%s",
+                         LINUX_BY_ID_DIR, dent->d_name);
+                if ((dent->d_name[0] != '.') &&
+                    (realpath(path, id_real) != NULL) &&
+                    (strcmp(id_real, dev_real) == 0)) {
+                    model_key_set(buf, buflen, dent->d_name);
+                    break;
+                }
+            }
+            closedir(dirp);
+        }
+    }
+#endif
+    for (ptr = buf; *ptr != '\0'; ptr++)
+        if (!isalnum((uint8_t) *ptr) && (*ptr != '-') && (*ptr != '.'))
+            *ptr = '_';
+}
+
+/*
+ * model_load() loads the timing model of the current programmer, which
+ *              was learned from prior jobs. The model is a text file of
+ *              "<name> <value> <samples>" lines in ~/.mxprog. Parameters
+ *              not yet measured use default values.
+ *
+ * @param  [in]  None.
+ * @global [out] tm_value[], tm_samples[], and tm_path[] are updated.
+ * @return       None.
+ */
+static void
+model_load(void)
+{
+    const char *home = getenv("HOME");
+    char        key[NAME_MAX + 1];
+    char        line[128];
+    char        name[64];
+    double      value;
+    uint        samples;
+    uint        cur;
+    FILE       *fp;
+
+    for (cur = 0; cur < TM_COUNT; cur++) {
+        tm_value[cur]   = tm_default[cur];
+        tm_samples[cur] = 0;
+    }
+    tm_path[0] = '\0';
+    if ((home == NULL) || (*home == '\0'))
+        return;
+    model_key(key, sizeof (key));
+    snprintf(tm_path, sizeof (tm_path), "%s/.mxprog/model-%s", home, key);
+
+    fp = fopen(tm_path, "r");
+    if (fp == NULL)
+        return;
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        if (sscanf(line, "%63s %lf %u", name, &value, &samples) != 3)
+            continue;
+        for (cur = 0; cur < TM_COUNT; cur++) {
+            if ((strcmp(name, tm_name[cur]) == 0) && (value > 0)) {
+                tm_value[cur]   = value;
+                tm_samples[cur] = samples;
+            }
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * model_save() writes the timing model of the current programmer, if it
+ *              was refined by measurements during this job.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+model_save(void)
+{
+    char  tmp[PATH_MAX + 8];
+    char *ptr;
+    uint  cur;
+    FILE *fp;
+
+    if ((tm_dirty == FALSE) || (tm_path[0] == '\0'))
+        return;
+    tm_dirty = FALSE;
+
+    /* Create ~/.mxprog if it does not exist */
+    snprintf(tmp, sizeof (tmp), "%s", tm_path);
+    ptr = strrchr(tmp, '/');
+    if (ptr != NULL) {
+        *ptr = '\0';
+        (void) mkdir(tmp, 0755);
+    }
+
+    snprintf(tmp, sizeof (tmp), "%s.tmp", tm_path);
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        warn("Failed to create %s", tmp);
+        return;
+    }
+    fprintf(fp, "# mxprog timing model: <name> <value> <samples>\n");
+    for (cur = 0; cur < TM_COUNT; cur++)
+        fprintf(fp, "%s %.1f %u\n", tm_name[cur], tm_value[cur],
+                tm_samples[cur]);
+    if ((fclose(fp) != 0) || (rename(tmp, tm_path) != 0)) {
+        warn("Failed to write %s", tm_path);
+        (void) unlink(tmp);
+    }
+}
+
+/*
+ * model_sample() refines a timing model parameter with a new measurement.
+ *                The first measurement replaces the default value. Later
+ *                measurements are combined in an exponentially weighted
+ *                average, so the model tracks gradual change in the board
+ *                and EEPROM while smoothing out a single slow job.
+ *
+ * @param  [in]  param - The parameter measured.
+ * @param  [in]  value - The measured value.
+ * @return       None.
+ */
+static void
+model_sample(tm_param_t param, double value)
+{
+    if (value <= 0)
+        return;
+    if (tm_samples[param] == 0)
+        tm_value[param] = value;
+    else
+        tm_value[param] += (value - tm_value[param]) / MODEL_WEIGHT;
+    tm_samples[param]++;
+    tm_dirty = TRUE;
+}
+
+/*
+ * page_count() returns the number of EEPROM program pages touched by
+ *              the specified range.
+ */
+static uint
+page_count(uint addr, uint len)
+{
+    if (len == 0)
+        return (0);
+    return ((addr + len - 1) / EEPROM_PAGE_SIZE - addr / EEPROM_PAGE_SIZE + 1);
+}
+
+/*
+ * erase_sectors() returns the number of sectors which eeprom_erase() will
+ *                 erase for the specified arguments, or 0 for chip erase.
+ *                 The programmer erases at least one sector, and always
+ *                 rounds the range out to whole sectors.
+ */
+static uint
+erase_sectors(uint bank, uint addr, uint len)
+{
+    if (bank != BANK_NOT_SPECIFIED) {
+        if (addr == ADDR_NOT_SPECIFIED)
+            addr = 0;
+        addr += bank * len;
+    }
+    if (addr == ADDR_NOT_SPECIFIED)
+        return (0);
+    if ((len == EEPROM_SIZE_NOT_SPECIFIED) || (len == 0))
+        return (1);
+    return ((addr + len - 1) / IMAGE_SECTOR_SIZE - addr / IMAGE_SECTOR_SIZE + 1);
+}
+
 /*
  * are_you_sure() prompts the user to confirm that an operation is intended.
  *
@@ -1310,7 +3962,14 @@ eeprom_erase(uint bank, uint addr, uint len)
     char cmd[64];
     int  count;
     int  no_data;
+    int  dsr_start;
+    int  notify_rc;
+    bool done = FALSE;
+    bool prompt_seen = FALSE;
     char prompt[80];
+    uint sectors = erase_sectors(bank, addr, len);
+    uint64_t start;
+    uint64_t last = 0;
 
     if (bank != BANK_NOT_SPECIFIED) {
         if (addr == ADDR_NOT_SPECIFIED)
@@ -1335,9 +3994,19 @@ eeprom_erase(uint bank, uint addr, uint len)
         return (1);
     cmd[sizeof (cmd) - 1] = '\0';
 
+    dsr_start = cmd_notify_start();
+    start = time_usec();
     if (send_cmd(cmd))
         return (1);  // send_cmd() reported "timeout" in this case
 
+    /*
+     * Sleep until the programmer reports completion. Output accumulated
+     * meanwhile is displayed below. Older firmware (no notifications)
+     * falls back to watching output for the command prompt.
+     */
+    tl_begin("erase_wait", "%u sectors", sectors);
+    notify_rc = cmd_notify_wait(dsr_start, 100000);  // Chip erase < 100 sec
+
     no_data = 0;
     for (count = 0; count < 1000; count++) {  // 100 seconds max
         if (recv_output(cmd_output, sizeof (cmd_output), &rxcount, 100))
@@ -1349,15 +4018,363 @@ eeprom_erase(uint bank, uint addr, uint len)
             }
         } else {
             no_data = 0;
+            last = time_usec();
             printf("%.*s", rxcount, cmd_output);
             fflush(stdout);
+            if (strstr(cmd_output, "Done") != NULL)
+                done = TRUE;  // Erase status reported success
             if (strstr(cmd_output, "CMD>") != NULL) {
                 /* Normal end */
+                prompt_seen = TRUE;
                 break;
             }
         }
     }
+
+    tl_end("erase_wait");
+
+    /*
+     * Erase ends when the programmer reports the result and prompts.
+     * Only a successful erase is a valid timing sample.
+     */
+    if (prompt_seen &&
+        ((notify_rc == 0) || ((notify_rc == -1) && done))) {
+        if (sectors == 0)
+            model_sample(TM_CHIP, last - start);
+        else
+            model_sample(TM_SECTOR, (double) (last - start) / sectors);
+    }
+    return (0);
+}
+
+/*
+ * show_crashlog() requests the crash log which the programmer preserved
+ *                 from before its last reset, and displays it. The log
+ *                 records the fault registers (if the programmer faulted),
+ *                 the command and EEPROM address in progress, and the most
+ *                 recent program and erase times.
+ *
+ * @param  [in]  None.
+ * @return       0 - Success.
+ * @return       1 - Failure (or no crash log present).
+ */
+static int
+show_crashlog(void)
+{
+    char cmd_output[1024];
+    int  rxcount;
+    int  count;
+    int  total = 0;
+    int  rc = 0;
+
+    if (send_cmd("crashlog"))
+        return (1);  // send_cmd() reported "timeout" in this case
+
+    for (count = 0; count < 10; count++) {  // 1 second max
+        if (recv_output(cmd_output, sizeof (cmd_output) - 1, &rxcount, 100))
+            return (1); // "timeout" was reported in this case
+        if (rxcount == 0) {
+            if (total != 0)
+                break;  // End of output
+            continue;
+        }
+        cmd_output[rxcount] = '\0';
+        printf("%s", cmd_output);
+        if (strstr(cmd_output, "No crash log") != NULL)
+            rc = 1;
+        total += rxcount;
+    }
+    if (total == 0)
+        printf("Receive timeout\n");
+    return (rc);
+}
+
+/*
+ * Dump archive (-R). Each dump is stored as a text manifest which lists the
+ * SHA-256 of every ARCHIVE_CHUNK sector of the image. Sector contents are
+ * kept once in a content-addressed object store, so dumps of the same
+ * Kickstart banks, mirrored or rearranged, take no additional space.
+ *
+ *     <dir>/manifests/<name>
+ *     <dir>/objects/<first 2 hex digits>/<sha256 hex>
+ */
+#define ARCHIVE_CHUNK    0x10000  // Sector size stored as one object
+#define ARCHIVE_MAGIC    "# mxprog archive manifest v1"
+#define ARCHIVE_DIR_NAME ".mxprog/archive"  // Default in $HOME
+
+/*
+ * archive_default_dir() returns the archive used when -R is not specified,
+ *                       which is ~/.mxprog/archive.
+ *
+ * @param  [out] buf    - Buffer to hold the directory name.
+ * @param  [in]  buflen - Size of the buffer.
+ * @return       Directory name.
+ * @exit         EXIT_FAILURE - $HOME is not set.
+ */
+static const char *
+archive_default_dir(char *buf, size_t buflen)
+{
+    const char *home = getenv("HOME");
+
+    if ((home == NULL) || (*home == '\0'))
+        errx(EXIT_FAILURE, "HOME is not set; specify an archive with -R");
+    snprintf(buf, buflen, "%s/%s", home, ARCHIVE_DIR_NAME);
+    return (buf);
+}
+
+/*
+ * archive_mkdir() creates a directory and any missing parents.
+ *
+ * @param  [in]  path - Directory to create.
+ * @return       None.
+ * @exit         EXIT_FAILURE - A directory could not be created.
+ */
+static void
+archive_mkdir(const char *path)
+{
+    char  tmp[PATH_MAX];
+    char *ptr;
+
+    snprintf(tmp, sizeof (tmp), "%s", path);
+    for (ptr = tmp + 1; ; ptr++) {
+        if ((*ptr == '/') || (*ptr == '\0')) {
+            char ch = *ptr;
+            *ptr = '\0';
+            if ((mkdir(tmp, 0755) != 0) && (errno != EEXIST))
+                err(EXIT_FAILURE, "Failed to create %s", tmp);
+            *ptr = ch;
+            if (ch == '\0')
+                break;
+        }
+    }
+}
+
+/*
+ * archive_manifest_path() generates the manifest filename of a dump. Only
+ *                         the last component of the name is used, so that
+ *                         "mxprog -R dir -r dumps/kick.rom" stores kick.rom.
+ *
+ * @param  [out] buf    - Buffer to hold the manifest filename.
+ * @param  [in]  buflen - Size of the buffer.
+ * @param  [in]  dir    - Archive directory.
+ * @param  [in]  name   - Dump name.
+ * @return       None.
+ * @exit         EXIT_FAILURE - The name is not valid.
+ */
+static void
+archive_manifest_path(char *buf, size_t buflen, const char *dir,
+                      const char *name)
+{
+    const char *slash = strrchr(name, '/');
+
+    if (slash != NULL)
+        name = slash + 1;
+    if ((*name == '\0') || (strcmp(name, ".") == 0) ||
+        (strcmp(name, "..") == 0)) {
+        errx(EXIT_FAILURE, "Invalid archive name \"%s\"", name);
+    }
+    snprintf(buf, buflen, "%s/manifests/%s", dir, name);
+}
+
+/*
+ * archive_put() stores a dump in the archive. Each sector is hashed, and
+ *               only sectors not already present in the object store are
+ *               written. Objects and the manifest are written to a
+ *               temporary file and renamed, so that an interrupted dump
+ *               never leaves a partial object behind.
+ *
+ * @param  [in]  dir  - Archive directory.
+ * @param  [in]  name - Dump name.
+ * @param  [in]  buf  - Dump contents.
+ * @param  [in]  len  - Dump length.
+ * @return       None.
+ * @exit         EXIT_FAILURE - The program will terminate on file error.
+ */
+static void
+archive_put(const char *dir, const char *name, const uint8_t *buf, uint len)
+{
+    char        mpath[PATH_MAX];
+    char        opath[PATH_MAX + 80];
+    char        tmp[PATH_MAX + 100];
+    char        hex[SHA256_LEN * 2 + 1];
+    uint8_t     digest[SHA256_LEN];
+    struct stat statbuf;
+    sha256_t    ctx;
+    uint        pos;
+    uint        clen;
+    uint        cur;
+    uint        chunks = 0;
+    uint        stored = 0;
+    FILE       *mfp;
+    FILE       *fp;
+
+    archive_manifest_path(mpath, sizeof (mpath), dir, name);
+    snprintf(tmp, sizeof (tmp), "%s/manifests", dir);
+    archive_mkdir(tmp);
+
+    snprintf(tmp, sizeof (tmp), "%s.tmp.%d", mpath, getpid());
+    mfp = fopen(tmp, "w");
+    if (mfp == NULL)
+        err(EXIT_FAILURE, "Failed to create %s", tmp);
+    fprintf(mfp, "%s\n", ARCHIVE_MAGIC);
+    fprintf(mfp, "len 0x%x crc 0x%08x\n", len, crc32(0, buf, len));
+
+    tl_begin("archive_put", "%s", name);
+    for (pos = 0; pos < len; pos += clen) {
+        clen = len - pos;
+        if (clen > ARCHIVE_CHUNK)
+            clen = ARCHIVE_CHUNK;
+        sha256_init(&ctx);
+        sha256_update(&ctx, buf + pos, clen);
+        sha256_final(&ctx, digest);
+        for (cur = 0; cur < SHA256_LEN; cur++)
+            sprintf(hex + cur * 2, "%02x", digest[cur]);
+        fprintf(mfp, "0x%06x 0x%05x %s\n", pos, clen, hex);
+        chunks++;
+
+        snprintf(opath, sizeof (opath), "%s/objects/%.2s/%s", dir, hex, hex);
+        if ((stat(opath, &statbuf) == 0) && (statbuf.st_size == clen)) {
+            stored++;
+            continue;
+        }
+        snprintf(tmp, sizeof (tmp), "%s/objects/%.2s", dir, hex);
+        archive_mkdir(tmp);
+        snprintf(tmp, sizeof (tmp), "%s.tmp.%d", opath, getpid());
+        fp = fopen(tmp, "w");
+        if (fp == NULL)
+            err(EXIT_FAILURE, "Failed to create %s", tmp);
+        if ((fwrite(buf + pos, clen, 1, fp) != 1) || (fclose(fp) != 0) ||
+            (rename(tmp, opath) != 0)) {
+            (void) unlink(tmp);
+            err(EXIT_FAILURE, "Failed to write %s", opath);
+        }
+    }
+    tl_end("archive_put");
+
+    snprintf(tmp, sizeof (tmp), "%s.tmp.%d", mpath, getpid());
+    if ((fclose(mfp) != 0) || (rename(tmp, mpath) != 0)) {
+        (void) unlink(tmp);
+        err(EXIT_FAILURE, "Failed to write %s", mpath);
+    }
+    printf("Archived 0x%x bytes as %s: %u sectors, %u new, "
+           "%u already stored\n", len, mpath, chunks, chunks - stored, stored);
+}
+
+/*
+ * archive_get() rebuilds a dump from the archive. Every object is checked
+ *               against its hash, and the rebuilt image against the CRC
+ *               recorded when the dump was stored.
+ *
+ * @param  [in]  dir      - Archive directory.
+ * @param  [in]  name     - Dump name.
+ * @param  [in]  filename - File to which the dump is written.
+ * @return       0 - Dump rebuilt.
+ * @return       1 - Manifest or object store is damaged.
+ * @exit         EXIT_FAILURE - The program will terminate on file error.
+ */
+static int
+archive_get(const char *dir, const char *name, const char *filename)
+{
+    char        mpath[PATH_MAX];
+    char        opath[PATH_MAX + 80];
+    char        line[160];
+    char        hex[SHA256_LEN * 2 + 1];
+    char        ohex[SHA256_LEN * 2 + 1];
+    uint8_t     digest[SHA256_LEN];
+    uint8_t    *buf;
+    struct stat statbuf;
+    sha256_t    ctx;
+    uint32_t    crc;
+    uint        len;
+    uint        pos = 0;
+    uint        clen;
+    uint        cur;
+    uint        chunks = 0;
+    FILE       *fp;
+
+    archive_manifest_path(mpath, sizeof (mpath), dir, name);
+    fp = fopen(mpath, "r");
+    if (fp == NULL)
+        err(EXIT_FAILURE, "Failed to open %s", mpath);
+    if ((fgets(line, sizeof (line), fp) == NULL) ||
+        (strncmp(line, ARCHIVE_MAGIC, strlen(ARCHIVE_MAGIC)) != 0) ||
+        (fgets(line, sizeof (line), fp) == NULL) ||
+        (sscanf(line, "len %x crc %x", &len, &crc) != 2)) {
+        errx(EXIT_FAILURE, "%s is not an mxprog archive manifest", mpath);
+    }
+    if (len > EEPROM_SIZE_DEFAULT) {
+        errx(EXIT_FAILURE, "%s: image length 0x%x exceeds 0x%x",
+             mpath, len, EEPROM_SIZE_DEFAULT);
+    }
+    buf = malloc(len + 1);
+    if (buf == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+
+    tl_begin("archive_get", "%s", name);
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        FILE *ofp;
+
+        if ((sscanf(line, "%x %x %64s", &cur, &clen, hex) != 3) ||
+            (cur != pos) || (clen == 0) || (clen > ARCHIVE_CHUNK) ||
+            (clen > len - pos) || (strlen(hex) != SHA256_LEN * 2)) {
+            warnx("%s: invalid sector entry: %s", mpath, line);
+            goto fail;
+        }
+        snprintf(opath, sizeof (opath), "%s/objects/%.2s/%s", dir, hex, hex);
+        ofp = fopen(opath, "r");
+        if (ofp == NULL) {
+            warn("Sector 0x%x object %s", pos, opath);
+            goto fail;
+        }
+        if ((fstat(fileno(ofp), &statbuf) != 0) ||
+            (statbuf.st_size != clen) ||
+            (fread(buf + pos, clen, 1, ofp) != 1)) {
+            fclose(ofp);
+            warnx("Sector 0x%x object %s is not 0x%x bytes", pos, opath, clen);
+            goto fail;
+        }
+        fclose(ofp);
+
+        sha256_init(&ctx);
+        sha256_update(&ctx, buf + pos, clen);
+        sha256_final(&ctx, digest);
+        for (cur = 0; cur < SHA256_LEN; cur++)
+            sprintf(ohex + cur * 2, "%02x", digest[cur]);
+        if (strcmp(ohex, hex) != 0) {
+            warnx("Sector 0x%x object %s is corrupt (hash %s)",
+                  pos, opath, ohex);
+            goto fail;
+        }
+        pos += clen;
+        chunks++;
+    }
+    if (pos != len) {
+        warnx("%s: sectors cover 0x%x of 0x%x bytes", mpath, pos, len);
+        goto fail;
+    }
+    if (crc32(0, buf, len) != crc) {
+        warnx("%s: rebuilt image CRC 0x%08x does not match 0x%08x",
+              mpath, crc32(0, buf, len), crc);
+        goto fail;
+    }
+    tl_end("archive_get");
+    fclose(fp);
+
+    fp = fopen(filename, "w");
+    if (fp == NULL)
+        err(EXIT_FAILURE, "Failed to open %s", filename);
+    if ((fwrite(buf, len, 1, fp) != 1) || (fclose(fp) != 0))
+        err(EXIT_FAILURE, "Failed to write %s", filename);
+    printf("Rebuilt 0x%x bytes from %u sectors of %s into %s\n",
+           len, chunks, mpath, filename);
+    free(buf);
     return (0);
+
+fail:
+    tl_end("archive_get");
+    fclose(fp);
+    free(buf);
+    return (1);
 }
 
 /*
@@ -1402,6 +4419,7 @@ eeprom_read(const char *filename, uint bank, uint addr, uint len)
     char cmd[64];
     char *eebuf;
     int rxcount;
+    uint64_t start;
 
     if (addr == ADDR_NOT_SPECIFIED)
         addr = 0x000000;  // Start of EEPROM
@@ -1416,13 +4434,16 @@ eeprom_read(const char *filename, uint bank, uint addr, uint len)
     if (eebuf == NULL)
         errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
 
-    snprintf(cmd, sizeof (cmd) - 1, "prom read %x %x", addr, len);
+    snprintf(cmd, sizeof (cmd) - 1, "%s read %x %x", prom_xfer(), addr, len);
     cmd[sizeof (cmd) - 1] = '\0';
+    start = time_usec();
     if (send_cmd(cmd))
         return; // "timeout" was reported in this case
     rxcount = receive_ll_crc(eebuf, len);
     if (rxcount == -1)
         return;  // Send error was reported
+    if (rxcount == len)
+        model_sample(TM_LINK, len * 1000000.0 / (time_usec() - start));
     if (rxcount < len) {
         printf("Receive failed at byte 0x%x.\n", rxcount);
         if (strncmp(eebuf + rxcount - 11, "FAILURE", 8) == 0) {
@@ -1430,15 +4451,21 @@ eeprom_read(const char *filename, uint bank, uint addr, uint len)
             printf("Read %.11s\n", eebuf + rxcount);
         }
     }
-    if (rxcount > 0) {
+    if ((rxcount > 0) && (archive_dir != NULL)) {
+        archive_put(archive_dir, filename, (uint8_t *) eebuf, rxcount);
+    } else if (rxcount > 0) {
         size_t written;
-        FILE *fp = fopen(filename, "w");
+        FILE *fp;
+
+        tl_begin("write_file", "%s", filename);
+        fp = fopen(filename, "w");
         if (fp == NULL)
             err(EXIT_FAILURE, "Failed to open %s", filename);
         written = fwrite(eebuf, rxcount, 1, fp);
         if (written != 1)
             err(EXIT_FAILURE, "Failed to write %s", filename);
         fclose(fp);
+        tl_end("write_file");
         printf("Read 0x%x bytes from device and wrote to file %s\n",
                rxcount, filename);
     }
@@ -1446,41 +4473,263 @@ eeprom_read(const char *filename, uint bank, uint addr, uint len)
 }
 
 /*
- * eeprom_write() uses the programmer to writes all or part of an EEPROM image.
- *                Content to write is sourced from a local file.
+ * bank_filename() generates the output filename for a single bank by
+ *                 inserting -<bank> ahead of the filename extension.
+ *                 For example, bank 2 of kick.rom is kick-2.rom.
  *
- * @param  [in]  filename        - The file to write to the EEPROM.
- * @param  [in]  addr            - The EEPROM starting address.
- * @param  [io]  len             - The length to write.
- * @return       0 - Verify successful.
- * @return       1 - Verify failed.
- * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ * @param  [out] buf      - Buffer to hold the generated filename.
+ * @param  [in]  buflen   - Size of the buffer.
+ * @param  [in]  filename - Base filename specified by the user.
+ * @param  [in]  bank     - Bank number.
  */
-static uint
-eeprom_write(const char *filename, uint addr, uint len)
+static void
+bank_filename(char *buf, size_t buflen, const char *filename, uint bank)
 {
-    FILE       *fp;
-    uint8_t    *filebuf;
-    char        cmd[64];
-    char        cmd_output[64];
-    int         rxcount;
-    int         tcount = 0;
+    const char *dot   = strrchr(filename, '.');
+    const char *slash = strrchr(filename, '/');
+    const char *base  = (slash == NULL) ? filename : slash + 1;
 
-    filebuf = malloc(len);
-    if (filebuf == NULL)
-        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+    if ((dot == NULL) || (dot <= base))
+        snprintf(buf, buflen, "%s-%u", filename, bank);
+    else
+        snprintf(buf, buflen, "%.*s-%u%s",
+                 (int) (dot - filename), filename, bank, dot);
+}
 
-    fp = fopen(filename, "r");
+/*
+ * files_identical() compares the contents of two files.
+ *
+ * @param  [in]  name1 - First file.
+ * @param  [in]  name2 - Second file.
+ * @return       TRUE  - File contents are identical.
+ * @return       FALSE - Contents differ or a file could not be read.
+ */
+static bool
+files_identical(const char *name1, const char *name2)
+{
+    char   buf1[4096];
+    char   buf2[4096];
+    size_t len1;
+    size_t len2;
+    bool   same = TRUE;
+    FILE  *fp1  = fopen(name1, "r");
+    FILE  *fp2  = fopen(name2, "r");
+
+    if ((fp1 == NULL) || (fp2 == NULL))
+        same = FALSE;
+    while (same) {
+        len1 = fread(buf1, 1, sizeof (buf1), fp1);
+        len2 = fread(buf2, 1, sizeof (buf2), fp2);
+        if ((len1 != len2) || (memcmp(buf1, buf2, len1) != 0))
+            same = FALSE;
+        if (len1 == 0)
+            break;
+    }
+    if (fp1 != NULL)
+        fclose(fp1);
+    if (fp2 != NULL)
+        fclose(fp2);
+    return (same);
+}
+
+/*
+ * rx_sink_split() is a receive_ll_crc_sink() function which writes received
+ *                 data to one file per bank, opening the next bank file
+ *                 as the previous one fills.
+ */
+static int
+rx_sink_split(void *arg, const uint8_t *data, uint pos, uint len)
+{
+    split_t *split = arg;
+    char     name[PATH_MAX];
+
+    while (len > 0) {
+        uint tlen = split->size - split->cur_len;
+        if (tlen > len)
+            tlen = len;
+
+        if (split->fp == NULL) {
+            bank_filename(name, sizeof (name), split->filename, split->cur);
+            split->fp = fopen(name, "w");
+            if (split->fp == NULL) {
+                warn("Failed to open %s", name);
+                return (1);
+            }
+        }
+        if (fwrite(data, tlen, 1, split->fp) != 1) {
+            warn("Failed to write bank %u", split->cur);
+            return (1);
+        }
+        split->crc[split->cur] = crc32(split->crc[split->cur], data, tlen);
+        split->cur_len += tlen;
+        data += tlen;
+        len  -= tlen;
+
+        if (split->cur_len == split->size) {
+            /* Bank is complete */
+            fclose(split->fp);
+            split->fp = NULL;
+            split->len[split->cur++] = split->cur_len;
+            split->cur_len = 0;
+        }
+    }
+    return (0);
+}
+
+/*
+ * eeprom_read_split() reads an EEPROM range in a single transfer, writing
+ *                     each bank of the specified size to its own file as
+ *                     data arrives. Banks which are identical to an earlier
+ *                     bank are reported and, if requested, replaced with a
+ *                     hard link to the earlier bank file.
+ *
+ * @param  [in]  filename - Base filename (see bank_filename()).
+ * @param  [in]  bank     - Starting address addition multiplier.
+ * @param  [in]  addr     - The EEPROM starting address.
+ * @param  [in]  len      - The length to read.
+ * @return       0 - Read successful.
+ * @return       1 - Read failed.
+ */
+static int
+eeprom_read_split(const char *filename, uint bank, uint addr, uint len)
+{
+    char    cmd[64];
+    char    name[PATH_MAX];
+    char    pname[PATH_MAX];
+    int     rxcount;
+    int     rc = 0;
+    uint    cur;
+    uint    prev;
+    split_t split;
+
+    if (addr == ADDR_NOT_SPECIFIED)
+        addr = 0x000000;  // Start of EEPROM
+
+    if (len == EEPROM_SIZE_NOT_SPECIFIED)
+        len = EEPROM_SIZE_DEFAULT - addr;
+
+    if (bank != BANK_NOT_SPECIFIED)
+        addr += bank * len;
+
+    memset(&split, 0, sizeof (split));
+    split.filename = filename;
+    split.size     = split_size;
+    split.banks    = (len + split_size - 1) / split_size;
+    split.crc      = calloc(split.banks, sizeof (*split.crc));
+    split.len      = calloc(split.banks, sizeof (*split.len));
+    if ((split.crc == NULL) || (split.len == NULL))
+        errx(EXIT_FAILURE, "Could not allocate %u bank records", split.banks);
+
+    snprintf(cmd, sizeof (cmd) - 1, "%s read %x %x", prom_xfer(), addr, len);
+    cmd[sizeof (cmd) - 1] = '\0';
+    if (send_cmd(cmd)) {
+        rc = 1; // "timeout" was reported in this case
+        goto done;
+    }
+    rxcount = receive_ll_crc_sink(len, rx_sink_split, &split);
+    if (split.fp != NULL) {
+        /* Final partial bank */
+        fclose(split.fp);
+        split.fp = NULL;
+        split.len[split.cur++] = split.cur_len;
+    }
+    if (rxcount < (int) len) {
+        if (rxcount >= 0)
+            printf("Receive failed at byte 0x%x.\n", rxcount);
+        rc = 1;
+        goto done;
+    }
+    bank_filename(name, sizeof (name), filename, 0);
+    printf("Read 0x%x bytes from device and wrote %u banks of 0x%x "
+           "bytes to %s...\n", len, split.banks, split_size, name);
+
+    /* Report banks which duplicate an earlier bank */
+    for (cur = 1; cur < split.banks; cur++) {
+        for (prev = 0; prev < cur; prev++) {
+            if ((split.crc[prev] != split.crc[cur]) ||
+                (split.len[prev] != split.len[cur]))
+                continue;
+            bank_filename(name, sizeof (name), filename, cur);
+            bank_filename(pname, sizeof (pname), filename, prev);
+            if (files_identical(pname, name) == FALSE)
+                continue;
+            printf("Bank %u is identical to bank %u", cur, prev);
+            if (link_dups) {
+                if (unlink(name) || link(pname, name)) {
+                    printf("\n");
+                    warn("Failed to link %s to %s", name, pname);
+                    rc = 1;
+                    break;
+                }
+                printf(" (linked)");
+            }
+            printf("\n");
+            break;
+        }
+    }
+done:
+    free(split.crc);
+    free(split.len);
+    return (rc);
+}
+
+/*
+ * read_file() allocates a buffer and fills it with the leading contents of
+ *             the specified file.
+ *
+ * @param  [in]  filename        - The file to read.
+ * @param  [in]  len             - The number of bytes to read.
+ * @return       Allocated buffer holding file contents.
+ * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ */
+static uint8_t *
+read_file(const char *filename, uint len)
+{
+    FILE       *fp;
+    uint8_t    *filebuf;
+
+    filebuf = malloc(len);
+    if (filebuf == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+
+    tl_begin("read_file", "%s", filename);
+    fp = fopen(filename, "r");
     if (fp == NULL)
         errx(EXIT_FAILURE, "Failed to open %s", filename);
     if (fread(filebuf, len, 1, fp) != 1)
         errx(EXIT_FAILURE, "Failed to read %u bytes from %s", len, filename);
     fclose(fp);
+    tl_end("read_file");
+    return (filebuf);
+}
+
+/*
+ * eeprom_write_buf() uses the programmer to write all or part of an EEPROM
+ *                    image which is already present in memory.
+ *
+ * @param  [in]  filebuf         - The data to write to the EEPROM.
+ * @param  [in]  addr            - The EEPROM starting address.
+ * @param  [in]  len             - The length to write.
+ * @param  [in]  filename        - The file from which the data originated.
+ * @return       0 - Write successful.
+ * @return       1 - Write failed.
+ * @exit         EXIT_FAILURE - The program will terminate on send failure.
+ */
+static uint
+eeprom_write_buf(uint8_t *filebuf, uint addr, uint len, const char *filename)
+{
+    char        cmd[64];
+    char        cmd_output[512];
+    int         rxcount;
+    int         tcount = 0;
+    uint64_t    start;
+    uint64_t    end;
 
     printf("Writing 0x%06x bytes to EEPROM starting at address 0x%x\n",
            len, addr);
 
-    snprintf(cmd, sizeof (cmd) - 1, "prom write %x %x", addr, len);
+    snprintf(cmd, sizeof (cmd) - 1, "%s write %x %x", prom_xfer(), addr, len);
+    start = time_usec();
     if (send_cmd(cmd))
         return (-1); // "timeout" was reported in this case
 
@@ -1488,18 +4737,21 @@ eeprom_write(const char *filename, uint addr, uint len)
         errx(EXIT_FAILURE, "Send failure");
     }
 
+    tl_begin("tx_flush", NULL);
     while (tx_rb_flushed() == FALSE) {
         if (tcount++ > 500)
             errx(EXIT_FAILURE, "Send timeout");
 
         time_delay_msec(1);
     }
+    tl_end("tx_flush");
     printf("Wrote 0x%x bytes to device from file %s\n", len, filename);
 
     snprintf(cmd, sizeof (cmd) - 1, "prom status");
     cmd[sizeof (cmd) - 1] = '\0';
     if (send_cmd(cmd))
         return (-1); // "timeout" was reported in this case
+    end = time_usec();  // Prompt indicates the write has completed
     if (recv_output(cmd_output, sizeof (cmd_output), &rxcount, 100))
         return (-1); // "timeout" was reported in this case
     if (rxcount == 0) {
@@ -1509,10 +4761,232 @@ eeprom_write(const char *filename, uint addr, uint len)
         printf("Status: %.*s", rxcount, cmd_output);
     }
 
-    free(filebuf);
+    /*
+     * The programmer writes each page as its data arrives, so transfer
+     * overlaps programming. The model records the combined time per page.
+     */
+    if ((rxcount >= 4) && (strncmp(cmd_output, "0080", 4) == 0))
+        model_sample(TM_PAGE, (double) (end - start) / page_count(addr, len));
     return (0);
 }
 
+/*
+ * eeprom_write() uses the programmer to writes all or part of an EEPROM image.
+ *                Content to write is sourced from a local file.
+ *
+ * @param  [in]  filename        - The file to write to the EEPROM.
+ * @param  [in]  addr            - The EEPROM starting address.
+ * @param  [io]  len             - The length to write.
+ * @return       0 - Write successful.
+ * @return       1 - Write failed.
+ * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ */
+static uint
+eeprom_write(const char *filename, uint addr, uint len)
+{
+    uint8_t *filebuf = read_file(filename, len);
+    uint     rc      = eeprom_write_buf(filebuf, addr, len, filename);
+
+    free(filebuf);
+    return (rc);
+}
+
+/*
+ * stage_fill_run() returns the length of the run of a repeated 16-bit word
+ *                  at the specified position in an image.
+ *
+ * @param  [in]  buf - Image data.
+ * @param  [in]  pos - Even offset in image at which the run starts.
+ * @param  [in]  len - Even length of image.
+ * @return       Length of run in bytes.
+ */
+static uint
+stage_fill_run(const uint8_t *buf, uint pos, uint len)
+{
+    uint end;
+
+    for (end = pos + 2; end < len; end += 2)
+        if ((buf[end] != buf[pos]) || (buf[end + 1] != buf[pos + 1]))
+            break;
+    return (end - pos);
+}
+
+/*
+ * stage_build() converts an EEPROM image into the staged image format.
+ *               Runs of a repeated 16-bit word (such as erased or padded
+ *               areas) become fill records, which the programmer expands
+ *               as it programs the EEPROM.
+ *
+ * @param  [in]  buf       - Image data.
+ * @param  [in]  addr      - EEPROM starting address.
+ * @param  [in]  len       - Image length.
+ * @param  [out] stage_len - Length of the staged image.
+ * @return       Allocated staged image (header followed by records).
+ */
+static uint8_t *
+stage_build(const uint8_t *buf, uint addr, uint len, uint *stage_len)
+{
+    stage_hdr_t hdr;
+    stage_rec_t rec;
+    uint8_t    *stage;
+    uint8_t    *ptr;
+    uint        pos;
+    uint        run;
+    uint        data_start = 0;
+
+    /* Worst case is a single data record */
+    stage = malloc(sizeof (hdr) + len / STAGE_FILL_MIN * 2 * sizeof (rec) +
+                   sizeof (rec) + len);
+    if (stage == NULL)
+        errx(EXIT_FAILURE, "Failed to allocate %u bytes", len);
+    ptr = stage + sizeof (hdr);
+
+    for (pos = 0; pos <= len; pos += run) {
+        run = (pos < len) ? stage_fill_run(buf, pos, len) : 0;
+        if ((run >= STAGE_FILL_MIN) || (pos == len)) {
+            if (pos > data_start) {
+                /* Data preceding the fill run (or end of image) */
+                rec.len   = pos - data_start;
+                rec.fill  = 0;
+                rec.flags = STAGE_REC_DATA;
+                memcpy(ptr, &rec, sizeof (rec));
+                memcpy(ptr + sizeof (rec), buf + data_start, rec.len);
+                ptr += sizeof (rec) + rec.len;
+            }
+            if (pos == len)
+                break;
+            rec.len   = run;
+            rec.fill  = buf[pos] | (buf[pos + 1] << 8);
+            rec.flags = STAGE_REC_FILL;
+            memcpy(ptr, &rec, sizeof (rec));
+            ptr += sizeof (rec);
+            data_start = pos + run;
+        }
+    }
+
+    memset(&hdr, 0, sizeof (hdr));
+    hdr.magic     = STAGE_MAGIC;
+    hdr.version   = STAGE_VERSION;
+    hdr.addr      = addr;
+    hdr.len       = len;
+    hdr.rec_len   = ptr - stage - sizeof (hdr);
+    hdr.image_crc = crc32(0, buf, len);
+    hdr.rec_crc   = crc32(0, stage + sizeof (hdr), hdr.rec_len);
+    hdr.hdr_crc   = crc32(0, &hdr, offsetof(stage_hdr_t, hdr_crc));
+    memcpy(stage, &hdr, sizeof (hdr));
+
+    *stage_len = ptr - stage;
+    return (stage);
+}
+
+/*
+ * stage_cmd() sends a command to the programmer and displays its output
+ *             until the command prompt returns.
+ *
+ * @param  [in]  cmd - Command string to send to the programmer.
+ * @return       0 - Command succeeded.
+ * @return       1 - Command failed or timeout.
+ */
+static int
+stage_cmd(const char *cmd)
+{
+    char  cmd_output[1024];
+    char *ptr;
+    int   rxcount;
+    int   count;
+    int   rc = 0;
+
+    if (send_cmd(cmd))
+        return (1);  // send_cmd() reported "timeout" in this case
+
+    for (count = 0; count < 300; count++) {  // 30 seconds max
+        rxcount = receive_ll(cmd_output, sizeof (cmd_output) - 1, 100, false);
+        if (rxcount == 0)
+            continue;
+        cmd_output[rxcount] = '\0';
+        if ((strstr(cmd_output, "FAILURE") != NULL) ||
+            (strstr(cmd_output, "error") != NULL) ||
+            (strstr(cmd_output, "No staged") != NULL))
+            rc = 1;
+        if ((ptr = strstr(cmd_output, "CMD>")) != NULL) {
+            printf("%.*s", (int) (ptr - cmd_output), cmd_output);
+            return (rc);
+        }
+        printf("%s", cmd_output);
+        fflush(stdout);
+    }
+    printf("Receive timeout\n");
+    return (1);
+}
+
+/*
+ * eeprom_stage() stages an EEPROM image in programmer MCU flash. The
+ *                programmer may then program EEPROMs with the staged
+ *                image without a host, started by its abort button or by
+ *                the "prom program staged" command.
+ *
+ * @param  [in]  filename - The file to stage.
+ * @param  [in]  addr     - The EEPROM starting address.
+ * @param  [in]  len      - The length to stage.
+ * @return       0 - Image staged.
+ * @return       1 - Staging failed.
+ */
+static int
+eeprom_stage(const char *filename, uint addr, uint len)
+{
+    struct stat statbuf;
+    uint8_t    *filebuf;
+    uint8_t    *stage;
+    uint        stage_len;
+    char        cmd[64];
+    int         tcount = 0;
+    int         rc = 1;
+
+    if (addr == ADDR_NOT_SPECIFIED)
+        addr = 0x000000;  // Start of EEPROM
+    if (lstat(filename, &statbuf))
+        errx(EXIT_FAILURE, "Failed to stat %s", filename);
+    if (len == EEPROM_SIZE_NOT_SPECIFIED) {
+        len = EEPROM_SIZE_DEFAULT;
+        if (len > statbuf.st_size)
+            len = statbuf.st_size;
+    }
+    if (len > statbuf.st_size) {
+        errx(EXIT_FAILURE, "Length 0x%x is greater than %s size %jx",
+             len, filename, (intmax_t)statbuf.st_size);
+    }
+    if ((addr & 1) || (len & 1))
+        errx(EXIT_FAILURE, "Staged address and length must be even");
+
+    filebuf = read_file(filename, len);
+    stage   = stage_build(filebuf, addr, len, &stage_len);
+    printf("Staging 0x%06x bytes for EEPROM address 0x%x as 0x%x bytes\n",
+           len, addr, stage_len);
+
+    snprintf(cmd, sizeof (cmd), "prom stage erase %x", stage_len);
+    if (stage_cmd(cmd))
+        goto stage_fail;
+
+    snprintf(cmd, sizeof (cmd), "%s stage write %x", prom_xfer(), stage_len);
+    if (send_cmd(cmd))
+        goto stage_fail;
+    if (send_ll_crc(stage, stage_len))
+        errx(EXIT_FAILURE, "Send failure");
+    while (tx_rb_flushed() == FALSE) {
+        if (tcount++ > 500)
+            errx(EXIT_FAILURE, "Send timeout");
+        time_delay_msec(1);
+    }
+    printf("\nSent 0x%x bytes to programmer staging area\n", stage_len);
+
+    rc = stage_cmd("prom stage status");
+
+stage_fail:
+    free(stage);
+    free(filebuf);
+    return (rc);
+}
+
 /*
  * show_fail_range() displays the contents of the range over which a verify
  *                   error has occurred.
@@ -1552,97 +5026,1811 @@ show_fail_range(char *filebuf, char *eebuf, uint len, uint addr, uint filepos,
     printf("\n");
 }
 
+/*
+ * bits_set_below() returns the count of values in [0, limit) which have
+ *                  the specified bit set.
+ */
+static uint32_t
+bits_set_below(uint32_t limit, uint bit)
+{
+    uint32_t period = (1U << (bit + 1));
+    uint32_t rem    = limit & (period - 1);
+
+    return ((limit >> (bit + 1)) << bit) +
+           ((rem > (1U << bit)) ? rem - (1U << bit) : 0);
+}
 
 /*
- * eeprom_verify() reads an image from the eeprom and compares it against
- *                 a file on disk. Differences are reported for the user.
+ * line_stats_add() accumulates verify statistics per EEPROM data and
+ *                  address line for a range of file and EEPROM data. The
+ *                  even byte of each 16-bit word is DQ0-DQ7, and the odd
+ *                  byte is DQ8-DQ15.
  *
- * @param  [in]  filename        - The file to compare EEPROM contents against.
- * @param  [in]  addr            - The EEPROM starting address.
- * @param  [in]  len             - The length to compare.
- * @param  [in]  miscompares_max - Specifies the maximum number of miscompares
- *                                 to verbosely report.
- * @return       0 - Verify successful.
- * @return       1 - Verify failed.
- * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ * @param  [in]  filebuf - File data.
+ * @param  [in]  eebuf   - EEPROM data, or NULL if the range is already
+ *                         known to match (by CRC).
+ * @param  [in]  spos    - Starting offset in both buffers.
+ * @param  [in]  epos    - Ending offset in both buffers.
+ * @param  [in]  addr    - Base address of EEPROM contents.
+ *
+ * @return       None.
  */
-static int
-eeprom_verify(const char *filename, uint addr, uint len, uint miscompares_max)
+static void
+line_stats_add(const char *filebuf, const char *eebuf, uint spos, uint epos,
+               uint addr)
 {
-    FILE       *fp;
-    char       *filebuf;
-    char       *eebuf;
-    char        cmd[64];
-    int         rxcount;
-    int         pos;
-    int         first_fail_pos = -1;
-    uint        miscompares = 0;
+    uint32_t first = (addr + spos) / 2;
+    uint32_t end   = (addr + epos + 1) / 2;
+    uint32_t word;
+    uint     bit;
 
-    filebuf = malloc(len);
-    eebuf   = malloc(len + 4);
-    if ((eebuf == NULL) || (filebuf == NULL))
-        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+    if (spos >= epos)
+        return;
+    line_stats.words += end - first;
+    for (bit = 0; bit < ADDR_LINES; bit++) {
+        line_stats.a_one[bit] += bits_set_below(end, bit) -
+                                 bits_set_below(first, bit);
+    }
+    if (eebuf == NULL)
+        return;
 
-    fp = fopen(filename, "r");
-    if (fp == NULL)
-        errx(EXIT_FAILURE, "Failed to open %s", filename);
-    if (fread(filebuf, len, 1, fp) != 1)
-        errx(EXIT_FAILURE, "Failed to read %u bytes from %s", len, filename);
-    fclose(fp);
+    for (word = first; word < end; word++) {
+        uint16_t expected = 0;
+        uint16_t actual   = 0;
+        uint16_t stuck0;
+        uint16_t stuck1;
+        uint     byte;
 
-    snprintf(cmd, sizeof (cmd) - 1, "prom read %x %x", addr, len);
-    cmd[sizeof (cmd) - 1] = '\0';
-    if (send_cmd(cmd))
-        return (1); // "timeout" was reported in this case
-    rxcount = receive_ll_crc(eebuf, len);
-    if (rxcount <= 0)
-        return (1); // "timeout" was reported in this case
-    if (rxcount < len) {
-        if (strncmp(eebuf + rxcount - 11, "FAILURE", 8) == 0) {
-            rxcount -= 11;
-            printf("Read %.11s\n", eebuf + rxcount);
+        for (byte = 0; byte < 2; byte++) {
+            uint pos = word * 2 + byte - addr;
+            if ((word * 2 + byte < addr + spos) || (pos >= epos))
+                continue;
+            expected |= (uint8_t) filebuf[pos] << (byte * 8);
+            actual   |= (uint8_t) eebuf[pos] << (byte * 8);
         }
-        printf("Only read 0x%x bytes of expected 0x%x\n", rxcount, len);
+        stuck0 = expected & ~actual;
+        stuck1 = actual & ~expected;
+        if ((stuck0 | stuck1) == 0)
+            continue;
+
+        line_stats.bad++;
+        for (bit = 0; bit < DQ_LINES; bit++) {
+            if (stuck0 & (1U << bit))
+                line_stats.dq_stuck0[bit]++;
+            if (stuck1 & (1U << bit))
+                line_stats.dq_stuck1[bit]++;
+        }
+        for (bit = 0; bit < ADDR_LINES; bit++) {
+            if (word & (1U << bit))
+                line_stats.a_stuck0[bit]++;
+            else
+                line_stats.a_stuck1[bit]++;
+        }
+    }
+}
+
+/*
+ * line_suspect() determines whether a line's mismatches indicate it is
+ *                stuck: nearly all mismatched words fail on that line in
+ *                the same direction.
+ *
+ * @param  [in]  n0  - Mismatched words which read 0 (or had An=1).
+ * @param  [in]  n1  - Mismatched words which read 1 (or had An=0).
+ * @param  [in]  bad - Total mismatched words.
+ *
+ * @return       0 - Line appears stuck at 0.
+ * @return       1 - Line appears stuck at 1.
+ * @return       -1 - Line does not appear stuck.
+ */
+static int
+line_suspect(uint32_t n0, uint32_t n1, uint32_t bad)
+{
+    if (bad < LINE_SUSPECT_MIN)
+        return (-1);
+    if ((n0 * 10 >= bad * 9) && (n1 * 10 <= n0))
+        return (0);
+    if ((n1 * 10 >= bad * 9) && (n0 * 10 <= n1))
         return (1);
+    return (-1);
+}
+
+/*
+ * line_stats_show() reports verify mismatches per data line, and data or
+ *                   address lines which appear stuck. The report matches
+ *                   the programmer's "prom status" report of write
+ *                   read-back mismatches.
+ *
+ * An address line stuck at 0 causes mismatches only in words with An=1
+ * (which read their An=0 alias), and most of those words will mismatch.
+ * A range of bad words shares its high address bits, so an address line
+ * is only suspect if a large fraction of the words compared on that side
+ * failed.
+ *
+ * @param  [in]  None.
+ * @return       None.
+ */
+static void
+line_stats_show(void)
+{
+    const line_stats_t *ls = &line_stats;
+    uint bit;
+    uint suspects = 0;
+
+    if (ls->bad == 0)
+        return;
+    printf("Line errors in %u of %u words (stuck-0/stuck-1):",
+           ls->bad, ls->words);
+    for (bit = 0; bit < DQ_LINES; bit++)
+        if ((ls->dq_stuck0[bit] != 0) || (ls->dq_stuck1[bit] != 0))
+            printf(" DQ%u %u/%u", bit, ls->dq_stuck0[bit],
+                   ls->dq_stuck1[bit]);
+    printf("\n");
+
+    for (bit = 0; bit < DQ_LINES; bit++) {
+        int stuck = line_suspect(ls->dq_stuck0[bit], ls->dq_stuck1[bit],
+                                 ls->bad);
+        if (stuck >= 0)
+            printf("%s DQ%u stuck-%d", suspects++ ? "," : "Suspect", bit,
+                   stuck);
     }
+    for (bit = 0; bit < ADDR_LINES; bit++) {
+        uint32_t one  = ls->a_one[bit];
+        uint32_t zero = ls->words - one;
+        uint32_t n0   = ls->a_stuck0[bit];
+        uint32_t n1   = ls->a_stuck1[bit];
+        int      stuck = line_suspect(n0, n1, ls->bad);
 
-    /* Compare two buffers */
-    for (pos = 0; pos < len; pos++) {
-        if (eebuf[pos] != filebuf[pos]) {
-            miscompares++;
-            if (first_fail_pos == -1)
-                first_fail_pos = pos;
-            if (miscompares == miscompares_max) {
-                /* Report now and only count futher miscompares */
-                show_fail_range(filebuf, eebuf, pos - first_fail_pos + 1,
-                                addr, first_fail_pos, miscompares_max);
-                first_fail_pos = -1;
+        /*
+         * The failing side must have mostly failed, and the other side
+         * must have been compared and failed at a far lower rate.
+         */
+        if ((stuck == 0) && ((zero == 0) || (n0 * 4 < one) ||
+                             ((uint64_t) n1 * one * 10 > (uint64_t) n0 * zero)))
+            stuck = -1;
+        if ((stuck == 1) && ((one == 0) || (n1 * 4 < zero) ||
+                             ((uint64_t) n0 * zero * 10 > (uint64_t) n1 * one)))
+            stuck = -1;
+        if (stuck >= 0)
+            printf("%s A%u stuck-%d", suspects++ ? "," : "Suspect", bit,
+                   stuck);
+    }
+    if (suspects != 0)
+        printf("\n");
+}
+
+/*
+ * compare_range() compares a range of file and EEPROM data, reporting
+ *                 differences for the user.
+ *
+ * @param  [in]  filebuf         - File data to compare.
+ * @param  [in]  eebuf           - EEPROM data to compare.
+ * @param  [in]  spos            - Starting offset in both buffers.
+ * @param  [in]  epos            - Ending offset in both buffers.
+ * @param  [in]  addr            - Base address of EEPROM contents.
+ * @param  [in]  miscompares     - Count of previous miscompares.
+ * @param  [in]  miscompares_max - Maximum number of miscompares to report.
+ *
+ * @return       Updated count of miscompares.
+ */
+static uint
+compare_range(char *filebuf, char *eebuf, uint spos, uint epos, uint addr,
+              uint miscompares, uint miscompares_max)
+{
+    uint pos;
+    int  first_fail_pos = -1;
+
+    line_stats_add(filebuf, eebuf, spos, epos, addr);
+    for (pos = spos; pos < epos; pos++) {
+        if (eebuf[pos] != filebuf[pos]) {
+            miscompares++;
+            if (first_fail_pos == -1)
+                first_fail_pos = pos;
+            if (miscompares == miscompares_max) {
+                /* Report now and only count futher miscompares */
+                show_fail_range(filebuf, eebuf, pos - first_fail_pos + 1,
+                                addr, first_fail_pos, miscompares_max);
+                first_fail_pos = -1;
+            }
+        } else {
+            if (first_fail_pos != -1) {
+                if (miscompares < miscompares_max) {
+                    /* Report previous range */
+                    show_fail_range(filebuf, eebuf, pos - first_fail_pos,
+                                    addr, first_fail_pos, miscompares_max);
+                }
+                first_fail_pos = -1;
+            }
+        }
+    }
+    if ((first_fail_pos != -1) && (miscompares < miscompares_max)) {
+        /* Report final range not previously reported */
+        show_fail_range(filebuf, eebuf, pos - first_fail_pos, addr,
+                        first_fail_pos, miscompares_max);
+    }
+    return (miscompares);
+}
+
+/*
+ * eeprom_verify_buf() reads an image from the eeprom and compares it against
+ *                     data in memory. Differences are reported for the user.
+ *
+ * @param  [in]  filebuf         - The data to compare EEPROM contents against.
+ * @param  [in]  addr            - The EEPROM starting address.
+ * @param  [in]  len             - The length to compare.
+ * @param  [in]  miscompares_max - Specifies the maximum number of miscompares
+ *                                 to verbosely report.
+ * @return       0 - Verify successful.
+ * @return       1 - Verify failed.
+ */
+static int
+eeprom_verify_buf(char *filebuf, uint addr, uint len, uint miscompares_max)
+{
+    char       *eebuf;
+    char        cmd[64];
+    int         rxcount;
+    uint        miscompares;
+    uint64_t    start;
+
+    eebuf = malloc(len + 4);
+    if (eebuf == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+
+    snprintf(cmd, sizeof (cmd) - 1, "%s read %x %x", prom_xfer(), addr, len);
+    cmd[sizeof (cmd) - 1] = '\0';
+    start = time_usec();
+    if (send_cmd(cmd))
+        return (1); // "timeout" was reported in this case
+    rxcount = receive_ll_crc(eebuf, len);
+    if (rxcount <= 0)
+        return (1); // "timeout" was reported in this case
+    if (rxcount == len)
+        model_sample(TM_LINK, len * 1000000.0 / (time_usec() - start));
+    if (rxcount < len) {
+        if (strncmp(eebuf + rxcount - 11, "FAILURE", 8) == 0) {
+            rxcount -= 11;
+            printf("Read %.11s\n", eebuf + rxcount);
+        }
+        printf("Only read 0x%x bytes of expected 0x%x\n", rxcount, len);
+        return (1);
+    }
+
+    /* Compare two buffers */
+    memset(&line_stats, 0, sizeof (line_stats));
+    miscompares = compare_range(filebuf, eebuf, 0, len, addr, 0,
+                                miscompares_max);
+    free(eebuf);
+    if (miscompares) {
+        printf("%u miscompares\n", miscompares);
+        line_stats_show();
+        return (1);
+    } else {
+        printf("Verify success\n");
+        return (0);
+    }
+}
+
+/*
+ * eeprom_verify() reads an image from the eeprom and compares it against
+ *                 a file on disk. Differences are reported for the user.
+ *
+ * @param  [in]  filename        - The file to compare EEPROM contents against.
+ * @param  [in]  addr            - The EEPROM starting address.
+ * @param  [in]  len             - The length to compare.
+ * @param  [in]  miscompares_max - Specifies the maximum number of miscompares
+ *                                 to verbosely report.
+ * @return       0 - Verify successful.
+ * @return       1 - Verify failed.
+ * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ */
+static int
+eeprom_verify(const char *filename, uint addr, uint len, uint miscompares_max)
+{
+    char *filebuf = (char *) read_file(filename, len);
+    int   rc      = eeprom_verify_buf(filebuf, addr, len, miscompares_max);
+
+    free(filebuf);
+    return (rc);
+}
+
+/*
+ * parse_extents() parses a list of EEPROM ranges specified by the user.
+ *                 The list is either comma-separated <addr>:<len> pairs
+ *                 or @<filename>, where the file has one <addr> <len>
+ *                 pair per line.
+ *
+ * @param  [in]  arg - User-specified extent list.
+ *
+ * @return       None.
+ * @global [out] extent_list[] and extent_count are updated.
+ * @exit         EXIT_FAILURE - The list could not be parsed.
+ */
+static void
+parse_extents(const char *arg)
+{
+    char  buf[256];
+    FILE *fp = NULL;
+    char *ptr;
+
+    if (*arg == '@') {
+        fp = fopen(arg + 1, "r");
+        if (fp == NULL)
+            err(EXIT_FAILURE, "Failed to open %s", arg + 1);
+    }
+
+    while (1) {
+        if (fp != NULL) {
+            if (fgets(buf, sizeof (buf), fp) == NULL)
+                break;
+        } else {
+            if (*arg == '\0')
+                break;
+            strncpy(buf, arg, sizeof (buf) - 1);
+            buf[sizeof (buf) - 1] = '\0';
+            if ((ptr = strchr(buf, ',')) != NULL)
+                *ptr = '\0';
+            arg += strlen(buf);
+            if (*arg == ',')
+                arg++;
+        }
+        if ((ptr = strchr(buf, '#')) != NULL)
+            *ptr = '\0';  // Strip comment
+        for (ptr = buf; *ptr != '\0'; ptr++)
+            if (*ptr == ':')
+                *ptr = ' ';
+        ptr = buf;
+        while (isspace(*ptr))
+            ptr++;
+        if (*ptr == '\0')
+            continue;  // Blank line or comment
+        if (extent_count >= ARRAY_SIZE(extent_list))
+            errx(EXIT_FAILURE, "Too many extents (max %zu)",
+                 ARRAY_SIZE(extent_list));
+        if ((sscanf(ptr, "%i %i",
+                    (int *) &extent_list[extent_count].addr,
+                    (int *) &extent_list[extent_count].len) != 2) ||
+            (extent_list[extent_count].len == 0)) {
+            errx(EXIT_FAILURE, "Invalid extent \"%s\"", ptr);
+        }
+        extent_count++;
+    }
+    if (fp != NULL)
+        fclose(fp);
+    if (extent_count == 0)
+        errx(EXIT_FAILURE, "No extents specified");
+}
+
+/*
+ * send_extents() issues a list command to the programmer and then uploads
+ *                the binary extent list, followed by its CRC.
+ *
+ * @param  [in]  op    - Programmer operation ("read" or "crc").
+ * @param  [in]  ext   - Array of EEPROM ranges.
+ * @param  [in]  count - Number of ranges.
+ *
+ * @return       0 - The programmer accepted the list.
+ * @return       1 - Failure (reported to the user).
+ */
+static int
+send_extents(const char *op, extent_t *ext, uint count)
+{
+    char     cmd[64];
+    uint32_t crc = crc32(0, ext, count * sizeof (*ext));
+    uint8_t  rc;
+
+    snprintf(cmd, sizeof (cmd) - 1, "%s %s list %u",
+             (strcmp(op, "read") == 0) ? prom_xfer() : "prom", op, count);
+    cmd[sizeof (cmd) - 1] = '\0';
+    if (send_cmd(cmd))
+        return (1); // "timeout" was reported in this case
+
+    xfer_active = TRUE;
+    if (send_ll_bin((uint8_t *) ext, count * sizeof (*ext)) ||
+        send_ll_bin((uint8_t *) &crc, sizeof (crc))) {
+        printf("Extent list send timeout\n");
+        (void) abort_transfer();
+        return (1);
+    }
+    if (receive_bin(&rc, 1, 500, false) == 0) {
+        (void) transfer_refused(-1);
+        printf("Extent list status receive timeout\n");
+        (void) abort_transfer();
+        return (1);
+    }
+    if (rc != 0) {
+        if (!transfer_refused(rc) && (bulk_fd != -1))
+            (void) report_remote_failure_message();  // Console is separate
+        printf("Programmer rejected extent list: %d\n", rc);
+        (void) abort_transfer();
+        return (1);
+    }
+    return (0);
+}
+
+/*
+ * receive_extents() reads a list of EEPROM ranges from the programmer in a
+ *                   single transfer, placing the contents of each range in
+ *                   the image buffer at its offset from the base address.
+ *
+ * @param  [out] image    - Buffer which represents EEPROM at baseaddr.
+ * @param  [in]  baseaddr - EEPROM address of the start of image.
+ * @param  [in]  ext      - Array of EEPROM ranges.
+ * @param  [in]  count    - Number of ranges.
+ *
+ * @return       0 - All ranges were received.
+ * @return       1 - Failure (reported to the user).
+ */
+static int
+receive_extents(char *image, uint baseaddr, extent_t *ext, uint count)
+{
+    uint  cur;
+    uint  pos   = 0;
+    uint  total = 0;
+    int   rxcount;
+    char *buf;
+
+    for (cur = 0; cur < count; cur++)
+        total += ext[cur].len;
+
+    buf = malloc(total + 4);
+    if (buf == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", total);
+
+    if (send_extents("read", ext, count)) {
+        free(buf);
+        return (1);
+    }
+    rxcount = receive_ll_crc(buf, total);
+    if (rxcount < (int) total) {
+        if (rxcount >= 0)
+            printf("Only read 0x%x bytes of expected 0x%x\n", rxcount, total);
+        free(buf);
+        return (1);
+    }
+    for (cur = 0; cur < count; cur++) {
+        memcpy(image + ext[cur].addr - baseaddr, buf + pos, ext[cur].len);
+        pos += ext[cur].len;
+    }
+    free(buf);
+    return (0);
+}
+
+/*
+ * extents_check() verifies that all extents lie within the specified
+ *                 image starting at EEPROM address baseaddr.
+ *
+ * @return       Length of image required to hold all extents.
+ * @exit         EXIT_FAILURE - An extent is outside of the image.
+ */
+static uint
+extents_check(uint baseaddr, uint len)
+{
+    uint cur;
+    uint end = 0;
+
+    for (cur = 0; cur < extent_count; cur++) {
+        extent_t *ext = &extent_list[cur];
+        if ((ext->addr < baseaddr) || (ext->addr - baseaddr > len) ||
+            (ext->len > baseaddr + len - ext->addr)) {
+            errx(EXIT_FAILURE, "Extent 0x%x+0x%x is outside 0x%x-0x%x",
+                 ext->addr, ext->len, baseaddr, baseaddr + len);
+        }
+        if (end < ext->addr + ext->len - baseaddr)
+            end = ext->addr + ext->len - baseaddr;
+    }
+    return (end);
+}
+
+/*
+ * eeprom_read_extents() reads the user-specified list of EEPROM ranges in
+ *                       a single transfer, writing each range to the file
+ *                       at its offset from the base address.
+ *
+ * @param  [in]  filename - The file to write using EEPROM contents.
+ * @param  [in]  baseaddr - EEPROM address which corresponds to file start.
+ *
+ * @return       0 - Success.
+ * @return       1 - Failure.
+ * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ */
+static int
+eeprom_read_extents(const char *filename, uint baseaddr)
+{
+    uint  cur;
+    uint  len;
+    char *image;
+    FILE *fp;
+
+    if (baseaddr == ADDR_NOT_SPECIFIED)
+        baseaddr = 0x000000;  // Start of EEPROM
+
+    len   = extents_check(baseaddr, EEPROM_SIZE_DEFAULT - baseaddr);
+    image = malloc(len);
+    if (image == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+
+    if (receive_extents(image, baseaddr, extent_list, extent_count)) {
+        free(image);
+        return (1);
+    }
+
+    fp = fopen(filename, "w");
+    if (fp == NULL)
+        err(EXIT_FAILURE, "Failed to open %s", filename);
+    for (cur = 0; cur < extent_count; cur++) {
+        extent_t *ext = &extent_list[cur];
+        if (fseek(fp, ext->addr - baseaddr, SEEK_SET) ||
+            (fwrite(image + ext->addr - baseaddr, ext->len, 1, fp) != 1))
+            err(EXIT_FAILURE, "Failed to write %s", filename);
+    }
+    fclose(fp);
+    printf("Read %u extents from device and wrote to file %s\n",
+           extent_count, filename);
+    free(image);
+    return (0);
+}
+
+/*
+ * crc_extents() requests the programmer's CRC of each EEPROM range in a
+ *               list. The EEPROM data itself is not transferred.
+ *
+ * @param  [in]  ext   - Array of EEPROM ranges (at most EXTENT_MAX).
+ * @param  [in]  count - Number of ranges.
+ * @param  [out] crc   - CRC32 of each range.
+ *
+ * @return       0 - All CRCs were received.
+ * @return       1 - Failure (reported to the user).
+ */
+static int
+crc_extents(extent_t *ext, uint count, uint32_t *crc)
+{
+    uint64_t start = time_usec();
+    uint     total = 0;
+    uint     cur;
+    uint8_t  rc;
+
+    if (send_extents("crc", ext, count))
+        return (1);
+
+    for (cur = 0; cur < count; cur++) {
+        if ((receive_bin(&rc, 1, 5000, false) == 0) ||
+            (receive_bin(&crc[cur], sizeof (crc[cur]), 200, false) !=
+             sizeof (crc[cur]))) {
+            printf("CRC receive timeout at extent %u\n", cur);
+            return (1);
+        }
+        if (rc != 0) {
+            printf("Read error %d at extent 0x%x\n", rc, ext[cur].addr);
+            return (1);
+        }
+        total += ext[cur].len;
+    }
+    model_sample(TM_CRC, total * 1000000.0 / (time_usec() - start + 1));
+    return (0);
+}
+
+/*
+ * eeprom_verify_extents() verifies the user-specified list of EEPROM ranges
+ *                         against a file. CRCs of all ranges are requested
+ *                         from the programmer in a single command. Only
+ *                         ranges which have a CRC mismatch are then read
+ *                         back (again as a single transfer) so that the
+ *                         differences may be shown.
+ *
+ * @param  [in]  filename        - The file to compare EEPROM contents against.
+ * @param  [in]  baseaddr        - EEPROM address which corresponds to file
+ *                                 start.
+ * @param  [in]  miscompares_max - Specifies the maximum number of miscompares
+ *                                 to verbosely report.
+ * @return       0 - Verify successful.
+ * @return       1 - Verify failed.
+ * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ */
+static int
+eeprom_verify_extents(const char *filename, uint baseaddr,
+                      uint miscompares_max)
+{
+    struct stat statbuf;
+    extent_t    bad[EXTENT_MAX];
+    uint32_t    crc[EXTENT_MAX];
+    uint        bad_count = 0;
+    uint        miscompares = 0;
+    uint        cur;
+    uint        len;
+    char       *filebuf;
+    char       *eebuf;
+
+    if (baseaddr == ADDR_NOT_SPECIFIED)
+        baseaddr = 0x000000;  // Start of EEPROM
+    if (lstat(filename, &statbuf))
+        errx(EXIT_FAILURE, "Failed to stat %s", filename);
+
+    len     = extents_check(baseaddr, statbuf.st_size);
+    filebuf = (char *) read_file(filename, len);
+
+    if (crc_extents(extent_list, extent_count, crc)) {
+        free(filebuf);
+        return (1);
+    }
+    memset(&line_stats, 0, sizeof (line_stats));
+    for (cur = 0; cur < extent_count; cur++) {
+        extent_t *ext = &extent_list[cur];
+        uint      spos = ext->addr - baseaddr;
+        if (crc[cur] != crc32(0, filebuf + spos, ext->len))
+            bad[bad_count++] = *ext;
+        else
+            line_stats_add(filebuf, NULL, spos, spos + ext->len, baseaddr);
+    }
+
+    if (bad_count > 0) {
+        /* Read back mismatched extents to report differences */
+        eebuf = malloc(len);
+        if (eebuf == NULL)
+            errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+        if (receive_extents(eebuf, baseaddr, bad, bad_count) == 0) {
+            for (cur = 0; cur < bad_count; cur++) {
+                uint spos = bad[cur].addr - baseaddr;
+                miscompares = compare_range(filebuf, eebuf, spos,
+                                            spos + bad[cur].len, baseaddr,
+                                            miscompares, miscompares_max);
+            }
+        }
+        free(eebuf);
+    }
+    free(filebuf);
+    if (bad_count > 0) {
+        printf("%u of %u extents failed (%u miscompares)\n",
+               bad_count, extent_count, miscompares);
+        line_stats_show();
+        return (1);
+    }
+    printf("Verify success (%u extents)\n", extent_count);
+    return (0);
+}
+
+/*
+ * spot_rand() returns the next value of a reproducible pseudo-random
+ *             sequence (splitmix64), so that a spot-check seed selects
+ *             the same blocks on any host.
+ */
+static uint64_t
+spot_rand(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (z ^ (z >> 31));
+}
+
+/*
+ * spot_sample_count() calculates the number of blocks which must be drawn
+ *                     at random (without replacement) from a pool so that,
+ *                     if SPOT_DEFECT_PCT of the pool differs, at least one
+ *                     differing block is drawn with the specified
+ *                     confidence.
+ *
+ * @param  [in]  pool       - Number of blocks available to be drawn.
+ * @param  [in]  confidence - Required confidence (percent).
+ *
+ * @return       Number of blocks to draw.
+ */
+static uint
+spot_sample_count(uint pool, double confidence)
+{
+    uint   bad  = (pool * SPOT_DEFECT_PCT + 99) / 100;
+    double miss = 1.0;  // Probability no bad block has been drawn
+    uint   count;
+
+    for (count = 0; count < pool; count++) {
+        if (miss <= 1.0 - confidence / 100)
+            break;
+        if (pool - count <= bad)
+            return (pool);  // All good blocks drawn
+        miss *= (double) (pool - bad - count) / (pool - count);
+    }
+    return (count);
+}
+
+/*
+ * eeprom_spot_check() verifies a random sample of blocks from the EEPROM
+ *                     against a file, rather than reading back the entire
+ *                     image. The first and last block of every erase
+ *                     sector are always checked. Other blocks are drawn
+ *                     using a reproducible seed, enough that a part in
+ *                     which SPOT_DEFECT_PCT of blocks differ would be
+ *                     caught with the requested confidence.
+ *
+ * @param  [in]  filename        - The file to compare EEPROM contents against.
+ * @param  [in]  addr            - The EEPROM starting address.
+ * @param  [in]  len             - The length to compare.
+ * @param  [in]  miscompares_max - Maximum miscompares to verbosely report.
+ * @return       0 - Spot-check successful.
+ * @return       1 - Spot-check failed.
+ * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ */
+static int
+eeprom_spot_check(const char *filename, uint addr, uint len,
+                  uint miscompares_max)
+{
+    char     *filebuf = (char *) read_file(filename, len);
+    char     *eebuf   = malloc(len);
+    uint      blocks  = (len + SPOT_BLOCK_SIZE - 1) / SPOT_BLOCK_SIZE;
+    uint8_t  *chosen  = calloc(blocks, 1);
+    uint     *pool    = malloc(blocks * sizeof (*pool));
+    uint64_t  state   = spot_seed;
+    extent_t  ext[EXTENT_MAX];
+    uint      sectors = 0;
+    uint      pool_count = 0;
+    uint      sample;
+    uint      checked;
+    uint      bad_blocks = 0;
+    uint      miscompares = 0;
+    uint      count = 0;
+    uint      cur;
+    uint      blk;
+    int       rc = 1;
+
+    if ((eebuf == NULL) || (chosen == NULL) || (pool == NULL))
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+
+    /* The first and last block of each sector are always checked */
+    for (cur = addr / IMAGE_SECTOR_SIZE;
+         cur * IMAGE_SECTOR_SIZE < addr + len; cur++) {
+        uint start = cur * IMAGE_SECTOR_SIZE;
+        uint end   = start + IMAGE_SECTOR_SIZE;
+        if (start < addr)
+            start = addr;
+        if (end > addr + len)
+            end = addr + len;
+        chosen[(start - addr) / SPOT_BLOCK_SIZE] = 1;
+        chosen[(end - 1 - addr) / SPOT_BLOCK_SIZE] = 1;
+        sectors++;
+    }
+
+    /* Draw the remaining blocks at random */
+    for (blk = 0; blk < blocks; blk++)
+        if (chosen[blk] == 0)
+            pool[pool_count++] = blk;
+    sample  = spot_sample_count(pool_count, spot_confidence);
+    checked = blocks - pool_count + sample;
+    for (cur = 0; cur < sample; cur++) {
+        uint pick = cur + spot_rand(&state) % (pool_count - cur);
+        uint tmp  = pool[pick];
+        pool[pick] = pool[cur];
+        pool[cur]  = tmp;
+        chosen[tmp] = 1;
+    }
+
+    printf("Spot-checking %u of %u %u-byte blocks at 0x%x (seed %ju)\n",
+           checked, blocks, SPOT_BLOCK_SIZE, addr,
+           (uintmax_t) spot_seed);
+
+    /* Read chosen blocks in batches of extents, merging adjacent blocks */
+    memset(&line_stats, 0, sizeof (line_stats));
+    for (blk = 0; blk <= blocks; blk++) {
+        uint pos = blk * SPOT_BLOCK_SIZE;
+        if ((blk < blocks) && chosen[blk]) {
+            uint blen = (len - pos < SPOT_BLOCK_SIZE) ? len - pos :
+                                                        SPOT_BLOCK_SIZE;
+            if ((count > 0) &&
+                (ext[count - 1].addr + ext[count - 1].len == addr + pos)) {
+                ext[count - 1].len += blen;
+                continue;
+            }
+            if (count < EXTENT_MAX) {
+                ext[count].addr = addr + pos;
+                ext[count].len  = blen;
+                count++;
+                continue;
+            }
+        }
+        if ((count == EXTENT_MAX) || ((blk == blocks) && (count > 0))) {
+            if (receive_extents(eebuf, addr, ext, count))
+                goto done;
+            for (cur = 0; cur < count; cur++) {
+                uint spos = ext[cur].addr - addr;
+                uint epos = spos + ext[cur].len;
+                uint prev = miscompares;
+                miscompares = compare_range(filebuf, eebuf, spos, epos, addr,
+                                            miscompares, miscompares_max);
+                if (miscompares != prev) {
+                    uint bpos;
+                    for (bpos = spos; bpos < epos; bpos += SPOT_BLOCK_SIZE)
+                        if (memcmp(filebuf + bpos, eebuf + bpos,
+                                   (epos - bpos < SPOT_BLOCK_SIZE) ?
+                                   epos - bpos : SPOT_BLOCK_SIZE) != 0)
+                            bad_blocks++;
+                }
+            }
+            count = 0;
+            if ((blk < blocks) && chosen[blk])
+                blk--;  // Start the next batch with this block
+        }
+    }
+
+    if (miscompares) {
+        printf("%u miscompares in %u of %u blocks checked\n",
+               miscompares, bad_blocks, checked);
+        line_stats_show();
+    } else {
+        printf("Spot-check success: %u of %u blocks (%.1f%%) checked, "
+               "including both ends of %u sector%s\n"
+               "%.4g%% confidence that fewer than %u%% of blocks differ\n",
+               checked, blocks, checked * 100.0 / blocks, sectors,
+               (sectors == 1) ? "" : "s", spot_confidence, SPOT_DEFECT_PCT);
+        rc = 0;
+    }
+done:
+    free(pool);
+    free(chosen);
+    free(eebuf);
+    free(filebuf);
+    return (rc);
+}
+
+/*
+ * image_crc_map() computes the CRC32 of consecutive chunks of a buffer.
+ *
+ * @param  [in]  buf   - Data buffer.
+ * @param  [in]  len   - Length of the buffer.
+ * @param  [in]  chunk - Chunk size (the last chunk may be short).
+ * @param  [out] count - Number of CRCs in the map.
+ * @return       Allocated CRC map.
+ */
+static uint32_t *
+image_crc_map(const uint8_t *buf, uint len, uint chunk, uint *count)
+{
+    uint      cur;
+    uint32_t *map;
+
+    *count = (len + chunk - 1) / chunk;
+    map = malloc(*count * sizeof (*map) + 1);
+    if (map == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u CRC map", *count);
+    for (cur = 0; cur < *count; cur++) {
+        uint clen = len - cur * chunk;
+        if (clen > chunk)
+            clen = chunk;
+        map[cur] = crc32(0, buf + cur * chunk, clen);
+    }
+    return (map);
+}
+
+/*
+ * image_extents() finds the ranges of an image which are not erased
+ *                 (all 0xff). Ranges are found at IMAGE_EXTENT_GRAIN
+ *                 granularity, and ranges which are separated by less
+ *                 than IMAGE_EXTENT_GAP are merged to reduce the number
+ *                 of programmer commands needed to write them.
+ *
+ * @param  [in]  buf   - Image data.
+ * @param  [in]  len   - Length of the image.
+ * @param  [out] count - Number of extents found.
+ * @return       Allocated extent table (offsets within the image).
+ */
+static extent_t *
+image_extents(const uint8_t *buf, uint len, uint *count)
+{
+    uint      pos;
+    uint      max = (len + IMAGE_EXTENT_GRAIN - 1) / IMAGE_EXTENT_GRAIN;
+    extent_t *ext = malloc(max * sizeof (*ext) + 1);
+
+    if (ext == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u extents", max);
+
+    *count = 0;
+    for (pos = 0; pos < len; pos += IMAGE_EXTENT_GRAIN) {
+        uint glen = len - pos;
+        uint cur;
+        if (glen > IMAGE_EXTENT_GRAIN)
+            glen = IMAGE_EXTENT_GRAIN;
+        for (cur = 0; cur < glen; cur++)
+            if (buf[pos + cur] != 0xff)
+                break;
+        if (cur == glen)
+            continue;  // Erased
+
+        if ((*count > 0) &&
+            (pos - (ext[*count - 1].addr + ext[*count - 1].len) <
+             IMAGE_EXTENT_GAP)) {
+            /* Extend the previous extent */
+            ext[*count - 1].len = pos + glen - ext[*count - 1].addr;
+        } else {
+            ext[*count].addr = pos;
+            ext[*count].len  = glen;
+            (*count)++;
+        }
+    }
+    return (ext);
+}
+
+/*
+ * image_pack() creates an image container from a raw image file. The
+ *              container holds the target address and bank, a table of
+ *              non-erased extents, sector and block CRC maps, and the
+ *              payload, so that jobs using it need not scan the payload.
+ *
+ * @param  [in]  container - Container file to create.
+ * @param  [in]  filename  - Raw image file.
+ * @param  [in]  bank      - Target bank (may be BANK_NOT_SPECIFIED).
+ * @param  [in]  addr      - Target address (may be ADDR_NOT_SPECIFIED).
+ * @param  [in]  len       - Length of image (may be not specified).
+ * @return       0 - Container created.
+ * @exit         EXIT_FAILURE - File access error.
+ */
+static int
+image_pack(const char *container, const char *filename, uint bank, uint addr,
+           uint len)
+{
+    struct stat  statbuf;
+    image_hdr_t  hdr;
+    uint8_t     *payload;
+    extent_t    *ext;
+    uint32_t    *sector_crc;
+    uint32_t    *block_crc;
+    uint         sector_count;
+    uint         block_count;
+    uint         ext_count;
+    FILE        *fp;
+
+    if (lstat(filename, &statbuf))
+        errx(EXIT_FAILURE, "Failed to stat %s", filename);
+    if (len == EEPROM_SIZE_NOT_SPECIFIED)
+        len = statbuf.st_size;
+    if ((len == 0) || (len > statbuf.st_size)) {
+        errx(EXIT_FAILURE, "Length 0x%x is invalid for %s size %jx",
+             len, filename, (intmax_t)statbuf.st_size);
+    }
+
+    payload    = read_file(filename, len);
+    ext        = image_extents(payload, len, &ext_count);
+    sector_crc = image_crc_map(payload, len, IMAGE_SECTOR_SIZE,
+                               &sector_count);
+    block_crc  = image_crc_map(payload, len, IMAGE_BLOCK_SIZE, &block_count);
+
+    memset(&hdr, 0, sizeof (hdr));
+    hdr.magic        = IMAGE_MAGIC;
+    hdr.version      = IMAGE_VERSION;
+    hdr.hdr_len      = sizeof (hdr);
+    hdr.flags        = 0;
+    hdr.addr         = addr;
+    hdr.bank         = bank;
+    hdr.len          = len;
+    hdr.extent_count = ext_count;
+    hdr.extent_off   = sizeof (hdr);
+    hdr.sector_size  = IMAGE_SECTOR_SIZE;
+    hdr.sector_off   = hdr.extent_off + ext_count * sizeof (*ext);
+    hdr.block_size   = IMAGE_BLOCK_SIZE;
+    hdr.block_off    = hdr.sector_off + sector_count * sizeof (*sector_crc);
+    hdr.payload_off  = hdr.block_off + block_count * sizeof (*block_crc);
+    hdr.payload_crc  = crc32(0, payload, len);
+    hdr.table_crc    = crc32(crc32(crc32(0, ext, ext_count * sizeof (*ext)),
+                                   sector_crc,
+                                   sector_count * sizeof (*sector_crc)),
+                             block_crc, block_count * sizeof (*block_crc));
+    hdr.hdr_crc      = crc32(0, &hdr, sizeof (hdr));
+
+    fp = fopen(container, "w");
+    if (fp == NULL)
+        err(EXIT_FAILURE, "Failed to open %s", container);
+    if ((fwrite(&hdr, sizeof (hdr), 1, fp) != 1) ||
+        ((ext_count > 0) &&
+         (fwrite(ext, sizeof (*ext), ext_count, fp) != ext_count)) ||
+        (fwrite(sector_crc, sizeof (*sector_crc), sector_count, fp) !=
+         sector_count) ||
+        (fwrite(block_crc, sizeof (*block_crc), block_count, fp) !=
+         block_count) ||
+        (fwrite(payload, len, 1, fp) != 1) ||
+        (fclose(fp) != 0)) {
+        err(EXIT_FAILURE, "Failed to write %s", container);
+    }
+    printf("Packed 0x%x bytes from %s into %s: %u extents, "
+           "%u sector and %u block CRCs\n", len, filename, container,
+           ext_count, sector_count, block_count);
+
+    free(payload);
+    free(ext);
+    free(sector_crc);
+    free(block_crc);
+    return (0);
+}
+
+/*
+ * image_table_fits() checks that a container table lies within the file
+ *                    and after the header.
+ *
+ * @param  [in]  off       - Offset of the table.
+ * @param  [in]  count     - Number of table entries.
+ * @param  [in]  size      - Size of each entry.
+ * @param  [in]  file_size - Size of the container file.
+ * @return       TRUE  - The table is within the file.
+ * @return       FALSE - The table is out of bounds.
+ */
+static bool
+image_table_fits(uint32_t off, uint64_t count, size_t size, off_t file_size)
+{
+    return ((off >= sizeof (image_hdr_t)) &&
+            ((uint64_t) off + count * size <= (uint64_t) file_size));
+}
+
+/*
+ * image_open() maps an image container into memory. The header and table
+ *              CRCs are checked, and every table entry is checked against
+ *              the payload length, but the payload is not scanned, so
+ *              that even large images are ready immediately.
+ *
+ * @param  [in]  filename - File which may be an image container.
+ * @param  [out] img      - Mapped container.
+ * @return       TRUE  - The file is a container, and has been mapped.
+ * @return       FALSE - The file is not a container (raw image).
+ * @exit         EXIT_FAILURE - The container is damaged.
+ */
+static bool
+image_open(const char *filename, image_t *img)
+{
+    struct stat  statbuf;
+    image_hdr_t  hdr;
+    uint32_t     crc;
+    uint64_t     sector_count;
+    uint64_t     block_count;
+    uint         cur;
+    int          fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return (FALSE);  // Reported later as a raw file access error
+    if ((fstat(fd, &statbuf) != 0) || (statbuf.st_size < sizeof (hdr)) ||
+        (read(fd, &hdr, sizeof (hdr)) != sizeof (hdr)) ||
+        (hdr.magic != IMAGE_MAGIC)) {
+        close(fd);
+        return (FALSE);
+    }
+
+    crc = hdr.hdr_crc;
+    hdr.hdr_crc = 0;
+    if ((crc != crc32(0, &hdr, sizeof (hdr))) ||
+        (hdr.version != IMAGE_VERSION) || (hdr.hdr_len != sizeof (hdr)))
+        errx(EXIT_FAILURE, "%s: corrupt or unsupported container", filename);
+    if (hdr.flags & ~IMAGE_FLAGS_KNOWN)
+        errx(EXIT_FAILURE, "%s: unsupported transform flags %x",
+             filename, hdr.flags);
+    if ((hdr.sector_size == 0) || (hdr.block_size == 0) ||
+        (hdr.sector_size % hdr.block_size != 0))
+        errx(EXIT_FAILURE, "%s: corrupt or unsupported container", filename);
+    sector_count = ((uint64_t) hdr.len + hdr.sector_size - 1) /
+                   hdr.sector_size;
+    block_count  = ((uint64_t) hdr.len + hdr.block_size - 1) / hdr.block_size;
+    if (!image_table_fits(hdr.extent_off, hdr.extent_count,
+                          sizeof (extent_t), statbuf.st_size) ||
+        !image_table_fits(hdr.sector_off, sector_count,
+                          sizeof (uint32_t), statbuf.st_size) ||
+        !image_table_fits(hdr.block_off, block_count,
+                          sizeof (uint32_t), statbuf.st_size) ||
+        !image_table_fits(hdr.payload_off, hdr.len, 1, statbuf.st_size))
+        errx(EXIT_FAILURE, "%s: container is truncated", filename);
+
+    img->map_len = statbuf.st_size;
+    img->map = mmap(NULL, img->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (img->map == MAP_FAILED)
+        err(EXIT_FAILURE, "Failed to map %s", filename);
+
+    img->hdr        = img->map;
+    img->ext        = (extent_t *) ((char *) img->map + hdr.extent_off);
+    img->sector_crc = (uint32_t *) ((char *) img->map + hdr.sector_off);
+    img->block_crc  = (uint32_t *) ((char *) img->map + hdr.block_off);
+    img->payload    = (uint8_t *) img->map + hdr.payload_off;
+
+    crc = crc32(crc32(crc32(0, img->ext, hdr.extent_count * sizeof (extent_t)),
+                      img->sector_crc, sector_count * sizeof (uint32_t)),
+                img->block_crc, block_count * sizeof (uint32_t));
+    if (crc != hdr.table_crc)
+        errx(EXIT_FAILURE, "%s: container tables are corrupt", filename);
+    for (cur = 0; cur < hdr.extent_count; cur++) {
+        if ((uint64_t) img->ext[cur].addr + img->ext[cur].len > hdr.len)
+            errx(EXIT_FAILURE, "%s: extent %u (0x%x+0x%x) is beyond "
+                 "payload length 0x%x", filename, cur, img->ext[cur].addr,
+                 img->ext[cur].len, hdr.len);
+    }
+    return (TRUE);
+}
+
+static void
+image_close(image_t *img)
+{
+    munmap(img->map, img->map_len);
+}
+
+/*
+ * image_crc_check() asks the programmer for the CRC of consecutive chunks
+ *                   of EEPROM and compares them against a CRC map. Only
+ *                   chunks listed in the index array are checked.
+ *
+ * @param  [in]  addr     - EEPROM address of the start of the image.
+ * @param  [in]  len      - Length of the image.
+ * @param  [in]  chunk    - Chunk size of the CRC map.
+ * @param  [in]  map      - CRC map.
+ * @param  [in]  index    - Chunk numbers to check.
+ * @param  [in]  count    - Number of chunks to check.
+ * @param  [out] bad      - Chunk numbers which did not match.
+ * @param  [out] bad_count - Number of chunks which did not match.
+ * @return       0 - All requested CRCs were checked.
+ * @return       1 - Failure (reported to the user).
+ */
+static int
+image_crc_check(uint addr, uint len, uint chunk, const uint32_t *map,
+                const uint *index, uint count, uint *bad, uint *bad_count)
+{
+    extent_t ext[EXTENT_MAX];
+    uint32_t crc[EXTENT_MAX];
+    uint     pos;
+    uint     cur;
+    uint     batch;
+
+    *bad_count = 0;
+    for (pos = 0; pos < count; pos += batch) {
+        batch = count - pos;
+        if (batch > EXTENT_MAX)
+            batch = EXTENT_MAX;
+        for (cur = 0; cur < batch; cur++) {
+            uint off = index[pos + cur] * chunk;
+            ext[cur].addr = addr + off;
+            ext[cur].len  = (len - off < chunk) ? len - off : chunk;
+        }
+        if (crc_extents(ext, batch, crc))
+            return (1);
+        for (cur = 0; cur < batch; cur++)
+            if (crc[cur] != map[index[pos + cur]])
+                bad[(*bad_count)++] = index[pos + cur];
+    }
+    return (0);
+}
+
+/*
+ * image_verify() verifies EEPROM contents against an image container
+ *                using its CRC maps. Sector CRCs are checked first, then
+ *                block CRCs within mismatched sectors. Only mismatched
+ *                blocks are read back to report differences.
+ *
+ * @param  [in]  img             - Mapped container.
+ * @param  [in]  addr            - EEPROM address of the start of the image.
+ * @param  [in]  miscompares_max - Maximum miscompares to verbosely report.
+ * @return       0 - Verify successful.
+ * @return       1 - Verify failed.
+ */
+static int
+image_verify(image_t *img, uint addr, uint miscompares_max)
+{
+    const image_hdr_t *hdr = img->hdr;
+    uint  len          = hdr->len;
+    uint  sector_count = (len + hdr->sector_size - 1) / hdr->sector_size;
+    uint  block_count  = (len + hdr->block_size - 1) / hdr->block_size;
+    uint  per_sector   = hdr->sector_size / hdr->block_size;
+    uint *index        = malloc((block_count + 1) * sizeof (*index));
+    uint *bad          = malloc((block_count + 1) * sizeof (*bad));
+    uint  bad_count;
+    uint  count;
+    uint  cur;
+    uint  pos;
+    uint  miscompares  = 0;
+    int   rc           = 1;
+    char *eebuf        = NULL;
+
+    if ((index == NULL) || (bad == NULL))
+        errx(EXIT_FAILURE, "Could not allocate %u block map", block_count);
+
+    printf("Verifying 0x%x bytes at 0x%x by CRC\n", len, addr);
+    for (cur = 0; cur < sector_count; cur++)
+        index[cur] = cur;
+    if (image_crc_check(addr, len, hdr->sector_size, img->sector_crc,
+                        index, sector_count, bad, &bad_count))
+        goto done;
+    if (bad_count == 0) {
+        printf("Verify success (%u sectors)\n", sector_count);
+        rc = 0;
+        goto done;
+    }
+    printf("%u of %u sectors differ\n", bad_count, sector_count);
+
+    /* Narrow down to blocks within the mismatched sectors */
+    count = 0;
+    for (cur = 0; cur < bad_count; cur++)
+        for (pos = 0; pos < per_sector; pos++)
+            if (bad[cur] * per_sector + pos < block_count)
+                index[count++] = bad[cur] * per_sector + pos;
+    if (image_crc_check(addr, len, hdr->block_size, img->block_crc,
+                        index, count, bad, &bad_count))
+        goto done;
+
+    /* Blocks which matched by CRC count toward the line statistics */
+    memset(&line_stats, 0, sizeof (line_stats));
+    for (cur = 0, pos = 0; cur < block_count; cur++) {
+        uint off = cur * hdr->block_size;
+        if ((pos < bad_count) && (bad[pos] == cur)) {
+            pos++;
+            continue;
+        }
+        line_stats_add((char *) img->payload, NULL, off,
+                       (len - off < hdr->block_size) ?
+                       len : off + hdr->block_size, addr);
+    }
+
+    /* Read back only the mismatched blocks */
+    eebuf = malloc(len);
+    if (eebuf == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+    for (pos = 0; pos < bad_count; pos += count) {
+        extent_t ext[EXTENT_MAX];
+        count = bad_count - pos;
+        if (count > EXTENT_MAX)
+            count = EXTENT_MAX;
+        for (cur = 0; cur < count; cur++) {
+            uint off = bad[pos + cur] * hdr->block_size;
+            ext[cur].addr = addr + off;
+            ext[cur].len  = (len - off < hdr->block_size) ?
+                            len - off : hdr->block_size;
+        }
+        if (receive_extents(eebuf, addr, ext, count))
+            goto done;
+        for (cur = 0; cur < count; cur++) {
+            uint spos = ext[cur].addr - addr;
+            miscompares = compare_range((char *) img->payload, eebuf, spos,
+                                        spos + ext[cur].len, addr,
+                                        miscompares, miscompares_max);
+        }
+    }
+    printf("%u of %u blocks failed (%u miscompares)\n",
+           bad_count, block_count, miscompares);
+    line_stats_show();
+done:
+    free(eebuf);
+    free(index);
+    free(bad);
+    return (rc);
+}
+
+/*
+ * image_run() performs erase, write, and verify using an image container.
+ *             The target address and bank come from the container unless
+ *             overridden on the command line. Only the non-erased extents
+ *             of the payload are written.
+ *
+ * @param  [in]  mode       - MODE_ERASE, MODE_WRITE, and/or MODE_VERIFY.
+ * @param  [in]  img        - Mapped container.
+ * @param  [in]  filename   - Container filename.
+ * @param  [in]  bank       - Bank override (or BANK_NOT_SPECIFIED).
+ * @param  [in]  addr       - Address override (or ADDR_NOT_SPECIFIED).
+ * @param  [in]  report_max - Maximum miscompares to show verbosely.
+ * @return       0 - Success.
+ * @return       1 - Failure.
+ */
+static int
+image_run(uint mode, image_t *img, const char *filename, uint bank,
+          uint addr, uint report_max)
+{
+    const image_hdr_t *hdr = img->hdr;
+    uint               cur;
+
+    if (addr == ADDR_NOT_SPECIFIED)
+        addr = hdr->addr;
+    if (bank == BANK_NOT_SPECIFIED)
+        bank = hdr->bank;
+    if (addr == ADDR_NOT_SPECIFIED)
+        addr = 0x000000;  // Start of EEPROM
+    if (bank != BANK_NOT_SPECIFIED)
+        addr += bank * hdr->len;
+
+    if ((mode & MODE_ERASE) &&
+        eeprom_erase(BANK_NOT_SPECIFIED, addr, hdr->len))
+        return (1);
+
+    if (mode & MODE_WRITE) {
+        for (cur = 0; cur < hdr->extent_count; cur++) {
+            const extent_t *ext = &img->ext[cur];
+            if (eeprom_write_buf(img->payload + ext->addr, addr + ext->addr,
+                                 ext->len, filename) != 0)
+                return (1);
+        }
+        if (hdr->extent_count == 0)
+            printf("%s payload is entirely erased; nothing to write\n",
+                   filename);
+    }
+    if ((mode & MODE_VERIFY) && image_verify(img, addr, report_max))
+        return (1);
+    return (0);
+}
+
+/*
+ * vcd_bits() writes a VCD vector value change.
+ */
+static void
+vcd_bits(FILE *fp, uint32_t value, int width, char id)
+{
+    int bit;
+
+    fputc('b', fp);
+    for (bit = width - 1; bit >= 0; bit--)
+        fputc((value & (1U << bit)) ? '1' : '0', fp);
+    fprintf(fp, " %c\n", id);
+}
+
+/*
+ * capture_get() requests that the programmer run a short bus sequence
+ *               with pin capture active, and receives the captured
+ *               transitions.
+ *
+ * @param  [in]  op   - Bus sequence: read, unlock, id, or page.
+ * @param  [in]  addr - EEPROM address used by the sequence.
+ * @param  [out] hdr  - Capture header (tick rate and sample count).
+ * @return       Allocated array of hdr->count samples; NULL on failure.
+ */
+static capture_t *
+capture_get(const char *op, uint addr, capture_hdr_t *hdr)
+{
+    capture_t *cap;
+    char       cmd[64];
+    uint       len;
+
+    if (addr == ADDR_NOT_SPECIFIED)
+        addr = 0x000000;  // Start of EEPROM
+
+    snprintf(cmd, sizeof (cmd) - 1, "%s capture %s %x", prom_xfer(), op,
+             addr);
+    cmd[sizeof (cmd) - 1] = '\0';
+    if (send_cmd(cmd))
+        return (NULL); // "timeout" was reported in this case
+
+    if (receive_ll_crc(hdr, sizeof (*hdr)) != sizeof (*hdr))
+        return (NULL);
+    if (hdr->magic != CAPTURE_MAGIC) {
+        printf("Invalid capture header %08x\n", hdr->magic);
+        return (NULL);
+    }
+    if ((hdr->count == 0) || (hdr->tick_hz == 0)) {
+        printf("No capture samples\n");
+        return (NULL);
+    }
+    len = hdr->count * sizeof (*cap);
+    cap = malloc(len);
+    if (cap == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+    if (receive_ll_crc(cap, len) != len) {
+        free(cap);
+        return (NULL);
+    }
+    if (hdr->flags & CAPTURE_FLAG_FAILED)
+        printf("Warning: %s sequence reported failure\n", op);
+    if (hdr->flags & CAPTURE_FLAG_OVERFLOW)
+        printf("Warning: capture buffer filled; sequence was truncated\n");
+    return (cap);
+}
+
+/*
+ * eeprom_capture() requests that the programmer run a short bus sequence
+ *                  with pin capture active, and then writes the captured
+ *                  transitions to a Value Change Dump (VCD) file which
+ *                  can be viewed by any waveform viewer (such as GTKWave).
+ *
+ * @param  [in]  filename - VCD file to write.
+ * @param  [in]  op       - Bus sequence: read, unlock, id, or page.
+ * @param  [in]  addr     - EEPROM address used by the sequence.
+ *
+ * @return       0 - Success.
+ * @return       1 - Failure.
+ * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ */
+static int
+eeprom_capture(const char *filename, const char *op, uint addr)
+{
+    capture_hdr_t hdr;
+    capture_t    *cap;
+    capture_t    *last = NULL;
+    uint64_t      last_nsec = 0;
+    uint          cur;
+    time_t        now = time(NULL);
+    FILE         *fp;
+
+    if (addr == ADDR_NOT_SPECIFIED)
+        addr = 0x000000;  // Start of EEPROM
+
+    cap = capture_get(op, addr, &hdr);
+    if (cap == NULL)
+        return (1);
+
+    fp = fopen(filename, "w");
+    if (fp == NULL)
+        err(EXIT_FAILURE, "Failed to open %s", filename);
+
+    fprintf(fp, "$date %s$end\n", ctime(&now));
+    fprintf(fp, "$version mxprog capture %s 0x%x $end\n", op, addr);
+    fprintf(fp, "$timescale 1ns $end\n");
+    fprintf(fp, "$scope module mx29f1615 $end\n");
+    fprintf(fp, "$var wire 20 a addr $end\n");
+    fprintf(fp, "$var wire 16 d data $end\n");
+    fprintf(fp, "$var wire 1 c ce_n $end\n");
+    fprintf(fp, "$var wire 1 o oe_n $end\n");
+    fprintf(fp, "$var wire 1 v vpp $end\n");
+    fprintf(fp, "$var wire 1 e data_drive $end\n");
+    fprintf(fp, "$upscope $end\n");
+    fprintf(fp, "$enddefinitions $end\n");
+
+    for (cur = 0; cur < hdr.count; cur++) {
+        capture_t *sample = &cap[cur];
+        uint32_t   ticks  = sample->tick - cap[0].tick;
+        uint64_t   nsec   = (uint64_t) ticks * 1000000000 / hdr.tick_hz;
+        uint16_t   diff   = (last == NULL) ? 0xffff :
+                            (sample->ctrl ^ last->ctrl);
+
+        if ((last == NULL) || (nsec != last_nsec))
+            fprintf(fp, "#%ju\n", (uintmax_t) nsec);
+        last_nsec = nsec;
+        if (last == NULL)
+            fprintf(fp, "$dumpvars\n");
+        if ((last == NULL) || (sample->addr != last->addr))
+            vcd_bits(fp, sample->addr, 20, 'a');
+        if ((last == NULL) || (sample->data != last->data))
+            vcd_bits(fp, sample->data, 16, 'd');
+        if (diff & CAPTURE_CE)
+            fprintf(fp, "%dc\n", !!(sample->ctrl & CAPTURE_CE));
+        if (diff & CAPTURE_OE)
+            fprintf(fp, "%do\n", !!(sample->ctrl & CAPTURE_OE));
+        if (diff & CAPTURE_VPP)
+            fprintf(fp, "%dv\n", !!(sample->ctrl & CAPTURE_VPP));
+        if (diff & CAPTURE_DOE)
+            fprintf(fp, "%de\n", !!(sample->ctrl & CAPTURE_DOE));
+        if (last == NULL)
+            fprintf(fp, "$end\n");
+        last = sample;
+    }
+    fclose(fp);
+
+    printf("Captured %u transitions over %ju ns to %s\n", hdr.count,
+           (uintmax_t) ((uint64_t) (cap[hdr.count - 1].tick - cap[0].tick) *
+                        1000000000 / hdr.tick_hz), filename);
+    free(cap);
+    return (0);
+}
+
+/* MX29F1615 AC timing constraints checked by timing_check() */
+typedef enum {
+    TC_ACC, TC_CE, TC_OE, TC_DF, TC_OES, TC_AS, TC_AH, TC_WP, TC_DS, TC_DH,
+    TC_VPS, TC_VPH, TC_BLC, TC_BAL, TC_COUNT
+} tc_id_t;
+
+typedef struct {
+    const char *name;
+    const char *desc;
+    double      limit;   // Limit in nsec
+    bool        is_max;  // Limit is a maximum (otherwise a minimum)
+} tc_spec_t;
+
+typedef struct {
+    uint   count;       // Times the constraint was measured
+    uint   violations;  // Times the bound did not meet the limit
+    double worst;       // Bound with the least slack (nsec)
+    double raw_min;     // Shortest captured interval (nsec)
+    double raw_max;     // Longest captured interval (nsec)
+} tc_result_t;
+
+/*
+ * A constraint is checked only if its limit is at least this many times
+ * the capture resolution (the larger of one timer tick and the cost of
+ * one capture sample). Shorter constraints, which include every 35-120 ns
+ * read and write cycle constraint, are reported as raw intervals only.
+ */
+#define TC_RESOLVE_FACTOR 4
+
+static const tc_spec_t tc_spec[TC_COUNT] = {
+    { "tACC", "address stable to end of read",        120, FALSE },
+    { "tCE",  "CE# low to end of read",               120, FALSE },
+    { "tOE",  "OE# low to end of read",                60, FALSE },
+    { "tDF",  "OE# high to data driven",               35, FALSE },
+    { "tOES", "OE# high to CE# low (write)",            0, FALSE },
+    { "tAS",  "address to CE# low (write)",             0, FALSE },
+    { "tAH",  "CE# low to address change (write)",     60, FALSE },
+    { "tWP",  "CE# low write pulse width",             60, FALSE },
+    { "tDS",  "data valid to CE# high",                60, FALSE },
+    { "tDH",  "CE# high to data change",                0, FALSE },
+    { "tVPS", "VPP high to first write",             2000, FALSE },
+    { "tVPH", "last write to VPP low",               2000, FALSE },
+    { "tBLC", "word load to next word load",        30000, TRUE  },
+    { "tBAL", "last page word to status read",     100000, FALSE },
+};
+
+/*
+ * tc_slack() returns how far a measurement is from violating a constraint.
+ */
+static double
+tc_slack(tc_id_t id, double nsec)
+{
+    if (tc_spec[id].is_max)
+        return (tc_spec[id].limit - nsec);
+    return (nsec - tc_spec[id].limit);
+}
+
+/*
+ * tc_record() records one measurement of a timing constraint.
+ *
+ * @param  [io]  res  - Results to which the measurement is added.
+ * @param  [in]  id   - Constraint measured.
+ * @param  [in]  raw  - Captured interval (nsec).
+ * @param  [in]  less - Interval less the capture cost of the programmer's
+ *                      pin changes within it (nsec).
+ * @return       None.
+ */
+static void
+tc_record(tc_result_t *res, tc_id_t id, double raw, double less)
+{
+    tc_result_t *r     = &res[id];
+    double       bound = tc_spec[id].is_max ? raw : less;
+
+    if ((r->count == 0) || (tc_slack(id, bound) < tc_slack(id, r->worst)))
+        r->worst = bound;
+    if ((r->count == 0) || (raw < r->raw_min))
+        r->raw_min = raw;
+    if ((r->count == 0) || (raw > r->raw_max))
+        r->raw_max = raw;
+    if (tc_slack(id, bound) < 0)
+        r->violations++;
+    r->count++;
+}
+
+/*
+ * timing_check_trace() measures the timing constraints of the MX29F1615
+ *                      in a bus capture.
+ *
+ * Capturing a sample after each pin change slows the programmer, so the
+ * captured intervals are longer than those of the uninstrumented bus
+ * routines. The cost of one sample is estimated as the shortest interval
+ * between consecutive pin changes. A minimum is checked against the
+ * interval less that cost for each pin change made by the programmer
+ * within it, and a maximum against the captured interval, so each check
+ * errs towards reporting a violation. This is no model of the real bus
+ * timing: the sample cost is typically hundreds of ns, far coarser than
+ * the 35-120 ns cycle constraints, which therefore cannot be resolved.
+ *
+ * @param  [in]  hdr      - Capture header.
+ * @param  [in]  cap      - Captured samples.
+ * @param  [io]  res      - Results to which measurements are added.
+ * @param  [out] overhead - Estimated cost of one capture sample (nsec).
+ * @return       None.
+ */
+static void
+timing_check_trace(const capture_hdr_t *hdr, const capture_t *cap,
+                   tc_result_t *res, double *overhead)
+{
+    capture_t  idle = cap[0];
+    double    *t;
+    uint      *driven;  // Count of programmer pin changes before sample
+    uint       cur;
+    int        i_addr = 0;      // Last address change
+    int        i_data = -1;     // Last data change driven by programmer
+    int        i_ce_fall = -1;  // Last CE# fall
+    int        i_oe_fall = -1;  // Last OE# fall
+    int        i_oe_rise = -1;  // Last OE# rise
+    int        i_vpp = -1;      // Last VPP rise
+    int        i_wr_fall = -1;  // CE# fall of last write
+    int        i_wr_rise = -1;  // CE# rise of last write
+    int        i_ah = -1;       // First address change while CE# low
+    bool       df_pending = FALSE;
+    bool       dh_pending = FALSE;
+    bool       ah_pending = FALSE;
+    bool       vps_pending = FALSE;
+    bool       bal_pending = FALSE;
+    uint       writes = 0;      // Write cycles since VPP rise
+
+    /* The bus is idle before the first sample: CE# and OE# high */
+    idle.ctrl = CAPTURE_CE | CAPTURE_OE;
+
+    t      = calloc(hdr->count, sizeof (*t));
+    driven = calloc(hdr->count + 1, sizeof (*driven));
+    if ((t == NULL) || (driven == NULL))
+        errx(EXIT_FAILURE, "Could not allocate %u samples", hdr->count);
+
+    /* Timestamps and the cost of a capture sample */
+    *overhead = 0;
+    for (cur = 0; cur < hdr->count; cur++) {
+        const capture_t *prev = &cap[(cur == 0) ? 0 : cur - 1];
+        bool is_driven = (cur == 0) || (cap[cur].addr != prev->addr) ||
+                         (cap[cur].ctrl != prev->ctrl) ||
+                         ((cap[cur].data != prev->data) &&
+                          (cap[cur].ctrl & CAPTURE_DOE));
+        t[cur] = (double) (uint32_t) (cap[cur].tick - cap[0].tick) *
+                 1000000000.0 / hdr->tick_hz;
+        driven[cur + 1] = driven[cur] + is_driven;
+        if (is_driven && (cur > 0) && (driven[cur] == driven[cur - 1] + 1) &&
+            ((*overhead == 0) || (t[cur] - t[cur - 1] < *overhead)))
+            *overhead = t[cur] - t[cur - 1];
+    }
+
+#define TC_RECORD(id, from, to) \
+        tc_record(res, id, t[to] - t[from], \
+                  t[to] - t[from] - (driven[to] - driven[from]) * *overhead)
+
+    for (cur = 0; cur < hdr->count; cur++) {
+        const capture_t *prev   = (cur == 0) ? &idle : &cap[cur - 1];
+        const capture_t *sample = &cap[cur];
+        uint16_t         rise   = sample->ctrl & ~prev->ctrl;
+        uint16_t         fall   = prev->ctrl & ~sample->ctrl;
+
+        if (sample->addr != prev->addr) {
+            if (ah_pending) {
+                TC_RECORD(TC_AH, i_wr_fall, cur);
+                ah_pending = FALSE;
             }
-        } else {
-            if (first_fail_pos != -1) {
-                if (miscompares < miscompares_max) {
-                    /* Report previous range */
-                    show_fail_range(filebuf, eebuf, pos - first_fail_pos,
-                                    addr, first_fail_pos, miscompares_max);
-                }
-                first_fail_pos = -1;
+            if (((sample->ctrl & CAPTURE_CE) == 0) && (i_ah < 0))
+                i_ah = cur;
+            i_addr = cur;
+        }
+        if ((sample->ctrl & CAPTURE_DOE) &&
+            ((sample->data != prev->data) || (rise & CAPTURE_DOE))) {
+            if (dh_pending && ((rise & CAPTURE_DOE) == 0)) {
+                TC_RECORD(TC_DH, i_wr_rise, cur);
+                dh_pending = FALSE;
+            }
+            i_data = cur;
+        }
+        if (rise & CAPTURE_DOE) {
+            if (df_pending)
+                TC_RECORD(TC_DF, i_oe_rise, cur);
+            df_pending = FALSE;
+        }
+        if ((fall & CAPTURE_DOE) && dh_pending) {
+            TC_RECORD(TC_DH, i_wr_rise, cur);
+            dh_pending = FALSE;
+        }
+        if (fall & CAPTURE_OE)
+            i_oe_fall = cur;
+        if (rise & CAPTURE_OE) {
+            i_oe_rise  = cur;
+            df_pending = TRUE;
+        }
+        if (fall & CAPTURE_CE) {
+            i_ce_fall = cur;
+            i_ah      = -1;
+        }
+        if ((rise & CAPTURE_CE) && (i_ce_fall >= 0)) {
+            if (prev->ctrl & CAPTURE_DOE) {
+                /* Write cycle: data is latched on the rising edge of CE# */
+                TC_RECORD(TC_WP, i_ce_fall, cur);
+                if (i_data >= 0)
+                    TC_RECORD(TC_DS, i_data, cur);
+                if (i_oe_rise >= 0)
+                    TC_RECORD(TC_OES, i_oe_rise, i_ce_fall);
+                TC_RECORD(TC_AS, i_addr, i_ce_fall);
+                if (i_ah >= 0)
+                    TC_RECORD(TC_AH, i_ce_fall, i_ah);
+                if (vps_pending)
+                    TC_RECORD(TC_VPS, i_vpp, i_ce_fall);
+                if ((writes > 0) && (sample->ctrl & CAPTURE_VPP))
+                    TC_RECORD(TC_BLC, i_wr_fall, i_ce_fall);
+                ah_pending  = (i_ah < 0);
+                vps_pending = FALSE;
+                dh_pending  = TRUE;
+                i_wr_fall   = i_ce_fall;
+                i_wr_rise   = cur;
+                writes++;
+            } else if ((prev->ctrl & CAPTURE_OE) == 0) {
+                /* Read cycle: data is sampled just before CE# rises */
+                TC_RECORD(TC_CE, i_ce_fall, cur);
+                if (i_oe_fall >= 0)
+                    TC_RECORD(TC_OE, i_oe_fall, cur);
+                TC_RECORD(TC_ACC, i_addr, cur);
+                if (bal_pending)
+                    TC_RECORD(TC_BAL, i_wr_rise, i_ce_fall);
+                bal_pending = FALSE;
             }
         }
+        if (rise & CAPTURE_VPP) {
+            i_vpp       = cur;
+            vps_pending = TRUE;
+            bal_pending = FALSE;
+            writes      = 0;
+        }
+        if ((fall & CAPTURE_VPP) && (writes > 0)) {
+            TC_RECORD(TC_VPH, i_wr_rise, cur);
+            bal_pending = (writes > 3);  // Page program, not a command
+        }
     }
-    if ((first_fail_pos != -1) && (miscompares < miscompares_max)) {
-        /* Report final range not previously reported */
-        show_fail_range(filebuf, eebuf, pos - first_fail_pos, addr,
-                        first_fail_pos, miscompares_max);
+#undef TC_RECORD
+    free(t);
+    free(driven);
+}
+
+/*
+ * timing_check() captures each bus sequence of the programmer (read,
+ *                unlock, id, and page program) and measures the captured
+ *                pin transitions against the MX29F1615 AC timing
+ *                specifications. Capture resolution is far coarser than
+ *                the 35-120 ns read and write cycle constraints, so those
+ *                are reported as raw captured intervals only, with no
+ *                verdict. Only constraints of at least TC_RESOLVE_FACTOR
+ *                times the capture resolution (such as word load and
+ *                program time) are checked, against a bound which errs
+ *                towards a violation. The page program sequence
+ *                re-programs the page at <addr> with its current
+ *                contents.
+ *
+ * @param  [in]  addr - EEPROM address used by the sequences.
+ *
+ * @return       0 - All checked constraints were met.
+ * @return       1 - A checked constraint was violated or capture failed.
+ */
+static int
+timing_check(uint addr)
+{
+    static const char * const ops[] = { "read", "unlock", "id", "page" };
+    tc_result_t   res[TC_COUNT];
+    capture_hdr_t hdr;
+    capture_t    *cap;
+    double        overhead;
+    double        overhead_max = 0;
+    double        resolution;
+    uint          tick_hz = 0;
+    uint          samples = 0;
+    uint          cur;
+    int           rc = 0;
+
+    memset(res, 0, sizeof (res));
+    for (cur = 0; cur < ARRAY_SIZE(ops); cur++) {
+        cap = capture_get(ops[cur], addr, &hdr);
+        if (cap == NULL)
+            return (1);
+        timing_check_trace(&hdr, cap, res, &overhead);
+        if (overhead_max < overhead)
+            overhead_max = overhead;
+        tick_hz  = hdr.tick_hz;
+        samples += hdr.count;
+        free(cap);
     }
-    free(eebuf);
-    free(filebuf);
-    if (miscompares) {
-        printf("%u miscompares\n", miscompares);
-        return (1);
-    } else {
-        printf("Verify success\n");
-        return (0);
+    resolution = 1000000000.0 / tick_hz;
+    if (resolution < overhead_max)
+        resolution = overhead_max;
+
+    printf("MX29F1615 bus timing: %u transitions in %zu sequences\n",
+           samples, ARRAY_SIZE(ops));
+    printf("Timer %u Hz (%.1f ns); capture sample cost up to %.0f ns\n",
+           tick_hz, 1000000000.0 / tick_hz, overhead_max);
+    printf("Constraints under %.0f ns cannot be resolved by capture; "
+           "only their\ncaptured intervals are shown, which include "
+           "capture cost\n", resolution * TC_RESOLVE_FACTOR);
+    printf("  %-5s %-34s %9s %19s %10s %5s  %s\n", "Name", "Constraint",
+           "Limit", "Captured", "Slack", "Count", "Status");
+    for (cur = 0; cur < TC_COUNT; cur++) {
+        const tc_spec_t   *spec = &tc_spec[cur];
+        const tc_result_t *r    = &res[cur];
+        char               limit[16];
+        char               captured[24];
+        char               status[32];
+
+        snprintf(limit, sizeof (limit), "%s%.0f", spec->is_max ? "<=" : ">=",
+                 spec->limit);
+        if (r->count == 0) {
+            printf("  %-5s %-34s %9s %19s %10s %5u  %s\n", spec->name,
+                   spec->desc, limit, "-", "-", 0, "not exercised");
+            continue;
+        }
+        snprintf(captured, sizeof (captured), "%.0f-%.0f",
+                 r->raw_min, r->raw_max);
+        if (spec->limit < resolution * TC_RESOLVE_FACTOR) {
+            printf("  %-5s %-34s %9s %19s %10s %5u  %s\n", spec->name,
+                   spec->desc, limit, captured, "-", r->count,
+                   "below resolution");
+            continue;
+        }
+        if (r->violations > 0) {
+            snprintf(status, sizeof (status), "VIOLATED %u times",
+                     r->violations);
+            rc = 1;
+        } else {
+            snprintf(status, sizeof (status), "ok");
+        }
+        printf("  %-5s %-34s %9s %19s %+10.0f %5u  %s\n", spec->name,
+               spec->desc, limit, captured, tc_slack(cur, r->worst),
+               r->count, status);
     }
+    printf("All times are in ns\n");
+    return (rc);
 }
 
 /*
@@ -1728,8 +6916,6 @@ run_terminal_mode(void)
     running = 0;
 }
 
-#define LINUX_BY_ID_DIR "/dev/serial/by-id"
-
 /*
  * find_mx_programmer() will attempt to locate tty device associated with USB
  *                      connection of the MX25F1615 programmer. If found, it
@@ -1868,6 +7054,435 @@ wait_for_tx_writer(void)
             time_delay_msec(10);
 }
 
+/* Exit codes of a paired programming job */
+#define PAIR_RC_SUCCESS 0  // Write and verify successful
+#define PAIR_RC_WRITE   1  // Write failed (also errx() exit)
+#define PAIR_RC_VERIFY  2  // Verify failed
+#define PAIR_RC_OPEN    3  // Could not open programmer
+#define PAIR_RC_ERASE   4  // Erase failed
+
+/*
+ * eeprom_pair_job() runs in a child process and handles the programmer for
+ *                   one half of a paired 32-bit ROM set. Each child has its
+ *                   own copy of the device globals and communication threads,
+ *                   so the two programmers operate fully in parallel.
+ *
+ * @param  [in]  dev        - Serial device of the programmer.
+ * @param  [in]  mode       - Bitmask of MODE_ERASE, MODE_WRITE, MODE_VERIFY.
+ * @param  [in]  buf        - De-interleaved 16-bit image for this chip.
+ * @param  [in]  addr       - EEPROM starting address.
+ * @param  [in]  len        - Length of image for this chip.
+ * @param  [in]  report_max - Maximum miscompares to show in verbose manner.
+ * @param  [in]  filename   - Source filename (for messages).
+ * @exit         PAIR_RC_*  - Result of the job.
+ */
+static void __attribute__((noreturn))
+eeprom_pair_job(const char *dev, uint mode, uint8_t *buf, uint addr, uint len,
+                uint report_max, const char *filename)
+{
+    int rc = PAIR_RC_SUCCESS;
+
+    strncpy(device_name, dev, sizeof (device_name) - 1);
+    device_name[sizeof (device_name) - 1] = '\0';
+
+    tl_event('M', "process_name", "%s", dev);
+    model_load();  // Each programmer has its own timing model
+    if (serial_open(TRUE) != RC_SUCCESS)
+        exit(PAIR_RC_OPEN);
+    create_threads();
+
+    tl_begin("job", "mode 0x%x", mode);
+    if ((mode & MODE_ERASE) && eeprom_erase(BANK_NOT_SPECIFIED, addr, len))
+        rc = PAIR_RC_ERASE;
+    else if ((mode & MODE_WRITE) &&
+             (eeprom_write_buf(buf, addr, len, filename) != 0))
+        rc = PAIR_RC_WRITE;
+    else if ((mode & MODE_VERIFY) &&
+             (eeprom_verify_buf((char *) buf, addr, len, report_max) != 0))
+        rc = PAIR_RC_VERIFY;
+    tl_end("job");
+
+    wait_for_tx_writer();
+    model_save();
+    exit(rc);
+}
+
+/*
+ * eeprom_pair() writes and verifies a 32-bit ROM image which is split across
+ *               two 16-bit EEPROMs, each installed in a separate programmer.
+ *               The image is de-interleaved into HI (bytes 0-1 of each
+ *               32-bit word) and LO (bytes 2-3) halves, and then both
+ *               programmers are driven simultaneously.
+ *
+ * @param  [in]  dev_hi     - Serial device of the HI chip programmer.
+ * @param  [in]  dev_lo     - Serial device of the LO chip programmer.
+ * @param  [in]  mode       - Bitmask of MODE_ERASE, MODE_WRITE, MODE_VERIFY.
+ * @param  [in]  bank       - Base address as multiple of per-chip length.
+ * @param  [in]  baseaddr   - Per-chip base address, if specified.
+ * @param  [in]  len        - Length of the 32-bit image, if specified.
+ * @param  [in]  report_max - Maximum miscompares to show in verbose manner.
+ * @param  [in]  filename   - 32-bit image file.
+ *
+ * @return       0 - Both chips successfully programmed.
+ * @return       1 - Failure on at least one chip.
+ * @exit         EXIT_FAILURE - The program will terminate on file access error.
+ */
+static int
+eeprom_pair(const char *dev_hi, const char *dev_lo, uint mode, uint bank,
+            uint baseaddr, uint len, uint report_max, const char *filename)
+{
+    static const char * const pair_rc_str[] = {
+        "success", "write failed", "verify failed", "open failed",
+        "erase failed"
+    };
+    const char  *dev[2]  = { dev_hi, dev_lo };
+    const char  *half[2] = { "HI", "LO" };
+    uint8_t     *filebuf;
+    uint8_t     *chipbuf[2];
+    pid_t        pid[2];
+    struct stat  statbuf;
+    uint         chiplen;
+    uint         pos;
+    int          chip;
+    int          rc = 0;
+
+    if ((filename == NULL) || (filename[0] == '\0')) {
+        warnx("You must specify a filename with -p option\n");
+        usage(stderr);
+        return (1);
+    }
+    if (mode == MODE_UNKNOWN)
+        mode = MODE_WRITE | MODE_VERIFY;
+    if (mode & ~(MODE_ERASE | MODE_WRITE | MODE_VERIFY))
+        errx(EXIT_USAGE, "Only -e -w -v may be specified with -p");
+    if (baseaddr == ADDR_NOT_SPECIFIED)
+        baseaddr = 0x000000;  // Start of EEPROM
+
+    if (lstat(filename, &statbuf))
+        errx(EXIT_FAILURE, "Failed to stat %s", filename);
+    if (len == EEPROM_SIZE_NOT_SPECIFIED) {
+        len = EEPROM_SIZE_DEFAULT * 2;
+        if (len > statbuf.st_size)
+            len = statbuf.st_size;
+    }
+    if (len > statbuf.st_size) {
+        errx(EXIT_FAILURE, "Length 0x%x is greater than %s size %jx",
+             len, filename, (intmax_t)statbuf.st_size);
+    }
+    if ((len & 3) != 0)
+        errx(EXIT_FAILURE, "Length 0x%x is not a multiple of 32 bits", len);
+
+    chiplen = len / 2;
+    if (bank != BANK_NOT_SPECIFIED)
+        baseaddr += bank * chiplen;
+
+    if ((mode & MODE_ERASE) && (force_yes == FALSE)) {
+        char prompt[80];
+        sprintf(prompt, "Erase both EEPROMs from 0x%x to 0x%x",
+                baseaddr, baseaddr + chiplen);
+        if (are_you_sure(prompt) == false)
+            return (1);
+        force_yes = TRUE;  // Children must not prompt
+    }
+
+    /* De-interleave 32-bit big endian words into 16-bit HI and LO halves */
+    filebuf    = read_file(filename, len);
+    chipbuf[0] = malloc(chiplen);
+    chipbuf[1] = malloc(chiplen);
+    if ((chipbuf[0] == NULL) || (chipbuf[1] == NULL))
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", chiplen);
+    for (pos = 0; pos < len; pos += 4) {
+        memcpy(chipbuf[0] + pos / 2, filebuf + pos, 2);
+        memcpy(chipbuf[1] + pos / 2, filebuf + pos + 2, 2);
+    }
+    free(filebuf);
+
+    printf("Programming 0x%x bytes of %s as HI %s and LO %s\n",
+           len, filename, dev_hi, dev_lo);
+    fflush(stdout);
+
+    for (chip = 0; chip < 2; chip++) {
+        pid[chip] = fork();
+        if (pid[chip] < 0)
+            err(EXIT_FAILURE, "fork failed");
+        if (pid[chip] == 0) {
+            if (chip != 0)
+                show_progress = FALSE;  // Only one chip reports progress
+            eeprom_pair_job(dev[chip], mode, chipbuf[chip], baseaddr,
+                            chiplen, report_max, filename);
+        }
+    }
+
+    for (chip = 0; chip < 2; chip++) {
+        int status;
+        int code;
+
+        if (waitpid(pid[chip], &status, 0) < 0)
+            err(EXIT_FAILURE, "waitpid failed");
+        if (WIFEXITED(status) &&
+            ((code = WEXITSTATUS(status)) < (int) ARRAY_SIZE(pair_rc_str))) {
+            printf("%s %s: %s\n", half[chip], dev[chip], pair_rc_str[code]);
+        } else {
+            printf("%s %s: terminated abnormally\n", half[chip], dev[chip]);
+            code = PAIR_RC_WRITE;
+        }
+        if (code != PAIR_RC_SUCCESS)
+            rc = 1;
+    }
+    free(chipbuf[0]);
+    free(chipbuf[1]);
+    return (rc);
+}
+
+/*
+ * estimate_phase() displays the predicted duration of one job phase, and
+ *                  how many measurements of this programmer it is based on.
+ */
+static void
+estimate_phase(const char *phase, const char *work, double usec,
+               tm_param_t param)
+{
+    char basis[32];
+
+    if (tm_samples[param] == 0)
+        snprintf(basis, sizeof (basis), "default");
+    else
+        snprintf(basis, sizeof (basis), "%u sample%s", tm_samples[param],
+                 (tm_samples[param] == 1) ? "" : "s");
+    printf("  %-8s %-28s %8.1f sec  (%s)\n", phase, work, usec / 1000000,
+           basis);
+}
+
+/*
+ * job_estimate() predicts the duration of an erase, read, write, and/or
+ *                verify job without contacting the programmer. The planned
+ *                work (sectors to erase, pages to write, bytes to read) is
+ *                computed the same way run_mode() would perform the job,
+ *                then combined with the timing model learned for this
+ *                programmer from prior jobs.
+ *
+ * @param [in] mode     - MODE_ERASE, MODE_READ, MODE_VERIFY, MODE_WRITE.
+ * @param [in] bank     - Bank number, if specified.
+ * @param [in] baseaddr - Base address, if specified.
+ * @param [in] len      - Length, if specified.
+ * @param [in] fill     - Fill the remaining EEPROM with duplicate images.
+ * @param [in] filename - Source or destination filename.
+ *
+ * @return       0 - Success.
+ * @return       1 - Failure.
+ */
+static int
+job_estimate(uint mode, uint bank, uint baseaddr, uint len, bool fill,
+             const char *filename)
+{
+    const uint job_modes = MODE_ERASE | MODE_READ | MODE_VERIFY | MODE_WRITE;
+    uint       sectors = 0;
+    uint       chip    = 0;
+    uint       pages   = 0;
+    uint       wbytes  = 0;
+    uint       rbytes  = 0;
+    uint       cbytes  = 0;
+    uint       cur;
+    double     erase_usec;
+    double     write_usec;
+    double     read_usec;
+    double     crc_usec;
+    char       work[40];
+    image_t    img;
+
+    if ((mode & job_modes) == 0) {
+        warnx("-E requires one or more of -e -r -v -w");
+        return (1);
+    }
+    if (((filename == NULL) || (filename[0] == '\0')) &&
+        (mode & (MODE_READ | MODE_VERIFY | MODE_WRITE))) {
+        warnx("You must specify a filename with -r or -v or -w option\n");
+        return (1);
+    }
+
+    if (extent_count > 0) {
+        /* Extent verify compares CRCs; only mismatched ranges are read */
+        for (cur = 0; cur < extent_count; cur++) {
+            if (mode & MODE_READ)
+                rbytes += extent_list[cur].len;
+            else if (mode & MODE_VERIFY)
+                cbytes += extent_list[cur].len;
+        }
+    } else if (mode & MODE_READ) {
+        if (baseaddr == ADDR_NOT_SPECIFIED)
+            baseaddr = 0x000000;
+        if (len == EEPROM_SIZE_NOT_SPECIFIED)
+            len = EEPROM_SIZE_DEFAULT - baseaddr;
+        rbytes = len;
+    } else if ((mode & (MODE_WRITE | MODE_VERIFY)) &&
+               image_open(filename, &img)) {
+        const image_hdr_t *hdr = img.hdr;
+        uint               addr = baseaddr;
+
+        if (addr == ADDR_NOT_SPECIFIED)
+            addr = hdr->addr;
+        if (bank == BANK_NOT_SPECIFIED)
+            bank = hdr->bank;
+        if (addr == ADDR_NOT_SPECIFIED)
+            addr = 0x000000;
+        if (bank != BANK_NOT_SPECIFIED)
+            addr += bank * hdr->len;
+        if (mode & MODE_ERASE)
+            sectors = erase_sectors(BANK_NOT_SPECIFIED, addr, hdr->len);
+        if (mode & MODE_WRITE) {
+            for (cur = 0; cur < hdr->extent_count; cur++) {
+                pages  += page_count(addr + img.ext[cur].addr,
+                                     img.ext[cur].len);
+                wbytes += img.ext[cur].len;
+            }
+        }
+        if (mode & MODE_VERIFY)
+            cbytes = hdr->len;  // Sector CRCs; blocks read only on mismatch
+        image_close(&img);
+    } else {
+        if (mode & MODE_ERASE) {
+            sectors = erase_sectors(bank, baseaddr, len);
+            chip = (sectors == 0);
+        }
+        if (mode & (MODE_WRITE | MODE_VERIFY)) {
+            struct stat statbuf;
+            if (baseaddr == ADDR_NOT_SPECIFIED)
+                baseaddr = 0x000000;
+            if (lstat(filename, &statbuf))
+                errx(EXIT_FAILURE, "Failed to stat %s", filename);
+            if (len == EEPROM_SIZE_NOT_SPECIFIED) {
+                len = EEPROM_SIZE_DEFAULT;
+                if (len > statbuf.st_size)
+                    len = statbuf.st_size;
+            }
+            if (len > statbuf.st_size) {
+                errx(EXIT_FAILURE, "Length 0x%x is greater than %s size %jx",
+                     len, filename, (intmax_t)statbuf.st_size);
+            }
+            if (bank != BANK_NOT_SPECIFIED)
+                baseaddr += bank * len;
+            do {
+                if (mode & MODE_WRITE) {
+                    pages  += page_count(baseaddr, len);
+                    wbytes += len;
+                }
+                if (mode & MODE_VERIFY)
+                    rbytes += len;
+                baseaddr += len;
+            } while (fill && (baseaddr < EEPROM_SIZE_DEFAULT));
+        }
+    }
+
+    erase_usec = chip ? tm_value[TM_CHIP] : sectors * tm_value[TM_SECTOR];
+    write_usec = pages * tm_value[TM_PAGE];
+    read_usec  = rbytes * 1000000.0 / tm_value[TM_LINK];
+    crc_usec   = cbytes * 1000000.0 / tm_value[TM_CRC];
+
+    printf("Estimate for %s\n", (device_name[0] != '\0') ? device_name :
+           "unknown programmer (default model)");
+    if (chip) {
+        estimate_phase("Erase", "entire EEPROM", erase_usec, TM_CHIP);
+    } else if (sectors > 0) {
+        snprintf(work, sizeof (work), "%u sector%s", sectors,
+                 (sectors == 1) ? "" : "s");
+        estimate_phase("Erase", work, erase_usec, TM_SECTOR);
+    }
+    if (mode & MODE_WRITE) {
+        snprintf(work, sizeof (work), "%u pages (0x%x bytes)", pages, wbytes);
+        estimate_phase("Write", work, write_usec, TM_PAGE);
+    }
+    if (rbytes > 0) {
+        snprintf(work, sizeof (work), "0x%x bytes", rbytes);
+        estimate_phase((mode & MODE_READ) ? "Read" : "Verify", work,
+                       read_usec, TM_LINK);
+    }
+    if (cbytes > 0) {
+        snprintf(work, sizeof (work), "0x%x bytes by CRC", cbytes);
+        estimate_phase("Verify", work, crc_usec, TM_CRC);
+    }
+    printf("  %-8s %-28s %8.1f sec\n", "Total", "",
+           (erase_usec + write_usec + read_usec + crc_usec) / 1000000);
+    return (0);
+}
+
+/*
+ * bench_run() measures the link to the programmer (-B), so that the
+ *             usbdevfs transport (-U) may be compared with the tty path.
+ *             Round trip time is from sending a newline until the command
+ *             prompt arrives. Throughput is measured by reading EEPROM
+ *             contents, which are discarded. Write throughput is not
+ *             measured, as that would require programming the EEPROM.
+ *
+ * @param  [in]  addr - EEPROM starting address to read.
+ * @param  [in]  len  - Number of bytes to read.
+ * @return       0 - Success.
+ * @return       1 - The programmer did not respond.
+ */
+static int
+bench_run(uint addr, uint len)
+{
+    char     cmd[64];
+    char    *buf;
+    uint64_t start;
+    uint64_t usec;
+    uint64_t total = 0;
+    uint64_t min   = UINT64_MAX;
+    uint64_t max   = 0;
+    uint     cur;
+    int      rxcount;
+
+    if (addr == ADDR_NOT_SPECIFIED)
+        addr = 0x000000;  // Start of EEPROM
+    if (len == EEPROM_SIZE_NOT_SPECIFIED)
+        len = BENCH_LEN_DEFAULT;
+
+    printf("Transport: %s", usbfs_mode ? "usbdevfs" : device_name);
+    if (usbfs_mode)
+        printf(" (%u read and %u write URBs)", USBFS_IN_URBS, USBFS_OUT_URBS);
+    printf(", binary data on %s\n",
+           (bulk_fd != -1) ? "bulk data interface" : "console");
+
+    send_ll_str("\025");  // ^U  (delete any command text)
+    discard_input(50);
+    for (cur = 0; cur < BENCH_ROUNDS; cur++) {
+        start = time_usec();
+        send_ll_str("\n");
+        if (wait_for_text("CMD>", 500)) {
+            warnx("CMD: timeout");
+            return (1);
+        }
+        usec = time_usec() - start;
+        total += usec;
+        if (min > usec)
+            min = usec;
+        if (max < usec)
+            max = usec;
+    }
+    printf("Round trip: %u commands, min %.2f avg %.2f max %.2f ms\n",
+           BENCH_ROUNDS, min / 1000.0, total / 1000.0 / BENCH_ROUNDS,
+           max / 1000.0);
+
+    buf = malloc(len + 4);
+    if (buf == NULL)
+        errx(EXIT_FAILURE, "Could not allocate %u byte buffer", len);
+    snprintf(cmd, sizeof (cmd), "%s read %x %x", prom_xfer(), addr, len);
+    start = time_usec();
+    if (send_cmd(cmd)) {
+        free(buf);
+        return (1);
+    }
+    rxcount = receive_ll_crc(buf, len);
+    usec = time_usec() - start;
+    free(buf);
+    if (rxcount != (int) len) {
+        printf("Receive failed at byte 0x%x.\n", (rxcount < 0) ? 0 : rxcount);
+        return (1);
+    }
+    printf("Read: 0x%x bytes in %.3f sec, %.1f KB/sec\n",
+           len, usec / 1000000.0, len * 1000000.0 / usec / 1024);
+    return (0);
+}
+
 /*
  * run_mode() handles command line options provided by the user.
  *
@@ -1878,16 +7493,19 @@ wait_for_tx_writer(void)
  * @param [in] report_max - Maximum miscompares to show in verbose manner.
  * @param [in] fill       - Fill the remaining EEPROM with duplicate images.
  * @param [in] filename   - Source or destination filename.
+ * @param [in] capture_op - Bus sequence to capture.
  *
  * @return       0 - Success.
  * @return       1 - Failure.
  */
 int
 run_mode(uint mode, uint bank, uint baseaddr, uint len, uint report_max,
-         bool fill, const char *filename)
+         bool fill, const char *filename, const char *capture_op)
 {
+    image_t img;
+
     if (mode == MODE_UNKNOWN) {
-        warnx("You must specify one of: -e -i -r -t or -w");
+        warnx("You must specify one of: -B -c -e -i -r -S -t -T or -w");
         usage(stderr);
         return (1);
     }
@@ -1899,13 +7517,24 @@ run_mode(uint mode, uint bank, uint baseaddr, uint len, uint report_max,
         eeprom_id();
         return (0);
     }
+    if (mode & MODE_CRASHLOG)
+        return (show_crashlog());
+    if (mode & MODE_CAPTURE)
+        return (eeprom_capture(filename, capture_op, baseaddr));
+    if (mode & MODE_TIMING)
+        return (timing_check(baseaddr));
+    if (mode & MODE_BENCH)
+        return (bench_run(baseaddr, len));
     if (((filename == NULL) || (filename[0] == '\0')) &&
-        (mode & (MODE_READ | MODE_VERIFY | MODE_WRITE))) {
-        warnx("You must specify a filename with -r or -v or -w option\n");
+        (mode & (MODE_READ | MODE_VERIFY | MODE_WRITE | MODE_STAGE))) {
+        warnx("You must specify a filename with -r -S -v or -w option\n");
         usage(stderr);
         return (1);
     }
 
+    if (mode & MODE_STAGE)
+        return (eeprom_stage(filename, baseaddr, len));
+
     if (bank != BANK_NOT_SPECIFIED) {
         if ((mode & MODE_READ) && (len == EEPROM_SIZE_NOT_SPECIFIED)) {
             warnx("You must specify a length with -r and -b together\n");
@@ -1919,12 +7548,63 @@ run_mode(uint mode, uint bank, uint baseaddr, uint len, uint report_max,
         }
     }
 
+    if ((archive_dir != NULL) &&
+        ((mode != MODE_READ) || (extent_count > 0) || (split_size != 0))) {
+        warnx("-R may only be used with -r or -G, and not with -s or -x\n");
+        usage(stderr);
+        return (1);
+    }
+
+    if ((spot_confidence != 0) && ((extent_count > 0) || (split_size != 0))) {
+        warnx("-V may not be used with -s or -x\n");
+        usage(stderr);
+        return (1);
+    }
+
+    if (extent_count > 0) {
+        if (mode & (MODE_ERASE | MODE_WRITE)) {
+            warnx("-x may only be used with -r or -v\n");
+            usage(stderr);
+            return (1);
+        }
+        if (mode & MODE_READ)
+            return (eeprom_read_extents(filename, baseaddr));
+        return (eeprom_verify_extents(filename, baseaddr, report_max));
+    }
+
+    if (split_size != 0) {
+        if (mode != MODE_READ) {
+            warnx("-s may only be used with -r\n");
+            usage(stderr);
+            return (1);
+        }
+        return (eeprom_read_split(filename, bank, baseaddr, len));
+    }
+
     if (mode & MODE_READ) {
+        tl_begin("read", "%s", filename);
         eeprom_read(filename, bank, baseaddr, len);
+        tl_end("read");
         return (0);
     }
+    if ((mode & (MODE_WRITE | MODE_VERIFY)) && image_open(filename, &img)) {
+        int rc;
+        if (fill || (len != EEPROM_SIZE_NOT_SPECIFIED))
+            warnx("-f and -l are ignored for image container %s", filename);
+        if (spot_confidence != 0)
+            warnx("-V is ignored for image container %s (verified by CRC)",
+                  filename);
+        rc = image_run(mode, &img, filename, bank, baseaddr, report_max);
+        image_close(&img);
+        return (rc);
+    }
     if (mode & MODE_ERASE) {
-        if (eeprom_erase(bank, baseaddr, len))
+        int rc;
+
+        tl_begin("erase", NULL);
+        rc = eeprom_erase(bank, baseaddr, len);
+        tl_end("erase");
+        if (rc)
             return (1);
     }
 
@@ -1949,13 +7629,25 @@ run_mode(uint mode, uint bank, uint baseaddr, uint len, uint report_max,
             baseaddr += bank * len;
 
         do {
-            if ((mode & MODE_WRITE) &&
-                (eeprom_write(filename, baseaddr, len) != 0))
-                return (1);
-
-            if ((mode & MODE_VERIFY) &&
-                (eeprom_verify(filename, baseaddr, len, report_max) != 0))
-                return (1);
+            int rc;
+
+            if (mode & MODE_WRITE) {
+                tl_begin("write", "0x%x", baseaddr);
+                rc = eeprom_write(filename, baseaddr, len);
+                tl_end("write");
+                if (rc != 0)
+                    return (1);
+            }
+            if (mode & MODE_VERIFY) {
+                tl_begin("verify", "0x%x", baseaddr);
+                if (spot_confidence != 0)
+                    rc = eeprom_spot_check(filename, baseaddr, len, report_max);
+                else
+                    rc = eeprom_verify(filename, baseaddr, len, report_max);
+                tl_end("verify");
+                if (rc != 0)
+                    return (1);
+            }
 
             baseaddr += len;
             if (baseaddr >= EEPROM_SIZE_DEFAULT)
@@ -1979,16 +7671,23 @@ int
 main(int argc, char * const *argv)
 {
     int              pos;
+    int              pos2;
     int              rc;
     int              ch;
     int              long_index = 0;
     bool             fill       = FALSE;
+    bool             estimate   = FALSE;
     uint             bank       = BANK_NOT_SPECIFIED;
     uint             baseaddr   = ADDR_NOT_SPECIFIED;
     uint             len        = EEPROM_SIZE_NOT_SPECIFIED;
     uint             report_max = 64;
     char            *filename   = NULL;
+    char            *pack_name  = NULL;
+    char            *archive_name = NULL;
     uint             mode       = MODE_UNKNOWN;
+    char            *pair_dev   = NULL;
+    char            *capture_op = "read";
+    char            *timeline   = NULL;
     struct sigaction sa;
 
     memset(&sa, 0, sizeof (sa));
@@ -2032,6 +7731,29 @@ errx(EXIT_FAILURE, "how did we get here?");
                     errx(EXIT_FAILURE, "Invalid bank \"%s\"", optarg);
                 }
                 break;
+            case 'B':
+                if (mode != MODE_UNKNOWN)
+                    errx(EXIT_FAILURE,
+                         "-%c may not be specified with any other mode", ch);
+                mode = MODE_BENCH;
+                break;
+            case 'c':
+                if (mode != MODE_UNKNOWN)
+                    errx(EXIT_FAILURE,
+                         "-%c may not be specified with any other mode", ch);
+                mode = MODE_CAPTURE;
+                filename = optarg;
+                break;
+            case 'C':
+                if ((strcmp(optarg, "read") != 0) &&
+                    (strcmp(optarg, "unlock") != 0) &&
+                    (strcmp(optarg, "id") != 0) &&
+                    (strcmp(optarg, "page") != 0)) {
+                    errx(EXIT_FAILURE, "Invalid capture operation \"%s\"",
+                         optarg);
+                }
+                capture_op = optarg;
+                break;
             case 'D':
                 ic_delay = atou(optarg);
                 break;
@@ -2043,21 +7765,71 @@ errx(EXIT_FAILURE, "how did we get here?");
                     errx(EXIT_FAILURE, "Only one of -iert may be specified");
                 mode |= MODE_ERASE;
                 break;
+            case 'E':
+                estimate = TRUE;
+                break;
             case 'f':
                 fill = TRUE;
                 break;
+            case 'F':
+                fec_mode = TRUE;
+                break;
+            case 'G':
+                if (mode != MODE_UNKNOWN)
+                    errx(EXIT_FAILURE,
+                         "-%c may not be specified with any other mode", ch);
+                mode = MODE_ARCHIVE_GET;
+                archive_name = optarg;
+                break;
             case 'i':
                 if (mode != MODE_UNKNOWN)
                     errx(EXIT_FAILURE,
                          "-%c may not be specified with any other mode", ch);
                 mode = MODE_ID;
                 break;
+            case 'j':
+                timeline = optarg;
+                break;
+            case 'k':
+                if (mode != MODE_UNKNOWN)
+                    errx(EXIT_FAILURE,
+                         "-%c may not be specified with any other mode", ch);
+                mode = MODE_CRASHLOG;
+                break;
             case 'l':
                 if ((sscanf(optarg, "%i%n", (int *)&len, &pos) != 1) ||
                     (optarg[pos] != '\0') || (pos == 0)) {
                     errx(EXIT_FAILURE, "Invalid length \"%s\"", optarg);
                 }
                 break;
+            case 'L':
+                link_dups = TRUE;
+                break;
+            case 'N':
+                bulk_disabled = TRUE;
+                break;
+            case 'p':
+                pair_dev = optarg;
+                break;
+            case 'P':
+                if (mode != MODE_UNKNOWN)
+                    errx(EXIT_FAILURE,
+                         "-%c may not be specified with any other mode", ch);
+                mode = MODE_PACK;
+                pack_name = optarg;
+                break;
+            case 's':
+                if ((sscanf(optarg, "%i%n", (int *)&split_size, &pos) != 1) ||
+                    (optarg[pos] != '\0') || (pos == 0) || (split_size == 0)) {
+                    errx(EXIT_FAILURE, "Invalid bank size \"%s\"", optarg);
+                }
+                break;
+            case 'S':
+                if (mode != MODE_UNKNOWN)
+                    errx(EXIT_FAILURE,
+                         "-%c may not be specified with any other mode", ch);
+                mode = MODE_STAGE;
+                break;
             case 'r':
                 if (mode != MODE_UNKNOWN)
                     errx(EXIT_FAILURE,
@@ -2065,6 +7837,9 @@ errx(EXIT_FAILURE, "how did we get here?");
                 mode = MODE_READ;
 //              filename = optarg;
                 break;
+            case 'R':
+                archive_dir = optarg;
+                break;
             case 't':
                 if (mode != MODE_UNKNOWN)
                     errx(EXIT_FAILURE,
@@ -2072,6 +7847,15 @@ errx(EXIT_FAILURE, "how did we get here?");
                 mode = MODE_TERM;
                 terminal_mode = TRUE;
                 break;
+            case 'T':
+                if (mode != MODE_UNKNOWN)
+                    errx(EXIT_FAILURE,
+                         "-%c may not be specified with any other mode", ch);
+                mode = MODE_TIMING;
+                break;
+            case 'U':
+                usbfs_mode = TRUE;
+                break;
             case 'w':
                 if (mode & (MODE_ID | MODE_READ | MODE_TERM))
                     errx(EXIT_FAILURE, "Only one of -irtw may be specified");
@@ -2084,6 +7868,24 @@ errx(EXIT_FAILURE, "how did we get here?");
                 mode |= MODE_VERIFY;
 //              filename = optarg;
                 break;
+            case 'V':
+                if (mode & (MODE_ID | MODE_READ | MODE_TERM))
+                    errx(EXIT_FAILURE, "Only one of -irtV may be specified");
+                spot_seed = time_usec() ^ ((uint64_t) getpid() << 32);
+                if (((sscanf(optarg, "%lf%n", &spot_confidence, &pos) != 1) ||
+                     (spot_confidence <= 0) || (spot_confidence >= 100)) ||
+                    ((optarg[pos] != '\0') &&
+                     ((optarg[pos] != ':') ||
+                      (sscanf(optarg + pos + 1, "%" SCNu64 "%n",
+                              &spot_seed, &pos2) != 1) ||
+                      (optarg[pos + 1 + pos2] != '\0')))) {
+                    errx(EXIT_FAILURE, "Invalid spot-check \"%s\"", optarg);
+                }
+                mode |= MODE_VERIFY;
+                break;
+            case 'x':
+                parse_extents(optarg);
+                break;
             case 'y':
                 force_yes = TRUE;
                 break;
@@ -2102,7 +7904,28 @@ errx(EXIT_FAILURE, "how did we get here?");
     argc -= optind;
     argv += optind;
 
-    if (argc > 0) {
+    if (timeline != NULL)
+        tl_open(timeline);
+
+    if (pair_dev != NULL) {
+        /* Paired mode: mxprog -p <dev_hi> <dev_lo> <filename> */
+        if (argc < 2)
+            errx(EXIT_USAGE, "-p requires <dev_hi> <dev_lo> <filename>");
+        if (argc > 2)
+            errx(EXIT_USAGE, "Too many arguments: %s", argv[2]);
+        if (len == 0)
+            errx(EXIT_USAGE, "Invalid length 0x%x", len);
+        if (spot_confidence != 0)
+            errx(EXIT_USAGE, "-V may not be used with -p");
+        if (archive_dir != NULL)
+            errx(EXIT_USAGE, "-R may not be used with -p");
+        atexit(at_exit_func);
+        rc = eeprom_pair(pair_dev, argv[0], mode, bank, baseaddr, len,
+                         report_max, argv[1]);
+        exit(rc);
+    }
+
+    if ((argc > 0) && (mode != MODE_CAPTURE)) {
         filename = argv[0];
         argv++;
         argc--;
@@ -2111,9 +7934,33 @@ errx(EXIT_FAILURE, "how did we get here?");
     if (argc > 0)
         errx(EXIT_USAGE, "Too many arguments: %s", argv[0]);
 
+    if (mode == MODE_PACK) {
+        /* Packing an image container does not require a programmer */
+        if (filename == NULL)
+            errx(EXIT_USAGE, "-P requires a source image filename");
+        exit(image_pack(pack_name, filename, bank, baseaddr, len));
+    }
+
+    if (mode == MODE_ARCHIVE_GET) {
+        /* Rebuilding an archived dump does not require a programmer */
+        char dir[PATH_MAX];
+
+        if (filename == NULL)
+            errx(EXIT_USAGE, "-G requires an output filename");
+        if (archive_dir == NULL)
+            archive_dir = archive_default_dir(dir, sizeof (dir));
+        exit(archive_get(archive_dir, archive_name, filename));
+    }
+
     if (device_name[0] == '\0')
         find_mx_programmer();
 
+    model_load();
+    if (estimate) {
+        /* Estimate does not require the programmer to be attached */
+        exit(job_estimate(mode, bank, baseaddr, len, fill, filename));
+    }
+
     if (device_name[0] == '\0') {
         warnx("You must specify a device to open (-d <dev>)");
         usage(stderr);
@@ -2128,8 +7975,12 @@ errx(EXIT_FAILURE, "how did we get here?");
         do_exit(EXIT_FAILURE);
 
     create_threads();
-    rc = run_mode(mode, bank, baseaddr, len, report_max, fill, filename);
+    tl_begin("job", "mode 0x%x", mode);
+    rc = run_mode(mode, bank, baseaddr, len, report_max, fill, filename,
+                  capture_op);
+    tl_end("job");
     wait_for_tx_writer();
+    model_save();
 
     exit(rc);
 }
@@ -0,0 +1,102 @@
+#!/bin/sh
+#
+# usbfs-gadget-bench.sh compares the mxprog tty and usbdevfs (-U)
+# transports through a USB gadget. A dummy_hcd ACM gadget is created with
+# the programmer's USB ID, and its tty (/dev/ttyGS0) is relayed to a
+# programmer attached to this host. "mxprog -N -B" is then run on the
+# gadget's host-side tty and on its usbdevfs node, so that both
+# transports carry the same console traffic, and the round trip time and
+# read rate of each are reported. Run as root on Linux with the
+# libcomposite and dummy_hcd modules available.
+#
+# Usage: usbfs-gadget-bench.sh <programmer tty> [<read length>]
+#     usbfs-gadget-bench.sh /dev/ttyACM0 0x40000
+#
+# Set MXPROG to use a mxprog other than the one in this directory.
+#
+# The relay adds latency which is common to both transports, so compare
+# the two results with each other rather than with a direct connection.
+
+MXPROG=${MXPROG:-$(dirname "$0")/mxprog}
+GADGET=/sys/kernel/config/usb_gadget/mxprog_bench
+SERIAL=mxprog-gadget-bench
+BACKEND=$1
+LEN=${2:-0x40000}
+RELAY=
+
+if [ -z "$BACKEND" ] || [ ! -c "$BACKEND" ]; then
+    echo "Usage: $0 <programmer tty> [<read length>]" >&2
+    exit 1
+fi
+if [ "$(id -u)" -ne 0 ]; then
+    echo "$0 must be run as root" >&2
+    exit 1
+fi
+
+cleanup() {
+    [ -n "$RELAY" ] && kill $RELAY 2>/dev/null
+    if [ -d $GADGET ]; then
+        echo "" > $GADGET/UDC 2>/dev/null
+        rm -f $GADGET/configs/c.1/acm.usb0
+        rmdir $GADGET/configs/c.1/strings/0x409 $GADGET/configs/c.1 \
+              $GADGET/functions/acm.usb0 $GADGET/strings/0x409 \
+              $GADGET 2>/dev/null
+    fi
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+modprobe libcomposite && modprobe dummy_hcd || exit 1
+if [ ! -d /sys/kernel/config/usb_gadget ]; then
+    mount -t configfs none /sys/kernel/config || exit 1
+fi
+
+# ACM function only: CDC control interface 0 and data interface 1
+mkdir -p $GADGET/strings/0x409 $GADGET/configs/c.1/strings/0x409 \
+         $GADGET/functions/acm.usb0 || exit 1
+echo 0x1209 > $GADGET/idVendor
+echo 0x1615 > $GADGET/idProduct
+echo $SERIAL > $GADGET/strings/0x409/serialnumber
+echo "MX29F1615 programmer relay" > $GADGET/strings/0x409/product
+echo "ACM" > $GADGET/configs/c.1/strings/0x409/configuration
+ln -s $GADGET/functions/acm.usb0 $GADGET/configs/c.1/
+UDC=$(ls /sys/class/udc | grep dummy_udc | head -n 1)
+if [ -z "$UDC" ]; then
+    echo "No dummy_hcd UDC found" >&2
+    exit 1
+fi
+echo "$UDC" > $GADGET/UDC || exit 1
+
+# Find the host side of the gadget by its serial number
+USBDEV=
+for try in 1 2 3 4 5 6 7 8 9 10; do
+    for dev in /sys/bus/usb/devices/*; do
+        if [ "$(cat $dev/serial 2>/dev/null)" = "$SERIAL" ]; then
+            USBDEV=$dev
+        fi
+    done
+    [ -n "$USBDEV" ] && [ -d "$USBDEV/$(basename $USBDEV):1.0/tty" ] && break
+    sleep 1
+done
+if [ -z "$USBDEV" ]; then
+    echo "Gadget did not enumerate" >&2
+    exit 1
+fi
+TTY=/dev/$(ls "$USBDEV/$(basename $USBDEV):1.0/tty")
+NODE=$(printf "/dev/bus/usb/%03u/%03u" \
+       "$(cat $USBDEV/busnum)" "$(cat $USBDEV/devnum)")
+
+# Relay the gadget tty to the programmer
+GS=/dev/$(basename $(ls -d /sys/class/tty/ttyGS* | head -n 1))
+stty -F "$GS" raw -echo || exit 1
+stty -F "$BACKEND" raw -echo 115200 || exit 1
+cat "$GS" > "$BACKEND" &
+RELAY=$!
+cat "$BACKEND" > "$GS" &
+RELAY="$RELAY $!"
+
+echo "Gadget $TTY ($NODE) relayed to $BACKEND"
+echo "--- tty"
+"$MXPROG" -N -B -l "$LEN" -d "$TTY" || exit 1
+echo "--- usbdevfs"
+"$MXPROG" -N -U -B -l "$LEN" -d "$NODE" || exit 1